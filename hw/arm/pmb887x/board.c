@@ -12,6 +12,7 @@
 #include "system/reset.h"
 #include "hw/core/loader.h"
 #include "hw/core/qdev-clock.h"
+#include "hw/sd/sd.h"
 #include "hw/arm/machines-qom.h"
 #include "system/system.h"
 #include "target/arm/cpregs.h"
@@ -31,7 +32,9 @@
 #include "hw/arm/pmb887x/gen/cpu_regs.h"
 
 #include "hw/arm/pmb887x/io_bridge.h"
+#include "hw/arm/pmb887x/idle.h"
 #include "hw/arm/pmb887x/regs_dump.h"
+#include "hw/arm/pmb887x/scheduler.h"
 #include "hw/arm/pmb887x/trace_common.h"
 
 void qmp_pmemsave(uint64_t addr, uint64_t size, const char *filename, Error **errp);
@@ -102,7 +105,11 @@ static void pmb887x_init(MachineState *machine) {
 	pmb8876_io_bridge_init();
 #endif
 
-	pmb887x_io_dump_init();
+	pmb887x_io_dump_init(getenv("PMB887X_IO_TRACE_FILE"));
+
+	const char *io_trace_decode = getenv("PMB887X_IO_TRACE_DECODE");
+	if (io_trace_decode)
+		exit(pmb887x_io_trace_decode(io_trace_decode, stdout) ? 0 : 1);
 
 	MemoryRegion *sysmem = get_system_memory();
 
@@ -116,6 +123,10 @@ static void pmb887x_init(MachineState *machine) {
 	qdev_realize(DEVICE(cpuobj), NULL, &error_fatal);
 	qemu_register_reset(pmb887x_cpu_reset, CPU(cpu));
 
+	// Fast-forward of the timer polling loops
+	pmb887x_idle_init(OBJECT(machine));
+	pmb887x_sched_init(OBJECT(machine));
+
 	// TCM
 	DeviceState *tcm = qdev_new("pmb887x-tcm");
 	object_property_set_link(OBJECT(tcm), "cpu", OBJECT(cpu), &error_fatal);
@@ -192,7 +203,14 @@ static void pmb887x_init(MachineState *machine) {
 	DeviceState *dsp = pmb887x_new_cpu_module("DSP");
 	pmb887x_dsp_set_config(dsp, pmb887x_cpu_get(pmb887x_board()->cpu)->dsp_config);
 	pmb887x_board_init_dsp(dsp);
+	const char *dsp_tcg_cache = getenv("PMB887X_DSP_TCG_CACHE");
+	if (dsp_tcg_cache && dsp_tcg_cache[0])
+		qdev_prop_set_string(dsp, "tcg_cache", dsp_tcg_cache);
+	const char *dsp_audiodev = getenv("PMB887X_DSP_AUDIODEV");
+	if (dsp_audiodev && dsp_audiodev[0])
+		qdev_prop_set_string(dsp, "audiodev", dsp_audiodev);
 	qdev_connect_clock_in(dsp, "GSM_CLOCK", qdev_get_clock_out(tpu, "GSM_CLOCK"));
+	object_property_add_child(OBJECT(machine), "dsp", OBJECT(dsp));
 	sysbus_realize_and_unref(SYS_BUS_DEVICE(dsp), &error_fatal);
 	for (size_t i = 0; i < PMB887X_DSP_GSM_SIGNAL_COUNT; i++)
 		qdev_connect_gpio_out_named(tpu, "GSM_OUT", i, qdev_get_gpio_in_named(dsp, "GSM_IN", i));
@@ -210,6 +228,21 @@ static void pmb887x_init(MachineState *machine) {
 		DeviceState *mmci = pmb887x_new_cpu_module("MMCI");
 		sysbus_realize_and_unref(SYS_BUS_DEVICE(mmci), &error_fatal);
 
+		// MicroSD card on the MMCI pins
+		DriveInfo *sd_dinfo = drive_get(IF_SD, 0, 0);
+		if (sd_dinfo) {
+			DeviceState *sd_card = qdev_new(TYPE_SD_CARD);
+			qdev_prop_set_drive_err(sd_card, "drive", blk_by_legacy_dinfo(sd_dinfo), &error_fatal);
+			qdev_realize_and_unref(sd_card, qdev_get_child_bus(mmci, "sd-bus"), &error_fatal);
+
+			pmb887x_qdev_connect_gpio_out(gpio, "pin_out", PMB8876_GPIO_MMCI_CLK, qdev_get_gpio_in_named(mmci, "SD_CLK_IN", 0));
+			pmb887x_qdev_connect_gpio_out(gpio, "pin_out", PMB8876_GPIO_MMCI_CMD, qdev_get_gpio_in_named(mmci, "SD_CMD_IN", 0));
+			pmb887x_qdev_connect_gpio_out(gpio, "pin_out", PMB8876_GPIO_MMCI_DAT0, qdev_get_gpio_in_named(mmci, "SD_DAT0_IN", 0));
+			pmb887x_qdev_connect_gpio_out(gpio, "pin_dir_out", PMB8876_GPIO_MMCI_DAT0, qdev_get_gpio_in_named(mmci, "SD_DAT0_DIR_IN", 0));
+			pmb887x_qdev_connect_gpio_out(mmci, "SD_CMD_OUT", 0, qdev_get_gpio_in_named(gpio, "pin_in", PMB8876_GPIO_MMCI_CMD));
+			pmb887x_qdev_connect_gpio_out(mmci, "SD_DAT0_OUT", 0, qdev_get_gpio_in_named(gpio, "pin_in", PMB8876_GPIO_MMCI_DAT0));
+		}
+
 		// Multi Media Controller Interface
 		DeviceState *mmicif = pmb887x_new_cpu_module("MMICIF");
 		sysbus_mmio_map(SYS_BUS_DEVICE(mmicif), 1, PMB8876_MMICIF_BASE + MMICIF_MMAP_BASE);
@@ -217,19 +250,27 @@ static void pmb887x_init(MachineState *machine) {
 	}
 
 	// SIM card interface
+	const char *sim_turbo = getenv("PMB887X_SIM_TURBO");
 	DeviceState *sim = pmb887x_new_cpu_module("SIM");
+	if (sim_turbo && strcmp(sim_turbo, "1") == 0)
+		qdev_prop_set_bit(sim, "turbo", true);
 	sysbus_realize_and_unref(SYS_BUS_DEVICE(sim), &error_fatal);
 
 	// USART0
+	const char *usart_turbo = getenv("PMB887X_USART_TURBO");
 	DeviceState *usart0 = pmb887x_new_cpu_module("USART0");
 	object_property_set_link(OBJECT(usart0), "pll", OBJECT(pll), &error_fatal);
 	qdev_prop_set_chr(DEVICE(usart0), "chardev", serial_hd(0));
+	if (usart_turbo && strcmp(usart_turbo, "1") == 0)
+		qdev_prop_set_bit(usart0, "turbo", true);
 	sysbus_realize_and_unref(SYS_BUS_DEVICE(usart0), &error_fatal);
 
 	// USART1
 	DeviceState *usart1 = pmb887x_new_cpu_module("USART1");
 	object_property_set_link(OBJECT(usart1), "pll", OBJECT(pll), &error_fatal);
 	qdev_prop_set_chr(DEVICE(usart1), "chardev", serial_hd(1));
+	if (usart_turbo && strcmp(usart_turbo, "1") == 0)
+		qdev_prop_set_bit(usart1, "turbo", true);
 	sysbus_realize_and_unref(SYS_BUS_DEVICE(usart1), &error_fatal);
 
 	// DIF
@@ -323,6 +364,14 @@ static void pmb887x_init(MachineState *machine) {
 	DeviceState *flash_blk = qdev_new("pmb887x-flash-blk");
 	flash_blk->id = strdup("FULLFLASH");
 	qdev_prop_set_drive(flash_blk, "drive", blk_by_legacy_dinfo(flash_dinfo));
+	const char *flash_writeback = getenv("PMB887X_FLASH_WRITEBACK");
+	if (flash_writeback && strcmp(flash_writeback, "1") == 0)
+		qdev_prop_set_bit(flash_blk, "writeback", true);
+	const char *flash_overlay = getenv("PMB887X_FLASH_OVERLAY");
+	if (flash_overlay && flash_overlay[0])
+		qdev_prop_set_string(flash_blk, "overlay", flash_overlay);
+	// Reachable as /machine/fullflash, e.g. for "qom-set /machine/fullflash flush true"
+	object_property_add_child(OBJECT(machine), "fullflash", OBJECT(flash_blk));
 	sysbus_realize_and_unref(SYS_BUS_DEVICE(flash_blk), &error_fatal);
 
 	pmb887x_cpu_modules_post_init();
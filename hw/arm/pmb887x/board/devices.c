@@ -7,6 +7,7 @@
 #include "hw/arm/pmb887x/mmicif.h"
 #include "hw/arm/pmb887x/sim.h"
 #include "hw/arm/pmb887x/sim/sim_card.h"
+#include "hw/arm/pmb887x/ssc/lcd_common.h"
 #include "hw/arm/pmb887x/utils/regexp.h"
 #include "hw/arm/pmb887x/utils/toml.h"
 
@@ -179,7 +180,9 @@ static pmb887x_dev_t devices_meta[] = {
 	},
 	{
 		.name = "sim-card",
-		.props = {},
+		.props = {
+			{ "image", DEV_PROP_STRING, false },
+		},
 	},
 
 	// FM Radio
@@ -337,6 +340,10 @@ static void device_init_gpios_from_config(DeviceState *dev, toml_datum_t table)
 }
 
 static void sim_card_apply_runtime_options(DeviceState *dev) {
+	const char *turbo = getenv("PMB887X_SIM_TURBO");
+	if (turbo && strcmp(turbo, "1") == 0)
+		qdev_prop_set_bit(dev, "turbo", true);
+
 	const char *source = getenv("PMB887X_SIM");
 	if (!source)
 		return;
@@ -344,6 +351,9 @@ static void sim_card_apply_runtime_options(DeviceState *dev) {
 	if (strcmp(source, "virtual") == 0) {
 		const char *imsi = getenv("PMB887X_SIM_IMSI");
 		const char *operator_code = getenv("PMB887X_SIM_OPERATOR");
+		const char *image = getenv("PMB887X_SIM_IMAGE");
+		if (image)
+			qdev_prop_set_string(dev, "image", image);
 		if (imsi)
 			qdev_prop_set_string(dev, "imsi", imsi);
 		if (operator_code)
@@ -358,6 +368,25 @@ static void sim_card_apply_runtime_options(DeviceState *dev) {
 	}
 }
 
+static void lcd_apply_runtime_options(DeviceState *dev) {
+	static bool stream_used;
+
+	const char *stream = getenv("PMB887X_LCD_STREAM");
+	if (stream && stream[0]) {
+		// The first display gets the path as is, others are suffixed with their id
+		g_autofree char *path = stream_used ? g_strdup_printf("%s.%s", stream, dev->id) : g_strdup(stream);
+		qdev_prop_set_string(dev, "stream", path);
+		stream_used = true;
+	}
+
+	const char *stream_interval = getenv("PMB887X_LCD_STREAM_INTERVAL");
+	if (stream_interval && stream_interval[0])
+		qdev_prop_set_uint32(dev, "stream_interval", strtoul(stream_interval, NULL, 10));
+
+	// Reachable as /machine/<id>, e.g. for "qom-get /machine/lcd frame-hash"
+	object_property_try_add_child(qdev_get_machine(), dev->id, OBJECT(dev), NULL);
+}
+
 static void sim_card_realize_and_attach(DeviceState *card, pmb887x_sim_t *sim) {
 	if (!object_dynamic_cast(OBJECT(card), TYPE_PMB887X_SIM_CARD))
 		hw_error("Device '%s' is not a SIM card", object_get_typename(OBJECT(card)));
@@ -394,6 +423,8 @@ static DeviceState *device_create_from_config(DeviceState *ebuc, const char *id,
 			qdev_prop_set_uint8(DEVICE(dev), "cs", global_cs_index++);
 			dev->id = g_strdup(id);
 			device_init_props_from_config(dev, meta, table);
+			if (object_dynamic_cast(OBJECT(dev), TYPE_PMB887X_LCD))
+				lcd_apply_runtime_options(dev);
 			qdev_realize_and_unref(dev, BUS(bus), &error_fatal);
 			device_init_gpios_from_config(dev, table);
 			break;
@@ -45,6 +45,8 @@ MemoryRegion *pmb887x_board_create_nor_flash(const char *id, uint32_t vid, uint3
 	qdev_prop_set_uint32(flash, "offset", offset);
 	qdev_prop_set_uint32(flash, "size", *size);
 	object_property_set_link(OBJECT(flash), "blk", OBJECT(flash_blk), &error_fatal);
+	// Reachable as /machine/<id>, e.g. for "qom-get /machine/<id> romd-switches"
+	object_property_try_add_child(qdev_get_machine(), id, OBJECT(flash), &error_fatal);
 	sysbus_realize_and_unref(SYS_BUS_DEVICE(flash), &error_fatal);
 
 	*size = object_property_get_uint(OBJECT(flash), "size", &error_fatal);
@@ -21,6 +21,7 @@
 #include "hw/arm/pmb887x/mod.h"
 #include "hw/arm/pmb887x/trace.h"
 #include "hw/arm/pmb887x/fifo.h"
+#include "hw/arm/pmb887x/ssc/lcd_common.h"
 
 #define TYPE_PMB887X_DIF	"pmb887x-dif-v1"
 OBJECT_DECLARE_SIMPLE_TYPE(pmb887x_dif_t, PMB887X_DIF);
@@ -85,6 +86,7 @@ struct pmb887x_dif_t {
 	pmb887x_clc_reg_t clc;
 	pmb887x_srb_reg_t srb;
     SSIBus *bus;
+	pmb887x_lcd_burst_t burst;
 
 	qemu_irq gpio_sclk;
 	qemu_irq gpio_mtsr;
@@ -238,10 +240,10 @@ static void dif_transfer_word(pmb887x_dif_t *p) {
 		} else {
 			if ((p->con & DIFv1_CON_HB_MSB) != 0) {
 				for (int shift = p->bits - 8; shift >= 0; shift -= 8)
-					received |= (ssi_transfer(p->bus, (transmitted >> shift) & 0xFF) & 0xFF) << shift;
+					received |= (pmb887x_lcd_burst_transfer(&p->burst, (transmitted >> shift) & 0xFF) & 0xFF) << shift;
 			} else {
 				for (int shift = 0; shift < p->bits; shift += 8)
-					received |= (ssi_transfer(p->bus, (transmitted >> shift) & 0xFF) & 0xFF) << shift;
+					received |= (pmb887x_lcd_burst_transfer(&p->burst, (transmitted >> shift) & 0xFF) & 0xFF) << shift;
 			}
 		}
 
@@ -271,6 +273,7 @@ static void dif_transfer_complete(void *opaque) {
 		if (pmb887x_srb_get_ris(&p->srb) != 0)
 			break;
 	}
+	pmb887x_lcd_burst_flush(&p->burst);
 	if (!p->transfer_pending)
 		p->status &= ~DIFv1_CON_BSY;
 }
@@ -693,6 +696,7 @@ static void dif_init(Object *obj) {
 	sysbus_init_mmio(SYS_BUS_DEVICE(obj), &p->mmio);
 
 	p->bus = ssi_create_bus(DEVICE(obj), TYPE_PMB887X_DIF);
+	p->burst.bus = p->bus;
 
 	for (int i = 0; i < ARRAY_SIZE(p->irq); i++)
 		sysbus_init_irq(SYS_BUS_DEVICE(obj), &p->irq[i]);
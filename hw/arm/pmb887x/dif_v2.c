@@ -2,6 +2,7 @@
  * Display Interface
  * */
 #include "hw/arm/pmb887x/fifo.h"
+#include "hw/arm/pmb887x/ssc/lcd_common.h"
 #define PMB887X_TRACE_ID		DIF
 #define PMB887X_TRACE_PREFIX	"pmb887x-dif"
 
@@ -62,6 +63,7 @@ struct pmb887x_dif_t {
 	MemoryRegion mmio;
 	uint32_t revision;
 	SSIBus *bus;
+	pmb887x_lcd_burst_t burst;
 
 	qemu_irq irq[4];
 
@@ -70,6 +72,8 @@ struct pmb887x_dif_t {
 	qemu_irq gpio_cd;
 	qemu_irq gpio_wr;
 	qemu_irq gpio_rd;
+	uint32_t gpio_levels;
+	bool is_gpio_levels_valid;
 
 	QEMUTimer *timer;
 	bool in_schedule;
@@ -227,16 +231,23 @@ static void dif_update_gpio_state(pmb887x_dif_t *p) {
 		{ p->state == DIF_STATE_RX, DIFv2_PERREG_RDPOL, p->gpio_rd, "RD" },
 		{ p->state != DIF_STATE_RX, DIFv2_PERREG_WRPOL, p->gpio_wr, "WR" },
 	};
+	uint32_t levels = 0;
 	for (int i = 0; i < ARRAY_SIZE(cs_pins); i++) {
 		bool polarity = (p->perreg & cs_pins[i].perreg) != 0;
-		bool value = cs_pins[i].value;
-		if (polarity) {
-			// DPRINTF("%s=%d set %s\n", cs_pins[i].name, value, value ? "HIGH" : "LOW");
-			qemu_set_irq(cs_pins[i].pin, value ? 1 : 0);
-		} else {
-			// DPRINTF("%s=%d set %s\n", cs_pins[i].name, value, value ? "LOW" : "HIGH");
-			qemu_set_irq(cs_pins[i].pin, value ? 0 : 1);
-		}
+		if (cs_pins[i].value == polarity)
+			levels |= BIT(i);
+	}
+
+	// CSREG is reloaded for every TX FIFO word, only real edges reach the LCD
+	if (p->is_gpio_levels_valid && p->gpio_levels == levels)
+		return;
+
+	pmb887x_lcd_burst_flush(&p->burst);
+	p->gpio_levels = levels;
+	p->is_gpio_levels_valid = true;
+	for (int i = 0; i < ARRAY_SIZE(cs_pins); i++) {
+		// DPRINTF("%s=%d set %s\n", cs_pins[i].name, cs_pins[i].value, (levels & BIT(i)) ? "HIGH" : "LOW");
+		qemu_set_irq(cs_pins[i].pin, (levels & BIT(i)) ? 1 : 0);
 	}
 }
 
@@ -252,6 +263,7 @@ static void dif_schedule(pmb887x_dif_t *p) {
 		if (pmb887x_srb_get_ris(&p->srb) != 0)
 			break;
 	}
+	pmb887x_lcd_burst_flush(&p->burst);
 	p->in_schedule = false;
 }
 
@@ -621,7 +633,7 @@ static uint16_t dif_bus_transfer(pmb887x_dif_t *p, uint16_t value) {
 	if (dif_is_serial(p) && (p->con & DIFv2_CON_LB) != 0)
 		return value;
 
-	return ssi_transfer(p->bus, value);
+	return pmb887x_lcd_burst_transfer(&p->burst, value);
 }
 
 static bool dif_send_word(pmb887x_dif_t *p, uint16_t value) {
@@ -794,6 +806,7 @@ static void dif_timer_reset(void *opaque) {
 		if (pmb887x_srb_get_ris(&p->srb) != 0)
 			break;
 	}
+	pmb887x_lcd_burst_flush(&p->burst);
 }
 
 static void dif_update_mux(pmb887x_dif_t *p) {
@@ -1266,6 +1279,7 @@ static void dif_init(Object *obj) {
 	sysbus_init_mmio(SYS_BUS_DEVICE(obj), &p->mmio);
 
 	p->bus = ssi_create_bus(DEVICE(obj), TYPE_PMB887X_DIF);
+	p->burst.bus = p->bus;
 
 	for (int i = 0; i < ARRAY_SIZE(p->irq); i++)
 		sysbus_init_irq(SYS_BUS_DEVICE(obj), &p->irq[i]);
@@ -1401,6 +1415,7 @@ static void dif_reset(DeviceState *dev) {
 	p->rx_fifo_req = false;
 	p->is_tx_started = false;
 
+	p->is_gpio_levels_valid = false;
 	dif_update_gpio_state(p);
 	dif_trigger_dma(p);
 }
@@ -8,6 +8,7 @@
 #include "hw/core/sysbus.h"
 #include "hw/core/hw-error.h"
 #include "system/memory.h"
+#include "system/memory_cached.h"
 #include "cpu.h"
 #include "qapi/error.h"
 #include "qemu/bswap.h"
@@ -108,36 +109,86 @@ static enum device_endian dmac_master_endian(pmb887x_dmac_t *p, bool is_ahb2) {
 }
 
 static void dmac_swap_byte_order(uint8_t *buffer, uint32_t width, uint32_t count) {
-	for (uint32_t i = 0; i < count; i++) {
-		uint8_t *transfer = buffer + i * width;
-		switch (width) {
-			case 2:
-				bswap16s((uint16_t *) transfer);
-				break;
-
-			case 4:
-				bswap32s((uint32_t *) transfer);
-				break;
-
-			default:
-				g_assert_not_reached();
-		}
+	/* Flat loops over aligned elements, the compiler turns these into vector shuffles. */
+	if (width == 2) {
+		uint16_t *values = (uint16_t *) buffer;
+		for (uint32_t i = 0; i < count; i++)
+			values[i] = bswap16(values[i]);
+	} else if (width == 4) {
+		uint32_t *values = (uint32_t *) buffer;
+		for (uint32_t i = 0; i < count; i++)
+			values[i] = bswap32(values[i]);
+	} else {
+		g_assert_not_reached();
 	}
 }
 
-static void dmac_read(pmb887x_dmac_t *p, hwaddr addr, uint8_t *buffer, uint32_t width, uint32_t count, enum device_endian endian) {
-	if (endian == DEVICE_BIG_ENDIAN && width < sizeof(uint32_t)) {
-		for (uint32_t i = 0; i < count; i++) {
-			hwaddr transfer_addr = (addr + i * width) ^ (sizeof(uint32_t) - width);
-			address_space_read(&p->downstream_as, transfer_addr, MEMTXATTRS_UNSPECIFIED, buffer + i * width, width);
+static bool dmac_cache_init(pmb887x_dmac_t *p, MemoryRegionCache *cache, hwaddr addr, hwaddr len, bool is_write) {
+	int64_t mapped = address_space_cache_init(cache, &p->downstream_as, addr, len, is_write);
+	if (mapped < 0)
+		return false;
+	if (mapped < len || !cache->ptr) {
+		address_space_cache_destroy(cache);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Reads count elements in the byte order seen on the bus. Big-endian masters swap the
+ * byte lanes of sub-word accesses. RAM is copied through a MemoryRegionCache, anything
+ * else gets one width-sized access per element.
+ */
+static void dmac_read_burst(pmb887x_dmac_t *p, hwaddr addr, bool increment, uint8_t *buffer,
+	uint32_t width, uint32_t count, enum device_endian endian) {
+	hwaddr lane_mask = endian == DEVICE_BIG_ENDIAN ? sizeof(uint32_t) - width : 0;
+	hwaddr size = increment ? width * count : width;
+	// Swapped lanes stay within the 32-bit word, so cover whole words (lane_mask is 2 for halfwords)
+	hwaddr align = lane_mask ? sizeof(uint32_t) : 1;
+	hwaddr start = increment ? QEMU_ALIGN_DOWN(addr, align) : addr ^ lane_mask;
+	hwaddr end = increment ? QEMU_ALIGN_UP(addr + size, align) : start + width;
+	MemoryRegionCache cache;
+
+	if (dmac_cache_init(p, &cache, start, end - start, false)) {
+		if (!increment) {
+			for (uint32_t i = 0; i < count; i++)
+				memcpy(buffer + i * width, cache.ptr, width);
+		} else if (lane_mask == 0) {
+			memcpy(buffer, cache.ptr, size);
+		} else {
+			for (uint32_t i = 0; i < count; i++)
+				memcpy(buffer + i * width, cache.ptr + (((addr + i * width) ^ lane_mask) - start), width);
 		}
-	} else {
-		address_space_read(&p->downstream_as, addr, MEMTXATTRS_UNSPECIFIED, buffer, width * count);
+		address_space_cache_destroy(&cache);
+		return;
+	}
+
+	for (uint32_t i = 0; i < count; i++) {
+		hwaddr element_addr = (increment ? addr + i * width : addr) ^ lane_mask;
+		address_space_read(&p->downstream_as, element_addr, MEMTXATTRS_UNSPECIFIED, buffer + i * width, width);
 	}
 }
 
-static void dmac_write(pmb887x_dmac_t *p, hwaddr addr, const uint8_t *buffer, uint32_t width) {
-	address_space_write(&p->downstream_as, addr, MEMTXATTRS_UNSPECIFIED, buffer, width);
+static void dmac_write_burst(pmb887x_dmac_t *p, hwaddr addr, bool increment, const uint8_t *buffer,
+	uint32_t width, uint32_t count) {
+	hwaddr size = increment ? width * count : width;
+	MemoryRegionCache cache;
+
+	if (count == 0)
+		return;
+
+	if (dmac_cache_init(p, &cache, addr, size, true)) {
+		// Repeated writes to one RAM location only leave the last element behind
+		memcpy(cache.ptr, increment ? buffer : buffer + (count - 1) * width, size);
+		address_space_cache_invalidate(&cache, 0, size);
+		address_space_cache_destroy(&cache);
+		return;
+	}
+
+	for (uint32_t i = 0; i < count; i++) {
+		hwaddr element_addr = increment ? addr + i * width : addr;
+		address_space_write(&p->downstream_as, element_addr, MEMTXATTRS_UNSPECIFIED, buffer + i * width, width);
+	}
 }
 
 static void dmac_schedule(pmb887x_dmac_t *p) {
@@ -218,7 +269,7 @@ static void dmac_transfer_finish(pmb887x_dmac_t *p, pmb887x_dmac_ch_t *ch) {
 	if (lli_addr) {
 		uint32_t lli[4];
 		enum device_endian lli_endian = dmac_master_endian(p, (ch->lli & DMAC_CH_LLI_LM) != 0);
-		dmac_read(p, lli_addr, (uint8_t *) lli, sizeof(uint32_t), ARRAY_SIZE(lli), lli_endian);
+		dmac_read_burst(p, lli_addr, true, (uint8_t *) lli, sizeof(uint32_t), ARRAY_SIZE(lli), lli_endian);
 		if (lli_endian == DEVICE_BIG_ENDIAN)
 			dmac_swap_byte_order((uint8_t *) lli, sizeof(uint32_t), ARRAY_SIZE(lli));
 
@@ -266,21 +317,8 @@ static void dmac_transfer_memory(pmb887x_dmac_t *p, pmb887x_dmac_ch_t *ch, uint3
 	uint32_t tx_size = (ch->control & DMAC_CH_CONTROL_TRANSFER_SIZE) >> DMAC_CH_CONTROL_TRANSFER_SIZE_SHIFT;
 	enum device_endian src_endian = dmac_master_endian(p, (ch->control & DMAC_CH_CONTROL_S_AHB2) != 0);
 	enum device_endian dst_endian = dmac_master_endian(p, (ch->control & DMAC_CH_CONTROL_D_AHB2) != 0);
-
-	bool is_simple_memcpy = (
-		flow_ctrl == DMAC_CH_CONFIG_FLOW_CTRL_MEM2MEM &&
-		dst_width == src_width &&
-		src_endian == dst_endian &&
-		(src_endian == DEVICE_LITTLE_ENDIAN || src_width == sizeof(uint32_t)) &&
-		(ch->control & DMAC_CH_CONTROL_SI) != 0 &&
-		(ch->control & DMAC_CH_CONTROL_DI) != 0
-	);
-
-	bool is_src_memory = (
-		flow_ctrl == DMAC_CH_CONFIG_FLOW_CTRL_MEM2MEM ||
-		flow_ctrl == DMAC_CH_CONFIG_FLOW_CTRL_MEM2PER ||
-		flow_ctrl == DMAC_CH_CONFIG_FLOW_CTRL_MEM2PER_PER
-	);
+	bool src_increment = (ch->control & DMAC_CH_CONTROL_SI) != 0;
+	bool dst_increment = (ch->control & DMAC_CH_CONTROL_DI) != 0;
 
 	ch->src_addr &= ~(src_width - 1);
 	ch->dst_addr &= ~(dst_width - 1);
@@ -288,73 +326,27 @@ static void dmac_transfer_memory(pmb887x_dmac_t *p, pmb887x_dmac_ch_t *ch, uint3
 	DPRINTF("CH%d: %08X [%dx%d] -> %08X [%dx%d] [%d]\n",
 		ch->id, ch->src_addr, src_width, burst_size, ch->dst_addr, dst_width, burst_size, tx_size);
 
-	if (is_simple_memcpy) {
-		address_space_read(&p->downstream_as, ch->src_addr, MEMTXATTRS_UNSPECIFIED, buffer, src_width * burst_size);
-		address_space_write(&p->downstream_as, ch->dst_addr, MEMTXATTRS_UNSPECIFIED, buffer, dst_width * burst_size);
-		ch->src_addr += src_width * burst_size;
-		ch->dst_addr += dst_width * burst_size;
-	} else if (dst_width == src_width) {
-		uint32_t transferred = 0;
-		while (transferred < burst_size) {
-			dmac_read(p, ch->src_addr, buffer, src_width, 1, src_endian);
-			if (src_endian != dst_endian && src_width > 1)
-				dmac_swap_byte_order(buffer, dst_width, 1);
-			dmac_write(p, ch->dst_addr, buffer, dst_width);
-
-			if ((ch->control & DMAC_CH_CONTROL_SI))
-				ch->src_addr += src_width;
-
-			if ((ch->control & DMAC_CH_CONTROL_DI))
-				ch->dst_addr += dst_width;
-
-			transferred++;
-		}
-	} else if (dst_width > src_width) {
-		uint32_t transferred = 0;
-		uint32_t buffer_size = 0;
-		while (transferred < burst_size) {
-			dmac_read(p, ch->src_addr, buffer + buffer_size, src_width, 1, src_endian);
-			if (src_endian == DEVICE_BIG_ENDIAN && src_width > 1)
-				dmac_swap_byte_order(buffer + buffer_size, src_width, 1);
-			buffer_size += src_width;
-
-			if ((ch->control & DMAC_CH_CONTROL_SI))
-				ch->src_addr += src_width;
-
-			if (buffer_size == dst_width) {
-				if (dst_endian == DEVICE_BIG_ENDIAN && dst_width > 1)
-					dmac_swap_byte_order(buffer, dst_width, 1);
-				dmac_write(p, ch->dst_addr, buffer, dst_width);
-				buffer_size = 0;
-
-				if ((ch->control & DMAC_CH_CONTROL_DI))
-					ch->dst_addr += dst_width;
-			}
-			transferred++;
-		}
-	} else {
-		uint32_t transferred = 0;
-		uint32_t src_burst_size = is_src_memory && (ch->control & DMAC_CH_CONTROL_SI) ? burst_size : 1;
-		uint32_t src_burst_size_bytes = src_burst_size * src_width;
-		while (transferred < burst_size) {
-			dmac_read(p, ch->src_addr, buffer, src_width, src_burst_size, src_endian);
-			if (src_endian == DEVICE_BIG_ENDIAN)
-				dmac_swap_byte_order(buffer, src_width, src_burst_size);
-
-			if ((ch->control & DMAC_CH_CONTROL_SI))
-				ch->src_addr += src_burst_size_bytes;
-
-			for (uint32_t j = 0; j < src_burst_size_bytes; j += dst_width) {
-				if (dst_endian == DEVICE_BIG_ENDIAN && dst_width > 1)
-					dmac_swap_byte_order(buffer + j, dst_width, 1);
-				dmac_write(p, ch->dst_addr, buffer + j, dst_width);
-
-				if ((ch->control & DMAC_CH_CONTROL_DI))
-					ch->dst_addr += dst_width;
-			}
-			transferred += src_burst_size;
-		}
+	/*
+	 * TransferSize counts source elements. The whole burst is gathered first, converted
+	 * to little-endian, re-packed to the destination width and then scattered. An odd
+	 * tail that does not fill a destination element is dropped.
+	 */
+	uint32_t burst_bytes = src_width * burst_size;
+	uint32_t dst_count = burst_bytes / dst_width;
+
+	dmac_read_burst(p, ch->src_addr, src_increment, buffer, src_width, burst_size, src_endian);
+	if (src_endian != dst_endian || src_width != dst_width) {
+		if (src_endian == DEVICE_BIG_ENDIAN && src_width > 1)
+			dmac_swap_byte_order(buffer, src_width, burst_size);
+		if (dst_endian == DEVICE_BIG_ENDIAN && dst_width > 1)
+			dmac_swap_byte_order(buffer, dst_width, dst_count);
 	}
+	dmac_write_burst(p, ch->dst_addr, dst_increment, buffer, dst_width, dst_count);
+
+	if (src_increment)
+		ch->src_addr += burst_bytes;
+	if (dst_increment)
+		ch->dst_addr += dst_count * dst_width;
 
 	uint32_t tx_size_mask = DMAC_CH_CONTROL_TRANSFER_SIZE >> DMAC_CH_CONTROL_TRANSFER_SIZE_SHIFT;
 	tx_size = (tx_size - burst_size) & tx_size_mask;
@@ -13,6 +13,7 @@
 #include "qemu/main-loop.h"
 #include "qemu/thread.h"
 #include "qemu/timer.h"
+#include "qemu/audio.h"
 #include "hw/core/qdev-properties.h"
 #include "hw/core/qdev-clock.h"
 #include "hw/ssi/ssi.h"
@@ -33,11 +34,16 @@
 #define DSP_BOOT_DATA_OFFSET	2
 #define DSP_RUNTIME_PIPE_OFFSET	5
 #define DSP_RUNTIME_PIPE_STRIDE	0x1C
+// Boot command and pipe command words, ARM writes there are trapped to wake the core
+#define DSP_RAM_COMMAND_SIZE	((DSP_RUNTIME_PIPE_OFFSET + PMB887X_DSP_INT_COUNT * DSP_RUNTIME_PIPE_STRIDE) * sizeof(uint16_t))
 #define DSP_OUTPUT_COUNT	3
 #define DSP_BASEBAND_SYNC_TIMEOUT_MS	50
 #define DSP_BASEBAND_SPIN_NS	(100 * SCALE_US)
 #define DSP_BASEBAND_IRQ_MASK	(TEAK_INT_FINTA0_BBHI | TEAK_INT_FINTA0_BBLO | TEAK_INT_FINTA0_BB_FULL)
 #define DSP_SSC_BUS_NAME	"pmb887x-dsp-ssc"
+// Default frequency of the QEMU audio backends, so the mixer doesn't resample once more
+#define DSP_AUDIO_OUTPUT_RATE	44100
+#define DSP_AUDIO_CHUNK_FRAMES	512
 #define TYPE_PMB887X_DSP	"pmb887x-dsp"
 #define PMB887X_DSP(obj)	OBJECT_CHECK(dsp_state_t, (obj), TYPE_PMB887X_DSP)
 
@@ -265,6 +271,7 @@ enum {
 typedef struct dsp_state_t dsp_state_t;
 typedef struct dsp_events_t dsp_events_t;
 typedef struct dsp_worker_t dsp_worker_t;
+typedef struct dsp_mailbox_t dsp_mailbox_t;
 
 struct dsp_events_t {
 	uint16_t interrupts;
@@ -272,6 +279,15 @@ struct dsp_events_t {
 	uint16_t outputs;
 };
 
+/*
+ * MCU -> DSP commands, posted by the vCPU without taking the worker mutex and drained by the worker before each run.
+ * Comm keeps pending sets in the low half and pending clears in the high half, a later write to a flag cancels the earlier one.
+ * */
+struct dsp_mailbox_t {
+	uint16_t requests;
+	uint32_t comm;
+};
+
 struct dsp_worker_t {
 	QEMUBH *bh;
 	QemuThread thread;
@@ -279,11 +295,14 @@ struct dsp_worker_t {
 	QemuCond cond;
 	QemuCond idle_cond;
 	QemuEvent event;
+	// Set after every run and before the worker goes to sleep
+	QemuEvent done;
 	uint16_t interrupt_events;
 	uint16_t output_events;
 	uint16_t outputs;
 	bool enabled;
 	bool busy;
+	bool sleeping;
 	bool sync_requested;
 	bool reset;
 	bool stop;
@@ -295,18 +314,20 @@ struct dsp_state_t {
 	MemoryRegion mmio;
 	MemoryRegion regs;
 	MemoryRegion ram;
+	MemoryRegion ram_commands;
+	MemoryRegion ram_gate;
 	uint32_t revision;
 	uint32_t rom_version;
+	char *tcg_cache;
 	const pmb887x_dsp_config_t *config;
 	bool trace_boot_mode;
 	pmb887x_clc_reg_t clc;
 	dsp_runtime_t *runtime;
 	dsp_worker_t worker;
+	dsp_mailbox_t mailbox;
 	bool runtime_running;
 	VMChangeStateEntry *vmstate;
 	uint16_t comm_status;
-	uint16_t reset_comm_flags;
-	uint16_t reset_requests;
 	uint16_t baseband_timeout_flags;
 	Clock *gsm_clock;
 	bool reset_pending;
@@ -314,6 +335,9 @@ struct dsp_state_t {
 	qemu_irq mcu_interrupts[PMB887X_DSP_MCU_INT_COUNT];
 	qemu_irq outputs[DSP_OUTPUT_COUNT];
 	SSIBus *ssc_bus;
+	AudioBackend *audio_be;
+	SWVoiceOut *voice;
+	dsp_audio_t *audio;
 };
 
 static uint32_t dsp_ssc_transfer(void *opaque, uint32_t value) {
@@ -342,6 +366,46 @@ static bool dsp_runnable(dsp_state_t *p) {
 	return !dsp_runtime_is_idle(p->runtime);
 }
 
+static void dsp_mailbox_post_comm(dsp_state_t *p, uint16_t set, uint16_t clear) {
+	uint32_t old_value;
+	uint32_t new_value;
+
+	do {
+		old_value = qatomic_read(&p->mailbox.comm);
+		new_value = (old_value | set | (uint32_t) clear << 16) & ~((uint32_t) set << 16 | clear);
+	} while (qatomic_cmpxchg(&p->mailbox.comm, old_value, new_value) != old_value);
+}
+
+static bool dsp_mailbox_pending(dsp_state_t *p) {
+	return qatomic_read(&p->mailbox.requests) != 0 || qatomic_read(&p->mailbox.comm) != 0;
+}
+
+static void dsp_mailbox_drain(dsp_state_t *p) {
+	uint16_t requests = qatomic_xchg(&p->mailbox.requests, 0);
+	uint32_t comm = qatomic_xchg(&p->mailbox.comm, 0);
+
+	if ((comm & 0xFFFF) != 0)
+		dsp_runtime_set_comm(p->runtime, comm & 0xFFFF);
+	if ((comm >> 16) != 0)
+		dsp_runtime_clear_comm(p->runtime, comm >> 16);
+	for (size_t i = 0; i < PMB887X_DSP_INT_COUNT; i++)
+		if ((requests & BIT(i)) != 0)
+			dsp_runtime_set_request(p->runtime, i, true);
+}
+
+static void dsp_publish_comm(dsp_state_t *p) {
+	uint32_t pending;
+
+	qatomic_set(&p->comm_status, dsp_runtime_get_comm(p->runtime));
+
+	// MCU writes posted during the run are not in the core yet
+	pending = qatomic_read(&p->mailbox.comm);
+	if (pending != 0) {
+		qatomic_or(&p->comm_status, pending & 0xFFFF);
+		qatomic_and(&p->comm_status, (uint16_t) ~(pending >> 16));
+	}
+}
+
 static void dsp_worker_bh(void *opaque) {
 	dsp_state_t *p = opaque;
 	uint16_t events = qatomic_xchg(&p->worker.interrupt_events, 0);
@@ -382,7 +446,6 @@ static void *dsp_worker(void *opaque) {
 	qemu_mutex_lock(&p->worker.mutex);
 	while (!p->worker.stop) {
 		dsp_events_t events = {};
-		bool runnable;
 
 		while (!p->worker.enabled && !p->worker.reset && !p->worker.stop)
 			qemu_cond_wait(&p->worker.cond, &p->worker.mutex);
@@ -392,10 +455,8 @@ static void *dsp_worker(void *opaque) {
 
 		if (p->worker.reset) {
 			bool run_startup = p->worker.enabled;
-			uint16_t comm_flags;
-			uint16_t requests;
 
-			p->worker.busy = true;
+			qatomic_set(&p->worker.busy, true);
 			p->worker.reset = false;
 			qemu_mutex_unlock(&p->worker.mutex);
 			dsp_runtime_reset(p->runtime);
@@ -406,54 +467,61 @@ static void *dsp_worker(void *opaque) {
 				dsp_run(p, &events);
 
 			qemu_mutex_lock(&p->worker.mutex);
-			p->worker.busy = false;
+			qatomic_set(&p->worker.busy, false);
 			p->worker.sync_requested = false;
 			qemu_cond_broadcast(&p->worker.idle_cond);
+			qemu_event_set(&p->worker.done);
 			if (p->worker.reset)
 				continue;
 
-			comm_flags = qatomic_read(&p->reset_comm_flags);
-			requests = qatomic_read(&p->reset_requests);
-			dsp_runtime_set_comm(p->runtime, comm_flags);
-			qatomic_set(&p->comm_status, dsp_runtime_get_comm(p->runtime));
-			for (size_t i = 0; i < PMB887X_DSP_INT_COUNT; i++)
-				if ((requests & BIT(i)) != 0)
-					dsp_runtime_set_request(p->runtime, i, true);
+			// Commands posted while the reset was pending
+			dsp_mailbox_drain(p);
+			dsp_publish_comm(p);
 
 			qatomic_set(&p->reset_pending, false);
-			qatomic_set(&p->reset_comm_flags, 0);
-			qatomic_set(&p->reset_requests, 0);
 			qemu_cond_broadcast(&p->worker.idle_cond);
 			dsp_worker_publish_events(p, &events);
 			continue;
 		}
 
-		runnable = dsp_runnable(p);
-		if (!runnable) {
+		qatomic_set(&p->worker.busy, true);
+		// Pairs with dsp_worker_kick(): a command posted after the drain makes the run exit early
+		smp_mb();
+		dsp_mailbox_drain(p);
+
+		if (!dsp_runnable(p)) {
+			qatomic_set(&p->worker.busy, false);
 			qemu_event_reset(&p->worker.event);
-			runnable = dsp_runnable(p);
-			if (!runnable) {
+			if (!dsp_runnable(p) && !dsp_mailbox_pending(p)) {
+				p->worker.sync_requested = false;
+				qemu_cond_broadcast(&p->worker.idle_cond);
+				qatomic_set(&p->worker.sleeping, true);
+				qemu_event_set(&p->worker.done);
 				qemu_mutex_unlock(&p->worker.mutex);
 				qemu_event_wait(&p->worker.event);
 				qemu_mutex_lock(&p->worker.mutex);
-				continue;
+				qatomic_set(&p->worker.sleeping, false);
 			}
+			continue;
 		}
 
-		p->worker.busy = true;
 		qemu_mutex_unlock(&p->worker.mutex);
 
 		dsp_run(p, &events);
 
 		qemu_mutex_lock(&p->worker.mutex);
-		qatomic_set(&p->comm_status, dsp_runtime_get_comm(p->runtime));
-		p->worker.busy = false;
+		qatomic_set(&p->worker.busy, false);
 		p->worker.sync_requested = false;
 		qemu_cond_broadcast(&p->worker.idle_cond);
 
-		if (p->worker.reset)
+		if (p->worker.reset) {
+			qemu_event_set(&p->worker.done);
 			continue;
+		}
+
+		dsp_publish_comm(p);
 		dsp_worker_publish_events(p, &events);
+		qemu_event_set(&p->worker.done);
 	}
 
 	qemu_mutex_unlock(&p->worker.mutex);
@@ -492,33 +560,24 @@ static void dsp_vm_state_change(void *opaque, bool running, RunState state) {
 static void dsp_worker_kick(void *opaque) {
 	dsp_state_t *p = opaque;
 
-	if (qemu_thread_is_self(&p->worker.thread)) {
-		qemu_event_set(&p->worker.event);
-		return;
-	}
-
-	qemu_mutex_lock(&p->worker.mutex);
-	if (p->worker.busy) {
-		dsp_runtime_kick(p->runtime);
-	} else {
-		dsp_runtime_wake(p->runtime);
+	if (!qemu_thread_is_self(&p->worker.thread)) {
+		// Order the posted command before the busy check, a running core has to leave its slice to see it
+		smp_mb();
+		if (qatomic_read(&p->worker.busy)) {
+			dsp_runtime_kick(p->runtime);
+		} else {
+			dsp_runtime_wake(p->runtime);
+		}
 	}
 	qemu_event_set(&p->worker.event);
-	qemu_mutex_unlock(&p->worker.mutex);
 }
 
 static void dsp_worker_notify_activity(void *opaque) {
 	dsp_state_t *p = opaque;
 
-	if (qemu_thread_is_self(&p->worker.thread)) {
-		qemu_event_set(&p->worker.event);
-		return;
-	}
-
-	qemu_mutex_lock(&p->worker.mutex);
-	dsp_runtime_wake(p->runtime);
+	if (!qemu_thread_is_self(&p->worker.thread))
+		dsp_runtime_wake(p->runtime);
 	qemu_event_set(&p->worker.event);
-	qemu_mutex_unlock(&p->worker.mutex);
 }
 
 static void dsp_worker_notify_comm(void *opaque, uint16_t flags, bool set) {
@@ -567,9 +626,9 @@ static void dsp_reset_internal_state(dsp_state_t *p) {
 	qatomic_set(&p->worker.interrupt_events, 0);
 	qatomic_set(&p->worker.output_events, 0);
 	qatomic_set(&p->worker.outputs, 0);
+	qatomic_set(&p->mailbox.requests, 0);
+	qatomic_set(&p->mailbox.comm, 0);
 	qatomic_set(&p->comm_status, 0);
-	qatomic_set(&p->reset_comm_flags, 0);
-	qatomic_set(&p->reset_requests, 0);
 	p->baseband_timeout_flags = 0;
 	for (size_t i = 0; i < ARRAY_SIZE(p->outputs); i++)
 		qemu_irq_lower(p->outputs[i]);
@@ -631,19 +690,7 @@ static void dsp_interrupt_input(void *opaque, int id, int level) {
 	if (pmb887x_trace_log_enabled(PMB887X_TRACE_DSP))
 		dsp_trace_command(p, id);
 
-	if (!qatomic_read(&p->reset_pending)) {
-		dsp_runtime_set_request(p->runtime, id, true);
-		dsp_worker_kick(p);
-		return;
-	}
-
-	qemu_mutex_lock(&p->worker.mutex);
-	if (qatomic_read(&p->reset_pending)) {
-		qatomic_or(&p->reset_requests, BIT(id));
-	} else {
-		dsp_runtime_set_request(p->runtime, id, true);
-	}
-	qemu_mutex_unlock(&p->worker.mutex);
+	qatomic_or(&p->mailbox.requests, BIT(id));
 	dsp_worker_kick(p);
 }
 
@@ -683,30 +730,40 @@ static void dsp_wait_baseband_irq(dsp_state_t *p, int signal, int level) {
 	int64_t spin_deadline = start + DSP_BASEBAND_SPIN_NS;
 	uint32_t sleeps = 0;
 	bool timed_out = false;
+	bool stalled = false;
 
 	dsp_worker_kick(p);
 	while (dsp_baseband_event_blocked(p) && qemu_clock_get_ns(QEMU_CLOCK_HOST) < spin_deadline)
 		cpu_relax();
 
-	qemu_mutex_lock(&p->worker.mutex);
 	while (dsp_baseband_event_blocked(p)) {
-		bool worker_stopped = !p->worker.enabled || !p->runtime_running || p->worker.stop;
+		bool worker_stopped;
 
+		// Reset before the checks, so a run finished after them still wakes us up
+		qemu_event_reset(&p->worker.done);
+		if (!dsp_baseband_event_blocked(p))
+			break;
+
+		worker_stopped = !qatomic_read(&p->worker.enabled) || !qatomic_read(&p->runtime_running) ||
+			qatomic_read(&p->worker.stop);
 		if (worker_stopped)
 			break;
 
-		int64_t remaining = deadline - qemu_clock_get_ns(QEMU_CLOCK_HOST);
+		// The core went to sleep with the event still blocked, only the MCU can change that
+		if (qatomic_read(&p->worker.sleeping) && dsp_runtime_is_idle(p->runtime)) {
+			stalled = true;
+			break;
+		}
 
-		if (remaining <= 0) {
+		if (qemu_clock_get_ns(QEMU_CLOCK_HOST) >= deadline) {
 			timed_out = true;
 			break;
 		}
 		sleeps++;
-		qemu_cond_timedwait(&p->worker.idle_cond, &p->worker.mutex, DIV_ROUND_UP(remaining, SCALE_MS));
+		qemu_event_wait(&p->worker.done);
 	}
-	qemu_mutex_unlock(&p->worker.mutex);
 
-	if (timed_out)
+	if (timed_out || stalled)
 		p->baseband_timeout_flags = dsp_runtime_get_irq_pending_flags(p->runtime, 0) & DSP_BASEBAND_IRQ_MASK;
 
 	if (sleeps == 0)
@@ -716,8 +773,9 @@ static void dsp_wait_baseband_irq(dsp_state_t *p, int signal, int level) {
 	uint16_t flags = dsp_runtime_get_irq_flags(p->runtime, 0) & DSP_BASEBAND_IRQ_MASK;
 	uint32_t pc = dsp_runtime_get_pc(p->runtime);
 
-	DPRINTF("ARM wait: sig=%d/%d irq=%04X active=%u pc=%05X wait=%" PRId64 " us sleeps=%u timeout=%u\n",
-		signal, level, flags, dsp_runtime_is_maskable_interrupt_active(p->runtime), pc, host_wait_us, sleeps, timed_out);
+	DPRINTF("ARM wait: sig=%d/%d irq=%04X active=%u pc=%05X wait=%" PRId64 " us sleeps=%u timeout=%u stall=%u\n",
+		signal, level, flags, dsp_runtime_is_maskable_interrupt_active(p->runtime), pc, host_wait_us, sleeps, timed_out,
+		stalled);
 }
 
 static void dsp_gsm_input(void *opaque, int signal, int level) {
@@ -732,6 +790,10 @@ static void dsp_gsm_input(void *opaque, int signal, int level) {
 	dsp_runtime_set_gsm_signal(p->runtime, signal, level != 0);
 }
 
+static void dsp_update_shared_ram(dsp_state_t *p) {
+	memory_region_set_enabled(&p->ram_gate, !pmb887x_clc_is_enabled(&p->clc));
+}
+
 static uint64_t dsp_io_read(void *opaque, hwaddr haddr, unsigned size) {
 	dsp_state_t *p = opaque;
 	uint64_t value = 0;
@@ -749,11 +811,7 @@ static uint64_t dsp_io_read(void *opaque, hwaddr haddr, unsigned size) {
 			uint32_t program_start_pc;
 			bool reset_pending = qatomic_read(&p->reset_pending);
 
-			if (reset_pending) {
-				value = qatomic_read(&p->reset_comm_flags) | qatomic_read(&p->comm_status);
-			} else {
-				value = qatomic_read(&p->comm_status);
-			}
+			value = qatomic_read(&p->comm_status);
 
 			if (!reset_pending && dsp_runtime_take_program_start(p->runtime, &program_start_pc))
 				DPRINTF("cold program start: pc=%05X flags=%04" PRIX64 "\n", program_start_pc, value);
@@ -793,31 +851,21 @@ static void dsp_io_write(void *opaque, hwaddr haddr, uint64_t value, unsigned si
 	switch (haddr) {
 		case DSP_CLC:
 			pmb887x_clc_set(&p->clc, value);
+			dsp_update_shared_ram(p);
 			dsp_runtime_set_clock(p->runtime, pmb887x_clc_is_enabled(&p->clc));
 			dsp_worker_set_enabled(p, p->vm_running && pmb887x_clc_is_enabled(&p->clc));
 			break;
 
 		case DSP_COM_SET:
-			qemu_mutex_lock(&p->worker.mutex);
-			if (qatomic_read(&p->reset_pending)) {
-				qatomic_or(&p->reset_comm_flags, value & DSP_COM_SET_FLAGS);
-			} else {
-				dsp_runtime_set_comm(p->runtime, value & DSP_COM_SET_FLAGS);
-				qatomic_or(&p->comm_status, value & DSP_COM_SET_FLAGS);
-			}
-			qemu_mutex_unlock(&p->worker.mutex);
+			// Visible in COM_STATUS right away, the core gets it on the next run
+			dsp_mailbox_post_comm(p, value & DSP_COM_SET_FLAGS, 0);
+			qatomic_or(&p->comm_status, value & DSP_COM_SET_FLAGS);
 			dsp_worker_kick(p);
 			break;
 
 		case DSP_COM_CLEAR:
-			qemu_mutex_lock(&p->worker.mutex);
-			if (qatomic_read(&p->reset_pending)) {
-				qatomic_and(&p->reset_comm_flags, (uint16_t) ~(value & DSP_COM_CLEAR_FLAGS));
-			} else {
-				dsp_runtime_clear_comm(p->runtime, value & DSP_COM_CLEAR_FLAGS);
-				qatomic_and(&p->comm_status, (uint16_t) ~(value & DSP_COM_CLEAR_FLAGS));
-			}
-			qemu_mutex_unlock(&p->worker.mutex);
+			dsp_mailbox_post_comm(p, 0, value & DSP_COM_CLEAR_FLAGS);
+			qatomic_and(&p->comm_status, (uint16_t) ~(value & DSP_COM_CLEAR_FLAGS));
 			dsp_worker_kick(p);
 			break;
 
@@ -883,14 +931,30 @@ static const MemoryRegionOps ram_io_ops = {
 	},
 };
 
+static void dsp_init_shared_ram(dsp_state_t *p, size_t size) {
+	Object *obj = OBJECT(p);
+
+#if HOST_BIG_ENDIAN
+	// Host words don't have the ARM byte order, every access is converted
+	memory_region_init_io(&p->ram, obj, &ram_io_ops, p, "pmb887x-dsp-ram", size);
+#else
+	memory_region_init_ram_ptr(&p->ram, obj, "pmb887x-dsp-ram", size, dsp_runtime_shared_ptr(p->runtime));
+#endif
+	memory_region_init_io(&p->ram_commands, obj, &ram_io_ops, p, "pmb887x-dsp-ram-commands", MIN(DSP_RAM_COMMAND_SIZE, size));
+	// Reads as zero and ignores writes while the DSP module is disabled
+	memory_region_init_io(&p->ram_gate, obj, &ram_io_ops, p, "pmb887x-dsp-ram-gate", size);
+
+	memory_region_add_subregion(&p->mmio, DSP_RAM0, &p->ram);
+	memory_region_add_subregion_overlap(&p->mmio, DSP_RAM0, &p->ram_commands, 1);
+	memory_region_add_subregion_overlap(&p->mmio, DSP_RAM0, &p->ram_gate, 2);
+}
+
 static void dsp_init(Object *obj) {
 	dsp_state_t *p = PMB887X_DSP(obj);
 	p->ssc_bus = ssi_create_bus(DEVICE(obj), DSP_SSC_BUS_NAME);
 	memory_region_init(&p->mmio, obj, "pmb887x-dsp", DSP_IO_SIZE);
 	memory_region_init_io(&p->regs, obj, &io_ops, p, "pmb887x-dsp-regs", DSP_RAM0);
-	memory_region_init_io(&p->ram, obj, &ram_io_ops, p, "pmb887x-dsp-ram", DSP_RAM_SIZE);
 	memory_region_add_subregion(&p->mmio, 0, &p->regs);
-	memory_region_add_subregion(&p->mmio, DSP_RAM0, &p->ram);
 	sysbus_init_mmio(SYS_BUS_DEVICE(obj), &p->mmio);
 	qdev_init_gpio_in_named(DEVICE(obj), dsp_reset_input, "RESET_IN", 1);
 	qdev_init_gpio_in_named(DEVICE(obj), dsp_interrupt_input, "INT_IN", PMB887X_DSP_INT_COUNT);
@@ -907,6 +971,7 @@ static void dsp_init(Object *obj) {
 static void dsp_reset(DeviceState *dev) {
 	dsp_state_t *p = PMB887X_DSP(dev);
 	pmb887x_clc_set(&p->clc, MOD_CLC_DISR);
+	dsp_update_shared_ram(p);
 	dsp_runtime_set_clock(p->runtime, false);
 	dsp_reset_internal_state(p);
 }
@@ -920,8 +985,44 @@ static const Property dsp_properties[] = {
 	DEFINE_PROP_UINT32("revision", dsp_state_t, revision, 0),
 	DEFINE_PROP_UINT32("rom_version", dsp_state_t, rom_version, 0),
 	DEFINE_PROP_LINK("bus_ssc", dsp_state_t, ssc_bus, "SSI", SSIBus *),
+	DEFINE_PROP_STRING("tcg_cache", dsp_state_t, tcg_cache),
+	DEFINE_AUDIO_PROPERTIES(dsp_state_t, audio_be),
 };
 
+static void dsp_audio_callback(void *opaque, int avail) {
+	dsp_state_t *p = opaque;
+	int16_t buffer[DSP_AUDIO_CHUNK_FRAMES];
+	size_t frames = avail / sizeof(int16_t);
+
+	while (frames > 0) {
+		size_t chunk = MIN(frames, DSP_AUDIO_CHUNK_FRAMES);
+		dsp_audio_render(p->audio, buffer, chunk);
+		if (audio_be_write(p->audio_be, p->voice, buffer, chunk * sizeof(int16_t)) < chunk * sizeof(int16_t))
+			break;
+		frames -= chunk;
+	}
+}
+
+static void dsp_init_audio(dsp_state_t *p) {
+	struct audsettings settings = {
+		.freq = DSP_AUDIO_OUTPUT_RATE,
+		.nchannels = 1,
+		.fmt = AUDIO_FORMAT_S16,
+		.big_endian = HOST_BIG_ENDIAN,
+	};
+
+	p->audio = g_new0(dsp_audio_t, 1);
+	dsp_audio_init(p->audio, settings.freq);
+	p->voice = audio_be_open_out(p->audio_be, NULL, TYPE_PMB887X_DSP, p, dsp_audio_callback, &settings);
+	if (p->voice == NULL) {
+		EPRINTF("can't open audio voice, DSP audio is disabled\n");
+		g_clear_pointer(&p->audio, g_free);
+		return;
+	}
+	audio_be_set_active_out(p->audio_be, p->voice, true);
+	dsp_runtime_set_audio(p->runtime, p->audio);
+}
+
 static void dsp_realize(DeviceState *dev, Error **errp) {
 	dsp_state_t *p = PMB887X_DSP(dev);
 	const pmb887x_dsp_config_t *config;
@@ -936,7 +1037,6 @@ static void dsp_realize(DeviceState *dev, Error **errp) {
 	config = p->config;
 
 	shared_ram_size = config->shared_size * sizeof(uint16_t);
-	memory_region_set_size(&p->ram, shared_ram_size);
 	memory_region_set_size(&p->mmio, DSP_RAM0 + shared_ram_size);
 	if (p->rom_version == 0)
 		p->rom_version = config->default_rom_version;
@@ -947,8 +1047,17 @@ static void dsp_realize(DeviceState *dev, Error **errp) {
 		return;
 	}
 
+	// Audio output is optional, e.g. -audiodev wav,id=snd0,path=dsp.wav -global pmb887x-dsp.audiodev=snd0
+	if (p->audio_be && !audio_be_check(&p->audio_be, errp))
+		return;
+
 	p->runtime = dsp_runtime_create(config, p->rom_version, rom->program_rom, rom->data_rom,
 		p, dsp_worker_notify_activity, dsp_worker_notify_comm, dsp_ssc_transfer);
+	dsp_runtime_set_cache_dir(p->runtime, p->tcg_cache);
+	dsp_init_shared_ram(p, shared_ram_size);
+
+	if (p->audio_be)
+		dsp_init_audio(p);
 
 	p->worker.stop = false;
 	p->worker.enabled = false;
@@ -956,12 +1065,14 @@ static void dsp_realize(DeviceState *dev, Error **errp) {
 	qemu_cond_init(&p->worker.cond);
 	qemu_cond_init(&p->worker.idle_cond);
 	qemu_event_init(&p->worker.event, false);
+	qemu_event_init(&p->worker.done, false);
 	p->worker.bh = qemu_bh_new(dsp_worker_bh, p);
 	qemu_thread_create(&p->worker.thread, "pmb887x-dsp", dsp_worker, p, QEMU_THREAD_JOINABLE);
 	p->worker.created = true;
 
 	p->vmstate = qdev_add_vm_change_state_handler(dev, dsp_vm_state_change, NULL, p);
 	pmb887x_clc_set(&p->clc, MOD_CLC_DISR);
+	dsp_update_shared_ram(p);
 	dsp_reset_internal_state(p);
 	DPRINTF("core initialized: cpu=%s revision=%02X rom_version=%04X\n", config->name, p->revision, p->rom_version);
 }
@@ -984,11 +1095,42 @@ static void dsp_unrealize(DeviceState *dev) {
 		qemu_cond_destroy(&p->worker.idle_cond);
 		qemu_cond_destroy(&p->worker.cond);
 		qemu_event_destroy(&p->worker.event);
+		qemu_event_destroy(&p->worker.done);
 		qemu_mutex_destroy(&p->worker.mutex);
 	}
 
 	dsp_runtime_destroy(p->runtime);
 	p->runtime = NULL;
+
+	if (p->voice != NULL) {
+		audio_be_close_out(p->audio_be, p->voice);
+		p->voice = NULL;
+	}
+	g_clear_pointer(&p->audio, g_free);
+}
+
+static char *dsp_get_tcg_cache_stats(Object *obj, Error **errp) {
+	dsp_state_t *p = PMB887X_DSP(obj);
+	if (p->runtime == NULL)
+		return g_strdup("");
+	return dsp_runtime_get_cache_stats(p->runtime);
+}
+
+static char *dsp_get_audio_stats(Object *obj, Error **errp) {
+	static const char *const names[DSP_AUDIO_SOURCE_COUNT] = { "voice", "i2s" };
+	dsp_state_t *p = PMB887X_DSP(obj);
+	GString *s = g_string_new("");
+
+	if (p->audio == NULL)
+		return g_string_free(s, false);
+
+	for (size_t i = 0; i < DSP_AUDIO_SOURCE_COUNT; i++) {
+		const dsp_audio_stream_t *stream = &p->audio->streams[i];
+		g_string_append_printf(s, "%s%s: rate=%u playing=%d dropped=%u underruns=%u", i ? ", " : "", names[i],
+			qatomic_read(&stream->ring.rate), stream->playing, qatomic_read(&stream->ring.dropped),
+			stream->underruns);
+	}
+	return g_string_free(s, false);
 }
 
 static void dsp_class_init(ObjectClass *klass, const void *data) {
@@ -997,6 +1139,11 @@ static void dsp_class_init(ObjectClass *klass, const void *data) {
 	device_class_set_legacy_reset(dc, dsp_reset);
 	dc->realize = dsp_realize;
 	dc->unrealize = dsp_unrealize;
+
+	// qom-get /machine/dsp tcg-cache-stats: block cache counters since the last DSP reset
+	object_class_property_add_str(klass, "tcg-cache-stats", dsp_get_tcg_cache_stats, NULL);
+	// qom-get /machine/dsp audio-stats: per source rate, dropped samples and ring underruns
+	object_class_property_add_str(klass, "audio-stats", dsp_get_audio_stats, NULL);
 }
 
 static const TypeInfo dsp_info = {
@@ -0,0 +1,191 @@
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+
+#include <math.h>
+
+#include "hw/arm/pmb887x/dsp/audio.h"
+
+#define DSP_AUDIO_RING_MASK		(DSP_AUDIO_RING_SIZE - 1)
+#define DSP_AUDIO_PHASE_SHIFT	(32 - 6)
+#define DSP_AUDIO_RENDER_CHUNK	256
+// Passband edge relative to the lower Nyquist frequency
+#define DSP_AUDIO_CUTOFF		0.9
+
+QEMU_BUILD_BUG_ON(DSP_AUDIO_RING_SIZE & DSP_AUDIO_RING_MASK);
+QEMU_BUILD_BUG_ON(DSP_AUDIO_PHASES != 1 << (32 - DSP_AUDIO_PHASE_SHIFT));
+
+/*
+ * Blackman windowed sinc, each phase is normalized to unity DC gain.
+ * Output point of phase p lies between window taps TAPS/2 - 1 and TAPS/2, p / PHASES past the first one.
+ * */
+static void dsp_audio_resampler_init(dsp_audio_resampler_t *r, uint32_t input_rate, uint32_t output_rate) {
+	double cutoff = 0.5 * MIN(1.0, (double) output_rate / input_rate) * DSP_AUDIO_CUTOFF;
+
+	memset(r, 0, sizeof(*r));
+	r->input_rate = input_rate;
+	r->output_rate = output_rate;
+	r->step = ((uint64_t) input_rate << 32) / output_rate;
+
+	for (size_t p = 0; p < DSP_AUDIO_PHASES; p++) {
+		double taps[DSP_AUDIO_TAPS];
+		double sum = 0;
+
+		for (size_t t = 0; t < DSP_AUDIO_TAPS; t++) {
+			double x = (double) t - (DSP_AUDIO_TAPS / 2 - 1) - (double) p / DSP_AUDIO_PHASES;
+			double u = (x + DSP_AUDIO_TAPS / 2) / DSP_AUDIO_TAPS;
+			double window = 0.42 - 0.5 * cos(2 * M_PI * u) + 0.08 * cos(4 * M_PI * u);
+			double sinc = x == 0 ? 2 * cutoff : sin(2 * M_PI * cutoff * x) / (M_PI * x);
+			taps[t] = sinc * window;
+			sum += taps[t];
+		}
+
+		for (size_t t = 0; t < DSP_AUDIO_TAPS; t++)
+			r->coeffs[p][t] = CLAMP(lround(taps[t] / sum * INT16_MAX), INT16_MIN, INT16_MAX);
+	}
+}
+
+// The window ends with the last consumed sample, it's read in place from the ring
+static int32_t dsp_audio_resampler_output(const dsp_audio_resampler_t *r, const int16_t *window, uint64_t position) {
+	const int16_t *coeffs = r->coeffs[position >> DSP_AUDIO_PHASE_SHIFT];
+	// Sum of the absolute coefficients stays below 2, so this can't overflow
+	int32_t acc = 1 << 14;
+
+	for (size_t t = 0; t < DSP_AUDIO_TAPS; t++)
+		acc += window[t] * coeffs[t];
+	return acc >> 15;
+}
+
+void dsp_audio_init(dsp_audio_t *audio, uint32_t output_rate) {
+	memset(audio, 0, sizeof(*audio));
+	audio->output_rate = output_rate;
+}
+
+void dsp_audio_write(dsp_audio_t *audio, dsp_audio_source_t source, int16_t sample, uint32_t rate) {
+	dsp_audio_ring_t *ring = &audio->streams[source].ring;
+	uint32_t head = ring->head;
+	uint32_t index = head & DSP_AUDIO_RING_MASK;
+
+	if (head - qatomic_load_acquire(&ring->tail) >= DSP_AUDIO_RING_CAPACITY) {
+		qatomic_set(&ring->dropped, ring->dropped + 1);
+		return;
+	}
+
+	if (qatomic_read(&ring->rate) != rate)
+		qatomic_set(&ring->rate, rate);
+	ring->samples[index] = sample;
+	if (index < DSP_AUDIO_TAPS)
+		ring->samples[DSP_AUDIO_RING_SIZE + index] = sample;
+	qatomic_store_release(&ring->head, head + 1);
+}
+
+// Written and dropped samples, the producer's view of time
+static uint32_t dsp_audio_ring_produced(dsp_audio_ring_t *ring) {
+	return qatomic_load_acquire(&ring->head) + qatomic_read(&ring->dropped);
+}
+
+static void dsp_audio_stream_measure(dsp_audio_stream_t *stream, size_t frames, uint32_t output_rate) {
+	uint32_t produced = dsp_audio_ring_produced(&stream->ring);
+	uint32_t samples = produced - stream->window_produced;
+
+	if (produced != stream->produced) {
+		stream->produced = produced;
+		stream->idle_frames = 0;
+	} else {
+		stream->idle_frames += frames;
+	}
+
+	// A stopped producer says nothing about its rate, start over once it's back
+	if (stream->idle_frames >= output_rate * DSP_AUDIO_LATENCY_MS / 1000) {
+		stream->window_produced = produced;
+		stream->window_frames = 0;
+		stream->idle_frames = 0;
+		return;
+	}
+
+	stream->window_frames += frames;
+	if (stream->window_frames < output_rate * DSP_AUDIO_RATE_WINDOW_MS / 1000)
+		return;
+
+	uint32_t rate = MAX((uint64_t) samples * output_rate / stream->window_frames, 1);
+	uint32_t current = stream->resampler.input_rate;
+
+	if ((uint64_t) abs((int32_t) (rate - current)) * 1000000 > (uint64_t) current * DSP_AUDIO_MAX_DRIFT_PPM)
+		stream->measured_rate = rate;
+	stream->window_produced = produced;
+	stream->window_frames = 0;
+}
+
+static void dsp_audio_stream_render(dsp_audio_stream_t *stream, int32_t *mix, size_t frames, uint32_t output_rate) {
+	dsp_audio_ring_t *ring = &stream->ring;
+	dsp_audio_resampler_t *r = &stream->resampler;
+	uint32_t declared_rate = qatomic_read(&ring->rate);
+
+	if (declared_rate == 0)
+		return;
+	if (declared_rate != stream->declared_rate) {
+		stream->declared_rate = declared_rate;
+		stream->measured_rate = 0;
+		stream->window_produced = stream->produced = dsp_audio_ring_produced(ring);
+		stream->window_frames = 0;
+		stream->idle_frames = 0;
+	}
+
+	uint32_t rate = stream->measured_rate != 0 ? stream->measured_rate : declared_rate;
+	if (rate != r->input_rate || output_rate != r->output_rate) {
+		uint64_t position = r->position;
+		dsp_audio_resampler_init(r, rate, output_rate);
+		r->position = position;
+	}
+	dsp_audio_stream_measure(stream, frames, output_rate);
+
+	uint32_t tail = ring->tail;
+	uint32_t head = qatomic_load_acquire(&ring->head);
+	int64_t target = MAX(rate * DSP_AUDIO_LATENCY_MS / 1000, 1);
+
+	if (!stream->playing) {
+		if (head - tail < target)
+			return;
+		stream->playing = true;
+	}
+
+	// DSP and host clocks drift apart, steer the ring fill back to the target by a slight speed change
+	int64_t ppm = ((int64_t) (head - tail) - target) * DSP_AUDIO_MAX_DRIFT_PPM / target;
+	ppm = CLAMP(ppm, -DSP_AUDIO_MAX_DRIFT_PPM, DSP_AUDIO_MAX_DRIFT_PPM);
+	uint64_t step = r->step + (int64_t) r->step * ppm / 1000000;
+
+	uint64_t position = r->position;
+	for (size_t i = 0; i < frames; i++) {
+		uint32_t advance = position >> 32;
+		if (advance > head - tail) {
+			position -= (uint64_t) (head - tail) << 32;
+			tail = head;
+			stream->playing = false;
+			stream->underruns++;
+			break;
+		}
+		tail += advance;
+		position -= (uint64_t) advance << 32;
+		mix[i] += dsp_audio_resampler_output(r, &ring->samples[(tail - DSP_AUDIO_TAPS) & DSP_AUDIO_RING_MASK], position);
+		position += step;
+	}
+
+	r->position = position;
+	qatomic_store_release(&ring->tail, tail);
+}
+
+void dsp_audio_render(dsp_audio_t *audio, int16_t *output, size_t frames) {
+	int32_t mix[DSP_AUDIO_RENDER_CHUNK];
+
+	while (frames > 0) {
+		size_t chunk = MIN(frames, DSP_AUDIO_RENDER_CHUNK);
+
+		memset(mix, 0, chunk * sizeof(*mix));
+		for (size_t i = 0; i < DSP_AUDIO_SOURCE_COUNT; i++)
+			dsp_audio_stream_render(&audio->streams[i], mix, chunk, audio->output_rate);
+		for (size_t i = 0; i < chunk; i++)
+			output[i] = CLAMP(mix[i], INT16_MIN, INT16_MAX);
+
+		output += chunk;
+		frames -= chunk;
+	}
+}
@@ -0,0 +1,86 @@
+#ifndef HW_ARM_PMB887X_DSP_AUDIO_H
+#define HW_ARM_PMB887X_DSP_AUDIO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define DSP_AUDIO_RING_SIZE		8192
+#define DSP_AUDIO_TAPS			16
+// The consumer keeps the last TAPS samples behind the tail as the filter history
+#define DSP_AUDIO_RING_CAPACITY	(DSP_AUDIO_RING_SIZE - DSP_AUDIO_TAPS)
+#define DSP_AUDIO_PHASES		64
+// Ring fill the consumer starts from and steers towards
+#define DSP_AUDIO_LATENCY_MS	40
+// Maximum playback speed correction, small enough to be inaudible
+#define DSP_AUDIO_MAX_DRIFT_PPM	5000
+// Output time over which the real producer rate is measured
+#define DSP_AUDIO_RATE_WINDOW_MS	500
+
+typedef enum dsp_audio_source_t dsp_audio_source_t;
+typedef struct dsp_audio_ring_t dsp_audio_ring_t;
+typedef struct dsp_audio_resampler_t dsp_audio_resampler_t;
+typedef struct dsp_audio_stream_t dsp_audio_stream_t;
+typedef struct dsp_audio_t dsp_audio_t;
+
+enum dsp_audio_source_t {
+	DSP_AUDIO_VOICE,		// AFE voiceband receive path (earpiece, speaker)
+	DSP_AUDIO_I2S,			// I2S3 transmitter (ringtones, MP3)
+	DSP_AUDIO_SOURCE_COUNT,
+};
+
+/*
+ * Single producer (DSP worker) and single consumer (audio callback on the main loop).
+ * The DSP never waits for the host: samples are dropped when the ring is full.
+ * The first TAPS samples are mirrored past the end, so the filter window is always contiguous.
+ * */
+struct dsp_audio_ring_t {
+	int16_t samples[DSP_AUDIO_RING_SIZE + DSP_AUDIO_TAPS];
+	uint32_t head;
+	uint32_t tail;
+	uint32_t rate;
+	uint32_t dropped;
+};
+
+// Polyphase FIR with Q15 coefficients, the nearest phase is used for the fractional position
+struct dsp_audio_resampler_t {
+	uint32_t input_rate;
+	uint32_t output_rate;
+	uint64_t step;			// input samples per output sample, 32.32
+	uint64_t position;		// 32.32, input samples to consume before the next output
+	int16_t coeffs[DSP_AUDIO_PHASES][DSP_AUDIO_TAPS];
+};
+
+/*
+ * The DSP worker is not paced to real time, so the rate the producer declares is not the rate samples arrive at.
+ * The consumer counts them against the output clock and resamples from the measured rate when it's off
+ * by more than the drift control can absorb.
+ * */
+struct dsp_audio_stream_t {
+	dsp_audio_ring_t ring;
+	dsp_audio_resampler_t resampler;
+	bool playing;
+	uint32_t underruns;
+	uint32_t declared_rate;
+	uint32_t measured_rate;		// 0 until the first full window
+	uint32_t window_produced;	// head + dropped at the window start
+	uint32_t window_frames;		// output frames since the window start
+	uint32_t produced;			// head + dropped seen by the last render
+	uint32_t idle_frames;		// output frames since the producer last wrote
+};
+
+struct dsp_audio_t {
+	uint32_t output_rate;
+	dsp_audio_stream_t streams[DSP_AUDIO_SOURCE_COUNT];
+};
+
+void dsp_audio_init(dsp_audio_t *audio, uint32_t output_rate);
+
+// Producer side, called from the DSP worker
+void dsp_audio_write(dsp_audio_t *audio, dsp_audio_source_t source, int16_t sample, uint32_t rate);
+
+// Consumer side: resamples and mixes all sources, fills silence when nothing is playing
+// Costs one 16 tap FIR per output frame and playing source, stopped or prefilling sources are skipped
+void dsp_audio_render(dsp_audio_t *audio, int16_t *output, size_t frames);
+
+#endif
@@ -314,6 +314,7 @@ struct teak_memory_t {
 	uint32_t cycle_sensitive_base;
 	uint32_t cycle_sensitive_size;
 	uint16_t y_space_base;
+	uint16_t program_bank_base;
 };
 
 struct teak_insn_t {
@@ -429,6 +430,7 @@ struct teak_tcg_core_t {
 	teak_state_t state;
 	teak_memory_t memory;
 	uint64_t cache_id;
+	uint32_t program_bank;
 	uint32_t last_block_cycles;
 	uint32_t last_block_count;
 	uint32_t translation_error_address;
@@ -445,6 +447,9 @@ struct teak_tcg_core_t {
 	uint64_t cache_fast_hits;
 	uint64_t cache_decoded_hits;
 	uint64_t cache_compiles;
+	uint64_t cache_misses;
+	uint64_t cache_revalidations;
+	uint64_t cache_evictions;
 	uint64_t jit_entries;
 	uint64_t chain_links;
 	uint64_t chain_interrupts;
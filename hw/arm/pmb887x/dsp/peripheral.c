@@ -9,9 +9,89 @@ dsp_device_t *dsp_device_create(const pmb887x_dsp_peripheral_config_t *config, c
 	device->config = config;
 	device->ops = ops;
 	device->state = state;
+	device->heap_index = -1;
+	device->sched_id = -1;
 	return device;
 }
 
+static void dsp_bus_heap_place(dsp_bus_t *bus, size_t index, dsp_device_t *device) {
+	bus->heap[index] = device;
+	device->heap_index = index;
+}
+
+static void dsp_bus_heap_sift_up(dsp_bus_t *bus, size_t index) {
+	dsp_device_t *device = bus->heap[index];
+
+	while (index > 0) {
+		size_t parent = (index - 1) / 2;
+		if (bus->heap[parent]->deadline <= device->deadline)
+			break;
+		dsp_bus_heap_place(bus, index, bus->heap[parent]);
+		index = parent;
+	}
+	dsp_bus_heap_place(bus, index, device);
+}
+
+static void dsp_bus_heap_sift_down(dsp_bus_t *bus, size_t index) {
+	dsp_device_t *device = bus->heap[index];
+
+	while (index * 2 + 1 < bus->heap_count) {
+		size_t child = index * 2 + 1;
+		if (child + 1 < bus->heap_count && bus->heap[child + 1]->deadline < bus->heap[child]->deadline)
+			child++;
+		if (device->deadline <= bus->heap[child]->deadline)
+			break;
+		dsp_bus_heap_place(bus, index, bus->heap[child]);
+		index = child;
+	}
+	dsp_bus_heap_place(bus, index, device);
+}
+
+static void dsp_bus_heap_remove(dsp_bus_t *bus, dsp_device_t *device) {
+	size_t index = device->heap_index;
+	dsp_device_t *last = bus->heap[--bus->heap_count];
+
+	device->heap_index = -1;
+	if (last == device)
+		return;
+
+	dsp_bus_heap_place(bus, index, last);
+	dsp_bus_heap_sift_up(bus, index);
+	dsp_bus_heap_sift_down(bus, last->heap_index);
+}
+
+void dsp_bus_sync_device(dsp_bus_t *bus, dsp_device_t *device) {
+	uint64_t elapsed = bus->now - device->synced;
+
+	// Devices without a pending deadline are idle, the cycles they missed don't change their state
+	device->synced = bus->now;
+	if (device->heap_index >= 0 && elapsed != 0)
+		device->ops->advance(device, elapsed);
+}
+
+void dsp_bus_reschedule(dsp_bus_t *bus, dsp_device_t *device) {
+	size_t cycles = device->ops->next_event(device);
+
+	if (cycles == DSP_EVENT_NONE) {
+		if (device->heap_index >= 0)
+			dsp_bus_heap_remove(bus, device);
+		return;
+	}
+
+	device->deadline = bus->now + MAX(cycles, 1);
+	if (device->heap_index < 0) {
+		dsp_bus_heap_place(bus, bus->heap_count++, device);
+		dsp_bus_heap_sift_up(bus, device->heap_index);
+	} else {
+		dsp_bus_heap_sift_up(bus, device->heap_index);
+		dsp_bus_heap_sift_down(bus, device->heap_index);
+	}
+}
+
+void dsp_bus_wake(dsp_bus_t *bus, dsp_device_t *device) {
+	qatomic_or(&bus->wake_mask, BIT(device->sched_id));
+}
+
 static dsp_device_t *dsp_bus_create_device(dsp_bus_t *bus, const pmb887x_dsp_peripheral_config_t *config, const dsp_host_t *host) {
 	dsp_device_t *device;
 
@@ -72,7 +152,7 @@ static dsp_device_t *dsp_bus_create_device(dsp_bus_t *bus, const pmb887x_dsp_per
 		case PMB887X_DSP_PERIPHERAL_I2S_TX:
 			g_assert(bus->interrupt != NULL);
 
-			device = i2s_tx_create(config, bus->interrupt);
+			device = i2s_tx_create(config, bus->interrupt, host);
 			bus->i2s_tx = device;
 			return device;
 
@@ -119,8 +199,16 @@ dsp_bus_t *dsp_bus_create(const pmb887x_dsp_config_t *config, const dsp_host_t *
 	bus->device_count = config->peripheral_count;
 	bus->host = *host;
 	bus->devices = g_new0(dsp_device_t *, bus->device_count);
-	for (size_t i = 0; i < bus->device_count; i++)
-		bus->devices[i] = dsp_bus_create_device(bus, &config->peripherals[i], host);
+	for (size_t i = 0; i < bus->device_count; i++) {
+		dsp_device_t *device = dsp_bus_create_device(bus, &config->peripherals[i], host);
+
+		bus->devices[i] = device;
+		if (device->ops->next_event != NULL) {
+			g_assert(bus->sched_count < DSP_SCHED_MAX);
+			device->sched_id = bus->sched_count;
+			bus->sched[bus->sched_count++] = device;
+		}
+	}
 
 	bus->fallback_config = (pmb887x_dsp_peripheral_config_t) {
 		.name = "unknown",
@@ -171,65 +259,68 @@ void dsp_bus_reset(dsp_bus_t *bus) {
 	bus->fallback->ops->reset(bus->fallback);
 	for (size_t i = 0; i < bus->device_count; i++)
 		bus->devices[i]->ops->reset(bus->devices[i]);
+
+	qatomic_set(&bus->wake_mask, 0);
+	bus->heap_count = 0;
+	for (size_t i = 0; i < bus->sched_count; i++) {
+		bus->sched[i]->heap_index = -1;
+		bus->sched[i]->synced = bus->now;
+		dsp_bus_reschedule(bus, bus->sched[i]);
+	}
 }
 
 void dsp_bus_set_clock(dsp_bus_t *bus, bool enabled) {
-	if (bus->timer2 != NULL)
+	if (bus->timer2 != NULL) {
 		timer2_set_clock_enabled(bus->timer2, enabled);
+		dsp_bus_wake(bus, bus->timer2);
+	}
 }
 
 void dsp_bus_set_core_idle(dsp_bus_t *bus, bool idle) {
-	if (bus->timer2 != NULL)
+	if (bus->timer2 != NULL) {
+		dsp_bus_sync_device(bus, bus->timer2);
 		timer2_set_core_idle(bus->timer2, idle);
+		dsp_bus_reschedule(bus, bus->timer2);
+	}
 }
 
 void dsp_bus_advance(dsp_bus_t *bus, size_t cycles) {
-	if (bus->afe != NULL && afe_is_active(bus->afe))
-		afe_advance(bus->afe, cycles);
-	if (bus->channel_decoder != NULL && chdec_is_active(bus->channel_decoder))
-		chdec_advance(bus->channel_decoder, cycles);
-	if (bus->cipher != NULL && cipher_is_active(bus->cipher))
-		cipher_advance(bus->cipher, cycles);
-	if (bus->equalizer != NULL && equalizer_is_active(bus->equalizer))
-		equalizer_advance(bus->equalizer, cycles);
-	for (size_t i = 0; i < bus->i2s_count; i++)
-		if (i2s_is_active(bus->i2s[i]))
-			i2s_advance(bus->i2s[i], cycles);
-	if (bus->i2s_tx != NULL && i2s_tx_is_active(bus->i2s_tx))
-		i2s_tx_advance(bus->i2s_tx, cycles);
-	if (bus->modulator != NULL && modulator_is_active(bus->modulator))
-		modulator_advance(bus->modulator, cycles);
-	if (bus->ssc != NULL && ssc_is_active(bus->ssc))
-		ssc_advance(bus->ssc, cycles);
-	if (bus->timer1 != NULL && timer1_is_active(bus->timer1))
-		timer1_advance(bus->timer1, cycles);
-	if (bus->timer2 != NULL && timer2_is_active(bus->timer2))
-		timer2_advance(bus->timer2, cycles);
+	bus->now += cycles;
+
+	if (qatomic_read(&bus->wake_mask) != 0) {
+		uint32_t wake = qatomic_xchg(&bus->wake_mask, 0);
+
+		while (wake != 0) {
+			dsp_device_t *device = bus->sched[ctz32(wake)];
+
+			wake &= wake - 1;
+			dsp_bus_sync_device(bus, device);
+			dsp_bus_reschedule(bus, device);
+		}
+	}
+
+	while (bus->heap_count != 0 && bus->heap[0]->deadline <= bus->now) {
+		dsp_device_t *device = bus->heap[0];
+
+		dsp_bus_sync_device(bus, device);
+		dsp_bus_reschedule(bus, device);
+	}
 }
 
 bool dsp_bus_is_active(const dsp_bus_t *bus) {
-	if (bus->afe != NULL && afe_is_active(bus->afe))
-		return true;
-	if (bus->channel_decoder != NULL && chdec_is_active(bus->channel_decoder))
-		return true;
-	if (bus->cipher != NULL && cipher_is_active(bus->cipher))
-		return true;
-	if (bus->equalizer != NULL && equalizer_is_active(bus->equalizer))
-		return true;
-	for (size_t i = 0; i < bus->i2s_count; i++)
-		if (i2s_is_active(bus->i2s[i]))
-			return true;
-	if (bus->i2s_tx != NULL && i2s_tx_is_active(bus->i2s_tx))
-		return true;
-	if (bus->modulator != NULL && modulator_is_active(bus->modulator))
-		return true;
-	if (bus->ssc != NULL && ssc_is_active(bus->ssc))
-		return true;
-	if (bus->timer1 != NULL && timer1_is_active(bus->timer1))
-		return true;
-	if (bus->timer2 != NULL && timer2_is_active(bus->timer2))
-		return true;
-	return false;
+	return bus->heap_count != 0 || qatomic_read(&bus->wake_mask) != 0;
+}
+
+bool dsp_bus_wake_pending(const dsp_bus_t *bus) {
+	return qatomic_read(&bus->wake_mask) != 0;
+}
+
+size_t dsp_bus_cycles_until_event(const dsp_bus_t *bus) {
+	if (bus->heap_count == 0)
+		return SIZE_MAX;
+	if (bus->heap[0]->deadline <= bus->now)
+		return 1;
+	return bus->heap[0]->deadline - bus->now;
 }
 
 uint16_t dsp_bus_read(dsp_bus_t *bus, uint16_t address) {
@@ -254,19 +345,40 @@ void dsp_bus_write(dsp_bus_t *bus, uint16_t address, uint16_t value) {
 	bus->fallback->ops->write(bus->fallback, offset, pc, value);
 }
 
+static dsp_device_t *dsp_bus_external_device(dsp_bus_t *bus, size_t index) {
+	if (index == 0)
+		return bus->channel_decoder;
+	if (index == 1)
+		return bus->equalizer;
+	return NULL;
+}
+
 uint16_t dsp_bus_external_read(dsp_bus_t *bus, size_t index) {
-	if (index == 0 && bus->channel_decoder != NULL)
-		return chdec_external_read(bus->channel_decoder);
-	if (index == 1 && bus->equalizer != NULL)
-		return equalizer_external_read(bus->equalizer);
-	return 0;
+	dsp_device_t *device = dsp_bus_external_device(bus, index);
+	uint16_t value;
+
+	if (device == NULL)
+		return 0;
+
+	dsp_bus_sync_device(bus, device);
+	value = index == 0 ? chdec_external_read(device) : equalizer_external_read(device);
+	dsp_bus_reschedule(bus, device);
+	return value;
 }
 
 void dsp_bus_external_write(dsp_bus_t *bus, size_t index, uint16_t value) {
-	if (index == 0 && bus->channel_decoder != NULL)
-		chdec_external_write(bus->channel_decoder, value);
-	if (index == 1 && bus->equalizer != NULL)
-		equalizer_external_write(bus->equalizer, value);
+	dsp_device_t *device = dsp_bus_external_device(bus, index);
+
+	if (device == NULL)
+		return;
+
+	dsp_bus_sync_device(bus, device);
+	if (index == 0) {
+		chdec_external_write(device, value);
+	} else {
+		equalizer_external_write(device, value);
+	}
+	dsp_bus_reschedule(bus, device);
 }
 
 uint8_t dsp_bus_get_irq_lines(dsp_bus_t *bus) {
@@ -323,8 +435,10 @@ void dsp_bus_set_gsm_signal(dsp_bus_t *bus, pmb887x_dsp_gsm_signal_t signal, boo
 	}
 
 	if (signal == PMB887X_DSP_GSM_SIGNAL_CODON) {
-		if (bus->modulator != NULL)
+		if (bus->modulator != NULL) {
 			modulator_set_codon(bus->modulator, level);
+			dsp_bus_wake(bus, bus->modulator);
+		}
 
 		uint16_t flag = level ? TEAK_INT_FINTA0_CODONHI : TEAK_INT_FINTA0_CODONLO;
 		dsp_int_set_flags(bus->interrupt, 0, flag);
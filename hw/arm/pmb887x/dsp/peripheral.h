@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 
+#include "hw/arm/pmb887x/dsp/audio.h"
 #include "hw/arm/pmb887x/dsp/config.h"
 #include "hw/arm/pmb887x/dsp/signals.h"
 
@@ -20,6 +21,8 @@ struct dsp_host_t {
 	uint16_t (*data_read)(void *opaque, uint16_t address);
 	void (*data_write)(void *opaque, uint16_t address, uint16_t value);
 	uint32_t (*ssc_transfer)(void *opaque, uint32_t value);
+	// Optional, every sample the DAC paths take out of the data RAM
+	void (*audio_output)(void *opaque, dsp_audio_source_t source, int16_t sample, uint32_t rate);
 };
 
 dsp_bus_t *dsp_bus_create(const pmb887x_dsp_config_t *config, const dsp_host_t *host);
@@ -29,6 +32,8 @@ void dsp_bus_set_clock(dsp_bus_t *bus, bool enabled);
 void dsp_bus_set_core_idle(dsp_bus_t *bus, bool idle);
 void dsp_bus_advance(dsp_bus_t *bus, size_t cycles);
 bool dsp_bus_is_active(const dsp_bus_t *bus);
+bool dsp_bus_wake_pending(const dsp_bus_t *bus);
+size_t dsp_bus_cycles_until_event(const dsp_bus_t *bus);
 uint16_t dsp_bus_read(dsp_bus_t *bus, uint16_t address);
 void dsp_bus_write(dsp_bus_t *bus, uint16_t address, uint16_t value);
 uint16_t dsp_bus_external_read(dsp_bus_t *bus, size_t index);
@@ -11,8 +11,12 @@
 #define AFE_REGISTER_COUNT	(TEAK_AFE_RINGCTRL + 1)
 #define AFE_CONTROL_MASK	(TEAK_AFE_BCON_MODE | TEAK_AFE_BCON_RXSTART | TEAK_AFE_BCON_RXRATE | \
 	TEAK_AFE_BCON_TXSTART | TEAK_AFE_BCON_TXRATE)
+// Paced by executed DSP cycles, not real time: the audio consumer measures the rate samples really arrive at
 #define AFE_SAMPLE_CYCLES	16U
+#define AFE_TRANSMIT_BATCH_SAMPLES	32U
 #define AFE_INTERRUPT_GROUP	1
+// Transmitted samples fill the first half of the AFE RAM, the DAC reads the second one
+#define AFE_RECEIVE_RAM_OFFSET	0x40
 
 static const uint16_t AFE_POWER_DOWN_SAMPLES[] = {
 	0x85EA, 0x85F3, 0xB12F, 0x8000, 0x9048, 0x8A3B, 0x81C2, 0x8BCF,
@@ -50,6 +54,16 @@ static bool afe_transmit_active(const afe_state_t *state) {
 	return (control & active) == active;
 }
 
+static uint32_t afe_receive_rate(const afe_state_t *state) {
+	switch (state->registers[TEAK_AFE_BCON] & TEAK_AFE_BCON_RXRATE) {
+		case TEAK_AFE_BCON_RXRATE_KHZ_16:		return 16000;
+		case TEAK_AFE_BCON_RXRATE_KHZ_31_746:	return 31746;
+		case TEAK_AFE_BCON_RXRATE_KHZ_44_444:	return 44444;
+		case TEAK_AFE_BCON_RXRATE_KHZ_47_619:	return 47619;
+		default:								return 8000;
+	}
+}
+
 static void afe_destroy(dsp_device_t *device) {
 	g_free(device->state);
 }
@@ -120,11 +134,16 @@ static bool afe_write(dsp_device_t *device, uint16_t offset, uint32_t pc, uint16
 	return true;
 }
 
+static void afe_advance(dsp_device_t *device, size_t cycles);
+static size_t afe_next_event(dsp_device_t *device);
+
 static const dsp_device_ops_t afe_ops = {
 	.destroy = afe_destroy,
 	.reset = afe_reset,
 	.read = afe_read,
 	.write = afe_write,
+	.advance = afe_advance,
+	.next_event = afe_next_event,
 };
 
 dsp_device_t *afe_create(const pmb887x_dsp_peripheral_config_t *config, dsp_device_t *interrupt, const dsp_host_t *host) {
@@ -135,15 +154,21 @@ dsp_device_t *afe_create(const pmb887x_dsp_peripheral_config_t *config, dsp_devi
 	return dsp_device_create(config, &afe_ops, state);
 }
 
-void afe_advance(dsp_device_t *device, size_t cycles) {
+static void afe_advance(dsp_device_t *device, size_t cycles) {
 	afe_state_t *state = device->state;
 
 	if (afe_receive_active(state)) {
 		uint16_t interrupt_position = state->registers[TEAK_AFE_INTPTR] & TEAK_AFE_INTPTR_RXINTPTR;
+		uint32_t rate = afe_receive_rate(state);
 
 		state->receive_cycles += cycles;
 		while (state->receive_cycles >= AFE_SAMPLE_CYCLES) {
 			state->receive_cycles -= AFE_SAMPLE_CYCLES;
+			if (state->host.audio_output != NULL) {
+				uint16_t sample = state->host.data_read(state->host.opaque,
+					state->ram_base + AFE_RECEIVE_RAM_OFFSET + state->receive_position);
+				state->host.audio_output(state->host.opaque, DSP_AUDIO_VOICE, (int16_t) sample, rate);
+			}
 			state->receive_position++;
 			state->receive_position &= TEAK_AFE_RWADDR_RDADDR;
 
@@ -183,7 +208,24 @@ void afe_advance(dsp_device_t *device, size_t cycles) {
 	}
 }
 
-bool afe_is_active(const dsp_device_t *device) {
+static size_t afe_next_event(dsp_device_t *device) {
 	const afe_state_t *state = device->state;
-	return afe_receive_active(state) || afe_transmit_active(state);
+	size_t cycles = DSP_EVENT_NONE;
+
+	if (afe_receive_active(state)) {
+		uint16_t interrupt_position = state->registers[TEAK_AFE_INTPTR] & TEAK_AFE_INTPTR_RXINTPTR;
+		size_t samples = ((interrupt_position - state->receive_position - 1) & TEAK_AFE_RWADDR_RDADDR) + 1;
+		cycles = samples * AFE_SAMPLE_CYCLES - state->receive_cycles;
+	}
+
+	// Transmitted samples are written back to data RAM, so TX is only deferred by a bounded batch
+	if (afe_transmit_active(state)) {
+		uint16_t interrupt_position = state->registers[TEAK_AFE_INTPTR] >> TEAK_AFE_INTPTR_TXINTPTR_SHIFT;
+		size_t samples = ((interrupt_position - state->transmit_position - 1) &
+			(TEAK_AFE_RWADDR_WRADDR >> TEAK_AFE_RWADDR_WRADDR_SHIFT)) + 1;
+		samples = MIN(samples, AFE_TRANSMIT_BATCH_SAMPLES);
+		cycles = MIN(cycles, samples * AFE_SAMPLE_CYCLES - state->transmit_cycles);
+	}
+
+	return cycles;
 }
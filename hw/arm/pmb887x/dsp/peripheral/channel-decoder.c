@@ -6,6 +6,7 @@
 #include "qemu/bitops.h"
 
 #include "hw/arm/pmb887x/dsp/peripheral/internal.h"
+#include "hw/arm/pmb887x/dsp/peripheral/viterbi.h"
 #include "hw/arm/pmb887x/gen/dsp.h"
 #include "hw/arm/pmb887x/trace.h"
 
@@ -171,11 +172,16 @@ static bool chdec_write(dsp_device_t *device, uint16_t offset, uint32_t pc, uint
 	return true;
 }
 
+static void chdec_advance(dsp_device_t *device, size_t cycles);
+static size_t chdec_next_event(dsp_device_t *device);
+
 static const dsp_device_ops_t chdec_ops = {
 	.destroy = chdec_destroy,
 	.reset = chdec_reset,
 	.read = chdec_read,
 	.write = chdec_write,
+	.advance = chdec_advance,
+	.next_event = chdec_next_event,
 };
 
 static uint16_t *chdec_external_memory(chdec_state_t *state, size_t *word_count) {
@@ -252,29 +258,19 @@ static int16_t chdec_branch_metric(uint16_t reference, int8_t sin0, int8_t sin1,
 static uint64_t chdec_step(chdec_state_t *state, size_t metric_count, int8_t sin0, int8_t sin1, int8_t sin2) {
 	size_t source_bank = state->completed_count & 1;
 	size_t destination_bank = source_bank ^ 1;
-	uint16_t *source = state->metrics[source_bank];
-	uint16_t *destination = state->metrics[destination_bank];
-	uint64_t decisions = 0;
+	int16_t branch[DSP_VITERBI_MAX_BUTTERFLIES];
+	int16_t metrics[8];
 
+	// Only reference bits 1..3 select the metric
+	for (size_t reference = 0; reference < ARRAY_SIZE(metrics); reference++)
+		metrics[reference] = chdec_branch_metric(reference << 1, sin0, sin1, sin2);
 	for (size_t butterfly = 0; butterfly < metric_count / 2; butterfly++) {
 		uint16_t reference = state->references[butterfly / 4] >> (butterfly % 4 * 4) & 0x0F;
-		int16_t branch_metric = chdec_branch_metric(reference, sin0, sin1, sin2);
-		int16_t even_metric = source[butterfly * 2];
-		int16_t odd_metric = source[butterfly * 2 + 1];
-		int16_t lower_first = even_metric - branch_metric;
-		int16_t lower_second = odd_metric + branch_metric;
-		int16_t upper_first = even_metric + branch_metric;
-		int16_t upper_second = odd_metric - branch_metric;
-
-		destination[butterfly] = lower_first >= lower_second ? lower_first : lower_second;
-		destination[butterfly + metric_count / 2] = upper_first >= upper_second ? upper_first : upper_second;
-
-		if (lower_first >= lower_second)
-			decisions |= UINT64_C(1) << butterfly;
-		if (upper_first >= upper_second)
-			decisions |= UINT64_C(1) << (butterfly + metric_count / 2);
+		branch[butterfly] = metrics[reference >> 1];
 	}
-	return decisions;
+
+	return dsp_viterbi->butterflies((const int16_t *) state->metrics[source_bank],
+		(int16_t *) state->metrics[destination_bank], branch, metric_count / 2);
 }
 
 static void chdec_store_trace(chdec_state_t *state, size_t metric_count, uint64_t decisions) {
@@ -345,7 +341,7 @@ static void chdec_advance_timestamp(chdec_state_t *state) {
 		chdec_complete(state);
 }
 
-void chdec_advance(dsp_device_t *device, size_t cycles) {
+static void chdec_advance(dsp_device_t *device, size_t cycles) {
 	chdec_state_t *state = device->state;
 
 	if (!state->active)
@@ -359,13 +355,17 @@ void chdec_advance(dsp_device_t *device, size_t cycles) {
 	}
 }
 
-bool chdec_is_active(const dsp_device_t *device) {
-	const chdec_state_t *state = device->state;
-	return state->active;
-}
 
 dsp_device_t *chdec_create(const pmb887x_dsp_peripheral_config_t *config, dsp_device_t *interrupt) {
 	chdec_state_t *state = g_new0(chdec_state_t, 1);
 	state->interrupt = interrupt;
 	return dsp_device_create(config, &chdec_ops, state);
 }
+
+static size_t chdec_next_event(dsp_device_t *device) {
+	const chdec_state_t *state = device->state;
+
+	if (!state->active)
+		return DSP_EVENT_NONE;
+	return CHANNEL_DECODER_TIMESTAMP_CYCLES - state->elapsed_cycles;
+}
@@ -0,0 +1,302 @@
+#include "qemu/osdep.h"
+#include "qemu/bitops.h"
+#include "qemu/host-utils.h"
+
+#include "hw/arm/pmb887x/dsp/peripheral/cipher-a5.h"
+
+#define A5_R1_LENGTH		19
+#define A5_R2_LENGTH		22
+#define A5_R3_LENGTH		23
+#define A5_R4_LENGTH		17
+#define A5_R1_TAPS		0x072000
+#define A5_R2_TAPS		0x300000
+#define A5_R3_TAPS		0x700080
+#define A5_R4_TAPS		0x010800
+#define A51_R1_CLOCK_BIT	8
+#define A51_R2_CLOCK_BIT	10
+#define A51_R3_CLOCK_BIT	10
+#define A52_R4_CLOCK0_BIT	10
+#define A52_R4_CLOCK1_BIT	3
+#define A52_R4_CLOCK2_BIT	7
+#define A51_WARMUP_CLOCKS	100
+#define A52_WARMUP_CLOCKS	99
+#define A5_COUNT_BITS		22
+#define A5_MAX_LENGTH		A5_R3_LENGTH
+
+typedef struct a5_slice_t a5_slice_t;
+
+// Bitsliced registers: bit n of lane word k is bit k of register for frame n
+struct a5_slice_t {
+	uint64_t registers[4][A5_MAX_LENGTH];
+};
+
+static const uint8_t A5_LENGTHS[4] = { A5_R1_LENGTH, A5_R2_LENGTH, A5_R3_LENGTH, A5_R4_LENGTH };
+static const uint32_t A5_TAPS[4] = { A5_R1_TAPS, A5_R2_TAPS, A5_R3_TAPS, A5_R4_TAPS };
+
+// No tap is below bit 7, so eight clocks never feed back a freshly shifted bit
+QEMU_BUILD_BUG_ON(((A5_R1_TAPS | A5_R2_TAPS | A5_R3_TAPS | A5_R4_TAPS) & 0x7F) != 0);
+
+static uint32_t a5_parity(uint32_t value) {
+	return ctpop32(value) & 1;
+}
+
+static uint32_t a5_mask(size_t index) {
+	return (1U << A5_LENGTHS[index]) - 1;
+}
+
+static uint32_t a5_clock_register(uint32_t value, size_t index) {
+	return (value << 1 & a5_mask(index)) | a5_parity(value & A5_TAPS[index]);
+}
+
+// Eight forced clocks, input bits are XOR-ed in LSB first
+static uint32_t a5_load_byte(uint32_t value, size_t index, uint8_t input) {
+	uint8_t feedback = 0;
+
+	for (unsigned i = 0; i < 8; i++)
+		feedback |= a5_parity(value & (A5_TAPS[index] >> i)) << (7 - i);
+	return (value << 8 | (feedback ^ revbit8(input))) & a5_mask(index);
+}
+
+static void a5_load_key(uint32_t *registers, size_t count, const uint8_t key[8]) {
+	for (size_t i = 0; i < 8; i++) {
+		for (size_t j = 0; j < count; j++)
+			registers[j] = a5_load_byte(registers[j], j, key[i]);
+	}
+}
+
+static void a5_load_frame(uint32_t *registers, size_t count, uint32_t frame) {
+	for (size_t i = 0; i < A5_COUNT_BITS / 8; i++) {
+		for (size_t j = 0; j < count; j++)
+			registers[j] = a5_load_byte(registers[j], j, frame >> (i * 8));
+	}
+
+	for (size_t i = A5_COUNT_BITS / 8 * 8; i < A5_COUNT_BITS; i++) {
+		for (size_t j = 0; j < count; j++)
+			registers[j] = a5_clock_register(registers[j], j) ^ (frame >> i & 1);
+	}
+}
+
+static uint32_t a5_majority(uint32_t first, uint32_t second, uint32_t third) {
+	return (first & second) | (first & third) | (second & third);
+}
+
+static void a51_clock(uint32_t registers[3]) {
+	uint32_t clock1 = registers[0] >> A51_R1_CLOCK_BIT & 1;
+	uint32_t clock2 = registers[1] >> A51_R2_CLOCK_BIT & 1;
+	uint32_t clock3 = registers[2] >> A51_R3_CLOCK_BIT & 1;
+	uint32_t majority = a5_majority(clock1, clock2, clock3);
+
+	if (clock1 == majority)
+		registers[0] = a5_clock_register(registers[0], 0);
+	if (clock2 == majority)
+		registers[1] = a5_clock_register(registers[1], 1);
+	if (clock3 == majority)
+		registers[2] = a5_clock_register(registers[2], 2);
+}
+
+static uint8_t a51_output(const uint32_t registers[3]) {
+	return (registers[0] >> (A5_R1_LENGTH - 1) ^ registers[1] >> (A5_R2_LENGTH - 1) ^
+		registers[2] >> (A5_R3_LENGTH - 1)) & 1;
+}
+
+static void a52_clock(uint32_t registers[4]) {
+	uint32_t clock1 = registers[3] >> A52_R4_CLOCK0_BIT & 1;
+	uint32_t clock2 = registers[3] >> A52_R4_CLOCK1_BIT & 1;
+	uint32_t clock3 = registers[3] >> A52_R4_CLOCK2_BIT & 1;
+	uint32_t majority = a5_majority(clock1, clock2, clock3);
+
+	if (clock1 == majority)
+		registers[0] = a5_clock_register(registers[0], 0);
+	if (clock2 == majority)
+		registers[1] = a5_clock_register(registers[1], 1);
+	if (clock3 == majority)
+		registers[2] = a5_clock_register(registers[2], 2);
+	registers[3] = a5_clock_register(registers[3], 3);
+}
+
+static uint8_t a52_output(const uint32_t registers[4]) {
+	uint32_t r1 = a5_majority(registers[0] >> 15, ~registers[0] >> 14, registers[0] >> 12);
+	uint32_t r2 = a5_majority(~registers[1] >> 16, registers[1] >> 13, registers[1] >> 9);
+	uint32_t r3 = a5_majority(registers[2] >> 18, registers[2] >> 16, ~registers[2] >> 13);
+	return (a51_output(registers) ^ r1 ^ r2 ^ r3) & 1;
+}
+
+static void a52_finish_load(uint32_t registers[4]) {
+	registers[0] |= BIT(15);
+	registers[1] |= BIT(16);
+	registers[2] |= BIT(18);
+	registers[3] |= BIT(10);
+}
+
+void cipher_a51_keystream(const uint8_t key[8], uint32_t count, uint8_t *output, size_t bits) {
+	uint32_t registers[3] = { 0, 0, 0 };
+
+	a5_load_key(registers, ARRAY_SIZE(registers), key);
+	a5_load_frame(registers, ARRAY_SIZE(registers), count);
+	for (size_t i = 0; i < A51_WARMUP_CLOCKS; i++)
+		a51_clock(registers);
+
+	memset(output, 0, DIV_ROUND_UP(bits, 8));
+	for (size_t i = 0; i < bits; i++) {
+		a51_clock(registers);
+		output[i / 8] |= a51_output(registers) << (i % 8);
+	}
+}
+
+void cipher_a52_keystream(const uint8_t key[8], uint32_t count, uint8_t *output, size_t bits) {
+	uint32_t registers[4] = { 0, 0, 0, 0 };
+
+	a5_load_key(registers, ARRAY_SIZE(registers), key);
+	a5_load_frame(registers, ARRAY_SIZE(registers), count);
+	a52_finish_load(registers);
+	for (size_t i = 0; i < A52_WARMUP_CLOCKS; i++)
+		a52_clock(registers);
+
+	memset(output, 0, DIV_ROUND_UP(bits, 8));
+	for (size_t i = 0; i < bits; i++) {
+		a52_clock(registers);
+		output[i / 8] |= a52_output(registers) << (i % 8);
+	}
+}
+
+static void a5_slice_clock(uint64_t *bits, size_t length, uint64_t feedback, uint64_t enable) {
+	for (size_t i = length - 1; i > 0; i--)
+		bits[i] ^= (bits[i] ^ bits[i - 1]) & enable;
+	bits[0] ^= (bits[0] ^ feedback) & enable;
+}
+
+static uint64_t a5_slice_feedback(const uint64_t *bits, size_t index) {
+	uint32_t taps = A5_TAPS[index];
+	uint64_t feedback = 0;
+
+	while (taps) {
+		feedback ^= bits[ctz32(taps)];
+		taps &= taps - 1;
+	}
+	return feedback;
+}
+
+static uint64_t a5_slice_majority(uint64_t first, uint64_t second, uint64_t third) {
+	return (first & second) | (first & third) | (second & third);
+}
+
+// The key part of the setup is the same for every lane, so it runs once in scalar code
+static void a5_slice_load(a5_slice_t *slice, size_t count, const uint8_t key[8], const uint32_t *frames,
+	size_t frame_count
+) {
+	uint32_t registers[4] = { 0, 0, 0, 0 };
+
+	a5_load_key(registers, count, key);
+	for (size_t i = 0; i < count; i++) {
+		for (size_t bit = 0; bit < A5_LENGTHS[i]; bit++)
+			slice->registers[i][bit] = (registers[i] >> bit & 1) ? UINT64_MAX : 0;
+	}
+
+	for (size_t i = 0; i < A5_COUNT_BITS; i++) {
+		uint64_t input = 0;
+
+		for (size_t lane = 0; lane < frame_count; lane++)
+			input |= (uint64_t) (frames[lane] >> i & 1) << lane;
+		for (size_t j = 0; j < count; j++) {
+			uint64_t feedback = a5_slice_feedback(slice->registers[j], j);
+			a5_slice_clock(slice->registers[j], A5_LENGTHS[j], feedback ^ input, UINT64_MAX);
+		}
+	}
+}
+
+static uint64_t a51_slice_step(a5_slice_t *slice) {
+	uint64_t *r1 = slice->registers[0];
+	uint64_t *r2 = slice->registers[1];
+	uint64_t *r3 = slice->registers[2];
+	uint64_t majority = a5_slice_majority(r1[A51_R1_CLOCK_BIT], r2[A51_R2_CLOCK_BIT], r3[A51_R3_CLOCK_BIT]);
+	uint64_t enable1 = ~(r1[A51_R1_CLOCK_BIT] ^ majority);
+	uint64_t enable2 = ~(r2[A51_R2_CLOCK_BIT] ^ majority);
+	uint64_t enable3 = ~(r3[A51_R3_CLOCK_BIT] ^ majority);
+
+	a5_slice_clock(r1, A5_R1_LENGTH, a5_slice_feedback(r1, 0), enable1);
+	a5_slice_clock(r2, A5_R2_LENGTH, a5_slice_feedback(r2, 1), enable2);
+	a5_slice_clock(r3, A5_R3_LENGTH, a5_slice_feedback(r3, 2), enable3);
+	return r1[A5_R1_LENGTH - 1] ^ r2[A5_R2_LENGTH - 1] ^ r3[A5_R3_LENGTH - 1];
+}
+
+static uint64_t a52_slice_step(a5_slice_t *slice) {
+	uint64_t *r1 = slice->registers[0];
+	uint64_t *r2 = slice->registers[1];
+	uint64_t *r3 = slice->registers[2];
+	uint64_t *r4 = slice->registers[3];
+	uint64_t majority = a5_slice_majority(r4[A52_R4_CLOCK0_BIT], r4[A52_R4_CLOCK1_BIT], r4[A52_R4_CLOCK2_BIT]);
+	uint64_t enable1 = ~(r4[A52_R4_CLOCK0_BIT] ^ majority);
+	uint64_t enable2 = ~(r4[A52_R4_CLOCK1_BIT] ^ majority);
+	uint64_t enable3 = ~(r4[A52_R4_CLOCK2_BIT] ^ majority);
+
+	a5_slice_clock(r1, A5_R1_LENGTH, a5_slice_feedback(r1, 0), enable1);
+	a5_slice_clock(r2, A5_R2_LENGTH, a5_slice_feedback(r2, 1), enable2);
+	a5_slice_clock(r3, A5_R3_LENGTH, a5_slice_feedback(r3, 2), enable3);
+	a5_slice_clock(r4, A5_R4_LENGTH, a5_slice_feedback(r4, 3), UINT64_MAX);
+
+	return r1[A5_R1_LENGTH - 1] ^ r2[A5_R2_LENGTH - 1] ^ r3[A5_R3_LENGTH - 1] ^
+		a5_slice_majority(r1[15], ~r1[14], r1[12]) ^
+		a5_slice_majority(~r2[16], r2[13], r2[9]) ^
+		a5_slice_majority(r3[18], r3[16], ~r3[13]);
+}
+
+// block[row] bit column <-> block[column] bit row
+static void a5_transpose64(uint64_t block[64]) {
+	uint64_t mask = 0x00000000FFFFFFFFULL;
+
+	for (size_t width = 32; width != 0; width >>= 1, mask ^= mask << width) {
+		for (size_t k = 0; k < 64; k = (k + width + 1) & ~width) {
+			uint64_t swap = (block[k] >> width ^ block[k + width]) & mask;
+			block[k] ^= swap << width;
+			block[k + width] ^= swap;
+		}
+	}
+}
+
+static void a5_slice_generate(a5_slice_t *slice, uint64_t (*step)(a5_slice_t *slice), size_t frames,
+	uint8_t *output, size_t stride, size_t bits
+) {
+	uint64_t block[64];
+
+	for (size_t offset = 0; offset < bits; offset += 64) {
+		size_t count = MIN(bits - offset, 64);
+
+		for (size_t i = 0; i < 64; i++)
+			block[i] = i < count ? step(slice) : 0;
+		a5_transpose64(block);
+
+		for (size_t lane = 0; lane < frames; lane++) {
+			uint8_t *dst = output + lane * stride + offset / 8;
+			for (size_t i = 0; i < DIV_ROUND_UP(count, 8); i++)
+				dst[i] = block[lane] >> (i * 8);
+		}
+	}
+}
+
+void cipher_a51_keystream_batch(const uint8_t key[8], const uint32_t *counts, size_t frames,
+	uint8_t *output, size_t stride, size_t bits
+) {
+	a5_slice_t slice;
+
+	assert(frames <= CIPHER_A5_BATCH_MAX);
+	a5_slice_load(&slice, 3, key, counts, frames);
+	for (size_t i = 0; i < A51_WARMUP_CLOCKS; i++)
+		a51_slice_step(&slice);
+	a5_slice_generate(&slice, a51_slice_step, frames, output, stride, bits);
+}
+
+void cipher_a52_keystream_batch(const uint8_t key[8], const uint32_t *counts, size_t frames,
+	uint8_t *output, size_t stride, size_t bits
+) {
+	a5_slice_t slice;
+
+	assert(frames <= CIPHER_A5_BATCH_MAX);
+	a5_slice_load(&slice, 4, key, counts, frames);
+	slice.registers[0][15] = UINT64_MAX;
+	slice.registers[1][16] = UINT64_MAX;
+	slice.registers[2][18] = UINT64_MAX;
+	slice.registers[3][10] = UINT64_MAX;
+	for (size_t i = 0; i < A52_WARMUP_CLOCKS; i++)
+		a52_slice_step(&slice);
+	a5_slice_generate(&slice, a52_slice_step, frames, output, stride, bits);
+}
@@ -0,0 +1,20 @@
+#ifndef HW_ARM_PMB887X_DSP_PERIPHERAL_CIPHER_A5_H
+#define HW_ARM_PMB887X_DSP_PERIPHERAL_CIPHER_A5_H
+
+#define CIPHER_A5_BATCH_MAX	64
+
+/*
+ * A5/1 and A5/2 keystream generators.
+ * Kc bit i is key[i / 8] >> (i % 8), COUNT is the 22-bit T1/T3/T2 frame count.
+ * Keystream bit i is stored as output[i / 8] >> (i % 8), both bursts back to back.
+ * */
+void cipher_a51_keystream(const uint8_t key[8], uint32_t count, uint8_t *output, size_t bits);
+void cipher_a52_keystream(const uint8_t key[8], uint32_t count, uint8_t *output, size_t bits);
+
+// Bitsliced: up to CIPHER_A5_BATCH_MAX frames with the same Kc for roughly the price of four single frames
+void cipher_a51_keystream_batch(const uint8_t key[8], const uint32_t *counts, size_t frames,
+	uint8_t *output, size_t stride, size_t bits);
+void cipher_a52_keystream_batch(const uint8_t key[8], const uint32_t *counts, size_t frames,
+	uint8_t *output, size_t stride, size_t bits);
+
+#endif
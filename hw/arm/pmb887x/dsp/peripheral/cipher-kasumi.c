@@ -55,19 +55,6 @@ static const uint16_t KASUMI_S9[] = {
 	43, 66, 60, 455, 341, 445, 202, 432, 8, 237, 15, 376, 436, 464, 59, 461,
 };
 
-typedef struct kasumi_keys_t kasumi_keys_t;
-
-struct kasumi_keys_t {
-	uint16_t kl1[8];
-	uint16_t kl2[8];
-	uint16_t ko1[8];
-	uint16_t ko2[8];
-	uint16_t ko3[8];
-	uint16_t ki1[8];
-	uint16_t ki2[8];
-	uint16_t ki3[8];
-};
-
 static uint16_t kasumi_load_be16(const uint8_t *data) {
 	return (uint16_t) data[0] << 8 | data[1];
 }
@@ -89,7 +76,7 @@ static uint16_t kasumi_fi(uint16_t input, uint16_t key) {
 	return right << 9 | left;
 }
 
-static uint32_t kasumi_fo(uint32_t input, const kasumi_keys_t *keys, size_t round) {
+static uint32_t kasumi_fo(uint32_t input, const cipher_kasumi_keys_t *keys, size_t round) {
 	uint16_t left = input >> 16;
 	uint16_t right = input;
 
@@ -99,7 +86,7 @@ static uint32_t kasumi_fo(uint32_t input, const kasumi_keys_t *keys, size_t roun
 	return (uint32_t) right << 16 | left;
 }
 
-static uint32_t kasumi_fl(uint32_t input, const kasumi_keys_t *keys, size_t round) {
+static uint32_t kasumi_fl(uint32_t input, const cipher_kasumi_keys_t *keys, size_t round) {
 	uint16_t left = input >> 16;
 	uint16_t right = input;
 
@@ -108,7 +95,7 @@ static uint32_t kasumi_fl(uint32_t input, const kasumi_keys_t *keys, size_t roun
 	return (uint32_t) left << 16 | right;
 }
 
-static uint64_t kasumi_encrypt(uint64_t input, const kasumi_keys_t *keys) {
+uint64_t cipher_kasumi_encrypt(const cipher_kasumi_keys_t *keys, uint64_t input) {
 	uint32_t left = input >> 32;
 	uint32_t right = input;
 
@@ -119,7 +106,7 @@ static uint64_t kasumi_encrypt(uint64_t input, const kasumi_keys_t *keys) {
 	return (uint64_t) left << 32 | right;
 }
 
-static void kasumi_expand_key(const uint8_t key[16], kasumi_keys_t *keys) {
+void cipher_kasumi_setup(cipher_kasumi_keys_t *keys, const uint8_t key[16]) {
 	static const uint16_t CONSTANTS[8] = { 0x0123, 0x4567, 0x89AB, 0xCDEF, 0xFEDC, 0xBA98, 0x7654, 0x3210 };
 	uint16_t prime[8];
 
@@ -143,31 +130,48 @@ static void kasumi_store_be64(uint8_t *data, uint64_t value) {
 		data[i] = value >> (56 - i * 8);
 }
 
-void cipher_kgcore(
-	uint8_t ca, uint8_t cb, uint32_t cc, uint8_t cd, uint16_t ce,
-	const uint8_t key[16], uint8_t *output, size_t bits
-) {
-	kasumi_keys_t keys;
+void cipher_kgcore_set_key(cipher_kgcore_t *kgcore, const uint8_t key[16]) {
 	uint8_t modified_key[16];
-	uint64_t input = (uint64_t) cc << 32 | (uint64_t) ((cb << 3) | (cd << 2)) << 24 |
-		(uint64_t) ca << 16 | ce;
-	uint64_t block = 0;
+
+	if (kgcore->valid && memcmp(kgcore->key, key, sizeof(kgcore->key)) == 0)
+		return;
 
 	for (size_t i = 0; i < 16; i++)
 		modified_key[i] = key[i] ^ 0x55;
 
-	kasumi_expand_key(modified_key, &keys);
-	input = kasumi_encrypt(input, &keys);
+	memcpy(kgcore->key, key, sizeof(kgcore->key));
+	cipher_kasumi_setup(&kgcore->keys, key);
+	cipher_kasumi_setup(&kgcore->modified_keys, modified_key);
+	kgcore->valid = true;
+}
 
-	kasumi_expand_key(key, &keys);
+void cipher_kgcore_generate(
+	const cipher_kgcore_t *kgcore, uint8_t ca, uint8_t cb, uint32_t cc, uint8_t cd, uint16_t ce,
+	uint8_t *output, size_t bits
+) {
+	uint64_t input = (uint64_t) cc << 32 | (uint64_t) ((cb << 3) | (cd << 2)) << 24 |
+		(uint64_t) ca << 16 | ce;
+	uint64_t block = 0;
+
+	input = cipher_kasumi_encrypt(&kgcore->modified_keys, input);
 
 	for (size_t offset = 0; offset < bits; offset += 64) {
 		size_t block_index = offset / 64;
 		size_t remaining = MIN(bits - offset, 64);
 		uint8_t encoded[8];
 
-		block = kasumi_encrypt(input ^ block_index ^ block, &keys);
+		block = cipher_kasumi_encrypt(&kgcore->keys, input ^ block_index ^ block);
 		kasumi_store_be64(encoded, block);
 		memcpy(output + offset / 8, encoded, DIV_ROUND_UP(remaining, 8));
 	}
 }
+
+void cipher_kgcore(
+	uint8_t ca, uint8_t cb, uint32_t cc, uint8_t cd, uint16_t ce,
+	const uint8_t key[16], uint8_t *output, size_t bits
+) {
+	cipher_kgcore_t kgcore = { .valid = false };
+
+	cipher_kgcore_set_key(&kgcore, key);
+	cipher_kgcore_generate(&kgcore, ca, cb, cc, cd, ce, output, bits);
+}
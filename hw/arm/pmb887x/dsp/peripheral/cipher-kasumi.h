@@ -1,6 +1,35 @@
 #ifndef HW_ARM_PMB887X_DSP_PERIPHERAL_CIPHER_KASUMI_H
 #define HW_ARM_PMB887X_DSP_PERIPHERAL_CIPHER_KASUMI_H
 
+typedef struct cipher_kasumi_keys_t cipher_kasumi_keys_t;
+typedef struct cipher_kgcore_t cipher_kgcore_t;
+
+struct cipher_kasumi_keys_t {
+	uint16_t kl1[8];
+	uint16_t kl2[8];
+	uint16_t ko1[8];
+	uint16_t ko2[8];
+	uint16_t ko3[8];
+	uint16_t ki1[8];
+	uint16_t ki2[8];
+	uint16_t ki3[8];
+};
+
+// KGCORE with both key schedules expanded, reused while the key stays the same
+struct cipher_kgcore_t {
+	uint8_t key[16];
+	cipher_kasumi_keys_t keys;
+	cipher_kasumi_keys_t modified_keys;
+	bool valid;
+};
+
+void cipher_kasumi_setup(cipher_kasumi_keys_t *keys, const uint8_t key[16]);
+uint64_t cipher_kasumi_encrypt(const cipher_kasumi_keys_t *keys, uint64_t input);
+
+void cipher_kgcore_set_key(cipher_kgcore_t *kgcore, const uint8_t key[16]);
+void cipher_kgcore_generate(const cipher_kgcore_t *kgcore, uint8_t ca, uint8_t cb, uint32_t cc, uint8_t cd,
+	uint16_t ce, uint8_t *output, size_t bits);
+
 void cipher_kgcore(uint8_t ca, uint8_t cb, uint32_t cc, uint8_t cd, uint16_t ce,
 	const uint8_t key[16], uint8_t *output, size_t bits);
 
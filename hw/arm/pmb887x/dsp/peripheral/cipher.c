@@ -4,6 +4,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/bitops.h"
+#include "hw/arm/pmb887x/dsp/peripheral/cipher-a5.h"
 #include "hw/arm/pmb887x/dsp/peripheral/cipher-kasumi.h"
 #include "hw/arm/pmb887x/dsp/peripheral/internal.h"
 #include "hw/arm/pmb887x/gen/dsp.h"
@@ -19,27 +20,28 @@
 #define CIPHER_A53_EDGE_CYCLES	3744
 #define CIPHER_INTERRUPT_GROUP	2
 
-#define A5_R1_LENGTH		19
-#define A5_R2_LENGTH		22
-#define A5_R3_LENGTH		23
-#define A5_R4_LENGTH		17
-#define A5_R1_MASK		((1U << A5_R1_LENGTH) - 1)
-#define A5_R2_MASK		((1U << A5_R2_LENGTH) - 1)
-#define A5_R3_MASK		((1U << A5_R3_LENGTH) - 1)
-#define A5_R4_MASK		((1U << A5_R4_LENGTH) - 1)
-#define A5_R1_TAPS		0x072000
-#define A5_R2_TAPS		0x300000
-#define A5_R3_TAPS		0x700080
-#define A5_R4_TAPS		0x010800
-#define A51_R1_CLOCK		0x000100
-#define A51_R2_CLOCK		0x000400
-#define A51_R3_CLOCK		0x000400
-#define A52_R4_CLOCK0		0x000400
-#define A52_R4_CLOCK1		0x000008
-#define A52_R4_CLOCK2		0x000080
+#define CIPHER_HYPERFRAME	(2048 * 26 * 51)
+#define CIPHER_PREFETCH_DISTANCE	8
+// Two spare bytes for the unaligned 16-bit reads in cipher_write_stream()
+#define CIPHER_STREAM_BYTES	(DIV_ROUND_UP(CIPHER_EDGE_BITS * 2, 8) + 2)
 
+typedef struct cipher_prefetch_t cipher_prefetch_t;
 typedef struct cipher_state_t cipher_state_t;
 
+/*
+ * A5/1 and A5/2 keystreams for the following frames of the same connection.
+ * Filled by the bitsliced generator once the firmware is seen stepping frame by frame.
+ * */
+struct cipher_prefetch_t {
+	uint8_t stream[CIPHER_A5_BATCH_MAX][CIPHER_STREAM_BYTES];
+	uint8_t key[8];
+	uint16_t mode;
+	uint32_t first_frame;
+	size_t frames;
+	uint32_t last_frame;
+	bool last_valid;
+};
+
 struct cipher_state_t {
 	uint16_t registers[CIPHER_REGISTER_COUNT];
 	dsp_device_t *interrupt;
@@ -47,170 +49,150 @@ struct cipher_state_t {
 	uint16_t ram_base;
 	size_t cycles_remaining;
 	bool active;
+	cipher_prefetch_t prefetch;
+	cipher_kgcore_t kgcore;
 };
 
-static uint32_t cipher_parity(uint32_t value) {
-	value ^= value >> 16;
-	value ^= value >> 8;
-	value ^= value >> 4;
-	return 0x6996U >> (value & 0x0F) & 1;
+// Kc bit i is key[i / 8] >> (i % 8), KEY0 holds the lowest bits
+static void cipher_get_a512_key(const cipher_state_t *state, uint8_t key[8]) {
+	for (size_t i = 0; i < 4; i++) {
+		uint16_t word = state->registers[TEAK_CIPH_KEY0 + i];
+		key[i * 2] = word;
+		key[i * 2 + 1] = word >> 8;
+	}
 }
 
-static bool cipher_majority(bool first, bool second, bool third) {
-	return first + second + third >= 2;
+static uint32_t cipher_get_frame_count(const cipher_state_t *state) {
+	uint32_t t1 = state->registers[TEAK_CIPH_SFNUM] & 0x07FF;
+	uint32_t t2 = state->registers[TEAK_CIPH_TMOD26] & 0x001F;
+	uint32_t t3 = state->registers[TEAK_CIPH_TMOD51] & 0x003F;
+	return t1 << 11 | t3 << 5 | t2;
 }
 
-static uint32_t cipher_clock_register(uint32_t value, uint32_t mask, uint32_t taps) {
-	uint32_t shifted = value << 1 & mask;
-	return shifted | cipher_parity(value & taps);
-}
+static bool cipher_count_to_frame(uint32_t count, uint32_t *frame) {
+	uint32_t t1 = count >> 11;
+	uint32_t t2 = count & 0x1F;
+	uint32_t t3 = count >> 5 & 0x3F;
 
-static void cipher_a51_clock(uint32_t registers[3], bool force) {
-	bool clocks[3] = {
-		(registers[0] & A51_R1_CLOCK) != 0,
-		(registers[1] & A51_R2_CLOCK) != 0,
-		(registers[2] & A51_R3_CLOCK) != 0,
-	};
-	bool majority = cipher_majority(clocks[0], clocks[1], clocks[2]);
-
-	if (force || clocks[0] == majority)
-		registers[0] = cipher_clock_register(registers[0], A5_R1_MASK, A5_R1_TAPS);
-	if (force || clocks[1] == majority)
-		registers[1] = cipher_clock_register(registers[1], A5_R2_MASK, A5_R2_TAPS);
-	if (force || clocks[2] == majority)
-		registers[2] = cipher_clock_register(registers[2], A5_R3_MASK, A5_R3_TAPS);
-}
+	if (t2 >= 26 || t3 >= 51)
+		return false;
 
-static uint8_t cipher_a51_output(const uint32_t registers[3]) {
-	return registers[0] >> (A5_R1_LENGTH - 1) ^ registers[1] >> (A5_R2_LENGTH - 1) ^
-		registers[2] >> (A5_R3_LENGTH - 1);
+	// FN mod 26 = T2, FN mod 51 = T3 and 51 = -1 (mod 26)
+	*frame = t1 * 26 * 51 + t3 + 51 * ((t3 + 52 - t2) % 26);
+	return true;
 }
 
-static void cipher_a52_clock(uint32_t registers[4], bool force) {
-	bool clocks[3] = {
-		(registers[3] & A52_R4_CLOCK0) != 0,
-		(registers[3] & A52_R4_CLOCK1) != 0,
-		(registers[3] & A52_R4_CLOCK2) != 0,
-	};
-	bool majority = cipher_majority(clocks[0], clocks[1], clocks[2]);
-
-	if (force || clocks[0] == majority)
-		registers[0] = cipher_clock_register(registers[0], A5_R1_MASK, A5_R1_TAPS);
-	if (force || clocks[1] == majority)
-		registers[1] = cipher_clock_register(registers[1], A5_R2_MASK, A5_R2_TAPS);
-	if (force || clocks[2] == majority)
-		registers[2] = cipher_clock_register(registers[2], A5_R3_MASK, A5_R3_TAPS);
-	registers[3] = cipher_clock_register(registers[3], A5_R4_MASK, A5_R4_TAPS);
+static uint32_t cipher_frame_to_count(uint32_t frame) {
+	return (frame / (26 * 51)) << 11 | (frame % 51) << 5 | frame % 26;
 }
 
-static uint8_t cipher_a52_output(const uint32_t registers[4]) {
-	bool r1 = cipher_majority((registers[0] & 0x08000) != 0, (~registers[0] & 0x04000) != 0,
-		(registers[0] & 0x01000) != 0);
-	bool r2 = cipher_majority((~registers[1] & 0x10000) != 0, (registers[1] & 0x02000) != 0,
-		(registers[1] & 0x00200) != 0);
-	bool r3 = cipher_majority((registers[2] & 0x40000) != 0, (registers[2] & 0x10000) != 0,
-		(~registers[2] & 0x02000) != 0);
-	return (registers[0] >> (A5_R1_LENGTH - 1)) ^ (registers[1] >> (A5_R2_LENGTH - 1)) ^
-		(registers[2] >> (A5_R3_LENGTH - 1)) ^ r1 ^ r2 ^ r3;
+static uint16_t cipher_read_bits16(const uint8_t *data, size_t bit) {
+	const uint8_t *bytes = data + bit / 8;
+	uint32_t value = bytes[0] | bytes[1] << 8 | bytes[2] << 16;
+	return value >> (bit % 8);
 }
 
-static void cipher_get_a512_key(const cipher_state_t *state, uint8_t key[8]) {
-	for (size_t i = 0; i < 4; i++) {
-		uint16_t word = state->registers[TEAK_CIPH_KEY0 + 3 - i];
-		key[i * 2] = word >> 8;
-		key[i * 2 + 1] = word;
+// Keystream bit (offset + i) goes to bit (i % 16) of word (base + i / 16)
+static void cipher_write_stream(cipher_state_t *state, uint16_t base, const uint8_t *data, size_t offset,
+	size_t bits
+) {
+	for (size_t bit = 0; bit < bits; bit += 16) {
+		uint16_t address = base + bit / 16;
+		size_t count = MIN(bits - bit, 16);
+		uint16_t mask = MAKE_64BIT_MASK(0, count);
+		uint16_t word = cipher_read_bits16(data, offset + bit) & mask;
+
+		if (count < 16)
+			word |= state->host.data_read(state->host.opaque, address) & ~mask;
+		state->host.data_write(state->host.opaque, address, word);
 	}
 }
 
-static uint32_t cipher_get_frame_count(const cipher_state_t *state) {
-	uint32_t t1 = state->registers[TEAK_CIPH_SFNUM] & 0x07FF;
-	uint32_t t2 = state->registers[TEAK_CIPH_TMOD26] & 0x001F;
-	uint32_t t3 = state->registers[TEAK_CIPH_TMOD51] & 0x003F;
-	return t1 << 11 | t3 << 5 | t2;
+static void cipher_a512_keystream(uint16_t mode, const uint8_t key[8], uint32_t count, uint8_t *output,
+	size_t bits
+) {
+	if ((mode & TEAK_CIPH_CSTAT_A52) != 0) {
+		cipher_a52_keystream(key, count, output, bits);
+	} else {
+		cipher_a51_keystream(key, count, output, bits);
+	}
 }
 
-static void cipher_write_bit(cipher_state_t *state, uint16_t base, size_t bit, uint8_t value) {
-	uint16_t address = base + bit / 16;
-	uint16_t word = state->host.data_read(state->host.opaque, address);
-	uint16_t mask = (uint16_t) BIT(bit % 16);
+static void cipher_prefetch_fill(cipher_prefetch_t *prefetch, uint16_t mode, const uint8_t key[8], uint32_t frame,
+	size_t bits
+) {
+	uint32_t counts[CIPHER_A5_BATCH_MAX];
+
+	for (size_t i = 0; i < CIPHER_A5_BATCH_MAX; i++)
+		counts[i] = cipher_frame_to_count((frame + i) % CIPHER_HYPERFRAME);
 
-	if (value != 0) {
-		word |= mask;
+	if ((mode & TEAK_CIPH_CSTAT_A52) != 0) {
+		cipher_a52_keystream_batch(key, counts, CIPHER_A5_BATCH_MAX, prefetch->stream[0], CIPHER_STREAM_BYTES, bits);
 	} else {
-		word &= ~mask;
+		cipher_a51_keystream_batch(key, counts, CIPHER_A5_BATCH_MAX, prefetch->stream[0], CIPHER_STREAM_BYTES, bits);
 	}
 
-	state->host.data_write(state->host.opaque, address, word);
+	memcpy(prefetch->key, key, sizeof(prefetch->key));
+	prefetch->mode = mode;
+	prefetch->first_frame = frame;
+	prefetch->frames = CIPHER_A5_BATCH_MAX;
 }
 
-static void cipher_a51_generate(cipher_state_t *state, size_t stream_bits) {
-	uint8_t key[8];
-	uint32_t registers[3] = { 0, 0, 0 };
-	uint32_t frame_count = cipher_get_frame_count(state);
-
-	cipher_get_a512_key(state, key);
-	for (size_t i = 0; i < 64; i++) {
-		uint8_t bit = key[7 - i / 8] >> (i % 8) & 1;
-		cipher_a51_clock(registers, true);
-		registers[0] ^= bit;
-		registers[1] ^= bit;
-		registers[2] ^= bit;
+/*
+ * Keystream for one frame. A single frame is cheap enough in scalar code, but once the firmware
+ * asks for nearby frames with the same Kc the next CIPHER_A5_BATCH_MAX frames are generated at once.
+ * */
+static const uint8_t *cipher_a512_lookup(cipher_state_t *state, uint16_t mode, const uint8_t key[8],
+	uint32_t count, size_t bits, uint8_t *output
+) {
+	cipher_prefetch_t *prefetch = &state->prefetch;
+	bool same_stream = prefetch->mode == mode && memcmp(prefetch->key, key, sizeof(prefetch->key)) == 0;
+	uint32_t frame;
+
+	if (!cipher_count_to_frame(count, &frame)) {
+		prefetch->last_valid = false;
+		cipher_a512_keystream(mode, key, count, output, bits);
+		return output;
 	}
 
-	for (size_t i = 0; i < 22; i++) {
-		uint8_t bit = frame_count >> i & 1;
-		cipher_a51_clock(registers, true);
-		registers[0] ^= bit;
-		registers[1] ^= bit;
-		registers[2] ^= bit;
+	if (!same_stream) {
+		prefetch->frames = 0;
+		prefetch->last_valid = false;
+		memcpy(prefetch->key, key, sizeof(prefetch->key));
+		prefetch->mode = mode;
 	}
 
-	for (size_t i = 0; i < 100; i++)
-		cipher_a51_clock(registers, false);
+	uint32_t index = (frame + CIPHER_HYPERFRAME - prefetch->first_frame) % CIPHER_HYPERFRAME;
+	uint32_t distance = (frame + CIPHER_HYPERFRAME - prefetch->last_frame) % CIPHER_HYPERFRAME;
+	bool sequential = prefetch->last_valid && distance != 0 && distance <= CIPHER_PREFETCH_DISTANCE;
 
-	for (size_t stream = 0; stream < 2; stream++) {
-		uint16_t base = state->ram_base + stream * CIPHER_STREAM_OFFSET;
-		for (size_t bit = 0; bit < stream_bits; bit++) {
-			cipher_a51_clock(registers, false);
-			cipher_write_bit(state, base, bit, cipher_a51_output(registers));
-		}
-	}
-}
+	prefetch->last_frame = frame;
+	prefetch->last_valid = true;
 
-static void cipher_a52_generate(cipher_state_t *state) {
-	uint8_t key[8];
-	uint32_t registers[4] = { 0, 0, 0, 0 };
-	uint32_t frame_count = cipher_get_frame_count(state);
+	if (index < prefetch->frames)
+		return prefetch->stream[index];
 
-	cipher_get_a512_key(state, key);
-	for (size_t i = 0; i < 64; i++) {
-		uint8_t bit = key[7 - i / 8] >> (i % 8) & 1;
-		cipher_a52_clock(registers, true);
-		for (size_t j = 0; j < 4; j++)
-			registers[j] ^= bit;
+	if (sequential) {
+		cipher_prefetch_fill(prefetch, mode, key, frame, bits);
+		return prefetch->stream[0];
 	}
 
-	for (size_t i = 0; i < 22; i++) {
-		uint8_t bit = frame_count >> i & 1;
-		cipher_a52_clock(registers, true);
-		for (size_t j = 0; j < 4; j++)
-			registers[j] ^= bit;
-	}
+	cipher_a512_keystream(mode, key, count, output, bits);
+	return output;
+}
 
-	registers[0] |= BIT(15);
-	registers[1] |= BIT(16);
-	registers[2] |= BIT(18);
-	registers[3] |= BIT(10);
+static void cipher_a512_generate(cipher_state_t *state, size_t stream_bits) {
+	uint16_t mode = state->registers[TEAK_CIPH_CSTAT] & (TEAK_CIPH_CSTAT_A52 | TEAK_CIPH_CSTAT_EDGE);
+	uint8_t output[CIPHER_STREAM_BYTES] = { 0 };
+	const uint8_t *keystream;
+	uint8_t key[8];
 
-	for (size_t i = 0; i < 99; i++)
-		cipher_a52_clock(registers, false);
+	cipher_get_a512_key(state, key);
+	keystream = cipher_a512_lookup(state, mode, key, cipher_get_frame_count(state), stream_bits * 2, output);
 
 	for (size_t stream = 0; stream < 2; stream++) {
 		uint16_t base = state->ram_base + stream * CIPHER_STREAM_OFFSET;
-		for (size_t bit = 0; bit < CIPHER_GSM_BITS; bit++) {
-			cipher_a52_clock(registers, false);
-			cipher_write_bit(state, base, bit, cipher_a52_output(registers));
-		}
+		cipher_write_stream(state, base, keystream, stream * stream_bits, stream_bits);
 	}
 }
 
@@ -221,6 +203,7 @@ static void cipher_a53_generate(cipher_state_t *state) {
 	};
 	uint8_t key[16];
 	uint8_t output[DIV_ROUND_UP(CIPHER_GSM_BITS * 2, 8)];
+	uint8_t keystream[DIV_ROUND_UP(CIPHER_GSM_BITS * 2, 8) + 2] = { 0 };
 	uint16_t kdata2 = state->registers[TEAK_CIPH_KDATA2];
 	uint16_t kdata3 = state->registers[TEAK_CIPH_KDATA3];
 	uint16_t kdata4 = state->registers[TEAK_CIPH_KDATA4];
@@ -240,16 +223,22 @@ static void cipher_a53_generate(cipher_state_t *state) {
 		key[key_offset + 3] = odd;
 	}
 
-	cipher_kgcore(ca, cb, frame_count, cd, ce, key, output, CIPHER_GSM_BITS * 2);
+	cipher_kgcore_set_key(&state->kgcore, key);
+	cipher_kgcore_generate(&state->kgcore, ca, cb, frame_count, cd, ce, output, CIPHER_GSM_BITS * 2);
 
+	// KGCORE output is MSB first and each burst is stored last bit first
 	for (size_t stream = 0; stream < 2; stream++) {
-		uint16_t base = state->ram_base + stream * CIPHER_STREAM_OFFSET;
 		for (size_t bit = 0; bit < CIPHER_GSM_BITS; bit++) {
 			size_t output_bit = stream * CIPHER_GSM_BITS + CIPHER_GSM_BITS - 1 - bit;
-			uint8_t value = output[output_bit / 8] >> (7 - output_bit % 8) & 1;
-			cipher_write_bit(state, base, bit, value);
+			size_t keystream_bit = stream * CIPHER_GSM_BITS + bit;
+			keystream[keystream_bit / 8] |= (output[output_bit / 8] >> (7 - output_bit % 8) & 1) << (keystream_bit % 8);
 		}
 	}
+
+	for (size_t stream = 0; stream < 2; stream++) {
+		uint16_t base = state->ram_base + stream * CIPHER_STREAM_OFFSET;
+		cipher_write_stream(state, base, keystream, stream * CIPHER_GSM_BITS, CIPHER_GSM_BITS);
+	}
 }
 
 static size_t cipher_operation_cycles(uint16_t control) {
@@ -266,10 +255,10 @@ static void cipher_run(cipher_state_t *state) {
 	if ((control & TEAK_CIPH_CSTAT_A53) != 0) {
 		cipher_a53_generate(state);
 	} else if ((control & TEAK_CIPH_CSTAT_A52) != 0) {
-		cipher_a52_generate(state);
+		cipher_a512_generate(state, CIPHER_GSM_BITS);
 	} else {
 		size_t stream_bits = (control & TEAK_CIPH_CSTAT_EDGE) != 0 ? CIPHER_EDGE_BITS : CIPHER_GSM_BITS;
-		cipher_a51_generate(state, stream_bits);
+		cipher_a512_generate(state, stream_bits);
 	}
 
 	state->registers[TEAK_CIPH_CSTAT] &= ~(TEAK_CIPH_CSTAT_CACT | TEAK_CIPH_CSTAT_INIT);
@@ -325,11 +314,16 @@ static bool cipher_write(dsp_device_t *device, uint16_t offset, uint32_t pc, uin
 	return true;
 }
 
+static void cipher_advance(dsp_device_t *device, size_t cycles);
+static size_t cipher_next_event(dsp_device_t *device);
+
 static const dsp_device_ops_t cipher_ops = {
 	.destroy = cipher_destroy,
 	.reset = cipher_reset,
 	.read = cipher_read,
 	.write = cipher_write,
+	.advance = cipher_advance,
+	.next_event = cipher_next_event,
 };
 
 dsp_device_t *cipher_create(const pmb887x_dsp_peripheral_config_t *config, dsp_device_t *interrupt, const dsp_host_t *host) {
@@ -340,7 +334,7 @@ dsp_device_t *cipher_create(const pmb887x_dsp_peripheral_config_t *config, dsp_d
 	return dsp_device_create(config, &cipher_ops, state);
 }
 
-void cipher_advance(dsp_device_t *device, size_t cycles) {
+static void cipher_advance(dsp_device_t *device, size_t cycles) {
 	cipher_state_t *state = device->state;
 
 	if (!state->active)
@@ -354,7 +348,10 @@ void cipher_advance(dsp_device_t *device, size_t cycles) {
 	cipher_run(state);
 }
 
-bool cipher_is_active(const dsp_device_t *device) {
-	cipher_state_t *state = device->state;
-	return state->active;
+static size_t cipher_next_event(dsp_device_t *device) {
+	const cipher_state_t *state = device->state;
+
+	if (!state->active)
+		return DSP_EVENT_NONE;
+	return state->cycles_remaining;
 }
@@ -6,6 +6,7 @@
 #include "qemu/bitops.h"
 
 #include "hw/arm/pmb887x/dsp/peripheral/internal.h"
+#include "hw/arm/pmb887x/dsp/peripheral/viterbi.h"
 #include "hw/arm/pmb887x/gen/dsp.h"
 #include "hw/arm/pmb887x/trace.h"
 
@@ -373,11 +374,16 @@ static bool equalizer_write(dsp_device_t *device, uint16_t offset, uint32_t pc,
 	return true;
 }
 
+static void equalizer_advance(dsp_device_t *device, size_t cycles);
+static size_t equalizer_next_event(dsp_device_t *device);
+
 static const dsp_device_ops_t equalizer_ops = {
 	.destroy = equalizer_destroy,
 	.reset = equalizer_reset,
 	.read = equalizer_read,
 	.write = equalizer_write,
+	.advance = equalizer_advance,
+	.next_event = equalizer_next_event,
 };
 
 static uint32_t *equalizer_external_ram32(equalizer_state_t *state, size_t *word_count) {
@@ -625,14 +631,6 @@ void equalizer_external_write(dsp_device_t *device, uint16_t value) {
 		state->external_pointer++;
 }
 
-static int16_t equalizer_saturate_int16(int32_t value) {
-	if (value > INT16_MAX)
-		return INT16_MAX;
-	if (value < INT16_MIN)
-		return INT16_MIN;
-	return value;
-}
-
 static int32_t equalizer_arithmetic_shift_right(int32_t value, size_t shift) {
 	if (value >= 0)
 		return value >> shift;
@@ -693,34 +691,33 @@ static void equalizer_write_soft(equalizer_state_t *state, size_t offset, int16_
 	}
 }
 
-static uint16_t equalizer_branch_metric(const equalizer_state_t *state, size_t timestamp, uint32_t path, size_t next) {
+static void equalizer_prepare_trellis(const equalizer_state_t *state, size_t timestamp, dsp_viterbi_eq_t *eq) {
 	uint32_t received = state->received[timestamp % EQUALIZER_RECEIVED_VALUES];
-	int16_t real = received;
-	int16_t imaginary = received >> 16;
-
-	for (size_t group = 0; group < 7; group++) {
-		size_t selector;
 
-		if (group == 0) {
-			selector = next;
-		} else if (group < 6) {
-			selector = path >> ((group - 1) * 3) & 7;
-		} else {
-			selector = path >> 15 & 7;
-		}
+	eq->received_real = received;
+	eq->received_imaginary = received >> 16;
+	for (size_t i = 0; i < EQUALIZER_STATES; i++) {
+		uint32_t branch = state->branch[i];
 
-		uint32_t branch = state->branch[group * EQUALIZER_STATES + selector];
-		real = equalizer_saturate_int16(real + (int16_t) branch);
-		imaginary = equalizer_saturate_int16(imaginary + (int16_t) (branch >> 16));
+		eq->metrics[i] = state->metrics[i];
+		eq->first_real[i] = branch;
+		eq->first_imaginary[i] = branch >> 16;
 	}
 
-	uint32_t real_square = (int32_t) real * real;
-	uint32_t imaginary_square = (int32_t) imaginary * imaginary;
-	uint32_t distance = (real_square >> 10) + (imaginary_square >> 10);
-	return distance >> 1 & 0x7FFF;
+	for (size_t group = 1; group < 7; group++) {
+		for (size_t previous = 0; previous < EQUALIZER_STATES; previous++) {
+			uint32_t path = state->paths[previous];
+			size_t selector = group < 6 ? path >> ((group - 1) * 3) & 7 : path >> 15 & 7;
+			uint32_t branch = state->branch[group * EQUALIZER_STATES + selector];
+
+			eq->tap_real[group - 1][previous] = branch;
+			eq->tap_imaginary[group - 1][previous] = branch >> 16;
+		}
+	}
 }
 
 static uint8_t equalizer_step(equalizer_state_t *state, size_t timestamp) {
+	dsp_viterbi_eq_t eq;
 	int16_t candidates[EQUALIZER_STATES][EQUALIZER_STATES];
 	uint16_t branch_metrics[EQUALIZER_STATES][EQUALIZER_STATES];
 	int16_t next_metrics[EQUALIZER_STATES];
@@ -733,13 +730,13 @@ static uint8_t equalizer_step(equalizer_state_t *state, size_t timestamp) {
 	size_t side = right;
 	size_t history_index = EQUALIZER_TRAINING_SYMBOLS + 1 + state->side_processed_count[side] + timestamp;
 
+	equalizer_prepare_trellis(state, timestamp, &eq);
+	dsp_viterbi->eq_metrics(&eq, branch_metrics, candidates);
+
 	for (size_t next = 0; next < EQUALIZER_STATES; next++) {
 		size_t best_predecessor = 0;
 
-		for (size_t previous = 0; previous < EQUALIZER_STATES; previous++) {
-			uint16_t branch = equalizer_branch_metric(state, timestamp, state->paths[previous], next);
-			branch_metrics[next][previous] = branch;
-			candidates[next][previous] = equalizer_saturate_int16(state->metrics[previous] + branch);
+		for (size_t previous = 1; previous < EQUALIZER_STATES; previous++) {
 			if (candidates[next][previous] < candidates[next][best_predecessor])
 				best_predecessor = previous;
 		}
@@ -844,7 +841,7 @@ static void equalizer_advance_timestamp(equalizer_state_t *state) {
 		equalizer_complete(state);
 }
 
-void equalizer_advance(dsp_device_t *device, size_t cycles) {
+static void equalizer_advance(dsp_device_t *device, size_t cycles) {
 	equalizer_state_t *state = device->state;
 
 	if (!state->active)
@@ -863,10 +860,6 @@ void equalizer_advance(dsp_device_t *device, size_t cycles) {
 	}
 }
 
-bool equalizer_is_active(const dsp_device_t *device) {
-	const equalizer_state_t *state = device->state;
-	return state->active;
-}
 
 dsp_device_t *equalizer_create(const pmb887x_dsp_peripheral_config_t *config, dsp_device_t *interrupt) {
 	equalizer_state_t *state = g_new0(equalizer_state_t, 1);
@@ -874,3 +867,11 @@ dsp_device_t *equalizer_create(const pmb887x_dsp_peripheral_config_t *config, ds
 	equalizer_reset_state(state);
 	return dsp_device_create(config, &equalizer_ops, state);
 }
+
+static size_t equalizer_next_event(dsp_device_t *device) {
+	const equalizer_state_t *state = device->state;
+
+	if (!state->active)
+		return DSP_EVENT_NONE;
+	return EQUALIZER_TIMESTAMP_CYCLES - state->elapsed_cycles;
+}
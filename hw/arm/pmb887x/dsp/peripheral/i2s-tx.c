@@ -9,14 +9,23 @@
 #include "hw/arm/pmb887x/trace.h"
 
 #define I2S_TX_REGISTER_COUNT	(TEAK_I2S3_TXINTADDR + 1)
+// Paced by executed DSP cycles like the AFE, the declared rate only seeds the audio consumer
 #define I2S_TX_SAMPLE_CYCLES	16U
 #define I2S_TX_INTERRUPT_GROUP	1
+// The module clock reference is not modelled, the divider always runs from 104 MHz
+#define I2S_TX_FREF_CLOCK		104000000U
+#define I2S_TX_FRAME_BITS		32U
+#define I2S_TX_MIN_RATE			8000U
+#define I2S_TX_MAX_RATE			48000U
+#define I2S_TX_DEFAULT_RATE		8000U
 
 typedef struct i2s_tx_state_t i2s_tx_state_t;
 
 struct i2s_tx_state_t {
 	uint16_t registers[I2S_TX_REGISTER_COUNT];
 	dsp_device_t *interrupt;
+	dsp_host_t host;
+	uint16_t ram_base;
 	uint16_t position;
 	size_t sample_cycles;
 };
@@ -27,6 +36,21 @@ static bool i2s_tx_active(const i2s_tx_state_t *state) {
 	return (control & active) == active;
 }
 
+// Bit clock is FREF * NUM / DEN with one 32 bit frame per sample word
+static uint32_t i2s_tx_sample_rate(const i2s_tx_state_t *state) {
+	uint32_t numerator = state->registers[TEAK_I2S3_NUM] & TEAK_I2S3_NUM_NUMERATOR;
+	uint32_t denominator = state->registers[TEAK_I2S3_DEN];
+	uint64_t rate;
+
+	if (numerator == 0 || denominator == 0)
+		return I2S_TX_DEFAULT_RATE;
+
+	rate = (uint64_t) I2S_TX_FREF_CLOCK * numerator / denominator / I2S_TX_FRAME_BITS;
+	if (rate < I2S_TX_MIN_RATE || rate > I2S_TX_MAX_RATE)
+		return I2S_TX_DEFAULT_RATE;
+	return rate;
+}
+
 static void i2s_tx_destroy(dsp_device_t *device) {
 	g_free(device->state);
 }
@@ -34,9 +58,13 @@ static void i2s_tx_destroy(dsp_device_t *device) {
 static void i2s_tx_reset(dsp_device_t *device) {
 	i2s_tx_state_t *state = device->state;
 	dsp_device_t *interrupt = state->interrupt;
+	dsp_host_t host = state->host;
+	uint16_t ram_base = state->ram_base;
 
 	memset(state, 0, sizeof(*state));
 	state->interrupt = interrupt;
+	state->host = host;
+	state->ram_base = ram_base;
 	state->registers[TEAK_I2S3_NUM] = 1;
 	state->registers[TEAK_I2S3_DEN] = 2;
 }
@@ -87,29 +115,42 @@ static bool i2s_tx_write(dsp_device_t *device, uint16_t offset, uint32_t pc, uin
 	return true;
 }
 
+static void i2s_tx_advance(dsp_device_t *device, size_t cycles);
+static size_t i2s_tx_next_event(dsp_device_t *device);
+
 static const dsp_device_ops_t i2s_tx_ops = {
 	.destroy = i2s_tx_destroy,
 	.reset = i2s_tx_reset,
 	.read = i2s_tx_read,
 	.write = i2s_tx_write,
+	.advance = i2s_tx_advance,
+	.next_event = i2s_tx_next_event,
 };
 
-dsp_device_t *i2s_tx_create(const pmb887x_dsp_peripheral_config_t *config, dsp_device_t *interrupt) {
+dsp_device_t *i2s_tx_create(const pmb887x_dsp_peripheral_config_t *config, dsp_device_t *interrupt, const dsp_host_t *host) {
 	i2s_tx_state_t *state = g_new0(i2s_tx_state_t, 1);
 	state->interrupt = interrupt;
+	state->host = *host;
+	state->ram_base = config->ram_base;
 	return dsp_device_create(config, &i2s_tx_ops, state);
 }
 
-void i2s_tx_advance(dsp_device_t *device, size_t cycles) {
+static void i2s_tx_advance(dsp_device_t *device, size_t cycles) {
 	i2s_tx_state_t *state = device->state;
+	uint32_t rate;
 
 	if (!i2s_tx_active(state))
 		return;
 
 	state->sample_cycles += cycles;
+	rate = i2s_tx_sample_rate(state);
 
 	while (i2s_tx_active(state) && state->sample_cycles >= I2S_TX_SAMPLE_CYCLES) {
 		state->sample_cycles -= I2S_TX_SAMPLE_CYCLES;
+		if (state->host.audio_output != NULL) {
+			uint16_t sample = state->host.data_read(state->host.opaque, state->ram_base + state->position);
+			state->host.audio_output(state->host.opaque, DSP_AUDIO_I2S, (int16_t) sample, rate);
+		}
 		state->position++;
 		state->position &= TEAK_I2S3_RADDR_RDADDR;
 
@@ -123,7 +164,13 @@ void i2s_tx_advance(dsp_device_t *device, size_t cycles) {
 	}
 }
 
-bool i2s_tx_is_active(const dsp_device_t *device) {
+static size_t i2s_tx_next_event(dsp_device_t *device) {
 	const i2s_tx_state_t *state = device->state;
-	return i2s_tx_active(state);
+	size_t samples;
+
+	if (!i2s_tx_active(state))
+		return DSP_EVENT_NONE;
+
+	samples = ((state->registers[TEAK_I2S3_TXINTADDR] - state->position - 1) & TEAK_I2S3_RADDR_RDADDR) + 1;
+	return samples * I2S_TX_SAMPLE_CYCLES - state->sample_cycles;
 }
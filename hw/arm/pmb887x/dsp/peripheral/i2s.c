@@ -103,11 +103,16 @@ static bool i2s_write(dsp_device_t *device, uint16_t offset, uint32_t pc, uint16
 	return true;
 }
 
+static void i2s_advance(dsp_device_t *device, size_t cycles);
+static size_t i2s_next_event(dsp_device_t *device);
+
 static const dsp_device_ops_t i2s_ops = {
 	.destroy = i2s_destroy,
 	.reset = i2s_reset,
 	.read = i2s_read,
 	.write = i2s_write,
+	.advance = i2s_advance,
+	.next_event = i2s_next_event,
 };
 
 dsp_device_t *i2s_create(const pmb887x_dsp_peripheral_config_t *config, dsp_device_t *interrupt, uint16_t interrupt_flag) {
@@ -117,7 +122,7 @@ dsp_device_t *i2s_create(const pmb887x_dsp_peripheral_config_t *config, dsp_devi
 	return dsp_device_create(config, &i2s_ops, state);
 }
 
-void i2s_advance(dsp_device_t *device, size_t cycles) {
+static void i2s_advance(dsp_device_t *device, size_t cycles) {
 	i2s_state_t *state = device->state;
 
 	if (!i2s_transmit_active(state) && !i2s_receive_active(state))
@@ -159,7 +164,20 @@ void i2s_advance(dsp_device_t *device, size_t cycles) {
 	}
 }
 
-bool i2s_is_active(const dsp_device_t *device) {
+static size_t i2s_samples_until(uint16_t position, uint16_t interrupt_position) {
+	return ((interrupt_position - position - 1) & TEAK_I2S_RWADDR_RDADDR) + 1;
+}
+
+static size_t i2s_next_event(dsp_device_t *device) {
 	const i2s_state_t *state = device->state;
-	return i2s_transmit_active(state) || i2s_receive_active(state);
+	size_t samples = SIZE_MAX;
+
+	if (i2s_transmit_active(state))
+		samples = i2s_samples_until(state->transmit_position, state->registers[TEAK_I2S_TXINTADDR]);
+	if (i2s_receive_active(state))
+		samples = MIN(samples, i2s_samples_until(state->receive_position, state->registers[TEAK_I2S_RXINTADDR]));
+
+	if (samples == SIZE_MAX)
+		return DSP_EVENT_NONE;
+	return samples * I2S_SAMPLE_CYCLES - state->sample_cycles;
 }
@@ -4,6 +4,8 @@
 #include "hw/arm/pmb887x/dsp/peripheral.h"
 
 #define DSP_I2S_COUNT	2
+#define DSP_EVENT_NONE	SIZE_MAX
+#define DSP_SCHED_MAX	32
 
 typedef struct dsp_device_t dsp_device_t;
 typedef struct dsp_device_ops_t dsp_device_ops_t;
@@ -14,12 +16,19 @@ struct dsp_device_ops_t {
 	void (*reset)(dsp_device_t *device);
 	bool (*read)(dsp_device_t *device, uint16_t offset, uint32_t pc, uint16_t *value);
 	bool (*write)(dsp_device_t *device, uint16_t offset, uint32_t pc, uint16_t value);
+	// Timed devices only: catch up elapsed cycles and report cycles until the next event (DSP_EVENT_NONE if idle)
+	void (*advance)(dsp_device_t *device, size_t cycles);
+	size_t (*next_event)(dsp_device_t *device);
 };
 
 struct dsp_device_t {
 	const pmb887x_dsp_peripheral_config_t *config;
 	const dsp_device_ops_t *ops;
 	void *state;
+	uint64_t synced;
+	uint64_t deadline;
+	int heap_index;
+	int sched_id;
 };
 
 struct dsp_route_t {
@@ -50,15 +59,29 @@ struct dsp_bus_t {
 	dsp_device_t *ssc;
 	dsp_device_t *timer1;
 	dsp_device_t *timer2;
+	uint64_t now;
+	dsp_device_t *sched[DSP_SCHED_MAX];
+	size_t sched_count;
+	dsp_device_t *heap[DSP_SCHED_MAX];
+	size_t heap_count;
+	uint32_t wake_mask;
 };
 
+void dsp_bus_sync_device(dsp_bus_t *bus, dsp_device_t *device);
+void dsp_bus_reschedule(dsp_bus_t *bus, dsp_device_t *device);
+void dsp_bus_wake(dsp_bus_t *bus, dsp_device_t *device);
+
 static inline uint16_t dsp_bus_read_at(dsp_bus_t *bus, uint16_t address, uint32_t pc) {
 	dsp_route_t *route = &bus->routes[address - bus->fallback_config.base];
 	dsp_device_t *device = route->device;
 	uint16_t value;
 
+	if (device->sched_id >= 0)
+		dsp_bus_sync_device(bus, device);
 	if (!device->ops->read(device, route->offset, pc, &value))
 		bus->fallback->ops->read(bus->fallback, address - bus->fallback->config->base, pc, &value);
+	if (device->sched_id >= 0)
+		dsp_bus_reschedule(bus, device);
 	return value;
 }
 
@@ -66,29 +89,27 @@ static inline void dsp_bus_write_at(dsp_bus_t *bus, uint16_t address, uint16_t v
 	dsp_route_t *route = &bus->routes[address - bus->fallback_config.base];
 	dsp_device_t *device = route->device;
 
+	if (device->sched_id >= 0)
+		dsp_bus_sync_device(bus, device);
 	if (!device->ops->write(device, route->offset, pc, value))
 		bus->fallback->ops->write(bus->fallback, address - bus->fallback->config->base, pc, value);
+	if (device->sched_id >= 0)
+		dsp_bus_reschedule(bus, device);
 }
 
 dsp_device_t *dsp_device_create(const pmb887x_dsp_peripheral_config_t *config, const dsp_device_ops_t *ops, void *state);
 
 dsp_device_t *afe_create(const pmb887x_dsp_peripheral_config_t *config, dsp_device_t *interrupt, const dsp_host_t *host);
-void afe_advance(dsp_device_t *device, size_t cycles);
-bool afe_is_active(const dsp_device_t *device);
 
 dsp_device_t *baseband_create(const pmb887x_dsp_peripheral_config_t *config, dsp_device_t *interrupt, const dsp_host_t *host);
 void baseband_set_clock(dsp_device_t *device, uint32_t frequency);
 void baseband_set_signal(dsp_device_t *device, pmb887x_dsp_gsm_signal_t signal, bool level);
 
 dsp_device_t *chdec_create(const pmb887x_dsp_peripheral_config_t *config, dsp_device_t *interrupt);
-void chdec_advance(dsp_device_t *device, size_t cycles);
-bool chdec_is_active(const dsp_device_t *device);
 uint16_t chdec_external_read(dsp_device_t *device);
 void chdec_external_write(dsp_device_t *device, uint16_t value);
 
 dsp_device_t *cipher_create(const pmb887x_dsp_peripheral_config_t *config, dsp_device_t *interrupt, const dsp_host_t *host);
-void cipher_advance(dsp_device_t *device, size_t cycles);
-bool cipher_is_active(const dsp_device_t *device);
 
 dsp_device_t *control_create(const pmb887x_dsp_peripheral_config_t *config, const dsp_host_t *host);
 int control_set_input(dsp_device_t *device, size_t index, bool level);
@@ -96,18 +117,12 @@ uint16_t control_get_outputs(dsp_device_t *device);
 uint16_t control_take_output_events(dsp_device_t *device);
 
 dsp_device_t *equalizer_create(const pmb887x_dsp_peripheral_config_t *config, dsp_device_t *interrupt);
-void equalizer_advance(dsp_device_t *device, size_t cycles);
-bool equalizer_is_active(const dsp_device_t *device);
 uint16_t equalizer_external_read(dsp_device_t *device);
 void equalizer_external_write(dsp_device_t *device, uint16_t value);
 
 dsp_device_t *i2s_create(const pmb887x_dsp_peripheral_config_t *config, dsp_device_t *interrupt, uint16_t interrupt_flag);
-void i2s_advance(dsp_device_t *device, size_t cycles);
-bool i2s_is_active(const dsp_device_t *device);
 
-dsp_device_t *i2s_tx_create(const pmb887x_dsp_peripheral_config_t *config, dsp_device_t *interrupt);
-void i2s_tx_advance(dsp_device_t *device, size_t cycles);
-bool i2s_tx_is_active(const dsp_device_t *device);
+dsp_device_t *i2s_tx_create(const pmb887x_dsp_peripheral_config_t *config, dsp_device_t *interrupt, const dsp_host_t *host);
 
 dsp_device_t *dsp_int_create(const pmb887x_dsp_peripheral_config_t *config, const dsp_host_t *host);
 uint8_t dsp_int_get_lines(dsp_device_t *device);
@@ -128,22 +143,14 @@ void mcs_release_mcu_semaphores(dsp_device_t *device, uint16_t value);
 
 dsp_device_t *modulator_create(const pmb887x_dsp_peripheral_config_t *config, dsp_device_t *interrupt);
 void modulator_set_codon(dsp_device_t *device, bool level);
-void modulator_advance(dsp_device_t *device, size_t cycles);
-bool modulator_is_active(const dsp_device_t *device);
 
 dsp_device_t *ssc_create(const pmb887x_dsp_peripheral_config_t *config, dsp_device_t *interrupt, const dsp_host_t *host);
-void ssc_advance(dsp_device_t *device, size_t cycles);
-bool ssc_is_active(const dsp_device_t *device);
 
 dsp_device_t *timer1_create(const pmb887x_dsp_peripheral_config_t *config, dsp_device_t *interrupt);
-void timer1_advance(dsp_device_t *device, size_t cycles);
-bool timer1_is_active(const dsp_device_t *device);
 
 dsp_device_t *timer2_create(const pmb887x_dsp_peripheral_config_t *config, dsp_device_t *interrupt);
 void timer2_set_clock_enabled(dsp_device_t *device, bool enabled);
 void timer2_set_core_idle(dsp_device_t *device, bool idle);
-void timer2_advance(dsp_device_t *device, size_t cycles);
-bool timer2_is_active(dsp_device_t *device);
 
 dsp_device_t *unknown_create(const pmb887x_dsp_peripheral_config_t *config);
 
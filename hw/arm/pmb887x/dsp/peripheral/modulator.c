@@ -105,11 +105,16 @@ static bool modulator_write(dsp_device_t *device, uint16_t offset, uint32_t pc,
 	return true;
 }
 
+static void modulator_advance(dsp_device_t *device, size_t cycles);
+static size_t modulator_next_event(dsp_device_t *device);
+
 static const dsp_device_ops_t modulator_ops = {
 	.destroy = modulator_destroy,
 	.reset = modulator_reset,
 	.read = modulator_read,
 	.write = modulator_write,
+	.advance = modulator_advance,
+	.next_event = modulator_next_event,
 };
 
 dsp_device_t *modulator_create(const pmb887x_dsp_peripheral_config_t *config, dsp_device_t *interrupt) {
@@ -124,7 +129,7 @@ void modulator_set_codon(dsp_device_t *device, bool level) {
 	qatomic_set(&state->codon, level);
 }
 
-void modulator_advance(dsp_device_t *device, size_t cycles) {
+static void modulator_advance(dsp_device_t *device, size_t cycles) {
 	modulator_state_t *state = device->state;
 
 	if (!modulator_active(state)) {
@@ -144,7 +149,13 @@ void modulator_advance(dsp_device_t *device, size_t cycles) {
 	}
 }
 
-bool modulator_is_active(const dsp_device_t *device) {
+static size_t modulator_next_event(dsp_device_t *device) {
 	const modulator_state_t *state = device->state;
-	return modulator_active(state);
+	size_t samples;
+
+	if (!modulator_active(state))
+		return DSP_EVENT_NONE;
+
+	samples = ((state->registers[TEAK_MOD_INT_ADDR] - state->position - 1) & TEAK_MOD_INT_ADDR_MINT_ADDR) + 1;
+	return samples * MODULATOR_SAMPLE_CYCLES - state->sample_cycles;
 }
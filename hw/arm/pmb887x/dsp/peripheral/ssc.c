@@ -351,11 +351,16 @@ static bool ssc_write(dsp_device_t *device, uint16_t offset, uint32_t pc, uint16
 	return true;
 }
 
+static void ssc_advance(dsp_device_t *device, size_t cycles);
+static size_t ssc_next_event(dsp_device_t *device);
+
 static const dsp_device_ops_t ssc_ops = {
 	.destroy = ssc_destroy,
 	.reset = ssc_reset,
 	.read = ssc_read,
 	.write = ssc_write,
+	.advance = ssc_advance,
+	.next_event = ssc_next_event,
 };
 
 dsp_device_t *ssc_create(const pmb887x_dsp_peripheral_config_t *config, dsp_device_t *interrupt, const dsp_host_t *host) {
@@ -367,7 +372,7 @@ dsp_device_t *ssc_create(const pmb887x_dsp_peripheral_config_t *config, dsp_devi
 	return dsp_device_create(config, &ssc_ops, state);
 }
 
-void ssc_advance(dsp_device_t *device, size_t cycles) {
+static void ssc_advance(dsp_device_t *device, size_t cycles) {
 	ssc_state_t *state = device->state;
 
 	while (cycles != 0 && ssc_running(state)) {
@@ -397,7 +402,12 @@ void ssc_advance(dsp_device_t *device, size_t cycles) {
 	}
 }
 
-bool ssc_is_active(const dsp_device_t *device) {
+static size_t ssc_next_event(dsp_device_t *device) {
 	const ssc_state_t *state = device->state;
-	return ssc_running(state) && (state->transfer_active || state->transmit_fifo.base.count != 0);
+
+	if (!ssc_running(state) || (!state->transfer_active && state->transmit_fifo.base.count == 0))
+		return DSP_EVENT_NONE;
+	if (!state->transfer_active)
+		return state->start_cycles;
+	return state->transfer_cycles;
 }
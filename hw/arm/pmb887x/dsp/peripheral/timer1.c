@@ -98,11 +98,16 @@ static bool timer1_write(dsp_device_t *device, uint16_t offset, uint32_t pc, uin
 	return true;
 }
 
+static void timer1_advance(dsp_device_t *device, size_t cycles);
+static size_t timer1_next_event(dsp_device_t *device);
+
 static const dsp_device_ops_t timer1_ops = {
 	.destroy = timer1_destroy,
 	.reset = timer1_reset,
 	.read = timer1_read,
 	.write = timer1_write,
+	.advance = timer1_advance,
+	.next_event = timer1_next_event,
 };
 
 dsp_device_t *timer1_create(const pmb887x_dsp_peripheral_config_t *config, dsp_device_t *interrupt) {
@@ -111,7 +116,7 @@ dsp_device_t *timer1_create(const pmb887x_dsp_peripheral_config_t *config, dsp_d
 	return dsp_device_create(config, &timer1_ops, state);
 }
 
-void timer1_advance(dsp_device_t *device, size_t cycles) {
+static void timer1_advance(dsp_device_t *device, size_t cycles) {
 	timer1_state_t *state = device->state;
 
 	if (state->restart_pending) {
@@ -152,7 +157,19 @@ void timer1_advance(dsp_device_t *device, size_t cycles) {
 	}
 }
 
-bool timer1_is_active(const dsp_device_t *device) {
+static size_t timer1_next_event(dsp_device_t *device) {
 	const timer1_state_t *state = device->state;
-	return state->restart_pending || (state->control & TEAK_TMR1_CTRL_DT1ACT) != 0;
+	uint32_t ticks;
+
+	if (state->restart_pending)
+		return state->restart_cycles;
+	if ((state->control & TEAK_TMR1_CTRL_DT1ACT) == 0)
+		return DSP_EVENT_NONE;
+
+	// Nearest of the two compare matches and the terminal count, counting with the same 16-bit wrap as advance
+	ticks = (uint16_t) (TEAK_TMR1_CNT_T1CNT - state->counter) ?: 0x10000;
+	for (size_t i = 0; i < ARRAY_SIZE(state->compare); i++)
+		ticks = MIN(ticks, (uint16_t) (state->compare[i] - state->counter) ?: 0x10000);
+
+	return (size_t) ticks * TIMER1_DIVIDER - state->prescaler;
 }
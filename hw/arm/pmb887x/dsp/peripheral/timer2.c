@@ -207,11 +207,16 @@ static bool timer2_write(dsp_device_t *device, uint16_t offset, uint32_t pc, uin
 	return true;
 }
 
+static void timer2_advance(dsp_device_t *device, size_t cycles);
+static size_t timer2_next_event(dsp_device_t *device);
+
 static const dsp_device_ops_t timer2_ops = {
 	.destroy = timer2_destroy,
 	.reset = timer2_reset,
 	.read = timer2_read,
 	.write = timer2_write,
+	.advance = timer2_advance,
+	.next_event = timer2_next_event,
 };
 
 dsp_device_t *timer2_create(const pmb887x_dsp_peripheral_config_t *config, dsp_device_t *interrupt) {
@@ -255,7 +260,7 @@ void timer2_set_core_idle(dsp_device_t *device, bool idle) {
 		timer2_raise_interrupt(state);
 }
 
-void timer2_advance(dsp_device_t *device, size_t cycles) {
+static void timer2_advance(dsp_device_t *device, size_t cycles) {
 	timer2_state_t *state = device->state;
 	bool interrupt = false;
 
@@ -268,13 +273,14 @@ void timer2_advance(dsp_device_t *device, size_t cycles) {
 		timer2_raise_interrupt(state);
 }
 
-bool timer2_is_active(dsp_device_t *device) {
+static size_t timer2_next_event(dsp_device_t *device) {
 	timer2_state_t *state = device->state;
-	bool active;
+	size_t cycles = DSP_EVENT_NONE;
 
 	qemu_mutex_lock(&state->mutex);
-	active = (state->control & TEAK_TMR2_CTRL_DT2ACT) != 0;
+	if (state->clock_enabled && !state->core_idle && (state->control & TEAK_TMR2_CTRL_DT2ACT) != 0)
+		cycles = timer2_ticks_until_interrupt(state) * TIMER2_DIVIDER - state->prescaler;
 	qemu_mutex_unlock(&state->mutex);
 
-	return active;
+	return cycles;
 }
@@ -0,0 +1,289 @@
+#include "qemu/osdep.h"
+
+#include "hw/arm/pmb887x/dsp/peripheral/viterbi.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include "host/cpuinfo.h"
+#include <immintrin.h>
+#define DSP_VITERBI_HAVE_X86	1
+#endif
+
+const dsp_viterbi_ops_t *dsp_viterbi;
+
+static int16_t viterbi_saturate_int16(int32_t value) {
+	if (value > INT16_MAX)
+		return INT16_MAX;
+	if (value < INT16_MIN)
+		return INT16_MIN;
+	return value;
+}
+
+static void viterbi_eq_metrics_scalar(const dsp_viterbi_eq_t *eq,
+	uint16_t branch[DSP_VITERBI_EQ_STATES][DSP_VITERBI_EQ_STATES],
+	int16_t candidates[DSP_VITERBI_EQ_STATES][DSP_VITERBI_EQ_STATES]
+) {
+	for (size_t next = 0; next < DSP_VITERBI_EQ_STATES; next++) {
+		for (size_t previous = 0; previous < DSP_VITERBI_EQ_STATES; previous++) {
+			int16_t real = viterbi_saturate_int16(eq->received_real + eq->first_real[next]);
+			int16_t imaginary = viterbi_saturate_int16(eq->received_imaginary + eq->first_imaginary[next]);
+
+			for (size_t tap = 0; tap < DSP_VITERBI_EQ_TAPS; tap++) {
+				real = viterbi_saturate_int16(real + eq->tap_real[tap][previous]);
+				imaginary = viterbi_saturate_int16(imaginary + eq->tap_imaginary[tap][previous]);
+			}
+
+			uint32_t real_square = (int32_t) real * real;
+			uint32_t imaginary_square = (int32_t) imaginary * imaginary;
+			uint32_t distance = (real_square >> 10) + (imaginary_square >> 10);
+			branch[next][previous] = distance >> 1 & 0x7FFF;
+			candidates[next][previous] = viterbi_saturate_int16(eq->metrics[previous] + branch[next][previous]);
+		}
+	}
+}
+
+static uint64_t viterbi_butterflies_scalar(const int16_t *source, int16_t *destination, const int16_t *branch,
+	size_t count
+) {
+	uint64_t decisions = 0;
+
+	for (size_t butterfly = 0; butterfly < count; butterfly++) {
+		int16_t branch_metric = branch[butterfly];
+		int16_t even_metric = source[butterfly * 2];
+		int16_t odd_metric = source[butterfly * 2 + 1];
+		int16_t lower_first = even_metric - branch_metric;
+		int16_t lower_second = odd_metric + branch_metric;
+		int16_t upper_first = even_metric + branch_metric;
+		int16_t upper_second = odd_metric - branch_metric;
+
+		destination[butterfly] = lower_first >= lower_second ? lower_first : lower_second;
+		destination[butterfly + count] = upper_first >= upper_second ? upper_first : upper_second;
+
+		if (lower_first >= lower_second)
+			decisions |= UINT64_C(1) << butterfly;
+		if (upper_first >= upper_second)
+			decisions |= UINT64_C(1) << (butterfly + count);
+	}
+	return decisions;
+}
+
+static const dsp_viterbi_ops_t viterbi_scalar = {
+	.name = "scalar",
+	.eq_metrics = viterbi_eq_metrics_scalar,
+	.butterflies = viterbi_butterflies_scalar,
+};
+
+#ifdef DSP_VITERBI_HAVE_X86
+/*
+ * All kernels below must stay bit-exact with the scalar ones: the metric
+ * arithmetic is wrapping for the channel decoder and saturating for the
+ * equalizer, which maps 1:1 onto paddw/paddsw.
+ * */
+
+static inline __m128i __attribute__((target("sse2"))) viterbi_eq_distance_sse2(__m128i real, __m128i imaginary) {
+	__m128i real_low = _mm_mullo_epi16(real, real);
+	__m128i real_high = _mm_mulhi_epi16(real, real);
+	__m128i imaginary_low = _mm_mullo_epi16(imaginary, imaginary);
+	__m128i imaginary_high = _mm_mulhi_epi16(imaginary, imaginary);
+	__m128i mask = _mm_set1_epi32(0x7FFF);
+
+	__m128i distance0 = _mm_add_epi32(_mm_srli_epi32(_mm_unpacklo_epi16(real_low, real_high), 10),
+		_mm_srli_epi32(_mm_unpacklo_epi16(imaginary_low, imaginary_high), 10));
+	__m128i distance1 = _mm_add_epi32(_mm_srli_epi32(_mm_unpackhi_epi16(real_low, real_high), 10),
+		_mm_srli_epi32(_mm_unpackhi_epi16(imaginary_low, imaginary_high), 10));
+	distance0 = _mm_and_si128(_mm_srli_epi32(distance0, 1), mask);
+	distance1 = _mm_and_si128(_mm_srli_epi32(distance1, 1), mask);
+	return _mm_packs_epi32(distance0, distance1);
+}
+
+static void __attribute__((target("sse2"))) viterbi_eq_metrics_sse2(const dsp_viterbi_eq_t *eq,
+	uint16_t branch[DSP_VITERBI_EQ_STATES][DSP_VITERBI_EQ_STATES],
+	int16_t candidates[DSP_VITERBI_EQ_STATES][DSP_VITERBI_EQ_STATES]
+) {
+	__m128i metrics = _mm_loadu_si128((const __m128i *) eq->metrics);
+	__m128i tap_real[DSP_VITERBI_EQ_TAPS];
+	__m128i tap_imaginary[DSP_VITERBI_EQ_TAPS];
+
+	for (size_t tap = 0; tap < DSP_VITERBI_EQ_TAPS; tap++) {
+		tap_real[tap] = _mm_loadu_si128((const __m128i *) eq->tap_real[tap]);
+		tap_imaginary[tap] = _mm_loadu_si128((const __m128i *) eq->tap_imaginary[tap]);
+	}
+
+	// Lanes are previous states
+	for (size_t next = 0; next < DSP_VITERBI_EQ_STATES; next++) {
+		__m128i real = _mm_set1_epi16(viterbi_saturate_int16(eq->received_real + eq->first_real[next]));
+		__m128i imaginary = _mm_set1_epi16(viterbi_saturate_int16(eq->received_imaginary + eq->first_imaginary[next]));
+
+		for (size_t tap = 0; tap < DSP_VITERBI_EQ_TAPS; tap++) {
+			real = _mm_adds_epi16(real, tap_real[tap]);
+			imaginary = _mm_adds_epi16(imaginary, tap_imaginary[tap]);
+		}
+
+		__m128i distance = viterbi_eq_distance_sse2(real, imaginary);
+		_mm_storeu_si128((__m128i *) branch[next], distance);
+		_mm_storeu_si128((__m128i *) candidates[next], _mm_adds_epi16(metrics, distance));
+	}
+}
+
+static uint64_t __attribute__((target("sse2"))) viterbi_butterflies_sse2(const int16_t *source, int16_t *destination,
+	const int16_t *branch, size_t count
+) {
+	uint64_t decisions = 0;
+
+	if (count % 8 != 0)
+		return viterbi_butterflies_scalar(source, destination, branch, count);
+
+	for (size_t butterfly = 0; butterfly < count; butterfly += 8) {
+		__m128i pair0 = _mm_loadu_si128((const __m128i *) &source[butterfly * 2]);
+		__m128i pair1 = _mm_loadu_si128((const __m128i *) &source[butterfly * 2 + 8]);
+		__m128i even = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(pair0, 16), 16),
+			_mm_srai_epi32(_mm_slli_epi32(pair1, 16), 16));
+		__m128i odd = _mm_packs_epi32(_mm_srai_epi32(pair0, 16), _mm_srai_epi32(pair1, 16));
+		__m128i metric = _mm_loadu_si128((const __m128i *) &branch[butterfly]);
+		__m128i lower_first = _mm_sub_epi16(even, metric);
+		__m128i lower_second = _mm_add_epi16(odd, metric);
+		__m128i upper_first = _mm_add_epi16(even, metric);
+		__m128i upper_second = _mm_sub_epi16(odd, metric);
+
+		_mm_storeu_si128((__m128i *) &destination[butterfly], _mm_max_epi16(lower_first, lower_second));
+		_mm_storeu_si128((__m128i *) &destination[butterfly + count], _mm_max_epi16(upper_first, upper_second));
+
+		// first >= second is !(second > first)
+		__m128i lower_taken = _mm_cmpgt_epi16(lower_second, lower_first);
+		__m128i upper_taken = _mm_cmpgt_epi16(upper_second, upper_first);
+		uint32_t mask = ~_mm_movemask_epi8(_mm_packs_epi16(lower_taken, upper_taken));
+		decisions |= (uint64_t) (mask & 0xFF) << butterfly;
+		decisions |= (uint64_t) (mask >> 8 & 0xFF) << (butterfly + count);
+	}
+	return decisions;
+}
+
+static const dsp_viterbi_ops_t viterbi_sse2 = {
+	.name = "sse2",
+	.eq_metrics = viterbi_eq_metrics_sse2,
+	.butterflies = viterbi_butterflies_sse2,
+};
+
+#ifdef CONFIG_AVX2_OPT
+static void __attribute__((target("avx2"))) viterbi_eq_metrics_avx2(const dsp_viterbi_eq_t *eq,
+	uint16_t branch[DSP_VITERBI_EQ_STATES][DSP_VITERBI_EQ_STATES],
+	int16_t candidates[DSP_VITERBI_EQ_STATES][DSP_VITERBI_EQ_STATES]
+) {
+	__m256i metrics = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) eq->metrics));
+	__m256i tap_real[DSP_VITERBI_EQ_TAPS];
+	__m256i tap_imaginary[DSP_VITERBI_EQ_TAPS];
+	__m256i mask = _mm256_set1_epi32(0x7FFF);
+
+	for (size_t tap = 0; tap < DSP_VITERBI_EQ_TAPS; tap++) {
+		tap_real[tap] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) eq->tap_real[tap]));
+		tap_imaginary[tap] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) eq->tap_imaginary[tap]));
+	}
+
+	// Two next states per vector, lanes are previous states
+	for (size_t next = 0; next < DSP_VITERBI_EQ_STATES; next += 2) {
+		__m256i real = _mm256_setr_m128i(
+			_mm_set1_epi16(viterbi_saturate_int16(eq->received_real + eq->first_real[next])),
+			_mm_set1_epi16(viterbi_saturate_int16(eq->received_real + eq->first_real[next + 1])));
+		__m256i imaginary = _mm256_setr_m128i(
+			_mm_set1_epi16(viterbi_saturate_int16(eq->received_imaginary + eq->first_imaginary[next])),
+			_mm_set1_epi16(viterbi_saturate_int16(eq->received_imaginary + eq->first_imaginary[next + 1])));
+
+		for (size_t tap = 0; tap < DSP_VITERBI_EQ_TAPS; tap++) {
+			real = _mm256_adds_epi16(real, tap_real[tap]);
+			imaginary = _mm256_adds_epi16(imaginary, tap_imaginary[tap]);
+		}
+
+		__m256i real_low = _mm256_mullo_epi16(real, real);
+		__m256i real_high = _mm256_mulhi_epi16(real, real);
+		__m256i imaginary_low = _mm256_mullo_epi16(imaginary, imaginary);
+		__m256i imaginary_high = _mm256_mulhi_epi16(imaginary, imaginary);
+		__m256i distance0 = _mm256_add_epi32(_mm256_srli_epi32(_mm256_unpacklo_epi16(real_low, real_high), 10),
+			_mm256_srli_epi32(_mm256_unpacklo_epi16(imaginary_low, imaginary_high), 10));
+		__m256i distance1 = _mm256_add_epi32(_mm256_srli_epi32(_mm256_unpackhi_epi16(real_low, real_high), 10),
+			_mm256_srli_epi32(_mm256_unpackhi_epi16(imaginary_low, imaginary_high), 10));
+		distance0 = _mm256_and_si256(_mm256_srli_epi32(distance0, 1), mask);
+		distance1 = _mm256_and_si256(_mm256_srli_epi32(distance1, 1), mask);
+
+		// unpack/pack are per 128-bit lane, so the order is restored here
+		__m256i distance = _mm256_packs_epi32(distance0, distance1);
+		_mm256_storeu_si256((__m256i *) branch[next], distance);
+		_mm256_storeu_si256((__m256i *) candidates[next], _mm256_adds_epi16(metrics, distance));
+	}
+}
+
+static uint64_t __attribute__((target("avx2"))) viterbi_butterflies_avx2(const int16_t *source, int16_t *destination,
+	const int16_t *branch, size_t count
+) {
+	uint64_t decisions = 0;
+
+	if (count % 16 != 0)
+		return viterbi_butterflies_sse2(source, destination, branch, count);
+
+	for (size_t butterfly = 0; butterfly < count; butterfly += 16) {
+		__m256i pair0 = _mm256_loadu_si256((const __m256i *) &source[butterfly * 2]);
+		__m256i pair1 = _mm256_loadu_si256((const __m256i *) &source[butterfly * 2 + 16]);
+		__m256i even = _mm256_packs_epi32(_mm256_srai_epi32(_mm256_slli_epi32(pair0, 16), 16),
+			_mm256_srai_epi32(_mm256_slli_epi32(pair1, 16), 16));
+		__m256i odd = _mm256_packs_epi32(_mm256_srai_epi32(pair0, 16), _mm256_srai_epi32(pair1, 16));
+		even = _mm256_permute4x64_epi64(even, 0xD8);
+		odd = _mm256_permute4x64_epi64(odd, 0xD8);
+
+		__m256i metric = _mm256_loadu_si256((const __m256i *) &branch[butterfly]);
+		__m256i lower_first = _mm256_sub_epi16(even, metric);
+		__m256i lower_second = _mm256_add_epi16(odd, metric);
+		__m256i upper_first = _mm256_add_epi16(even, metric);
+		__m256i upper_second = _mm256_sub_epi16(odd, metric);
+
+		_mm256_storeu_si256((__m256i *) &destination[butterfly], _mm256_max_epi16(lower_first, lower_second));
+		_mm256_storeu_si256((__m256i *) &destination[butterfly + count], _mm256_max_epi16(upper_first, upper_second));
+
+		// Bytes per 128-bit lane: lower[0..7], upper[0..7] | lower[8..15], upper[8..15]
+		__m256i lower_taken = _mm256_cmpgt_epi16(lower_second, lower_first);
+		__m256i upper_taken = _mm256_cmpgt_epi16(upper_second, upper_first);
+		uint32_t mask = ~_mm256_movemask_epi8(_mm256_packs_epi16(lower_taken, upper_taken));
+		uint64_t lower = (mask & 0xFF) | (mask >> 8 & 0xFF00);
+		uint64_t upper = (mask >> 8 & 0xFF) | (mask >> 16 & 0xFF00);
+		decisions |= lower << butterfly;
+		decisions |= upper << (butterfly + count);
+	}
+	return decisions;
+}
+
+static const dsp_viterbi_ops_t viterbi_avx2 = {
+	.name = "avx2",
+	.eq_metrics = viterbi_eq_metrics_avx2,
+	.butterflies = viterbi_butterflies_avx2,
+};
+#endif
+#endif
+
+const dsp_viterbi_ops_t *dsp_viterbi_get_ops(dsp_viterbi_impl_t impl) {
+#ifdef DSP_VITERBI_HAVE_X86
+	unsigned info = cpuinfo_init();
+#endif
+
+	switch (impl) {
+		case DSP_VITERBI_SCALAR:
+			return &viterbi_scalar;
+
+#ifdef DSP_VITERBI_HAVE_X86
+		case DSP_VITERBI_SSE2:
+			return (info & CPUINFO_SSE2) ? &viterbi_sse2 : NULL;
+
+#ifdef CONFIG_AVX2_OPT
+		case DSP_VITERBI_AVX2:
+			return (info & CPUINFO_AVX2) ? &viterbi_avx2 : NULL;
+#endif
+#endif
+
+		default:
+			return NULL;
+	}
+}
+
+static void __attribute__((constructor)) dsp_viterbi_init(void) {
+	for (int impl = DSP_VITERBI_IMPL_COUNT - 1; impl >= 0; impl--) {
+		dsp_viterbi = dsp_viterbi_get_ops(impl);
+		if (dsp_viterbi)
+			break;
+	}
+}
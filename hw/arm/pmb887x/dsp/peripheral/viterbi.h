@@ -0,0 +1,48 @@
+#ifndef HW_ARM_PMB887X_DSP_PERIPHERAL_VITERBI_H
+#define HW_ARM_PMB887X_DSP_PERIPHERAL_VITERBI_H
+
+#define DSP_VITERBI_EQ_STATES	8
+#define DSP_VITERBI_EQ_TAPS		6
+#define DSP_VITERBI_MAX_BUTTERFLIES	32
+
+typedef enum dsp_viterbi_impl_t dsp_viterbi_impl_t;
+typedef struct dsp_viterbi_eq_t dsp_viterbi_eq_t;
+typedef struct dsp_viterbi_ops_t dsp_viterbi_ops_t;
+
+enum dsp_viterbi_impl_t {
+	DSP_VITERBI_SCALAR,
+	DSP_VITERBI_SSE2,
+	DSP_VITERBI_AVX2,
+	DSP_VITERBI_IMPL_COUNT,
+};
+
+/*
+ * One equalizer trellis step. The first tap is selected by the next state,
+ * the remaining taps by the survivor path of the previous state.
+ * */
+struct dsp_viterbi_eq_t {
+	int16_t metrics[DSP_VITERBI_EQ_STATES];
+	int16_t received_real;
+	int16_t received_imaginary;
+	int16_t first_real[DSP_VITERBI_EQ_STATES];
+	int16_t first_imaginary[DSP_VITERBI_EQ_STATES];
+	int16_t tap_real[DSP_VITERBI_EQ_TAPS][DSP_VITERBI_EQ_STATES];
+	int16_t tap_imaginary[DSP_VITERBI_EQ_TAPS][DSP_VITERBI_EQ_STATES];
+};
+
+struct dsp_viterbi_ops_t {
+	const char *name;
+	// branch[next][previous] and candidates[next][previous] = metrics[previous] + branch, saturated
+	void (*eq_metrics)(const dsp_viterbi_eq_t *eq, uint16_t branch[DSP_VITERBI_EQ_STATES][DSP_VITERBI_EQ_STATES],
+		int16_t candidates[DSP_VITERBI_EQ_STATES][DSP_VITERBI_EQ_STATES]);
+	// Radix-2 add-compare-select, returns the decision bits (lower half first)
+	uint64_t (*butterflies)(const int16_t *source, int16_t *destination, const int16_t *branch, size_t count);
+};
+
+// Fastest implementation supported by the host CPU
+extern const dsp_viterbi_ops_t *dsp_viterbi;
+
+// NULL if the implementation is not available on this host
+const dsp_viterbi_ops_t *dsp_viterbi_get_ops(dsp_viterbi_impl_t impl);
+
+#endif
@@ -3,7 +3,9 @@
 
 #include "qemu/osdep.h"
 #include "qemu/atomic.h"
+#include "qemu/memalign.h"
 #include "qemu/bitops.h"
+#include "qemu/bswap.h"
 #include "qemu/rcu.h"
 
 #include "tcg/startup.h"
@@ -14,7 +16,15 @@
 #include "hw/arm/pmb887x/trace.h"
 
 #define DSP_ACTIVE_SLICE_CYCLES	32768
-#define DSP_STABLE_BLOCK_CYCLES	512
+#define DSP_TCG_CACHE_MAGIC		"PMBDTCG1"
+#define DSP_TCG_CACHE_HEADER_SIZE	24
+
+/*
+ * Translation cache file, one per program image (program RAM, ROM version and program bank):
+ *   header: magic[8], program hash (u64), rom version (u16), program bank (u16), entry count (u32)
+ *   body:   entry count block entry points (u16)
+ * Host code can't outlive the TCG buffer, so only the entry set is kept and recompiled in one batch.
+ */
 
 struct dsp_runtime_t {
 	const pmb887x_dsp_config_t *config;
@@ -25,8 +35,10 @@ struct dsp_runtime_t {
 	void (*notify_comm)(void *opaque, uint16_t flags, bool set);
 	teak_tcg_core_t core;
 	dsp_bus_t *bus;
+	dsp_audio_t *audio;
 	uint16_t *program;
 	uint16_t *data;
+	void *data_allocation;
 	size_t active_program_bank;
 	size_t active_data_bank;
 	uint16_t rom_version;
@@ -40,6 +52,11 @@ struct dsp_runtime_t {
 	bool program_start;
 	bool reschedule;
 	uint32_t program_start_pc;
+	char *cache_dir;
+	uint64_t cache_hash;
+	size_t cache_bank;
+	size_t cache_entries;
+	bool cache_save;
 };
 
 static uint16_t dsp_runtime_read_u16(const uint8_t *data) {
@@ -51,6 +68,91 @@ static void dsp_runtime_load_words(uint16_t *destination, const uint8_t *source,
 		qatomic_set(&destination[i], dsp_runtime_read_u16(source + i * sizeof(uint16_t)));
 }
 
+static uint64_t dsp_runtime_program_hash(const dsp_runtime_t *runtime) {
+	uint64_t hash = 0xCBF29CE484222325ULL;
+
+	for (size_t i = 0; i < runtime->config->program_rom_base; i++) {
+		hash = (hash ^ qatomic_read(&runtime->program[i])) * 0x100000001B3ULL;
+	}
+	return hash;
+}
+
+static char *dsp_runtime_cache_path(const dsp_runtime_t *runtime) {
+	return g_strdup_printf("%s/%s-%04X-%zu-%016" PRIX64 ".tcg", runtime->cache_dir, runtime->config->name,
+		runtime->rom_version, runtime->cache_bank, runtime->cache_hash);
+}
+
+static uint16_t *dsp_runtime_cache_load(dsp_runtime_t *runtime, size_t *count) {
+	g_autofree char *path = NULL;
+	g_autofree char *data = NULL;
+	uint16_t *entries;
+	gsize size;
+	size_t entry_count;
+
+	*count = 0;
+	runtime->cache_hash = dsp_runtime_program_hash(runtime);
+	runtime->cache_bank = runtime->active_program_bank;
+	runtime->cache_entries = 0;
+
+	path = dsp_runtime_cache_path(runtime);
+	if (!g_file_get_contents(path, &data, &size, NULL))
+		return NULL;
+
+	if (size < DSP_TCG_CACHE_HEADER_SIZE || memcmp(data, DSP_TCG_CACHE_MAGIC, 8) != 0 ||
+			ldq_le_p(data + 8) != runtime->cache_hash || lduw_le_p(data + 16) != runtime->rom_version ||
+			lduw_le_p(data + 18) != (uint16_t) runtime->cache_bank) {
+		WPRINTF("ignoring invalid translation cache: %s\n", path);
+		return NULL;
+	}
+
+	entry_count = ldl_le_p(data + 20);
+	if (entry_count > PMB887X_DSP_ADDRESS_SPACE_WORDS ||
+			size != DSP_TCG_CACHE_HEADER_SIZE + entry_count * sizeof(uint16_t)) {
+		WPRINTF("ignoring truncated translation cache: %s\n", path);
+		return NULL;
+	}
+
+	entries = g_new(uint16_t, entry_count);
+	for (size_t i = 0; i < entry_count; i++)
+		entries[i] = lduw_le_p(data + DSP_TCG_CACHE_HEADER_SIZE + i * sizeof(uint16_t));
+
+	*count = entry_count;
+	return entries;
+}
+
+static void dsp_runtime_cache_save(dsp_runtime_t *runtime) {
+	g_autofree uint16_t *entries = g_new(uint16_t, PMB887X_DSP_ADDRESS_SPACE_WORDS);
+	g_autofree uint8_t *data = NULL;
+	g_autofree char *path = NULL;
+	g_autoptr(GError) error = NULL;
+	size_t count;
+	size_t size;
+
+	count = teak_tcg_get_cached_entries(&runtime->core, entries);
+	if (count <= runtime->cache_entries)
+		return;
+
+	size = DSP_TCG_CACHE_HEADER_SIZE + count * sizeof(uint16_t);
+	data = g_malloc(size);
+	memcpy(data, DSP_TCG_CACHE_MAGIC, 8);
+	stq_le_p(data + 8, runtime->cache_hash);
+	stw_le_p(data + 16, runtime->rom_version);
+	stw_le_p(data + 18, runtime->cache_bank);
+	stl_le_p(data + 20, count);
+	for (size_t i = 0; i < count; i++)
+		stw_le_p(data + DSP_TCG_CACHE_HEADER_SIZE + i * sizeof(uint16_t), entries[i]);
+
+	path = dsp_runtime_cache_path(runtime);
+	g_mkdir_with_parents(runtime->cache_dir, 0755);
+	if (!g_file_set_contents(path, (const char *) data, size, &error)) {
+		WPRINTF("failed to save translation cache: %s\n", error->message);
+		return;
+	}
+
+	runtime->cache_entries = count;
+	DPRINTF("translation cache saved: %s entries=%zu\n", path, count);
+}
+
 void dsp_runtime_wake(dsp_runtime_t *runtime) {
 	qatomic_set(&runtime->idle, false);
 }
@@ -78,7 +180,10 @@ static void dsp_runtime_map_program_bank(dsp_runtime_t *runtime, size_t bank) {
 	bank_data = runtime->program_rom + (fixed_words + bank * bank_words) * sizeof(uint16_t);
 	dsp_runtime_load_words(runtime->program + config->program_bank_base, bank_data, bank_words);
 	teak_tcg_request_exit(&runtime->core);
-	teak_tcg_invalidate_program_range(&runtime->core, config->program_bank_base, bank_words);
+	// Translations are keyed by bank, so switching back to a bank reuses its blocks
+	if (runtime->active_program_bank == SIZE_MAX)
+		teak_tcg_invalidate_program_range(&runtime->core, config->program_bank_base, bank_words);
+	teak_tcg_set_program_bank(&runtime->core, bank);
 	runtime->active_program_bank = bank;
 }
 
@@ -221,6 +326,12 @@ static void dsp_runtime_bus_data_write(void *opaque, uint16_t address, uint16_t
 	qatomic_set(&runtime->data[address], value);
 }
 
+static void dsp_runtime_audio_output(void *opaque, dsp_audio_source_t source, int16_t sample, uint32_t rate) {
+	dsp_runtime_t *runtime = opaque;
+	if (runtime->audio != NULL)
+		dsp_audio_write(runtime->audio, source, sample, rate);
+}
+
 static uint16_t dsp_runtime_external_read(void *opaque, uint32_t index) {
 	dsp_runtime_t *runtime = opaque;
 	return dsp_bus_external_read(runtime->bus, index);
@@ -231,6 +342,23 @@ static void dsp_runtime_external_write(void *opaque, uint32_t index, uint16_t va
 	dsp_bus_external_write(runtime->bus, index, value);
 }
 
+/*
+ * The shared window is mapped into the ARM address space as RAM, so the window itself has to start on a host page.
+ * It is only 4 KiB aligned within the data space, the data space is shifted to make up for 16/64 KiB pages.
+ * One more page keeps the page-rounded RAM block inside the allocation.
+ * */
+static void dsp_runtime_alloc_data(dsp_runtime_t *runtime) {
+	size_t page_size = qemu_real_host_page_size();
+	size_t shared_offset = runtime->config->shared_base * sizeof(uint16_t);
+	size_t padding = ROUND_UP(shared_offset, page_size) - shared_offset;
+	size_t size = padding + ROUND_UP(PMB887X_DSP_ADDRESS_SPACE_WORDS * sizeof(uint16_t), page_size) + page_size;
+
+	runtime->data_allocation = qemu_memalign(page_size, size);
+	memset(runtime->data_allocation, 0, size);
+	runtime->data = (uint16_t *) ((uint8_t *) runtime->data_allocation + padding);
+	g_assert(QEMU_PTR_IS_ALIGNED(&runtime->data[runtime->config->shared_base], page_size));
+}
+
 dsp_runtime_t *dsp_runtime_create(
 	const pmb887x_dsp_config_t *config, uint16_t rom_version, const uint8_t *program_rom, const uint8_t *data_rom,
 	void *device_opaque, void (*notify_activity)(void *opaque), void (*notify_comm)(void *opaque, uint16_t flags, bool set),
@@ -249,7 +377,7 @@ dsp_runtime_t *dsp_runtime_create(
 	runtime->notify_activity = notify_activity;
 	runtime->notify_comm = notify_comm;
 	runtime->program = g_new0(uint16_t, PMB887X_DSP_ADDRESS_SPACE_WORDS);
-	runtime->data = g_new0(uint16_t, PMB887X_DSP_ADDRESS_SPACE_WORDS);
+	dsp_runtime_alloc_data(runtime);
 	runtime->active_program_bank = SIZE_MAX;
 	runtime->active_data_bank = SIZE_MAX;
 
@@ -263,6 +391,7 @@ dsp_runtime_t *dsp_runtime_create(
 		.data_read = dsp_runtime_bus_data_read,
 		.data_write = dsp_runtime_bus_data_write,
 		.ssc_transfer = ssc_transfer,
+		.audio_output = dsp_runtime_audio_output,
 	};
 	runtime->bus = dsp_bus_create(config, &host);
 
@@ -291,6 +420,7 @@ dsp_runtime_t *dsp_runtime_create(
 		.cycle_sensitive_base = config->mmio_base,
 		.cycle_sensitive_size = config->mmio_size,
 		.y_space_base = config->y_space_base,
+		.program_bank_base = config->program_bank_count > 1 ? config->program_bank_base : 0,
 	};
 
 	teak_tcg_init(&runtime->core, &memory);
@@ -298,8 +428,20 @@ dsp_runtime_t *dsp_runtime_create(
 	return runtime;
 }
 
+// Must be set before the worker starts, the pointer itself is not synchronized
+void dsp_runtime_set_audio(dsp_runtime_t *runtime, dsp_audio_t *audio) {
+	runtime->audio = audio;
+}
+
+void dsp_runtime_set_cache_dir(dsp_runtime_t *runtime, const char *dir) {
+	g_free(runtime->cache_dir);
+	runtime->cache_dir = dir != NULL && dir[0] ? g_strdup(dir) : NULL;
+}
+
 void dsp_runtime_set_clock(dsp_runtime_t *runtime, bool enabled) {
 	dsp_bus_set_clock(runtime->bus, enabled);
+	if (dsp_bus_wake_pending(runtime->bus))
+		teak_tcg_request_exit(&runtime->core);
 }
 
 void dsp_runtime_destroy(dsp_runtime_t *runtime) {
@@ -307,7 +449,8 @@ void dsp_runtime_destroy(dsp_runtime_t *runtime) {
 		return;
 
 	dsp_bus_destroy(runtime->bus);
-	g_free(runtime->data);
+	g_free(runtime->cache_dir);
+	qemu_vfree(runtime->data_allocation);
 	g_free(runtime->program);
 	g_free(runtime);
 }
@@ -317,6 +460,9 @@ void dsp_runtime_reset(dsp_runtime_t *runtime) {
 	size_t program_fixed_words = config->program_bank_base - config->program_rom_base;
 	size_t data_fixed_words = config->data_bank_base - config->data_rom_base;
 
+	if (runtime->cache_dir != NULL && qatomic_read(&runtime->mutable_program_started))
+		dsp_runtime_cache_save(runtime);
+
 	dsp_runtime_load_words(runtime->program + config->program_rom_base, runtime->program_rom, program_fixed_words);
 	dsp_runtime_load_words(runtime->data + config->data_rom_base, runtime->data_rom, data_fixed_words);
 
@@ -351,6 +497,9 @@ bool dsp_runtime_run(dsp_runtime_t *runtime) {
 
 	runtime->core.chain_exit_pc = 0;
 
+	if (qatomic_xchg(&runtime->cache_save, false))
+		dsp_runtime_cache_save(runtime);
+
 	qatomic_set(&runtime->idle, false);
 	dsp_bus_set_core_idle(runtime->bus, false);
 
@@ -358,7 +507,7 @@ bool dsp_runtime_run(dsp_runtime_t *runtime) {
 		uint8_t block_repeat_level;
 		uint32_t block_pc;
 		size_t remaining_cycles = DSP_ACTIVE_SLICE_CYCLES - cycles;
-		size_t slice_cycles = MIN(remaining_cycles, (size_t) DSP_STABLE_BLOCK_CYCLES);
+		size_t slice_cycles = MIN(remaining_cycles, dsp_bus_cycles_until_event(runtime->bus));
 		bool mutable_program = runtime->core.state.pc < runtime->config->program_rom_base;
 		bool new_program_lifecycle = !qatomic_read(&runtime->mutable_program_started);
 		bool program_changed = qatomic_read(&runtime->program_dirty);
@@ -372,8 +521,22 @@ bool dsp_runtime_run(dsp_runtime_t *runtime) {
 			qatomic_set(&runtime->mutable_program_started, true);
 			qatomic_set(&runtime->pram_cache_active, true);
 
+			g_autofree uint16_t *cached_entries = NULL;
+			size_t cached_count = 0;
+
+			if (runtime->cache_dir != NULL) {
+				if (!new_program_lifecycle)
+					dsp_runtime_cache_save(runtime);
+				cached_entries = dsp_runtime_cache_load(runtime, &cached_count);
+			}
+
 			size_t precompiled = teak_tcg_precompile_entry(&runtime->core, runtime->core.state.pc);
-			DPRINTF("cold program precompile: pc=%05X blocks=%zu\n", runtime->core.state.pc, precompiled);
+			if (cached_count != 0) {
+				precompiled += teak_tcg_precompile_entries(&runtime->core, cached_entries, cached_count);
+				runtime->cache_entries = cached_count;
+			}
+			DPRINTF("cold program precompile: pc=%05X blocks=%zu cached=%zu\n", runtime->core.state.pc,
+				precompiled, cached_count);
 		}
 
 		if (qatomic_read(&runtime->core_disabled)) {
@@ -470,8 +633,12 @@ bool dsp_runtime_is_program_warming(const dsp_runtime_t *runtime) {
 }
 
 void dsp_runtime_finish_program_warmup(dsp_runtime_t *runtime) {
-	qatomic_set(&runtime->program_warming, false);
+	bool warming = qatomic_xchg(&runtime->program_warming, false);
+
 	qatomic_set(&runtime->program_start, false);
+	// The warmed-up entry set is written by the DSP thread, which owns the block cache
+	if (warming && runtime->cache_dir != NULL)
+		qatomic_set(&runtime->cache_save, true);
 }
 
 void dsp_runtime_thread_enter(void) {
@@ -483,6 +650,10 @@ void dsp_runtime_thread_exit(void) {
 	rcu_unregister_thread();
 }
 
+uint16_t *dsp_runtime_shared_ptr(dsp_runtime_t *runtime) {
+	return &runtime->data[runtime->config->shared_base];
+}
+
 uint16_t dsp_runtime_shared_read(dsp_runtime_t *runtime, uint16_t offset) {
 	g_assert(offset < runtime->config->shared_size);
 	return qatomic_read(&runtime->data[runtime->config->shared_base + offset]);
@@ -563,6 +734,8 @@ void dsp_runtime_set_gsm_clock(dsp_runtime_t *runtime, uint32_t frequency) {
 
 void dsp_runtime_set_gsm_signal(dsp_runtime_t *runtime, pmb887x_dsp_gsm_signal_t signal, bool level) {
 	dsp_bus_set_gsm_signal(runtime->bus, signal, level);
+	if (dsp_bus_wake_pending(runtime->bus))
+		teak_tcg_request_exit(&runtime->core);
 
 	dsp_runtime_wake(runtime);
 	runtime->notify_activity(runtime->device_opaque);
@@ -580,6 +753,17 @@ uint64_t dsp_runtime_get_cache_compiles(const dsp_runtime_t *runtime) {
 	return qatomic_read(&runtime->core.cache_compiles);
 }
 
+char *dsp_runtime_get_cache_stats(const dsp_runtime_t *runtime) {
+	const teak_tcg_core_t *core = &runtime->core;
+	uint64_t hits = qatomic_read(&core->cache_fast_hits) + qatomic_read(&core->cache_decoded_hits);
+
+	return g_strdup_printf(
+		"hits=%" PRIu64 " revalidations=%" PRIu64 " misses=%" PRIu64 " compiles=%" PRIu64 " evictions=%" PRIu64,
+		hits, qatomic_read(&core->cache_revalidations), qatomic_read(&core->cache_misses),
+		qatomic_read(&core->cache_compiles), qatomic_read(&core->cache_evictions)
+	);
+}
+
 uint16_t dsp_runtime_take_output_events(dsp_runtime_t *runtime) {
 	return dsp_bus_take_output_events(runtime->bus);
 }
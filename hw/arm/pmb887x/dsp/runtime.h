@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 
+#include "hw/arm/pmb887x/dsp/audio.h"
 #include "hw/arm/pmb887x/dsp/config.h"
 #include "hw/arm/pmb887x/dsp/signals.h"
 
@@ -16,6 +17,8 @@ dsp_runtime_t *dsp_runtime_create(
 void dsp_runtime_destroy(dsp_runtime_t *runtime);
 void dsp_runtime_reset(dsp_runtime_t *runtime);
 void dsp_runtime_set_clock(dsp_runtime_t *runtime, bool enabled);
+void dsp_runtime_set_cache_dir(dsp_runtime_t *runtime, const char *dir);
+void dsp_runtime_set_audio(dsp_runtime_t *runtime, dsp_audio_t *audio);
 bool dsp_runtime_run(dsp_runtime_t *runtime);
 bool dsp_runtime_is_idle(const dsp_runtime_t *runtime);
 bool dsp_runtime_is_maskable_interrupt_active(const dsp_runtime_t *runtime);
@@ -28,6 +31,8 @@ bool dsp_runtime_is_program_warming(const dsp_runtime_t *runtime);
 void dsp_runtime_finish_program_warmup(dsp_runtime_t *runtime);
 void dsp_runtime_thread_enter(void);
 void dsp_runtime_thread_exit(void);
+// Host-endian words, shared with the core without any locking
+uint16_t *dsp_runtime_shared_ptr(dsp_runtime_t *runtime);
 uint16_t dsp_runtime_shared_read(dsp_runtime_t *runtime, uint16_t offset);
 void dsp_runtime_shared_write(dsp_runtime_t *runtime, uint16_t offset, uint16_t value);
 uint64_t dsp_runtime_shared_read_bytes(dsp_runtime_t *runtime, size_t offset, size_t size);
@@ -39,6 +44,7 @@ void dsp_runtime_set_gsm_signal(dsp_runtime_t *runtime, pmb887x_dsp_gsm_signal_t
 uint16_t dsp_runtime_get_outputs(dsp_runtime_t *runtime);
 uint32_t dsp_runtime_get_pc(const dsp_runtime_t *runtime);
 uint64_t dsp_runtime_get_cache_compiles(const dsp_runtime_t *runtime);
+char *dsp_runtime_get_cache_stats(const dsp_runtime_t *runtime);
 uint16_t dsp_runtime_take_output_events(dsp_runtime_t *runtime);
 uint16_t dsp_runtime_get_comm(dsp_runtime_t *runtime);
 void dsp_runtime_set_comm(dsp_runtime_t *runtime, uint16_t value);
@@ -17,6 +17,9 @@
 
 #define TEAK_TCG_MAX_BLOCK_INSTRUCTIONS	64
 #define TEAK_TCG_BLOCK_CACHE_ENTRIES	((size_t) UINT16_MAX + 1)
+#define TEAK_TCG_BLOCK_CACHE_BANK_STRIDE	0x9E35U
+#define TEAK_TCG_BLOCK_CACHE_STALE_LIMIT	4096
+#define TEAK_TCG_MAX_BLOCK_WORDS	(TEAK_TCG_MAX_BLOCK_INSTRUCTIONS * 2)
 #define TEAK_ACCUMULATOR_BITS	36
 #define TEAK_ACCUMULATOR_SIGN_BIT	(TEAK_ACCUMULATOR_BITS - 1)
 #define TEAK_ACCUMULATOR_HOST_SHIFT	(64 - TEAK_ACCUMULATOR_BITS)
@@ -66,14 +69,24 @@ struct teak_tcg_block_cache_entry_t {
 	teak_tcg_block_t block;
 	TranslationBlock *tb;
 	uint64_t cache_id;
+	uint64_t hash;
+	uint32_t bank;
 	uint32_t block_repeat_end[TEAK_BLOCK_REPEAT_LEVELS];
 	uint8_t block_repeat_level;
+	bool valid;
+	bool crosses_bank;
 	teak_tcg_block_cache_entry_t *next;
 };
 
+/*
+ * Blocks are hashed by (bank, pc). Code in the fixed area uses bank 0, code in the
+ * banked window uses the mapped bank + 1. Invalidated entries stay in the table
+ * and are revived when the same program words show up again.
+ */
 static teak_tcg_block_cache_entry_t *tcg_block_cache[TEAK_TCG_BLOCK_CACHE_ENTRIES];
 static TCGContext *tcg_block_cache_context;
 static unsigned int tcg_block_cache_flush_count;
+static size_t tcg_block_cache_stale;
 static TCGv_i32 tcg_memory_pc;
 static TCGv_i32 tcg_memory_cycle;
 static uint32_t tcg_memory_access;
@@ -983,28 +996,78 @@ static TranslationBlock *tcg_compile_block(uint32_t pc, uint16_t words, uint16_t
 	return tb;
 }
 
-static void tcg_clear_block_cache(void) {
+static uint32_t tcg_program_bank(const teak_tcg_core_t *core, uint32_t pc) {
+	uint16_t bank_base = core->memory.program_bank_base;
+	if (bank_base == 0 || (uint16_t) pc < bank_base)
+		return 0;
+	return core->program_bank + 1;
+}
+
+static teak_tcg_block_cache_entry_t **tcg_cache_bucket(uint32_t bank, uint32_t pc) {
+	return &tcg_block_cache[(uint16_t) (pc + bank * TEAK_TCG_BLOCK_CACHE_BANK_STRIDE)];
+}
+
+static uint64_t tcg_block_hash(teak_tcg_core_t *core, const teak_tcg_block_t *block) {
+	uint64_t hash = 0xCBF29CE484222325ULL;
+	for (size_t i = 0; i < block->words; i++) {
+		hash ^= teak_program_read(core, (block->pc + i) & TEAK_PROGRAM_ADDRESS_MASK);
+		hash *= 0x100000001B3ULL;
+	}
+	return hash;
+}
+
+static void tcg_clear_block_cache(teak_tcg_core_t *core) {
 	for (size_t i = 0; i < ARRAY_SIZE(tcg_block_cache); i++) {
 		teak_tcg_block_cache_entry_t *entry = tcg_block_cache[i];
 
 		while (entry != NULL) {
 			teak_tcg_block_cache_entry_t *next = entry->next;
+			if (entry->cache_id == core->cache_id)
+				core->cache_evictions++;
 			g_free(entry);
 			entry = next;
 		}
 		tcg_block_cache[i] = NULL;
 	}
+	tcg_block_cache_stale = 0;
 }
 
-static void tcg_check_block_cache(void) {
+static void tcg_check_block_cache(teak_tcg_core_t *core) {
 	unsigned int flush_count = qatomic_read(&tb_ctx.tb_flush_count);
 	if (tcg_block_cache_context == tcg_ctx && tcg_block_cache_flush_count == flush_count)
 		return;
-	tcg_clear_block_cache();
+	tcg_clear_block_cache(core);
 	tcg_block_cache_context = tcg_ctx;
 	tcg_block_cache_flush_count = flush_count;
 }
 
+static void tcg_invalidate_entry(teak_tcg_block_cache_entry_t *entry) {
+	if (!entry->valid)
+		return;
+	entry->valid = false;
+	tcg_block_cache_stale++;
+}
+
+static void tcg_evict_stale_entries(teak_tcg_core_t *core) {
+	if (tcg_block_cache_stale <= TEAK_TCG_BLOCK_CACHE_STALE_LIMIT)
+		return;
+
+	for (size_t i = 0; i < ARRAY_SIZE(tcg_block_cache); i++) {
+		teak_tcg_block_cache_entry_t **link = &tcg_block_cache[i];
+		while (*link != NULL) {
+			teak_tcg_block_cache_entry_t *entry = *link;
+			if (!entry->valid) {
+				*link = entry->next;
+				g_free(entry);
+				core->cache_evictions++;
+			} else {
+				link = &entry->next;
+			}
+		}
+	}
+	tcg_block_cache_stale = 0;
+}
+
 static bool tcg_cached_block_is_prefix(const teak_tcg_block_t *cached, const teak_tcg_block_t *block) {
 	size_t instruction_bytes;
 
@@ -1020,19 +1083,29 @@ static bool tcg_cached_block_is_prefix(const teak_tcg_block_t *cached, const tea
 static TranslationBlock *tcg_find_cached_block(teak_tcg_core_t *core, teak_tcg_block_t *block) {
 	teak_tcg_block_cache_entry_t *entry;
 	teak_tcg_block_cache_entry_t *prefix = NULL;
+	uint32_t bank = tcg_program_bank(core, block->pc);
+	uint64_t hash = tcg_block_hash(core, block);
 
-	tcg_check_block_cache();
-	entry = tcg_block_cache[block->pc];
+	tcg_check_block_cache(core);
+	entry = *tcg_cache_bucket(bank, block->pc);
 	while (entry != NULL) {
 		bool longer_prefix = prefix == NULL || entry->block.instruction_count > prefix->block.instruction_count;
+		bool same_key = entry->cache_id == core->cache_id && entry->bank == bank && entry->block.pc == block->pc;
 
-		if (entry->cache_id != core->cache_id) {
+		if (!same_key) {
 			entry = entry->next;
 			continue;
 		}
-		if (memcmp(&entry->block, block, sizeof(*block)) == 0)
+		if (entry->hash == hash && memcmp(&entry->block, block, sizeof(*block)) == 0) {
+			// Same words as before the invalidation, the old translation is still good
+			if (!entry->valid) {
+				entry->valid = true;
+				tcg_block_cache_stale--;
+				core->cache_revalidations++;
+			}
 			return entry->tb;
-		if (longer_prefix && tcg_cached_block_is_prefix(&entry->block, block))
+		}
+		if (entry->valid && longer_prefix && tcg_cached_block_is_prefix(&entry->block, block))
 			prefix = entry;
 		entry = entry->next;
 	}
@@ -1046,13 +1119,16 @@ static TranslationBlock *tcg_find_cached_block(teak_tcg_core_t *core, teak_tcg_b
 static teak_tcg_block_cache_entry_t *tcg_find_cached_entry_fast(teak_tcg_core_t *core) {
 	teak_tcg_block_cache_entry_t *entry;
 	uint8_t level = core->state.bcn;
+	uint32_t pc = core->state.pc;
+	uint32_t bank = tcg_program_bank(core, pc);
 
-	tcg_check_block_cache();
-	entry = tcg_block_cache[core->state.pc];
+	tcg_check_block_cache(core);
+	entry = *tcg_cache_bucket(bank, pc);
 	while (entry != NULL) {
+		bool same_key = entry->valid && entry->block.pc == pc && entry->bank == bank;
 		bool same_cache = entry->cache_id == core->cache_id;
 		bool same_level = entry->block_repeat_level == level;
-		if (same_cache && same_level) {
+		if (same_key && same_cache && same_level) {
 			bool same_repeat_end;
 
 			if (level == 0) {
@@ -1079,85 +1155,94 @@ static TranslationBlock *tcg_find_cached_block_fast(teak_tcg_core_t *core, teak_
 	return entry->tb;
 }
 
-static void tcg_cache_block(const teak_tcg_core_t *core, const teak_tcg_block_t *block, TranslationBlock *tb) {
+static void tcg_cache_block(teak_tcg_core_t *core, const teak_tcg_block_t *block, TranslationBlock *tb) {
 	teak_tcg_block_cache_entry_t *entry = g_new(teak_tcg_block_cache_entry_t, 1);
+	teak_tcg_block_cache_entry_t **bucket;
+	uint16_t bank_base = core->memory.program_bank_base;
+
 	entry->block = *block;
 	entry->tb = tb;
 	entry->cache_id = core->cache_id;
+	entry->hash = tcg_block_hash(core, block);
+	entry->bank = tcg_program_bank(core, block->pc);
 	memcpy(entry->block_repeat_end, core->state.block_repeat_end, sizeof(entry->block_repeat_end));
 	entry->block_repeat_level = core->state.bcn;
-	entry->next = tcg_block_cache[block->pc];
-	tcg_block_cache[block->pc] = entry;
+	entry->valid = true;
+	entry->crosses_bank = bank_base != 0 && entry->bank == 0 && block->pc < bank_base &&
+		block->pc + block->words > bank_base;
+
+	bucket = tcg_cache_bucket(entry->bank, block->pc);
+	entry->next = *bucket;
+	*bucket = entry;
 }
 
-static bool tcg_block_contains_address(const teak_tcg_block_t *block, uint16_t address) {
+static bool tcg_block_intersects(const teak_tcg_block_t *block, uint16_t start, size_t words) {
 	for (size_t i = 0; i < block->instruction_count; i++) {
 		const teak_insn_t *instruction = &block->instructions[i];
-		if ((uint16_t) instruction->address == address)
-			return true;
-		if (instruction->words == 2 && (uint16_t) (instruction->address + 1) == address)
+		uint16_t offset = (uint16_t) instruction->address - start;
+		if (offset < words || (instruction->words == 2 && (uint16_t) (offset + 1) < words))
 			return true;
 	}
 	return false;
 }
 
 void teak_tcg_invalidate_program(teak_tcg_core_t *core, uint32_t address) {
-	uint16_t program_address = (uint16_t) address;
+	teak_tcg_invalidate_program_range(core, address, 1);
+}
 
-	tcg_check_block_cache();
-	for (size_t distance = 0; distance < TEAK_TCG_MAX_BLOCK_INSTRUCTIONS * 2; distance++) {
-		uint16_t start = program_address - distance;
-		teak_tcg_block_cache_entry_t **link = &tcg_block_cache[start];
-		while (*link != NULL) {
-			teak_tcg_block_cache_entry_t *entry = *link;
-			bool contains_address = tcg_block_contains_address(&entry->block, program_address);
-			bool matching_entry = entry->cache_id == core->cache_id && contains_address;
-			if (matching_entry) {
-				*link = entry->next;
-				g_free(entry);
-			} else {
-				link = &entry->next;
-			}
+void teak_tcg_invalidate_program_range(teak_tcg_core_t *core, uint32_t address, size_t words) {
+	uint16_t start = (uint16_t) address;
+	uint16_t first = start - (TEAK_TCG_MAX_BLOCK_WORDS - 1);
+	size_t count = MIN(words + TEAK_TCG_MAX_BLOCK_WORDS - 1, TEAK_TCG_BLOCK_CACHE_ENTRIES);
+
+	// Only blocks starting up to one maximum block length before the range can overlap it
+	tcg_check_block_cache(core);
+	for (size_t i = 0; i < count; i++) {
+		uint16_t pc = first + i;
+		uint32_t bank = tcg_program_bank(core, pc);
+
+		for (teak_tcg_block_cache_entry_t *entry = *tcg_cache_bucket(bank, pc); entry != NULL; entry = entry->next) {
+			bool same_key = entry->cache_id == core->cache_id && entry->bank == bank && entry->block.pc == pc;
+			if (same_key && entry->valid && tcg_block_intersects(&entry->block, start, words))
+				tcg_invalidate_entry(entry);
 		}
 	}
+	tcg_evict_stale_entries(core);
 }
 
-void teak_tcg_invalidate_program_range(teak_tcg_core_t *core, uint32_t address, size_t words) {
-	uint16_t start = (uint16_t) address;
+void teak_tcg_set_program_bank(teak_tcg_core_t *core, uint32_t bank) {
+	uint16_t bank_base = core->memory.program_bank_base;
 
-	tcg_check_block_cache();
-	for (size_t i = 0; i < ARRAY_SIZE(tcg_block_cache); i++) {
-		teak_tcg_block_cache_entry_t **link = &tcg_block_cache[i];
-		while (*link != NULL) {
-			teak_tcg_block_cache_entry_t *entry = *link;
-			bool intersects = false;
-			for (size_t j = 0; j < entry->block.instruction_count; j++) {
-				const teak_insn_t *instruction = &entry->block.instructions[j];
-				uint16_t offset = (uint16_t) instruction->address - start;
-				intersects = offset < words || (instruction->words == 2 && (uint16_t) (offset + 1) < words);
-				if (intersects)
-					break;
-			}
+	if (core->program_bank == bank)
+		return;
+	core->program_bank = bank;
+	if (bank_base == 0)
+		return;
 
-			if (entry->cache_id == core->cache_id && intersects) {
-				*link = entry->next;
-				g_free(entry);
-			} else {
-				link = &entry->next;
-			}
+	// Blocks inside the window are keyed by bank, only fixed-area blocks running into it go stale
+	tcg_check_block_cache(core);
+	for (size_t i = 1; i < TEAK_TCG_MAX_BLOCK_WORDS; i++) {
+		uint16_t pc = bank_base - i;
+		for (teak_tcg_block_cache_entry_t *entry = *tcg_cache_bucket(0, pc); entry != NULL; entry = entry->next) {
+			if (entry->cache_id == core->cache_id && entry->bank == 0 && entry->block.pc == pc && entry->crosses_bank)
+				tcg_invalidate_entry(entry);
 		}
 	}
+	tcg_evict_stale_entries(core);
 }
 
 void teak_tcg_invalidate_all(teak_tcg_core_t *core) {
-	tcg_check_block_cache();
+	tcg_check_block_cache(core);
 	for (size_t i = 0; i < ARRAY_SIZE(tcg_block_cache); i++) {
 		teak_tcg_block_cache_entry_t **link = &tcg_block_cache[i];
 		while (*link != NULL) {
 			teak_tcg_block_cache_entry_t *entry = *link;
 			if (entry->cache_id == core->cache_id) {
 				*link = entry->next;
+				if (!entry->valid)
+					tcg_block_cache_stale--;
 				g_free(entry);
+				core->cache_evictions++;
 			} else {
 				link = &entry->next;
 			}
@@ -4574,6 +4659,7 @@ static TranslationBlock *tcg_prepare_block(teak_tcg_core_t *core, teak_tcg_block
 			core->cache_decoded_hits++;
 			break;
 		}
+		core->cache_misses++;
 
 		tb = tcg_compile_block(block->pc, block->words, block->instruction_count, tcg_emit_block,
 			block, &compile_error);
@@ -4584,7 +4670,7 @@ static TranslationBlock *tcg_prepare_block(teak_tcg_core_t *core, teak_tcg_block
 		}
 
 		if (compile_error == TEAK_TCG_COMPILE_RETRY) {
-			tcg_check_block_cache();
+			tcg_check_block_cache(core);
 			continue;
 		}
 
@@ -4606,7 +4692,7 @@ static void tcg_precompile_enqueue(uint16_t *queue, bool *queued, size_t *tail,
 	queue[(*tail)++] = pc;
 }
 
-size_t teak_tcg_precompile_entry(teak_tcg_core_t *core, uint32_t entry) {
+size_t teak_tcg_precompile_entries(teak_tcg_core_t *core, const uint16_t *entries, size_t count) {
 	uint16_t *queue = g_new(uint16_t, (size_t) TEAK_PROGRAM_ADDRESS_MASK + 1);
 	bool *queued = g_new0(bool, (size_t) TEAK_PROGRAM_ADDRESS_MASK + 1);
 	size_t head = 0;
@@ -4619,7 +4705,8 @@ size_t teak_tcg_precompile_entry(teak_tcg_core_t *core, uint32_t entry) {
 	uint8_t saved_bcn = core->state.bcn;
 	uint8_t saved_lp = core->state.lp;
 
-	tcg_precompile_enqueue(queue, queued, &tail, entry);
+	for (size_t i = 0; i < count; i++)
+		tcg_precompile_enqueue(queue, queued, &tail, entries[i]);
 	for (size_t i = 0; i < ARRAY_SIZE(teak_interrupt_vectors); i++)
 		tcg_precompile_enqueue(queue, queued, &tail, teak_interrupt_vectors[i]);
 
@@ -4688,6 +4775,30 @@ size_t teak_tcg_precompile_entry(teak_tcg_core_t *core, uint32_t entry) {
 	return blocks;
 }
 
+size_t teak_tcg_precompile_entry(teak_tcg_core_t *core, uint32_t entry) {
+	uint16_t pc = (uint16_t) entry;
+	return teak_tcg_precompile_entries(core, &pc, 1);
+}
+
+size_t teak_tcg_get_cached_entries(teak_tcg_core_t *core, uint16_t *entries) {
+	g_autofree uint8_t *cached = g_new0(uint8_t, TEAK_TCG_BLOCK_CACHE_ENTRIES);
+	size_t count = 0;
+
+	tcg_check_block_cache(core);
+	for (size_t i = 0; i < ARRAY_SIZE(tcg_block_cache); i++) {
+		for (teak_tcg_block_cache_entry_t *entry = tcg_block_cache[i]; entry != NULL; entry = entry->next) {
+			bool mapped = entry->bank == tcg_program_bank(core, entry->block.pc);
+			if (entry->cache_id == core->cache_id && entry->valid && mapped && entry->block_repeat_level == 0)
+				cached[(uint16_t) entry->block.pc] = 1;
+		}
+	}
+	for (size_t pc = 0; pc < TEAK_TCG_BLOCK_CACHE_ENTRIES; pc++) {
+		if (cached[pc])
+			entries[count++] = pc;
+	}
+	return count;
+}
+
 static void tcg_complete_block_cycles(teak_tcg_core_t *core, uint32_t block_cycles) {
 	assert(core->synchronized_cycles <= block_cycles);
 	core->pending_cycles += block_cycles - core->synchronized_cycles;
@@ -9,8 +9,11 @@ void teak_tcg_update_irq_lines(teak_tcg_core_t *core, uint8_t lines);
 void teak_tcg_request_exit(teak_tcg_core_t *core);
 bool teak_tcg_service_interrupt(teak_tcg_core_t *core);
 size_t teak_tcg_precompile_entry(teak_tcg_core_t *core, uint32_t entry);
+size_t teak_tcg_precompile_entries(teak_tcg_core_t *core, const uint16_t *entries, size_t count);
+size_t teak_tcg_get_cached_entries(teak_tcg_core_t *core, uint16_t *entries);
 void teak_tcg_invalidate_program(teak_tcg_core_t *core, uint32_t address);
 void teak_tcg_invalidate_program_range(teak_tcg_core_t *core, uint32_t address, size_t words);
+void teak_tcg_set_program_bank(teak_tcg_core_t *core, uint32_t bank);
 void teak_tcg_invalidate_all(teak_tcg_core_t *core);
 bool teak_tcg_execute_block(teak_tcg_core_t *core);
 bool teak_tcg_execute_slice(teak_tcg_core_t *core, size_t max_cycles);
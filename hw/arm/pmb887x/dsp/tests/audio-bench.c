@@ -0,0 +1,46 @@
+#include "qemu/osdep.h"
+
+#include "hw/arm/pmb887x/dsp/audio.h"
+
+#define BENCH_SECONDS	1.0
+#define BENCH_OUTPUT_RATE	44100
+#define BENCH_CHUNK_FRAMES	512
+
+static void bench_render(uint32_t voice_rate, uint32_t i2s_rate) {
+	dsp_audio_t *audio = g_new0(dsp_audio_t, 1);
+	int16_t output[BENCH_CHUNK_FRAMES];
+	int16_t noise[BENCH_CHUNK_FRAMES * 2];
+	size_t frames = 0;
+
+	dsp_audio_init(audio, BENCH_OUTPUT_RATE);
+	for (size_t i = 0; i < ARRAY_SIZE(noise); i++)
+		noise[i] = g_test_rand_int_range(-0x4000, 0x4000);
+
+	g_test_timer_start();
+	do {
+		// Keep both rings around the latency target, like a DSP running in real time
+		for (size_t i = 0; i < (size_t) voice_rate * BENCH_CHUNK_FRAMES / BENCH_OUTPUT_RATE + 1; i++)
+			dsp_audio_write(audio, DSP_AUDIO_VOICE, noise[i], voice_rate);
+		for (size_t i = 0; i < (size_t) i2s_rate * BENCH_CHUNK_FRAMES / BENCH_OUTPUT_RATE + 1; i++)
+			dsp_audio_write(audio, DSP_AUDIO_I2S, noise[i], i2s_rate);
+		dsp_audio_render(audio, output, BENCH_CHUNK_FRAMES);
+		frames += BENCH_CHUNK_FRAMES;
+	} while (g_test_timer_elapsed() < BENCH_SECONDS);
+
+	double elapsed = g_test_timer_last();
+	g_test_message("voice %5u Hz + i2s %5u Hz -> %u Hz: %6.3f ms of CPU per second of audio", voice_rate, i2s_rate,
+		BENCH_OUTPUT_RATE, elapsed * 1e3 / ((double) frames / BENCH_OUTPUT_RATE));
+	g_free(audio);
+}
+
+static void bench_audio(void) {
+	bench_render(8000, 8000);
+	bench_render(16000, 44444);
+	bench_render(47619, 48000);
+}
+
+int main(int argc, char **argv) {
+	g_test_init(&argc, &argv, NULL);
+	g_test_add_func("/pmb887x/dsp/audio/bench", bench_audio);
+	return g_test_run();
+}
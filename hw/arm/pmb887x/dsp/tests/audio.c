@@ -0,0 +1,134 @@
+#include "qemu/osdep.h"
+
+#include <math.h>
+
+#include "hw/arm/pmb887x/dsp/audio.h"
+
+#define TEST_OUTPUT_RATE	44100
+#define TEST_SETTLE_FRAMES	128
+
+static dsp_audio_t *test_audio_create(void) {
+	dsp_audio_t *audio = g_new0(dsp_audio_t, 1);
+	dsp_audio_init(audio, TEST_OUTPUT_RATE);
+	return audio;
+}
+
+static void test_write_tone(dsp_audio_t *audio, dsp_audio_source_t source, uint32_t rate, size_t count,
+	double frequency, double amplitude, double offset) {
+	for (size_t i = 0; i < count; i++) {
+		double value = offset + amplitude * sin(2 * M_PI * frequency * i / rate);
+		dsp_audio_write(audio, source, (int16_t) lround(value), rate);
+	}
+}
+
+static void test_ring_overflow(void) {
+	dsp_audio_t *audio = test_audio_create();
+
+	test_write_tone(audio, DSP_AUDIO_VOICE, 8000, DSP_AUDIO_RING_CAPACITY + 10, 0, 0, 1);
+	g_assert_cmpuint(audio->streams[DSP_AUDIO_VOICE].ring.dropped, ==, 10);
+	g_assert_cmpuint(audio->streams[DSP_AUDIO_VOICE].ring.head, ==, DSP_AUDIO_RING_CAPACITY);
+	g_assert_cmpuint(audio->streams[DSP_AUDIO_I2S].ring.head, ==, 0);
+	g_free(audio);
+}
+
+static void test_resample_dc(void) {
+	dsp_audio_t *audio = test_audio_create();
+	int16_t output[4410];
+
+	test_write_tone(audio, DSP_AUDIO_VOICE, 8000, 8000, 0, 0, 10000);
+	dsp_audio_render(audio, output, ARRAY_SIZE(output));
+	for (size_t i = TEST_SETTLE_FRAMES; i < ARRAY_SIZE(output); i++)
+		g_assert_cmpint(abs(output[i] - 10000), <=, 16);
+	g_free(audio);
+}
+
+static void test_resample_tone(void) {
+	dsp_audio_t *audio = test_audio_create();
+	size_t frames = TEST_OUTPUT_RATE / 2;
+	int16_t *output = g_new(int16_t, frames);
+	size_t crossings = 0;
+	int16_t peak = 0;
+
+	test_write_tone(audio, DSP_AUDIO_VOICE, 8000, 8000, 1000, 8000, 0);
+	dsp_audio_render(audio, output, frames);
+	for (size_t i = TEST_SETTLE_FRAMES + 1; i < frames; i++) {
+		if ((output[i - 1] < 0) != (output[i] < 0))
+			crossings++;
+		peak = MAX(peak, output[i]);
+	}
+
+	// 1 kHz for ~0.5 s, the drift control may speed playback up by 0.5%
+	g_assert_cmpuint(crossings, >=, 980);
+	g_assert_cmpuint(crossings, <=, 1020);
+	g_assert_cmpint(peak, >=, 7600);
+	g_assert_cmpint(peak, <=, 8400);
+	g_free(output);
+	g_free(audio);
+}
+
+static void test_underrun(void) {
+	dsp_audio_t *audio = test_audio_create();
+	dsp_audio_stream_t *stream = &audio->streams[DSP_AUDIO_I2S];
+	size_t target = 16000 * DSP_AUDIO_LATENCY_MS / 1000;
+	int16_t output[2048];
+
+	// Not enough for the prefill yet, the ring is left untouched
+	test_write_tone(audio, DSP_AUDIO_I2S, 16000, target - 1, 0, 0, 1000);
+	dsp_audio_render(audio, output, ARRAY_SIZE(output));
+	g_assert_false(stream->playing);
+	g_assert_cmpuint(stream->ring.tail, ==, 0);
+	g_assert_cmpint(output[ARRAY_SIZE(output) - 1], ==, 0);
+
+	test_write_tone(audio, DSP_AUDIO_I2S, 16000, 1, 0, 0, 1000);
+	dsp_audio_render(audio, output, ARRAY_SIZE(output));
+	g_assert_cmpuint(stream->ring.tail, ==, target);
+	g_assert_cmpuint(stream->underruns, ==, 1);
+	g_assert_false(stream->playing);
+	g_assert_cmpint(abs(output[TEST_SETTLE_FRAMES] - 1000), <=, 2);
+	g_assert_cmpint(output[ARRAY_SIZE(output) - 1], ==, 0);
+	g_free(audio);
+}
+
+static void test_producer_rate(void) {
+	dsp_audio_t *audio = test_audio_create();
+	dsp_audio_stream_t *stream = &audio->streams[DSP_AUDIO_VOICE];
+	int16_t output[256];
+	uint64_t written = 0;
+
+	// The DSP runs twice as fast as it should, 16000 samples per second arrive at the declared 8000 Hz
+	for (size_t frames = 0; frames < TEST_OUTPUT_RATE * 2; frames += ARRAY_SIZE(output)) {
+		uint64_t due = (uint64_t) (frames + ARRAY_SIZE(output)) * 16000 / TEST_OUTPUT_RATE;
+		test_write_tone(audio, DSP_AUDIO_VOICE, 8000, due - written, 0, 0, 1000);
+		written = due;
+		dsp_audio_render(audio, output, ARRAY_SIZE(output));
+	}
+
+	g_assert_cmpuint(stream->measured_rate, >=, 15900);
+	g_assert_cmpuint(stream->measured_rate, <=, 16100);
+	g_assert_cmpuint(stream->ring.dropped, ==, 0);
+	g_assert_cmpuint(stream->underruns, ==, 0);
+	g_assert_true(stream->playing);
+	g_free(audio);
+}
+
+static void test_mix(void) {
+	dsp_audio_t *audio = test_audio_create();
+	int16_t output[512];
+
+	test_write_tone(audio, DSP_AUDIO_VOICE, 8000, 1000, 0, 0, 20000);
+	test_write_tone(audio, DSP_AUDIO_I2S, 48000, 4000, 0, 0, 20000);
+	dsp_audio_render(audio, output, ARRAY_SIZE(output));
+	g_assert_cmpint(output[ARRAY_SIZE(output) - 1], ==, INT16_MAX);
+	g_free(audio);
+}
+
+int main(int argc, char **argv) {
+	g_test_init(&argc, &argv, NULL);
+	g_test_add_func("/pmb887x/dsp/audio/ring-overflow", test_ring_overflow);
+	g_test_add_func("/pmb887x/dsp/audio/resample-dc", test_resample_dc);
+	g_test_add_func("/pmb887x/dsp/audio/resample-tone", test_resample_tone);
+	g_test_add_func("/pmb887x/dsp/audio/underrun", test_underrun);
+	g_test_add_func("/pmb887x/dsp/audio/producer-rate", test_producer_rate);
+	g_test_add_func("/pmb887x/dsp/audio/mix", test_mix);
+	return g_test_run();
+}
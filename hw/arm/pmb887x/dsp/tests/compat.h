@@ -284,6 +284,7 @@ typedef dsp_host_t pmb887x_dsp_peripheral_host_t;
 #define pmb887x_dsp_peripheral_bus_set_core_idle dsp_bus_set_core_idle
 #define pmb887x_dsp_peripheral_bus_advance dsp_bus_advance
 #define pmb887x_dsp_peripheral_bus_is_active dsp_bus_is_active
+#define pmb887x_dsp_peripheral_bus_cycles_until_event dsp_bus_cycles_until_event
 #define pmb887x_dsp_peripheral_bus_read dsp_bus_read
 #define pmb887x_dsp_peripheral_bus_write dsp_bus_write
 #define pmb887x_dsp_peripheral_bus_external_read dsp_bus_external_read
@@ -1,6 +1,9 @@
 #include "qemu/osdep.h"
 
 #include "hw/arm/pmb887x/dsp/peripheral.h"
+#include "hw/arm/pmb887x/dsp/peripheral/cipher-a5.h"
+#include "hw/arm/pmb887x/dsp/peripheral/cipher-kasumi.h"
+#include "hw/arm/pmb887x/dsp/peripheral/viterbi.h"
 #include "hw/arm/pmb887x/regs_dump.h"
 #include "hw/arm/pmb887x/trace_common.h"
 
@@ -188,6 +191,27 @@ static void test_modulator(void) {
 	pmb887x_dsp_peripheral_bus_destroy(bus);
 }
 
+static void test_afe_deadline(void) {
+	test_host_t host = {};
+	pmb887x_dsp_peripheral_bus_t *bus = test_bus_create(&host);
+
+	pmb887x_dsp_peripheral_bus_reset(bus);
+	g_assert_false(pmb887x_dsp_peripheral_bus_is_active(bus));
+	pmb887x_dsp_peripheral_bus_write(bus, TEST_AFE_BASE, 4);
+	pmb887x_dsp_peripheral_bus_write(bus, TEST_AFE_BASE + 2, 3);
+	g_assert_true(pmb887x_dsp_peripheral_bus_is_active(bus));
+	g_assert_cmpuint(pmb887x_dsp_peripheral_bus_cycles_until_event(bus), ==, 64);
+	pmb887x_dsp_peripheral_bus_advance(bus, 40);
+	g_assert_cmphex(pmb887x_dsp_peripheral_bus_read(bus, TEST_AFE_BASE + 1), ==, 2);
+	g_assert_cmpuint(pmb887x_dsp_peripheral_bus_cycles_until_event(bus), ==, 24);
+	g_assert_cmphex(pmb887x_dsp_peripheral_bus_read(bus, TEST_INTERRUPT_BASE + 4), ==, 0);
+	pmb887x_dsp_peripheral_bus_advance(bus, 24);
+	g_assert_cmphex(pmb887x_dsp_peripheral_bus_read(bus, TEST_INTERRUPT_BASE + 4), ==, 0x0020);
+	pmb887x_dsp_peripheral_bus_write(bus, TEST_AFE_BASE + 2, 0);
+	g_assert_false(pmb887x_dsp_peripheral_bus_is_active(bus));
+	pmb887x_dsp_peripheral_bus_destroy(bus);
+}
+
 static void test_unknown(void) {
 	test_host_t host = {};
 	pmb887x_dsp_peripheral_bus_t *bus = test_bus_create(&host);
@@ -226,6 +250,161 @@ static void test_trace(void) {
 	pmb887x_dsp_peripheral_bus_destroy(bus);
 }
 
+static void test_viterbi_butterflies(void) {
+	const dsp_viterbi_ops_t *scalar = dsp_viterbi_get_ops(DSP_VITERBI_SCALAR);
+	static const size_t counts[] = { 8, 32 };
+
+	for (int impl = DSP_VITERBI_SCALAR + 1; impl < DSP_VITERBI_IMPL_COUNT; impl++) {
+		const dsp_viterbi_ops_t *ops = dsp_viterbi_get_ops(impl);
+		if (!ops)
+			continue;
+
+		for (size_t iteration = 0; iteration < 4096; iteration++) {
+			size_t count = counts[iteration % ARRAY_SIZE(counts)];
+			int16_t source[DSP_VITERBI_MAX_BUTTERFLIES * 2];
+			int16_t branch[DSP_VITERBI_MAX_BUTTERFLIES];
+			int16_t expected[DSP_VITERBI_MAX_BUTTERFLIES * 2] = {};
+			int16_t actual[DSP_VITERBI_MAX_BUTTERFLIES * 2] = {};
+
+			// Small ranges give ties, full ranges give wraparound
+			int32_t range = iteration & 1 ? 0x10000 : 8;
+			for (size_t i = 0; i < count * 2; i++)
+				source[i] = g_test_rand_int_range(-range / 2, range / 2);
+			for (size_t i = 0; i < count; i++)
+				branch[i] = g_test_rand_int_range(-384, 385);
+
+			uint64_t expected_decisions = scalar->butterflies(source, expected, branch, count);
+			uint64_t actual_decisions = ops->butterflies(source, actual, branch, count);
+			g_assert_cmphex(actual_decisions, ==, expected_decisions);
+			g_assert_cmpmem(actual, sizeof(actual), expected, sizeof(expected));
+		}
+	}
+}
+
+static void test_viterbi_equalizer(void) {
+	const dsp_viterbi_ops_t *scalar = dsp_viterbi_get_ops(DSP_VITERBI_SCALAR);
+
+	for (int impl = DSP_VITERBI_SCALAR + 1; impl < DSP_VITERBI_IMPL_COUNT; impl++) {
+		const dsp_viterbi_ops_t *ops = dsp_viterbi_get_ops(impl);
+		if (!ops)
+			continue;
+
+		for (size_t iteration = 0; iteration < 4096; iteration++) {
+			uint16_t expected_branch[DSP_VITERBI_EQ_STATES][DSP_VITERBI_EQ_STATES];
+			uint16_t actual_branch[DSP_VITERBI_EQ_STATES][DSP_VITERBI_EQ_STATES];
+			int16_t expected_candidates[DSP_VITERBI_EQ_STATES][DSP_VITERBI_EQ_STATES];
+			int16_t actual_candidates[DSP_VITERBI_EQ_STATES][DSP_VITERBI_EQ_STATES];
+			dsp_viterbi_eq_t eq;
+
+			// Half of the runs saturate the taps
+			int32_t range = iteration & 1 ? 0x10000 : 0x1000;
+			int16_t *words = (int16_t *) &eq;
+			for (size_t i = 0; i < sizeof(eq) / sizeof(*words); i++)
+				words[i] = g_test_rand_int_range(-range / 2, range / 2);
+
+			scalar->eq_metrics(&eq, expected_branch, expected_candidates);
+			ops->eq_metrics(&eq, actual_branch, actual_candidates);
+			g_assert_cmpmem(actual_branch, sizeof(actual_branch), expected_branch, sizeof(expected_branch));
+			g_assert_cmpmem(actual_candidates, sizeof(actual_candidates), expected_candidates,
+				sizeof(expected_candidates));
+		}
+	}
+}
+
+// Reference vectors publish each 114-bit burst MSB first
+static void test_cipher_burst(const uint8_t *keystream, size_t burst, uint8_t output[15]) {
+	memset(output, 0, 15);
+	for (size_t i = 0; i < 114; i++) {
+		size_t bit = burst * 114 + i;
+		output[i / 8] |= (keystream[bit / 8] >> (bit % 8) & 1) << (7 - i % 8);
+	}
+}
+
+static void test_cipher_a5_vectors(void) {
+	static const uint8_t a51_key[8] = { 0x12, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF };
+	static const uint8_t a51_bursts[2][15] = {
+		{ 0x53, 0x4E, 0xAA, 0x58, 0x2F, 0xE8, 0x15, 0x1A, 0xB6, 0xE1, 0x85, 0x5A, 0x72, 0x8C, 0x00 },
+		{ 0x24, 0xFD, 0x35, 0xA3, 0x5D, 0x5F, 0xB6, 0x52, 0x6D, 0x32, 0xF9, 0x06, 0xDF, 0x1A, 0xC0 },
+	};
+	static const uint8_t a52_key[8] = { 0x00, 0xFC, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+	static const uint8_t a52_bursts[2][15] = {
+		{ 0xF4, 0x51, 0x2C, 0xAC, 0x13, 0x59, 0x37, 0x64, 0x46, 0x0B, 0x72, 0x2D, 0xAD, 0xD5, 0x00 },
+		{ 0x48, 0x00, 0xD4, 0x32, 0x8E, 0x16, 0xA1, 0x4D, 0xCD, 0x7B, 0x97, 0x22, 0x26, 0x51, 0x00 },
+	};
+	uint8_t keystream[DIV_ROUND_UP(114 * 2, 8)];
+	uint8_t burst[15];
+
+	cipher_a51_keystream(a51_key, 0x134, keystream, 114 * 2);
+	for (size_t i = 0; i < 2; i++) {
+		test_cipher_burst(keystream, i, burst);
+		g_assert_cmpmem(burst, sizeof(burst), a51_bursts[i], sizeof(a51_bursts[i]));
+	}
+
+	cipher_a52_keystream(a52_key, 0x21, keystream, 114 * 2);
+	for (size_t i = 0; i < 2; i++) {
+		test_cipher_burst(keystream, i, burst);
+		g_assert_cmpmem(burst, sizeof(burst), a52_bursts[i], sizeof(a52_bursts[i]));
+	}
+}
+
+static void test_cipher_a5_batch(void) {
+	static const size_t lengths[] = { 114 * 2, 348 * 2, 64, 7 };
+
+	for (size_t iteration = 0; iteration < 16; iteration++) {
+		size_t frames = iteration & 1 ? CIPHER_A5_BATCH_MAX : g_test_rand_int_range(1, CIPHER_A5_BATCH_MAX);
+		size_t bits = lengths[iteration % ARRAY_SIZE(lengths)];
+		size_t stride = DIV_ROUND_UP(bits, 8);
+		uint32_t counts[CIPHER_A5_BATCH_MAX];
+		uint8_t key[8];
+		g_autofree uint8_t *batch = g_malloc0(CIPHER_A5_BATCH_MAX * stride);
+		g_autofree uint8_t *single = g_malloc0(stride);
+
+		for (size_t i = 0; i < sizeof(key); i++)
+			key[i] = g_test_rand_int();
+		for (size_t i = 0; i < frames; i++)
+			counts[i] = g_test_rand_int() & 0x3FFFFF;
+
+		cipher_a51_keystream_batch(key, counts, frames, batch, stride, bits);
+		for (size_t i = 0; i < frames; i++) {
+			cipher_a51_keystream(key, counts[i], single, bits);
+			g_assert_cmpmem(batch + i * stride, stride, single, stride);
+		}
+
+		cipher_a52_keystream_batch(key, counts, frames, batch, stride, bits);
+		for (size_t i = 0; i < frames; i++) {
+			cipher_a52_keystream(key, counts[i], single, bits);
+			g_assert_cmpmem(batch + i * stride, stride, single, stride);
+		}
+	}
+}
+
+static void test_cipher_kasumi(void) {
+	static const uint8_t key[16] = {
+		0x2B, 0xD6, 0x45, 0x9F, 0x82, 0xC5, 0xB3, 0x00, 0x95, 0x2C, 0x49, 0x10, 0x48, 0x81, 0xFF, 0x48,
+	};
+	cipher_kasumi_keys_t keys;
+	cipher_kgcore_t kgcore = { .valid = false };
+	uint8_t expected[DIV_ROUND_UP(114 * 2, 8)];
+	uint8_t actual[DIV_ROUND_UP(114 * 2, 8)];
+
+	// TS 35.203 test set 1
+	cipher_kasumi_setup(&keys, key);
+	g_assert_cmphex(cipher_kasumi_encrypt(&keys, 0xEA024714AD5C4D84ULL), ==, 0xDF1F9B251C0BF45FULL);
+
+	for (size_t iteration = 0; iteration < 64; iteration++) {
+		uint8_t next_key[16];
+		uint32_t count = g_test_rand_int() & 0x3FFFFF;
+
+		// The cached schedules must follow key changes
+		memcpy(next_key, key, sizeof(next_key));
+		next_key[iteration % sizeof(next_key)] ^= iteration / 16;
+		cipher_kgcore(0x0F, iteration & 0x1F, count, 0, 0, next_key, expected, 114 * 2);
+		cipher_kgcore_set_key(&kgcore, next_key);
+		cipher_kgcore_generate(&kgcore, 0x0F, iteration & 0x1F, count, 0, 0, actual, 114 * 2);
+		g_assert_cmpmem(actual, sizeof(actual), expected, sizeof(expected));
+	}
+}
+
 int main(int argc, char **argv) {
 	g_test_init(&argc, &argv, NULL);
 	g_test_add_func("/pmb887x/dsp/peripheral/control", test_control);
@@ -233,7 +412,13 @@ int main(int argc, char **argv) {
 	g_test_add_func("/pmb887x/dsp/peripheral/mcs", test_mcs);
 	g_test_add_func("/pmb887x/dsp/peripheral/interrupt", test_interrupt);
 	g_test_add_func("/pmb887x/dsp/peripheral/modulator", test_modulator);
+	g_test_add_func("/pmb887x/dsp/peripheral/afe-deadline", test_afe_deadline);
 	g_test_add_func("/pmb887x/dsp/peripheral/unknown", test_unknown);
 	g_test_add_func("/pmb887x/dsp/peripheral/trace", test_trace);
+	g_test_add_func("/pmb887x/dsp/peripheral/viterbi-butterflies", test_viterbi_butterflies);
+	g_test_add_func("/pmb887x/dsp/peripheral/viterbi-equalizer", test_viterbi_equalizer);
+	g_test_add_func("/pmb887x/dsp/peripheral/cipher-a5-vectors", test_cipher_a5_vectors);
+	g_test_add_func("/pmb887x/dsp/peripheral/cipher-a5-batch", test_cipher_a5_batch);
+	g_test_add_func("/pmb887x/dsp/peripheral/cipher-kasumi", test_cipher_kasumi);
 	return g_test_run();
 }
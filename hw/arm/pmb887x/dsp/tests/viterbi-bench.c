@@ -0,0 +1,67 @@
+#include "qemu/osdep.h"
+
+#include "hw/arm/pmb887x/dsp/peripheral/viterbi.h"
+
+#define BENCH_SECONDS	1.0
+
+static void bench_butterflies(const dsp_viterbi_ops_t *ops, size_t count) {
+	int16_t metrics[2][DSP_VITERBI_MAX_BUTTERFLIES * 2];
+	int16_t branch[DSP_VITERBI_MAX_BUTTERFLIES];
+	uint64_t decisions = 0;
+	size_t steps = 0;
+
+	for (size_t i = 0; i < ARRAY_SIZE(metrics[0]); i++)
+		metrics[0][i] = g_test_rand_int_range(-0x1000, 0x1000);
+	for (size_t i = 0; i < ARRAY_SIZE(branch); i++)
+		branch[i] = g_test_rand_int_range(-384, 385);
+
+	g_test_timer_start();
+	do {
+		for (size_t i = 0; i < 1024; i++, steps++)
+			decisions ^= ops->butterflies(metrics[steps & 1], metrics[~steps & 1], branch, count);
+	} while (g_test_timer_elapsed() < BENCH_SECONDS);
+
+	double elapsed = g_test_timer_last();
+	g_test_message("chdec %2zu states %-6s: %8.2f Msteps/s (%" PRIx64 ")", count * 2, ops->name,
+		steps / elapsed / 1e6, decisions);
+}
+
+static void bench_equalizer(const dsp_viterbi_ops_t *ops) {
+	uint16_t branch[DSP_VITERBI_EQ_STATES][DSP_VITERBI_EQ_STATES];
+	int16_t candidates[DSP_VITERBI_EQ_STATES][DSP_VITERBI_EQ_STATES];
+	dsp_viterbi_eq_t eq;
+	size_t steps = 0;
+
+	int16_t *words = (int16_t *) &eq;
+	for (size_t i = 0; i < sizeof(eq) / sizeof(*words); i++)
+		words[i] = g_test_rand_int_range(-0x1000, 0x1000);
+
+	g_test_timer_start();
+	do {
+		for (size_t i = 0; i < 1024; i++, steps++) {
+			ops->eq_metrics(&eq, branch, candidates);
+			eq.metrics[steps % DSP_VITERBI_EQ_STATES] = candidates[steps % DSP_VITERBI_EQ_STATES][0];
+		}
+	} while (g_test_timer_elapsed() < BENCH_SECONDS);
+
+	double elapsed = g_test_timer_last();
+	g_test_message("equalizer 8 states %-6s: %8.2f Msteps/s", ops->name, steps / elapsed / 1e6);
+}
+
+static void bench_viterbi(void) {
+	for (int impl = 0; impl < DSP_VITERBI_IMPL_COUNT; impl++) {
+		const dsp_viterbi_ops_t *ops = dsp_viterbi_get_ops(impl);
+		if (!ops)
+			continue;
+
+		bench_butterflies(ops, 8);
+		bench_butterflies(ops, 32);
+		bench_equalizer(ops);
+	}
+}
+
+int main(int argc, char **argv) {
+	g_test_init(&argc, &argv, NULL);
+	g_test_add_func("/pmb887x/dsp/viterbi/bench", bench_viterbi);
+	return g_test_run();
+}
@@ -3,10 +3,22 @@
 
 #include "qemu/osdep.h"
 #include "qapi/error.h"
+#include "qapi/visitor.h"
 #include "qemu/error-report.h"
+#include "qemu/bitmap.h"
+#include "qemu/bswap.h"
+#include "qemu/crc32c.h"
+#include "qemu/coroutine.h"
+#include "qemu/main-loop.h"
+#include "qemu/timer.h"
+#include "qemu/aio-wait.h"
 #include "block/block_int-common.h"
+#include "block/thread-pool.h"
 #include "hw/core/sysbus.h"
 #include "system/block-backend.h"
+#include "system/runstate.h"
+#include "system/tcg.h"
+#include "exec/tb-flush.h"
 #include "hw/core/qdev-properties.h"
 #include "hw/core/qdev-properties-system.h"
 #include "hw/arm/pmb887x/trace.h"
@@ -15,10 +27,101 @@
 #define TYPE_PMB887X_FLASH_BLK	"pmb887x-flash-blk"
 #define PMB887X_FLASH_BLK(obj)	OBJECT_CHECK(struct pmb887x_flash_blk_t, (obj), TYPE_PMB887X_FLASH_BLK)
 
+#define FLASH_BLK_CHUNK_SIZE		4096
+#define FLASH_BLK_MAX_BATCH			(4 * 1024 * 1024)
+
+/*
+ * Journal layout (little endian):
+ *   header:  magic[8], version, chunk size, records count, reserved
+ *   record:  offset (u64), size (u32), crc32c of data (u32), data
+ *   trailer: magic[8], crc32c of header and all records, reserved
+ * A transaction is valid only when the trailer CRC matches, so a torn journal write is simply discarded.
+ */
+#define FLASH_BLK_JOURNAL_MAGIC			"PMBFJRNL"
+#define FLASH_BLK_JOURNAL_COMMIT_MAGIC	"PMBFJCMT"
+#define FLASH_BLK_JOURNAL_VERSION		1
+#define FLASH_BLK_JOURNAL_HEADER_SIZE	24
+#define FLASH_BLK_JOURNAL_RECORD_SIZE	16
+#define FLASH_BLK_JOURNAL_TRAILER_SIZE	16
+
+/*
+ * Overlay layout (little endian, every area is 4 KiB aligned):
+ *   header:    magic[8], version, chunk size, image size (u64), map offset (u64), aux offset (u64), data offset (u64)
+ *   map:       one bit per image chunk, set when the chunk lives in the overlay
+ *   aux table: entries of name[240], offset (u64), size (u32), reserved (u32)
+ *   data:      chunks at data offset + image offset, the file is sparse
+ *   aux data:  EFA/OTP contents, allocated after the data area
+ * */
+#define FLASH_BLK_OVERLAY_MAGIC			"PMBFOVL1"
+#define FLASH_BLK_OVERLAY_VERSION		1
+#define FLASH_BLK_OVERLAY_PAGE			4096
+#define FLASH_BLK_OVERLAY_AUX_ENTRY		256
+#define FLASH_BLK_OVERLAY_AUX_NAME		240
+#define FLASH_BLK_OVERLAY_AUX_MAX		(FLASH_BLK_OVERLAY_PAGE / FLASH_BLK_OVERLAY_AUX_ENTRY)
+
+typedef struct pmb887x_flash_blk_region_t pmb887x_flash_blk_region_t;
+typedef struct pmb887x_flash_blk_run_t pmb887x_flash_blk_run_t;
+typedef struct pmb887x_flash_blk_journal_io_t pmb887x_flash_blk_journal_io_t;
+
+struct pmb887x_flash_blk_region_t {
+	int64_t offset;
+	int64_t size;
+	uint8_t *storage;
+};
+
+struct pmb887x_flash_blk_run_t {
+	int64_t offset;
+	uint32_t size;
+	uint32_t data_offset;
+};
+
+struct pmb887x_flash_blk_journal_io_t {
+	int fd;
+	const uint8_t *data;
+	size_t size;
+};
+
+typedef struct {
+	pmb887x_flash_blk_t *flash;
+	int64_t offset;
+	int64_t size;
+	const uint8_t *data;
+} pmb887x_flash_blk_store_io_t;
+
 struct pmb887x_flash_blk_t {
 	SysBusDevice parent_obj;
 	DeviceState *dev;
 	BlockBackend *blk;
+
+	bool lazy;
+	int image_fd;
+	uint64_t shared_perm;
+
+	char *overlay_file;
+	int overlay_fd;
+	int64_t overlay_chunks_n;
+	uint8_t *overlay_map;
+	uint32_t overlay_map_size;
+	uint8_t overlay_aux[FLASH_BLK_OVERLAY_PAGE];
+	int64_t overlay_aux_offset;
+	int64_t overlay_data_offset;
+	int64_t overlay_aux_data_offset;
+
+	bool writeback;
+	uint32_t writeback_delay;
+	char *journal_file;
+
+	pmb887x_flash_blk_region_t *regions;
+	uint32_t regions_n;
+
+	unsigned long *dirty;
+	int64_t chunks_n;
+	int64_t dirty_n;
+	QEMUTimer *flush_timer;
+	bool flush_running;
+	int journal_fd;
+
+	VMChangeStateEntry *vmstate;
 };
 
 int pmb887x_flash_blk_pread(pmb887x_flash_blk_t *flash, int64_t offset, int64_t size, void *storage) {
@@ -30,7 +133,7 @@ int pmb887x_flash_blk_pwrite(pmb887x_flash_blk_t *flash, int64_t offset, int64_t
 }
 
 bool pmb887x_flash_blk_is_rw(pmb887x_flash_blk_t *flash) {
-	return blk_supports_write_perm(flash->blk);
+	return flash->overlay_fd >= 0 || blk_supports_write_perm(flash->blk);
 }
 
 int64_t pmb887x_flash_blk_size(pmb887x_flash_blk_t *flash) {
@@ -46,40 +149,940 @@ pmb887x_flash_blk_t *pmb887x_flash_blk_self(DeviceState *dev) {
 	return PMB887X_FLASH_BLK(dev);
 }
 
+static pmb887x_flash_blk_region_t *flash_blk_find_region(pmb887x_flash_blk_t *flash, int64_t offset) {
+	for (uint32_t i = 0; i < flash->regions_n; i++) {
+		pmb887x_flash_blk_region_t *region = &flash->regions[i];
+		if (offset >= region->offset && offset < region->offset + region->size)
+			return region;
+	}
+	return NULL;
+}
+
+static int flash_blk_overlay_load(pmb887x_flash_blk_t *flash, pmb887x_flash_blk_region_t *region);
+
+void pmb887x_flash_blk_attach_storage(pmb887x_flash_blk_t *flash, int64_t offset, int64_t size, uint8_t *storage) {
+	flash->regions = g_renew(pmb887x_flash_blk_region_t, flash->regions, flash->regions_n + 1);
+	pmb887x_flash_blk_region_t *region = &flash->regions[flash->regions_n++];
+	*region = (pmb887x_flash_blk_region_t) {
+		.offset = offset,
+		.size = size,
+		.storage = storage,
+	};
+
+	if (flash->overlay_fd >= 0) {
+		if ((offset % FLASH_BLK_CHUNK_SIZE) || (size % FLASH_BLK_CHUNK_SIZE)) {
+			EPRINTF("Storage %08"PRIX64"...%08"PRIX64" is not aligned to overlay chunks", offset, offset + size - 1);
+			exit(1);
+		}
+
+		int ret = flash_blk_overlay_load(flash, region);
+		if (ret < 0) {
+			EPRINTF("Can't read overlay %s: %d, %s", flash->overlay_file, ret, strerror(-ret));
+			exit(1);
+		}
+	}
+}
+
+/*
+ * Lazy loading
+ * */
+static const char *flash_blk_raw_image_filename(pmb887x_flash_blk_t *flash) {
+	GRAPH_RDLOCK_GUARD_MAINLOOP();
+	BlockDriverState *bs = blk_bs(flash->blk);
+
+	// Only a plain file, directly or through the raw format driver, maps 1:1 to the guest flash
+	if (bs->drv && bs->drv->format_name && strcmp(bs->drv->format_name, "raw") == 0 && bs->file)
+		bs = bs->file->bs;
+	if (!bs->drv || !bs->drv->protocol_name || strcmp(bs->drv->protocol_name, "file") != 0)
+		return NULL;
+	return bs->filename;
+}
+
+static void flash_blk_open_image(pmb887x_flash_blk_t *flash) {
+	const char *filename = flash_blk_raw_image_filename(flash);
+	if (!filename) {
+		DPRINTF("Lazy loading is not available for non-raw image, fallback to pread\n");
+		return;
+	}
+
+	int fd = qemu_open(filename, O_RDONLY, NULL);
+	if (fd < 0) {
+		WPRINTF("Can't open %s for mapping, fallback to pread", filename);
+		return;
+	}
+
+	// A raw driver with offset/size options doesn't cover the whole file, keep pread for such cases
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size != blk_getlength(flash->blk)) {
+		DPRINTF("Image size mismatch, fallback to pread\n");
+		qemu_close(fd);
+		return;
+	}
+
+	/*
+	 * Private pages which were never written still follow the file, so nobody else may write the image
+	 * while it is mapped. Image locking extends this to other QEMU processes, external tools are not covered.
+	 * */
+	uint64_t perm, shared_perm;
+	blk_get_perm(flash->blk, &perm, &shared_perm);
+	if (blk_set_perm(flash->blk, perm, shared_perm & ~BLK_PERM_WRITE, NULL) < 0) {
+		DPRINTF("Image is writable by others, fallback to pread\n");
+		qemu_close(fd);
+		return;
+	}
+
+	flash->shared_perm = shared_perm & ~BLK_PERM_WRITE;
+	flash->image_fd = fd;
+}
+
+int pmb887x_flash_blk_map(pmb887x_flash_blk_t *flash, int64_t offset, int64_t size, uint8_t *storage) {
+	uintptr_t page_size = qemu_real_host_page_size();
+
+	if (flash->image_fd < 0)
+		return -ENOTSUP;
+	if ((offset % page_size) || ((uintptr_t) storage % page_size))
+		return -EINVAL;
+	if (offset + size > blk_getlength(flash->blk))
+		return -EINVAL;
+
+	/*
+	 * Replace anonymous ROMD pages with a private file mapping: pages are read on first touch,
+	 * and guest programming only dirties (copies) the touched pages. Persisting is done
+	 * explicitly with pmb887x_flash_blk_write_storage().
+	 * Only whole file pages are mapped, a partial last page stays anonymous and is read now.
+	 * */
+	int64_t mapped = ROUND_DOWN(size, page_size);
+	if (mapped > 0) {
+		void *ptr = mmap(storage, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, flash->image_fd, offset);
+		if (ptr == MAP_FAILED)
+			return -errno;
+	}
+	if (mapped < size)
+		return blk_pread(flash->blk, offset + mapped, size - mapped, storage + mapped, 0);
+	return 0;
+}
+
+/*
+ * Overlay
+ * */
+static int flash_blk_fd_pwrite(int fd, const void *data, size_t size, off_t offset) {
+	size_t done = 0;
+	while (done < size) {
+		ssize_t ret = pwrite(fd, (const uint8_t *) data + done, size - done, offset + done);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		done += ret;
+	}
+	return 0;
+}
+
+static int flash_blk_fd_pread(int fd, void *data, size_t size, off_t offset) {
+	size_t done = 0;
+	while (done < size) {
+		ssize_t ret = pread(fd, (uint8_t *) data + done, size - done, offset + done);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		if (ret == 0) {
+			// Hole at the end of sparse file
+			memset((uint8_t *) data + done, 0, size - done);
+			break;
+		}
+		done += ret;
+	}
+	return 0;
+}
+
+static inline bool flash_blk_overlay_has_chunk(pmb887x_flash_blk_t *flash, int64_t chunk) {
+	return (flash->overlay_map[chunk / 8] >> (chunk % 8)) & 1;
+}
+
+static int flash_blk_overlay_write_header(pmb887x_flash_blk_t *flash) {
+	uint8_t header[FLASH_BLK_OVERLAY_PAGE] = { 0 };
+	memcpy(header, FLASH_BLK_OVERLAY_MAGIC, 8);
+	stl_le_p(header + 8, FLASH_BLK_OVERLAY_VERSION);
+	stl_le_p(header + 12, FLASH_BLK_CHUNK_SIZE);
+	stq_le_p(header + 16, blk_getlength(flash->blk));
+	stq_le_p(header + 24, FLASH_BLK_OVERLAY_PAGE);
+	stq_le_p(header + 32, flash->overlay_aux_offset);
+	stq_le_p(header + 40, flash->overlay_data_offset);
+
+	int ret = flash_blk_fd_pwrite(flash->overlay_fd, header, sizeof(header), 0);
+	if (ret == 0)
+		ret = flash_blk_fd_pwrite(flash->overlay_fd, flash->overlay_map, flash->overlay_map_size, FLASH_BLK_OVERLAY_PAGE);
+	if (ret == 0)
+		ret = flash_blk_fd_pwrite(flash->overlay_fd, flash->overlay_aux, sizeof(flash->overlay_aux), flash->overlay_aux_offset);
+	return ret;
+}
+
+static void flash_blk_overlay_open(pmb887x_flash_blk_t *flash) {
+	int64_t image_size = blk_getlength(flash->blk);
+
+	flash->overlay_chunks_n = DIV_ROUND_UP(image_size, FLASH_BLK_CHUNK_SIZE);
+	flash->overlay_map_size = ROUND_UP(DIV_ROUND_UP(flash->overlay_chunks_n, 8), FLASH_BLK_OVERLAY_PAGE);
+	flash->overlay_map = g_malloc0(flash->overlay_map_size);
+	flash->overlay_aux_offset = FLASH_BLK_OVERLAY_PAGE + flash->overlay_map_size;
+	flash->overlay_data_offset = flash->overlay_aux_offset + FLASH_BLK_OVERLAY_PAGE;
+	flash->overlay_fd = qemu_open(flash->overlay_file, O_RDWR | O_CREAT, &error_fatal);
+
+	struct stat st;
+	if (fstat(flash->overlay_fd, &st) < 0) {
+		EPRINTF("Can't stat overlay %s: %s", flash->overlay_file, strerror(errno));
+		exit(1);
+	}
+
+	if (st.st_size == 0) {
+		// New overlay, starts empty
+		if (flash_blk_overlay_write_header(flash) < 0) {
+			EPRINTF("Can't create overlay %s: %s", flash->overlay_file, strerror(errno));
+			exit(1);
+		}
+		DPRINTF("Created overlay %s\n", flash->overlay_file);
+	} else {
+		uint8_t header[FLASH_BLK_OVERLAY_PAGE];
+		if (flash_blk_fd_pread(flash->overlay_fd, header, sizeof(header), 0) < 0 ||
+				memcmp(header, FLASH_BLK_OVERLAY_MAGIC, 8) != 0 ||
+				ldl_le_p(header + 8) != FLASH_BLK_OVERLAY_VERSION ||
+				ldl_le_p(header + 12) != FLASH_BLK_CHUNK_SIZE ||
+				ldq_le_p(header + 32) != flash->overlay_aux_offset ||
+				ldq_le_p(header + 40) != flash->overlay_data_offset) {
+			EPRINTF("Invalid overlay file: %s", flash->overlay_file);
+			exit(1);
+		}
+
+		if (ldq_le_p(header + 16) != image_size) {
+			EPRINTF("Overlay %s was created for another image: size %"PRIu64" != %"PRId64,
+				flash->overlay_file, ldq_le_p(header + 16), image_size);
+			exit(1);
+		}
+
+		if (flash_blk_fd_pread(flash->overlay_fd, flash->overlay_map, flash->overlay_map_size, FLASH_BLK_OVERLAY_PAGE) < 0 ||
+				flash_blk_fd_pread(flash->overlay_fd, flash->overlay_aux, sizeof(flash->overlay_aux), flash->overlay_aux_offset) < 0) {
+			EPRINTF("Can't read overlay %s: %s", flash->overlay_file, strerror(errno));
+			exit(1);
+		}
+	}
+
+	// Aux data is appended after the data area
+	flash->overlay_aux_data_offset = flash->overlay_data_offset + ROUND_UP(image_size, FLASH_BLK_OVERLAY_PAGE);
+	for (uint32_t i = 0; i < FLASH_BLK_OVERLAY_AUX_MAX; i++) {
+		const uint8_t *entry = flash->overlay_aux + i * FLASH_BLK_OVERLAY_AUX_ENTRY;
+		if (!entry[0])
+			break;
+		int64_t end = ldq_le_p(entry + FLASH_BLK_OVERLAY_AUX_NAME) + ldl_le_p(entry + FLASH_BLK_OVERLAY_AUX_NAME + 8);
+		flash->overlay_aux_data_offset = MAX(flash->overlay_aux_data_offset, ROUND_UP(end, FLASH_BLK_OVERLAY_PAGE));
+	}
+
+	DPRINTF("Using overlay %s\n", flash->overlay_file);
+}
+
+static int flash_blk_overlay_load(pmb887x_flash_blk_t *flash, pmb887x_flash_blk_region_t *region) {
+	int64_t first = region->offset / FLASH_BLK_CHUNK_SIZE;
+	int64_t end = (region->offset + region->size) / FLASH_BLK_CHUNK_SIZE;
+	int64_t loaded = 0;
+
+	for (int64_t chunk = first; chunk < end; chunk++) {
+		if (!flash_blk_overlay_has_chunk(flash, chunk))
+			continue;
+
+		int64_t run_end = chunk + 1;
+		while (run_end < end && flash_blk_overlay_has_chunk(flash, run_end))
+			run_end++;
+
+		int64_t offset = chunk * FLASH_BLK_CHUNK_SIZE;
+		int ret = flash_blk_fd_pread(flash->overlay_fd, region->storage + (offset - region->offset),
+			(run_end - chunk) * FLASH_BLK_CHUNK_SIZE, flash->overlay_data_offset + offset);
+		if (ret < 0)
+			return ret;
+		loaded += run_end - chunk;
+		chunk = run_end;
+	}
+
+	if (loaded)
+		DPRINTF("Loaded %"PRId64" chunks from overlay\n", loaded);
+	return 0;
+}
+
+static int flash_blk_overlay_write_data(pmb887x_flash_blk_t *flash, int64_t offset, int64_t size, const uint8_t *data) {
+	return flash_blk_fd_pwrite(flash->overlay_fd, data, size, flash->overlay_data_offset + offset);
+}
+
+// The map is only changed under BQL, returns true when the chunks were not in the overlay yet
+static bool flash_blk_overlay_mark(pmb887x_flash_blk_t *flash, int64_t offset, int64_t size) {
+	int64_t first = offset / FLASH_BLK_CHUNK_SIZE;
+	int64_t last = (offset + size - 1) / FLASH_BLK_CHUNK_SIZE;
+	bool changed = false;
+
+	for (int64_t chunk = first; chunk <= last; chunk++) {
+		if (!flash_blk_overlay_has_chunk(flash, chunk)) {
+			flash->overlay_map[chunk / 8] |= 1 << (chunk % 8);
+			changed = true;
+		}
+	}
+	return changed;
+}
+
+// Also called from the thread pool, reads only map bytes of the range which was just marked
+static int flash_blk_overlay_write_map(pmb887x_flash_blk_t *flash, int64_t offset, int64_t size) {
+	int64_t first = offset / FLASH_BLK_CHUNK_SIZE;
+	int64_t last = (offset + size - 1) / FLASH_BLK_CHUNK_SIZE;
+	return flash_blk_fd_pwrite(flash->overlay_fd, flash->overlay_map + first / 8, last / 8 - first / 8 + 1,
+		FLASH_BLK_OVERLAY_PAGE + first / 8);
+}
+
+// Chunk aligned write, data goes first, so the map never points to a chunk which was not written
+static int flash_blk_overlay_write(pmb887x_flash_blk_t *flash, int64_t offset, int64_t size, const uint8_t *data) {
+	int ret = flash_blk_overlay_write_data(flash, offset, size, data);
+	if (ret < 0)
+		return ret;
+	if (!flash_blk_overlay_mark(flash, offset, size))
+		return 0;
+	return flash_blk_overlay_write_map(flash, offset, size);
+}
+
+static int flash_blk_overlay_write_worker(void *opaque) {
+	pmb887x_flash_blk_store_io_t *io = opaque;
+	return flash_blk_overlay_write_data(io->flash, io->offset, io->size, io->data);
+}
+
+static int flash_blk_overlay_map_worker(void *opaque) {
+	pmb887x_flash_blk_store_io_t *io = opaque;
+	return flash_blk_overlay_write_map(io->flash, io->offset, io->size);
+}
+
+static int flash_blk_overlay_sync_worker(void *opaque) {
+	pmb887x_flash_blk_t *flash = opaque;
+	return qemu_fdatasync(flash->overlay_fd) < 0 ? -errno : 0;
+}
+
+static uint8_t *flash_blk_overlay_find_aux(pmb887x_flash_blk_t *flash, const char *name) {
+	for (uint32_t i = 0; i < FLASH_BLK_OVERLAY_AUX_MAX; i++) {
+		uint8_t *entry = flash->overlay_aux + i * FLASH_BLK_OVERLAY_AUX_ENTRY;
+		if (!entry[0] || strncmp((const char *) entry, name, FLASH_BLK_OVERLAY_AUX_NAME) == 0)
+			return entry;
+	}
+	return NULL;
+}
+
+bool pmb887x_flash_blk_aux_load(pmb887x_flash_blk_t *flash, const char *name, void *data, size_t size) {
+	if (flash->overlay_fd < 0)
+		return false;
+
+	const uint8_t *entry = flash_blk_overlay_find_aux(flash, name);
+	if (!entry || !entry[0])
+		return false;
+
+	if (ldl_le_p(entry + FLASH_BLK_OVERLAY_AUX_NAME + 8) != size) {
+		EPRINTF("Invalid size of %s in overlay %s", name, flash->overlay_file);
+		exit(1);
+	}
+
+	int ret = flash_blk_fd_pread(flash->overlay_fd, data, size, ldq_le_p(entry + FLASH_BLK_OVERLAY_AUX_NAME));
+	if (ret < 0) {
+		EPRINTF("Can't read %s from overlay %s: %d, %s", name, flash->overlay_file, ret, strerror(-ret));
+		exit(1);
+	}
+	return true;
+}
+
+bool pmb887x_flash_blk_aux_save(pmb887x_flash_blk_t *flash, const char *name, const void *data, size_t size) {
+	if (flash->overlay_fd < 0)
+		return false;
+
+	if (strlen(name) >= FLASH_BLK_OVERLAY_AUX_NAME) {
+		EPRINTF("Name is too long for overlay: %s", name);
+		exit(1);
+	}
+
+	uint8_t *entry = flash_blk_overlay_find_aux(flash, name);
+	if (!entry) {
+		EPRINTF("No free aux entries in overlay %s", flash->overlay_file);
+		exit(1);
+	}
+
+	if (!entry[0]) {
+		// Allocate once, EFA/OTP sizes never change
+		strcpy((char *) entry, name);
+		stq_le_p(entry + FLASH_BLK_OVERLAY_AUX_NAME, flash->overlay_aux_data_offset);
+		stl_le_p(entry + FLASH_BLK_OVERLAY_AUX_NAME + 8, size);
+		flash->overlay_aux_data_offset += ROUND_UP(size, FLASH_BLK_OVERLAY_PAGE);
+	}
+
+	int ret = flash_blk_fd_pwrite(flash->overlay_fd, data, size, ldq_le_p(entry + FLASH_BLK_OVERLAY_AUX_NAME));
+	if (ret == 0)
+		ret = flash_blk_fd_pwrite(flash->overlay_fd, flash->overlay_aux, sizeof(flash->overlay_aux), flash->overlay_aux_offset);
+	if (ret < 0) {
+		EPRINTF("Can't write %s to overlay %s: %d, %s", name, flash->overlay_file, ret, strerror(-ret));
+		exit(1);
+	}
+	return true;
+}
+
+static int flash_blk_overlay_reset(pmb887x_flash_blk_t *flash) {
+	memset(flash->overlay_map, 0, flash->overlay_map_size);
+	memset(flash->overlay_aux, 0, sizeof(flash->overlay_aux));
+	flash->overlay_aux_data_offset = flash->overlay_data_offset + ROUND_UP(blk_getlength(flash->blk), FLASH_BLK_OVERLAY_PAGE);
+
+	if (ftruncate(flash->overlay_fd, 0) < 0)
+		return -errno;
+	int ret = flash_blk_overlay_write_header(flash);
+	if (ret < 0)
+		return ret;
+	return qemu_fdatasync(flash->overlay_fd) < 0 ? -errno : 0;
+}
+
+static int flash_blk_overlay_commit_data(pmb887x_flash_blk_t *flash, Error **errp) {
+	g_autofree uint8_t *buffer = g_malloc(FLASH_BLK_CHUNK_SIZE);
+	int ret = 0;
+	for (int64_t chunk = 0; chunk < flash->overlay_chunks_n && ret >= 0; chunk++) {
+		if (!flash_blk_overlay_has_chunk(flash, chunk))
+			continue;
+		int64_t offset = chunk * FLASH_BLK_CHUNK_SIZE;
+		ret = flash_blk_fd_pread(flash->overlay_fd, buffer, FLASH_BLK_CHUNK_SIZE, flash->overlay_data_offset + offset);
+		if (ret >= 0)
+			ret = blk_pwrite(flash->blk, offset, MIN(FLASH_BLK_CHUNK_SIZE, blk_getlength(flash->blk) - offset), buffer, 0);
+	}
+	if (ret >= 0)
+		ret = blk_flush(flash->blk);
+	if (ret < 0) {
+		error_setg_errno(errp, -ret, "can't commit overlay to %s", pmb887x_flash_blk_filename(flash));
+		return ret;
+	}
+
+	// Aux entries are keyed by their original file names
+	for (uint32_t i = 0; i < FLASH_BLK_OVERLAY_AUX_MAX; i++) {
+		const uint8_t *entry = flash->overlay_aux + i * FLASH_BLK_OVERLAY_AUX_ENTRY;
+		if (!entry[0])
+			break;
+
+		uint32_t size = ldl_le_p(entry + FLASH_BLK_OVERLAY_AUX_NAME + 8);
+		g_autofree uint8_t *data = g_malloc(size);
+		g_autoptr(GError) error = NULL;
+		if (flash_blk_fd_pread(flash->overlay_fd, data, size, ldq_le_p(entry + FLASH_BLK_OVERLAY_AUX_NAME)) < 0 ||
+				!g_file_set_contents((const char *) entry, (const char *) data, size, &error)) {
+			error_setg(errp, "can't commit %s", (const char *) entry);
+			return -EIO;
+		}
+	}
+	return 0;
+}
+
+static void flash_blk_overlay_commit(pmb887x_flash_blk_t *flash, Error **errp) {
+	if (flash->overlay_fd < 0) {
+		error_setg(errp, "overlay is not used");
+		return;
+	}
+
+	if (!blk_supports_write_perm(flash->blk)) {
+		error_setg(errp, "base image %s is read-only", pmb887x_flash_blk_filename(flash));
+		return;
+	}
+
+	pmb887x_flash_blk_flush(flash);
+
+	/*
+	 * Other instances map the base image lazily and don't share WRITE with anybody, so the lock fails
+	 * while they are running: their untouched pages would silently change under the guest otherwise.
+	 * */
+	if (blk_set_perm(flash->blk, BLK_PERM_CONSISTENT_READ | BLK_PERM_WRITE, flash->shared_perm, errp) < 0) {
+		error_prepend(errp, "base image %s is used by another instance: ", pmb887x_flash_blk_filename(flash));
+		return;
+	}
+
+	int ret = flash_blk_overlay_commit_data(flash, errp);
+	blk_set_perm(flash->blk, BLK_PERM_CONSISTENT_READ, flash->shared_perm, &error_abort);
+	if (ret < 0)
+		return;
+
+	ret = flash_blk_overlay_reset(flash);
+	if (ret < 0) {
+		error_setg_errno(errp, -ret, "can't reset overlay %s", flash->overlay_file);
+		return;
+	}
+
+	DPRINTF("Overlay %s committed to %s\n", flash->overlay_file, pmb887x_flash_blk_filename(flash));
+}
+
+static void flash_blk_overlay_discard(pmb887x_flash_blk_t *flash, Error **errp) {
+	if (flash->overlay_fd < 0) {
+		error_setg(errp, "overlay is not used");
+		return;
+	}
+
+	// The storage backs ROMD regions: a running vCPU would keep executing translated code of the dropped contents
+	if (runstate_is_running()) {
+		error_setg(errp, "stop the VM before discarding the overlay");
+		return;
+	}
+	g_assert(bql_locked());
+
+	// Pending writes belong to the overlay being discarded
+	if (flash->dirty) {
+		timer_del(flash->flush_timer);
+		AIO_WAIT_WHILE(NULL, flash->flush_running);
+		bitmap_zero(flash->dirty, flash->chunks_n);
+		flash->dirty_n = 0;
+	}
+
+	int ret = flash_blk_overlay_reset(flash);
+	if (ret < 0) {
+		error_setg_errno(errp, -ret, "can't reset overlay %s", flash->overlay_file);
+		return;
+	}
+
+	// Flash contents go back to the base image immediately, EFA/OTP on the next start
+	for (uint32_t i = 0; i < flash->regions_n; i++) {
+		pmb887x_flash_blk_region_t *region = &flash->regions[i];
+		ret = blk_pread(flash->blk, region->offset, region->size, region->storage, 0);
+		if (ret < 0) {
+			error_setg_errno(errp, -ret, "can't reload %s", pmb887x_flash_blk_filename(flash));
+			return;
+		}
+	}
+
+	if (tcg_enabled())
+		tb_flush__exclusive_or_serial();
+
+	DPRINTF("Overlay %s discarded\n", flash->overlay_file);
+}
+
+/*
+ * Journal
+ * */
+static int flash_blk_journal_write_worker(void *opaque) {
+	pmb887x_flash_blk_journal_io_t *io = opaque;
+	size_t done = 0;
+
+	while (done < io->size) {
+		ssize_t ret = pwrite(io->fd, io->data + done, io->size - done, done);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		done += ret;
+	}
+
+	if (ftruncate(io->fd, io->size) < 0)
+		return -errno;
+	if (qemu_fdatasync(io->fd) < 0)
+		return -errno;
+	return 0;
+}
+
+static void flash_blk_journal_reset(pmb887x_flash_blk_t *flash) {
+	int ret = flash->journal_fd >= 0 ? ftruncate(flash->journal_fd, 0) : truncate(flash->journal_file, 0);
+	if (ret < 0)
+		WPRINTF("Can't truncate journal %s: %s", flash->journal_file, strerror(errno));
+}
+
+static uint8_t *flash_blk_journal_build(const uint8_t *data, const pmb887x_flash_blk_run_t *runs, uint32_t runs_n,
+	size_t *journal_size
+) {
+	size_t size = FLASH_BLK_JOURNAL_HEADER_SIZE + FLASH_BLK_JOURNAL_TRAILER_SIZE;
+	for (uint32_t i = 0; i < runs_n; i++)
+		size += FLASH_BLK_JOURNAL_RECORD_SIZE + runs[i].size;
+
+	uint8_t *journal = g_malloc0(size);
+	uint8_t *ptr = journal;
+
+	memcpy(ptr, FLASH_BLK_JOURNAL_MAGIC, 8);
+	stl_le_p(ptr + 8, FLASH_BLK_JOURNAL_VERSION);
+	stl_le_p(ptr + 12, FLASH_BLK_CHUNK_SIZE);
+	stl_le_p(ptr + 16, runs_n);
+	ptr += FLASH_BLK_JOURNAL_HEADER_SIZE;
+
+	for (uint32_t i = 0; i < runs_n; i++) {
+		const uint8_t *run_data = data + runs[i].data_offset;
+		stq_le_p(ptr, runs[i].offset);
+		stl_le_p(ptr + 8, runs[i].size);
+		stl_le_p(ptr + 12, crc32c(0xFFFFFFFF, run_data, runs[i].size));
+		memcpy(ptr + FLASH_BLK_JOURNAL_RECORD_SIZE, run_data, runs[i].size);
+		ptr += FLASH_BLK_JOURNAL_RECORD_SIZE + runs[i].size;
+	}
+
+	memcpy(ptr, FLASH_BLK_JOURNAL_COMMIT_MAGIC, 8);
+	stl_le_p(ptr + 8, crc32c(0xFFFFFFFF, journal, ptr - journal));
+
+	*journal_size = size;
+	return journal;
+}
+
+static void flash_blk_journal_replay(pmb887x_flash_blk_t *flash) {
+	g_autofree char *journal = NULL;
+	g_autoptr(GError) error = NULL;
+	size_t journal_size = 0;
+
+	if (!g_file_get_contents(flash->journal_file, &journal, &journal_size, &error)) {
+		if (!g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+			WPRINTF("Can't read journal %s: %s", flash->journal_file, error->message);
+		return;
+	}
+
+	if (journal_size < FLASH_BLK_JOURNAL_HEADER_SIZE + FLASH_BLK_JOURNAL_TRAILER_SIZE)
+		return;
+
+	const uint8_t *data = (const uint8_t *) journal;
+	if (memcmp(data, FLASH_BLK_JOURNAL_MAGIC, 8) != 0 || ldl_le_p(data + 8) != FLASH_BLK_JOURNAL_VERSION) {
+		WPRINTF("Ignoring journal %s with unknown format", flash->journal_file);
+		return;
+	}
+
+	// Walk records to find the trailer, then check the whole transaction before touching the image
+	uint32_t records_n = ldl_le_p(data + 16);
+	size_t pos = FLASH_BLK_JOURNAL_HEADER_SIZE;
+	for (uint32_t i = 0; i < records_n; i++) {
+		if (pos + FLASH_BLK_JOURNAL_RECORD_SIZE > journal_size)
+			goto uncommitted;
+		uint32_t size = ldl_le_p(data + pos + 8);
+		if (size > journal_size - pos - FLASH_BLK_JOURNAL_RECORD_SIZE)
+			goto uncommitted;
+		pos += FLASH_BLK_JOURNAL_RECORD_SIZE + size;
+	}
+	if (pos + FLASH_BLK_JOURNAL_TRAILER_SIZE > journal_size)
+		goto uncommitted;
+	if (memcmp(data + pos, FLASH_BLK_JOURNAL_COMMIT_MAGIC, 8) != 0)
+		goto uncommitted;
+	if (ldl_le_p(data + pos + 8) != crc32c(0xFFFFFFFF, data, pos))
+		goto uncommitted;
+
+	// A committed journal is kept as is when any record doesn't fit this image, nothing is applied
+	int64_t image_size = blk_getlength(flash->blk);
+	pos = FLASH_BLK_JOURNAL_HEADER_SIZE;
+	for (uint32_t i = 0; i < records_n; i++) {
+		uint64_t offset = ldq_le_p(data + pos);
+		uint32_t size = ldl_le_p(data + pos + 8);
+		const uint8_t *record = data + pos + FLASH_BLK_JOURNAL_RECORD_SIZE;
+
+		// The overlay is written in whole chunks, a plain image may end with a partial one
+		bool aligned = !(offset % FLASH_BLK_CHUNK_SIZE) && (flash->overlay_fd < 0 || !(size % FLASH_BLK_CHUNK_SIZE));
+		if (!size || !aligned || offset > image_size || size > image_size - offset) {
+			EPRINTF("Journal %s record %08"PRIX64"...%08"PRIX64" doesn't fit %s",
+				flash->journal_file, offset, offset + size - 1, pmb887x_flash_blk_filename(flash));
+			exit(1);
+		}
+
+		if (ldl_le_p(data + pos + 12) != crc32c(0xFFFFFFFF, record, size)) {
+			EPRINTF("Corrupted record in committed journal %s", flash->journal_file);
+			exit(1);
+		}
+		pos += FLASH_BLK_JOURNAL_RECORD_SIZE + size;
+	}
+
+	pos = FLASH_BLK_JOURNAL_HEADER_SIZE;
+	for (uint32_t i = 0; i < records_n; i++) {
+		int64_t offset = ldq_le_p(data + pos);
+		uint32_t size = ldl_le_p(data + pos + 8);
+		const uint8_t *record = data + pos + FLASH_BLK_JOURNAL_RECORD_SIZE;
+
+		int ret = flash->overlay_fd >= 0 ?
+			flash_blk_overlay_write(flash, offset, size, record) :
+			blk_pwrite(flash->blk, offset, size, record, 0);
+		if (ret < 0) {
+			EPRINTF("Can't replay journal to flash file: %d, %s", ret, strerror(-ret));
+			exit(1);
+		}
+		pos += FLASH_BLK_JOURNAL_RECORD_SIZE + size;
+	}
+
+	int ret = flash->overlay_fd >= 0 ?
+		(qemu_fdatasync(flash->overlay_fd) < 0 ? -errno : 0) :
+		blk_flush(flash->blk);
+	if (ret < 0) {
+		EPRINTF("Can't flush flash file: %d, %s", ret, strerror(-ret));
+		exit(1);
+	}
+
+	DPRINTF("Replayed %u records from journal %s\n", records_n, flash->journal_file);
+	flash_blk_journal_reset(flash);
+	return;
+
+uncommitted:
+	DPRINTF("Discarding uncommitted journal %s\n", flash->journal_file);
+	flash_blk_journal_reset(flash);
+}
+
+/*
+ * Write-back cache
+ * */
+static uint32_t flash_blk_collect_runs(pmb887x_flash_blk_t *flash, uint8_t *data, pmb887x_flash_blk_run_t *runs,
+	uint32_t max_runs
+) {
+	uint32_t runs_n = 0;
+	uint32_t data_size = 0;
+	int64_t chunk = find_first_bit(flash->dirty, flash->chunks_n);
+
+	while (chunk < flash->chunks_n && runs_n < max_runs) {
+		int64_t offset = chunk * FLASH_BLK_CHUNK_SIZE;
+		pmb887x_flash_blk_region_t *region = flash_blk_find_region(flash, offset);
+		g_assert(region != NULL);
+
+		// Coalesce adjacent dirty chunks of the same storage region into a single run
+		int64_t end = MIN(region->offset + region->size, offset + FLASH_BLK_CHUNK_SIZE);
+		clear_bit(chunk, flash->dirty);
+		flash->dirty_n--;
+		chunk++;
+		while (chunk < flash->chunks_n && test_bit(chunk, flash->dirty) && end < region->offset + region->size &&
+				data_size + (end - offset) + FLASH_BLK_CHUNK_SIZE <= FLASH_BLK_MAX_BATCH) {
+			end = MIN(region->offset + region->size, end + FLASH_BLK_CHUNK_SIZE);
+			clear_bit(chunk, flash->dirty);
+			flash->dirty_n--;
+			chunk++;
+		}
+
+		pmb887x_flash_blk_run_t *run = &runs[runs_n++];
+		run->offset = offset;
+		run->size = end - offset;
+		run->data_offset = data_size;
+		memcpy(data + data_size, region->storage + (offset - region->offset), run->size);
+		data_size += run->size;
+
+		if (data_size + FLASH_BLK_CHUNK_SIZE > FLASH_BLK_MAX_BATCH)
+			break;
+		chunk = find_next_bit(flash->dirty, flash->chunks_n, chunk);
+	}
+
+	return runs_n;
+}
+
+static void coroutine_fn flash_blk_flush_co(void *opaque) {
+	pmb887x_flash_blk_t *flash = opaque;
+	uint32_t max_runs = FLASH_BLK_MAX_BATCH / FLASH_BLK_CHUNK_SIZE;
+	g_autofree uint8_t *data = g_malloc(FLASH_BLK_MAX_BATCH);
+	g_autofree pmb887x_flash_blk_run_t *runs = g_new(pmb887x_flash_blk_run_t, max_runs);
+
+	while (flash->dirty_n > 0) {
+		// Snapshot dirty chunks under BQL, the vCPU may dirty them again while we are waiting for I/O
+		uint32_t runs_n = flash_blk_collect_runs(flash, data, runs, max_runs);
+
+		if (flash->journal_fd >= 0) {
+			size_t journal_size;
+			g_autofree uint8_t *journal = flash_blk_journal_build(data, runs, runs_n, &journal_size);
+			pmb887x_flash_blk_journal_io_t io = {
+				.fd = flash->journal_fd,
+				.data = journal,
+				.size = journal_size,
+			};
+			int ret = thread_pool_submit_co(flash_blk_journal_write_worker, &io);
+			if (ret < 0) {
+				EPRINTF("Can't write journal %s: %d, %s", flash->journal_file, ret, strerror(-ret));
+				exit(1);
+			}
+		}
+
+		for (uint32_t i = 0; i < runs_n; i++) {
+			int ret;
+			if (flash->overlay_fd >= 0) {
+				pmb887x_flash_blk_store_io_t io = {
+					.flash = flash,
+					.offset = runs[i].offset,
+					.size = runs[i].size,
+					.data = data + runs[i].data_offset,
+				};
+				ret = thread_pool_submit_co(flash_blk_overlay_write_worker, &io);
+				if (ret >= 0 && flash_blk_overlay_mark(flash, io.offset, io.size))
+					ret = thread_pool_submit_co(flash_blk_overlay_map_worker, &io);
+			} else {
+				ret = blk_co_pwrite(flash->blk, runs[i].offset, runs[i].size, data + runs[i].data_offset, 0);
+			}
+			if (ret < 0) {
+				EPRINTF("Can't write to flash file: %d, %s", ret, strerror(-ret));
+				exit(1);
+			}
+		}
+
+		int ret = flash->overlay_fd >= 0 ?
+			thread_pool_submit_co(flash_blk_overlay_sync_worker, flash) :
+			blk_co_flush(flash->blk);
+		if (ret < 0) {
+			EPRINTF("Can't flush flash file: %d, %s", ret, strerror(-ret));
+			exit(1);
+		}
+
+		flash_blk_journal_reset(flash);
+		DPRINTF("Flushed %u dirty runs\n", runs_n);
+	}
+
+	flash->flush_running = false;
+	aio_wait_kick();
+}
+
+static void flash_blk_start_flush(pmb887x_flash_blk_t *flash) {
+	if (flash->flush_running || !flash->dirty_n)
+		return;
+	flash->flush_running = true;
+	aio_co_enter(qemu_get_aio_context(), qemu_coroutine_create(flash_blk_flush_co, flash));
+}
+
+static void flash_blk_flush_timer(void *opaque) {
+	flash_blk_start_flush(opaque);
+}
+
+void pmb887x_flash_blk_flush(pmb887x_flash_blk_t *flash) {
+	if (!flash->dirty)
+		return;
+	timer_del(flash->flush_timer);
+	flash_blk_start_flush(flash);
+	AIO_WAIT_WHILE(NULL, flash->flush_running);
+}
+
+int pmb887x_flash_blk_write_storage(pmb887x_flash_blk_t *flash, int64_t offset, int64_t size) {
+	if (!pmb887x_flash_blk_is_rw(flash))
+		return 0;
+
+	pmb887x_flash_blk_region_t *region = flash_blk_find_region(flash, offset);
+	g_assert(region != NULL && offset + size <= region->offset + region->size);
+
+	if (!flash->dirty && flash->overlay_fd >= 0) {
+		int64_t start = ROUND_DOWN(offset, FLASH_BLK_CHUNK_SIZE);
+		int64_t end = ROUND_UP(offset + size, FLASH_BLK_CHUNK_SIZE);
+		return flash_blk_overlay_write(flash, start, end - start, region->storage + (start - region->offset));
+	}
+
+	if (!flash->dirty)
+		return blk_pwrite(flash->blk, offset, size, region->storage + (offset - region->offset), 0);
+
+	int64_t first = offset / FLASH_BLK_CHUNK_SIZE;
+	int64_t last = (offset + size - 1) / FLASH_BLK_CHUNK_SIZE;
+	for (int64_t chunk = first; chunk <= last; chunk++) {
+		if (!test_and_set_bit(chunk, flash->dirty))
+			flash->dirty_n++;
+	}
+
+	// Coalesce: the first write after a flush arms the timer, following writes ride along
+	if (!timer_pending(flash->flush_timer) && !flash->flush_running)
+		timer_mod(flash->flush_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME) + flash->writeback_delay);
+	return 0;
+}
+
+static void flash_blk_vm_state_change(void *opaque, bool running, RunState state) {
+	pmb887x_flash_blk_t *flash = opaque;
+	if (!running)
+		pmb887x_flash_blk_flush(flash);
+}
+
+static void flash_blk_set_flush(Object *obj, bool value, Error **errp) {
+	if (value)
+		pmb887x_flash_blk_flush(PMB887X_FLASH_BLK(obj));
+}
+
+static bool flash_blk_get_false(Object *obj, Error **errp) {
+	return false;
+}
+
+static void flash_blk_set_commit(Object *obj, bool value, Error **errp) {
+	if (value)
+		flash_blk_overlay_commit(PMB887X_FLASH_BLK(obj), errp);
+}
+
+static void flash_blk_set_discard(Object *obj, bool value, Error **errp) {
+	if (value)
+		flash_blk_overlay_discard(PMB887X_FLASH_BLK(obj), errp);
+}
+
+static void flash_blk_get_dirty(Object *obj, Visitor *v, const char *name, void *opaque, Error **errp) {
+	pmb887x_flash_blk_t *flash = PMB887X_FLASH_BLK(obj);
+	uint64_t value = flash->dirty_n * FLASH_BLK_CHUNK_SIZE;
+	visit_type_uint64(v, name, &value, errp);
+}
+
+static void flash_blk_init_writeback(pmb887x_flash_blk_t *flash) {
+	if (!flash->journal_file || !flash->journal_file[0]) {
+		g_free(flash->journal_file);
+		const char *base = flash->overlay_fd >= 0 ? flash->overlay_file : pmb887x_flash_blk_filename(flash);
+		flash->journal_file = g_strdup_printf("%s.journal", base);
+	}
+
+	// Finish a transaction interrupted by a crash before anything else reads the image
+	flash_blk_journal_replay(flash);
+
+	if (!flash->writeback)
+		return;
+
+	flash->journal_fd = qemu_create(flash->journal_file, O_RDWR, 0644, &error_fatal);
+	flash->chunks_n = DIV_ROUND_UP(blk_getlength(flash->blk), FLASH_BLK_CHUNK_SIZE);
+	flash->dirty = bitmap_new(flash->chunks_n);
+	flash->flush_timer = timer_new_ms(QEMU_CLOCK_REALTIME, flash_blk_flush_timer, flash);
+	flash->vmstate = qdev_add_vm_change_state_handler(flash->dev, flash_blk_vm_state_change, NULL, flash);
+
+	DPRINTF("Write-back enabled, delay %u ms, journal %s\n", flash->writeback_delay, flash->journal_file);
+}
+
 static void flash_blk_realize(DeviceState *dev, Error **errp) {
 	pmb887x_flash_blk_t *flash = PMB887X_FLASH_BLK(dev);
-	
+	flash->dev = dev;
+	flash->journal_fd = -1;
+	flash->image_fd = -1;
+	flash->overlay_fd = -1;
+	flash->shared_perm = BLK_PERM_ALL;
+
 	if (!flash->blk) {
 		EPRINTF("Property 'drive' is not set");
 		exit(1);
 	}
-	
+
 	DPRINTF("Drive size: %08"PRIX64"\n", blk_co_getlength(flash->blk));
-	
-	if (pmb887x_flash_blk_is_rw(flash)) {
-		int ret = blk_set_perm(flash->blk, BLK_PERM_CONSISTENT_READ | BLK_PERM_WRITE, BLK_PERM_ALL, errp);
+
+	if (flash->overlay_file && flash->overlay_file[0]) {
+		// Base image is shared by all instances, writes go only to the overlay
+		int ret = blk_set_perm(flash->blk, BLK_PERM_CONSISTENT_READ, flash->shared_perm, errp);
+		if (ret < 0) {
+			EPRINTF("Failed to set block dev permissions");
+			exit(1);
+		}
+		flash_blk_overlay_open(flash);
+		flash_blk_init_writeback(flash);
+	} else if (pmb887x_flash_blk_is_rw(flash)) {
+		int ret = blk_set_perm(flash->blk, BLK_PERM_CONSISTENT_READ | BLK_PERM_WRITE, flash->shared_perm, errp);
 		if (ret < 0) {
 			EPRINTF("Failed to set block dev permissions");
 			exit(1);
 		}
+		flash_blk_init_writeback(flash);
 	} else {
-		int ret = blk_set_perm(flash->blk, BLK_PERM_CONSISTENT_READ, BLK_PERM_ALL, errp);
+		int ret = blk_set_perm(flash->blk, BLK_PERM_CONSISTENT_READ, flash->shared_perm, errp);
 		if (ret < 0) {
 			EPRINTF("Failed to set block dev permissions");
 			exit(1);
 		}
 	}
+
+	if (flash->lazy)
+		flash_blk_open_image(flash);
+}
+
+static void flash_blk_reset(DeviceState *dev) {
+	pmb887x_flash_blk_flush(PMB887X_FLASH_BLK(dev));
 }
 
 static const Property flash_blk_properties[] = {
-	DEFINE_PROP_DRIVE("drive", pmb887x_flash_blk_t, blk)
+	DEFINE_PROP_DRIVE("drive", pmb887x_flash_blk_t, blk),
+	// Opt-in until mapped images got more soak time: -global pmb887x-flash-blk.lazy=on
+	DEFINE_PROP_BOOL("lazy", pmb887x_flash_blk_t, lazy, false),
+	DEFINE_PROP_STRING("overlay", pmb887x_flash_blk_t, overlay_file),
+	DEFINE_PROP_BOOL("writeback", pmb887x_flash_blk_t, writeback, false),
+	DEFINE_PROP_UINT32("writeback-delay", pmb887x_flash_blk_t, writeback_delay, 1000),
+	DEFINE_PROP_STRING("journal", pmb887x_flash_blk_t, journal_file),
 };
 
 static void flash_blk_class_init(ObjectClass *klass, const void *data) {
 	DeviceClass *dc = DEVICE_CLASS(klass);
 	device_class_set_props(dc, flash_blk_properties);
+	device_class_set_legacy_reset(dc, flash_blk_reset);
 	dc->realize = flash_blk_realize;
 	set_bit(DEVICE_CATEGORY_STORAGE, dc->categories);
+
+	// qom-set <path> flush true: write back all dirty sectors and wait for completion
+	object_class_property_add_bool(klass, "flush", flash_blk_get_false, flash_blk_set_flush);
+	// qom-set <path> overlay-commit/overlay-discard true: merge the overlay into the base image or drop it
+	object_class_property_add_bool(klass, "overlay-commit", flash_blk_get_false, flash_blk_set_commit);
+	object_class_property_add_bool(klass, "overlay-discard", flash_blk_get_false, flash_blk_set_discard);
+	object_class_property_add(klass, "dirty-bytes", "uint64", flash_blk_get_dirty, NULL, NULL, NULL);
 }
 
 static const TypeInfo flash_blk_info = {
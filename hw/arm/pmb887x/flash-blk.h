@@ -11,3 +11,14 @@ bool pmb887x_flash_blk_is_rw(pmb887x_flash_blk_t *flash);
 int64_t pmb887x_flash_blk_size(pmb887x_flash_blk_t *flash);
 const char *pmb887x_flash_blk_filename(pmb887x_flash_blk_t *flash);
 pmb887x_flash_blk_t *pmb887x_flash_blk_self(DeviceState *dev);
+
+// Register guest-visible storage mirroring [offset, offset + size) of the image
+void pmb887x_flash_blk_attach_storage(pmb887x_flash_blk_t *flash, int64_t offset, int64_t size, uint8_t *storage);
+// Map [offset, offset + size) of a raw image over the storage, so pages are loaded on first touch
+int pmb887x_flash_blk_map(pmb887x_flash_blk_t *flash, int64_t offset, int64_t size, uint8_t *storage);
+// Persist a range of the attached storage (write-through or deferred, depending on "writeback" property)
+int pmb887x_flash_blk_write_storage(pmb887x_flash_blk_t *flash, int64_t offset, int64_t size);
+void pmb887x_flash_blk_flush(pmb887x_flash_blk_t *flash);
+// EFA/OTP data stored in the overlay, returns false when the overlay is not used
+bool pmb887x_flash_blk_aux_load(pmb887x_flash_blk_t *flash, const char *name, void *data, size_t size);
+bool pmb887x_flash_blk_aux_save(pmb887x_flash_blk_t *flash, const char *name, const void *data, size_t size);
@@ -24,6 +24,9 @@
 #define CFI_ADDR	0x10
 #define CFI_INDEX_MASK	0xFFF
 
+// Array reads through the I/O path before the partition is mapped back as ROM
+#define FLASH_ROMD_RESTORE_READS		32
+
 #define FLASH_STATUS_BLOCK_LOCKED		BIT(1)
 #define FLASH_STATUS_PROGRAM_ERROR		BIT(4)
 #define FLASH_STATUS_BLOCK_ERASE_ERROR	BIT(5)
@@ -64,6 +67,8 @@ struct pmb887x_flash_part_t {
 	uint32_t cmd_addr;
 	uint16_t status;
 	bool io_mode;
+	bool romd;
+	uint32_t array_reads;
 	
 	uint8_t *storage;
 	
@@ -110,6 +115,10 @@ struct pmb887x_flash_t {
 	
 	uint32_t parts_n;
 	pmb887x_flash_part_t **parts;
+	
+	uint64_t romd_switches;
+	uint64_t romd_window_switches;
+	int64_t romd_window_start;
 };
 
 static void flash_trace(pmb887x_flash_t *flash, const char *format, ...) G_GNUC_PRINTF(2, 3);
@@ -127,13 +136,37 @@ static void flash_buffer_clear(pmb887x_flash_part_t *p) {
 	p->buffer_index = 0;
 }
 
+/*
+ * Every ROMD switch is a memory transaction commit which rebuilds the FlatViews.
+ * Leaving array mode is immediate, but going back is deferred until the firmware really reads the array,
+ * so back-to-back command sequences (program, status poll, reset, program...) stay in I/O mode.
+ * */
+static void flash_set_romd(pmb887x_flash_part_t *p, bool romd) {
+	p->array_reads = 0;
+	if (p->romd == romd)
+		return;
+	
+	p->romd = romd;
+	memory_region_rom_device_set_romd(&p->mem, romd);
+	
+	pmb887x_flash_t *flash = p->flash;
+	int64_t now = get_clock();
+	flash->romd_switches++;
+	flash->romd_window_switches++;
+	if (now - flash->romd_window_start >= NANOSECONDS_PER_SECOND) {
+		uint64_t rate = flash->romd_window_switches * NANOSECONDS_PER_SECOND / (now - flash->romd_window_start);
+		flash_trace(flash, "%"PRIu64" ROMD switches/s", rate);
+		flash->romd_window_switches = 0;
+		flash->romd_window_start = now;
+	}
+}
+
 static void flash_reset(pmb887x_flash_part_t *p) {
 	flash_trace_part(p, "back to read array mode");
 	flash_buffer_clear(p);
 	p->cmd = 0;
 	p->wcycle = 0;
-	if (!p->io_mode)
-		memory_region_rom_device_set_romd(&p->mem, true);
+	p->array_reads = 0;
 }
 
 static pmb887x_flash_block_t *flash_part_find_block(pmb887x_flash_part_t *p, uint32_t offset) {
@@ -203,12 +236,10 @@ static void flash_data_write(pmb887x_flash_part_t *p, uint32_t offset, uint32_t
 			exit(1);
 	}
 	
-	if (pmb887x_flash_blk_is_rw(p->flash->blk)) {
-		int ret = pmb887x_flash_blk_pwrite(p->flash->blk, p->flash->offset + p->offset + offset, size, p->storage + offset);
-		if (ret < 0) {
-			flash_error_part(p, "Can't write to flash file: %d, %s", ret, strerror(ret));
-			exit(1);
-		}
+	int ret = pmb887x_flash_blk_write_storage(p->flash->blk, p->flash->offset + p->offset + offset, size);
+	if (ret < 0) {
+		flash_error_part(p, "Can't write to flash file: %d, %s", ret, strerror(ret));
+		exit(1);
 	}
 }
 
@@ -477,13 +508,10 @@ static void flash_block_erase(pmb887x_flash_part_t *p, uint32_t offset) {
 
 	uint32_t erase_offset = base - p->offset;
 	memset(p->storage + erase_offset, 0xFF, sector_size);
-	if (pmb887x_flash_blk_is_rw(p->flash->blk)) {
-		int ret = pmb887x_flash_blk_pwrite(p->flash->blk, p->flash->offset + p->offset + erase_offset, sector_size,
-			p->storage + erase_offset);
-		if (ret < 0) {
-			flash_error_part(p, "Can't write to flash file: %d, %s", ret, strerror(ret));
-			exit(1);
-		}
+	int ret = pmb887x_flash_blk_write_storage(p->flash->blk, p->flash->offset + p->offset + erase_offset, sector_size);
+	if (ret < 0) {
+		flash_error_part(p, "Can't write to flash file: %d, %s", ret, strerror(ret));
+		exit(1);
 	}
 }
 
@@ -511,7 +539,7 @@ static void flash_buffer_abort(pmb887x_flash_part_t *p, uint32_t offset) {
 	p->cmd = 0x70;
 	p->wcycle = 0;
 	p->status |= FLASH_STATUS_READY | FLASH_STATUS_SEQUENCE_ERROR;
-	memory_region_rom_device_set_romd(&p->mem, false);
+	flash_set_romd(p, false);
 }
 
 static void flash_buffer_add(pmb887x_flash_part_t *p, uint32_t offset, uint64_t value, uint32_t size) {
@@ -576,6 +604,8 @@ static uint64_t flash_io_read(void *opaque, hwaddr part_offset, uint32_t size) {
 	switch (p->cmd) {
 		case 0x00:
 			value = flash_array_read(p, offset, size);
+			if (!p->io_mode && ++p->array_reads >= FLASH_ROMD_RESTORE_READS)
+				flash_set_romd(p, true);
 			break;
 
 		case 0x94:
@@ -620,7 +650,7 @@ static void flash_io_write(void *opaque, hwaddr part_offset, uint64_t value, uin
 	
 	if (p->wcycle == 0) {
 		if (!p->io_mode)
-			memory_region_rom_device_set_romd(&p->mem, false);
+			flash_set_romd(p, false);
 		
 		valid_command = true;
 		p->cmd_addr = offset;
@@ -663,7 +693,7 @@ static void flash_io_write(void *opaque, hwaddr part_offset, uint64_t value, uin
 			case 0x50:
 				flash_trace_part(p, "cmd clear status (%02"PRIX64")", value);
 				p->status &= ~FLASH_STATUS_ERRORS;
-				memory_region_rom_device_set_romd(&p->mem, p->cmd == 0);
+				// Array mode (cmd 0) is mapped back lazily by flash_io_read
 				break;
 
 			case 0x41:
@@ -716,7 +746,6 @@ static void flash_io_write(void *opaque, hwaddr part_offset, uint64_t value, uin
 
 			case 0xB0:
 				flash_trace_part(p, "cmd suspend (%02"PRIX64")", value);
-				memory_region_rom_device_set_romd(&p->mem, p->cmd == 0);
 				break;
 
 			case 0x60:
@@ -921,6 +950,11 @@ static void flash_load_file(pmb887x_flash_t *flash, const char *path, void *data
 	if (!path || !path[0])
 		return;
 
+	if (pmb887x_flash_blk_aux_load(flash->blk, path, data, size)) {
+		flash_trace(flash, "loaded %s from overlay", region);
+		return;
+	}
+
 	g_autofree char *contents = NULL;
 	g_autoptr(GError) error = NULL;
 	size_t contents_size = 0;
@@ -945,6 +979,11 @@ static void flash_save_file(pmb887x_flash_t *flash, const char *path, const void
 	if (!path || !path[0] || !pmb887x_flash_blk_is_rw(flash->blk))
 		return;
 
+	if (pmb887x_flash_blk_aux_save(flash->blk, path, data, size)) {
+		flash_trace(flash, "saved %s to overlay", region);
+		return;
+	}
+
 	g_autoptr(GError) error = NULL;
 	if (!g_file_set_contents(path, data, size, &error)) {
 		flash_error(flash, "Can't write %s file %s: %s", region, path, error->message);
@@ -1028,6 +1067,7 @@ static void flash_init_part(pmb887x_flash_t *flash, const pmb887x_flash_cfg_part
 	char *name = g_strdup_printf("pmb887x-flash[%s][%d]", p->flash->name, p->n);
 	memory_region_init_rom_device(&p->mem, OBJECT(p->flash->dev), &io_ops, p, name, p->size, NULL);
 	memory_region_rom_device_set_romd(&p->mem, true);
+	p->romd = true;
 	memory_region_add_subregion(&flash->mmio, p->offset, &p->mem);
 	g_free(name);
 	
@@ -1035,11 +1075,15 @@ static void flash_init_part(pmb887x_flash_t *flash, const pmb887x_flash_cfg_part
 	
 	flash_trace_part(p, "hw partition 0x%08X ... 0x%08X", p->flash->offset + p->offset, p->flash->offset + p->offset + p->size - 1);
 	
-	int ret = pmb887x_flash_blk_pread(p->flash->blk, flash->offset + p->offset, p->size, p->storage);
+	int64_t load_start = get_clock();
+	bool mapped = pmb887x_flash_blk_map(p->flash->blk, flash->offset + p->offset, p->size, p->storage) == 0;
+	int ret = mapped ? 0 : pmb887x_flash_blk_pread(p->flash->blk, flash->offset + p->offset, p->size, p->storage);
 	if (ret < 0) {
 		flash_error(p->flash, "failed to read the initial flash content [offset=%08X, size=%08X]", p->flash->offset + p->offset, p->size);
 		exit(1);
 	}
+	flash_trace_part(p, "%s in %"PRId64" us", mapped ? "mapped" : "loaded", (get_clock() - load_start) / 1000);
+	pmb887x_flash_blk_attach_storage(p->flash->blk, flash->offset + p->offset, p->size, p->storage);
 	
 	p->blocks_n = 0;
 	for (uint32_t i = 0; i < p->cfg->erase_regions_cnt; i++)
@@ -1137,6 +1181,9 @@ static void flash_realize(DeviceState *dev, Error **errp) {
 		flash_init_part(flash, &cfg->parts[i]);
 	
 	sysbus_init_mmio(SYS_BUS_DEVICE(flash->dev), &flash->mmio);
+	
+	flash->romd_window_start = get_clock();
+	object_property_add_uint64_ptr(OBJECT(dev), "romd-switches", &flash->romd_switches, OBJ_PROP_FLAG_READ);
 }
 
 static void flash_device_reset(DeviceState *dev) {
@@ -1152,6 +1199,9 @@ static void flash_device_reset(DeviceState *dev) {
 			}
 		}
 		flash_reset(p);
+		// CPU boots from the flash, map it back right away
+		if (!p->io_mode)
+			flash_set_romd(p, true);
 	}
 
 	for (uint32_t i = 0; i < flash->efa_blocks_n; i++) {
@@ -35,6 +35,8 @@ struct pmb887x_gpio_t {
 	
 	bool input_state[8][GPIOS_COUNT];
 	qemu_irq pins_out[8][GPIOS_COUNT];
+	// High while the pin drives its output, for bidirectional lines like MMCI_DAT0
+	qemu_irq pins_dir_out[GPIOS_COUNT];
 
 	const char **names;
 	uint32_t names_count;
@@ -56,7 +58,15 @@ static uint8_t gpio_get_mux_os(pmb887x_gpio_t *p, int pin) {
 	return 0;
 }
 
+static bool gpio_is_output(pmb887x_gpio_t *p, int id) {
+	if ((p->pins[id] & GPIO_PS) == GPIO_PS_MANUAL)
+		return (p->pins[id] & GPIO_DIR) == GPIO_DIR_OUT;
+	return gpio_get_mux_os(p, id) != 0;
+}
+
 static void gpio_sync_pin_state(pmb887x_gpio_t *p, int id) {
+	qemu_set_irq(p->pins_dir_out[id], gpio_is_output(p, id));
+
 	if ((p->pins[id] & GPIO_PS) == GPIO_PS_MANUAL) {
 		bool level = (p->pins[id] & GPIO_DIR) == GPIO_DIR_OUT ? (p->pins[id] & GPIO_DATA) == GPIO_DATA_HIGH : p->input_state[0][id];
 		qemu_set_irq(p->pins_out[0][id], level);
@@ -233,6 +243,7 @@ static void gpio_init(Object *obj) {
 
 	qdev_init_gpio_in_named(dev, gpio_input_handler, "pin_in", GPIOS_COUNT);
 	qdev_init_gpio_out_named(dev, p->pins_out[0], "pin_out", GPIOS_COUNT);
+	qdev_init_gpio_out_named(dev, p->pins_dir_out, "pin_dir_out", GPIOS_COUNT);
 
 	qdev_init_gpio_in_named(dev, gpio_input_alt0_handler, "pin_alt0_in", GPIOS_COUNT);
 	qdev_init_gpio_out_named(dev, p->pins_out[1], "pin_alt0_out", GPIOS_COUNT);
@@ -0,0 +1,63 @@
+/*
+ * GPRS LLC FCS and GEA keystream generators
+ */
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/host-utils.h"
+
+#include "hw/arm/pmb887x/gprs_crypto.h"
+
+static uint32_t crc24_reflect(uint32_t polynomial) {
+	return revbit32(polynomial) >> 8;
+}
+
+void pmb887x_crc24_init(pmb887x_crc24_t *crc, uint32_t polynomial) {
+	uint32_t reflected = crc24_reflect(polynomial & 0xFFFFFF);
+
+	crc->polynomial = polynomial;
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t value = i;
+		for (size_t bit = 0; bit < 8; bit++)
+			value = (value & 1) ? (value >> 1) ^ reflected : value >> 1;
+		crc->table[0][i] = value;
+	}
+
+	for (size_t slice = 1; slice < ARRAY_SIZE(crc->table); slice++) {
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t value = crc->table[slice - 1][i];
+			crc->table[slice][i] = (value >> 8) ^ crc->table[0][value & 0xFF];
+		}
+	}
+}
+
+uint32_t pmb887x_crc24_update(const pmb887x_crc24_t *crc, uint32_t value, const uint8_t *data, size_t size) {
+	const uint32_t (*table)[256] = crc->table;
+
+	value &= 0xFFFFFF;
+	while (size >= 8) {
+		uint32_t low = ldl_le_p(data) ^ value;
+		uint32_t high = ldl_le_p(data + 4);
+
+		value = table[7][low & 0xFF] ^ table[6][(low >> 8) & 0xFF] ^
+			table[5][(low >> 16) & 0xFF] ^ table[4][low >> 24] ^
+			table[3][high & 0xFF] ^ table[2][(high >> 8) & 0xFF] ^
+			table[1][(high >> 16) & 0xFF] ^ table[0][high >> 24];
+		data += 8;
+		size -= 8;
+	}
+
+	while (size--)
+		value = (value >> 8) ^ table[0][(value ^ *data++) & 0xFF];
+	return value;
+}
+
+void pmb887x_gea3_keystream(cipher_kgcore_t *kgcore, const uint8_t kc[8], uint32_t input, bool direction,
+	uint8_t *output, size_t size
+) {
+	uint8_t key[16];
+
+	memcpy(key, kc, 8);
+	memcpy(key + 8, kc, 8);
+	cipher_kgcore_set_key(kgcore, key);
+	cipher_kgcore_generate(kgcore, 0xFF, 0, input, direction, 0, output, size * 8);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "qemu/osdep.h"
+#include "hw/arm/pmb887x/dsp/peripheral/cipher-kasumi.h"
+
+// LLC FCS generator from TS 44.064, MSB is the x^23 term
+#define PMB887X_CRC24_POLYNOMIAL	0xBBA1B5
+#define PMB887X_CRC24_INIT			0xFFFFFF
+
+typedef struct pmb887x_crc24_t pmb887x_crc24_t;
+
+// Slice-by-8 tables for the bit-reversed (LSB first) form of the generator
+struct pmb887x_crc24_t {
+	uint32_t polynomial;
+	uint32_t table[8][256];
+};
+
+void pmb887x_crc24_init(pmb887x_crc24_t *crc, uint32_t polynomial);
+uint32_t pmb887x_crc24_update(const pmb887x_crc24_t *crc, uint32_t value, const uint8_t *data, size_t size);
+
+/*
+ * GEA3 keystream (TS 55.216): KGCORE with CA=0xFF, CB=0, CE=0 and CK = Kc || Kc.
+ * Byte i of the keystream is output[i], the first bit is the MSB.
+ * */
+void pmb887x_gea3_keystream(cipher_kgcore_t *kgcore, const uint8_t kc[8], uint32_t input, bool direction,
+	uint8_t *output, size_t size);
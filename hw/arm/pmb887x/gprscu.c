@@ -5,12 +5,15 @@
 #define PMB887X_TRACE_PREFIX "pmb887x-gprscu"
 
 #include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/log.h"
 #include "hw/core/qdev-properties.h"
 #include "hw/core/sysbus.h"
 #include "system/memory.h"
 
 #include "hw/arm/pmb887x/fifo.h"
 #include "hw/arm/pmb887x/gen/cpu_regs.h"
+#include "hw/arm/pmb887x/gprs_crypto.h"
 #include "hw/arm/pmb887x/mod.h"
 #include "hw/arm/pmb887x/regs_dump.h"
 #include "hw/arm/pmb887x/trace.h"
@@ -20,6 +23,8 @@
 
 #define GPRSCU_FIFO_SIZE 32
 #define GPRSCU_ID_BASE 0xF003C000
+#define GPRSCU_KEYSTREAM_SIZE 0x1000
+#define GPRSCU_KEYSTREAM_MIN 0x100
 
 #define GPRSCU_CON_CONFIGURATION (GPRSCU_CON_DIRECTION | GPRSCU_CON_CRC_CTRL | GPRSCU_CON_CIPH_CTRL | \
 	GPRSCU_CON_GEA2 | GPRSCU_CON_SEGMENT_MODE | GPRSCU_CON_GEA3)
@@ -47,16 +52,145 @@ struct pmb887x_gprscu_t {
 
 	pmb887x_fifo8_t input_fifo;
 	pmb887x_fifo8_t output_fifo;
+
+	pmb887x_crc24_t crc;
+	cipher_kgcore_t kgcore;
+	uint8_t keystream[GPRSCU_KEYSTREAM_SIZE];
+	uint32_t keystream_size;
+	uint32_t keystream_offset;
+	uint32_t segment_remaining;
+	bool segment_active;
 };
 
+static uint32_t gprscu_flags(pmb887x_gprscu_t *p) {
+	uint32_t flags = 0;
+
+	if (p->segment_active) {
+		if ((p->segment & GPRSCU_SEGMENT_CRC_CTRL) != 0)
+			flags |= GPRSCU_CON_CRC_CTRL;
+		if ((p->segment & GPRSCU_SEGMENT_CIPH_CTRL) != 0)
+			flags |= GPRSCU_CON_CIPH_CTRL;
+		return flags;
+	}
+	return p->con & (GPRSCU_CON_CRC_CTRL | GPRSCU_CON_CIPH_CTRL);
+}
+
+/*
+ * GEA1/GEA2 are not implemented. Passing such frames through unciphered would corrupt them silently,
+ * so they are left in the input FIFO and the firmware sees a stalled unit.
+ * */
+static bool gprscu_cipher_unsupported(pmb887x_gprscu_t *p, uint32_t flags) {
+	if ((flags & GPRSCU_CON_CIPH_CTRL) == 0 || (p->con & GPRSCU_CON_GEA3) != 0)
+		return false;
+	qemu_log_mask(LOG_UNIMP, "%s: GEA%d ciphering is not implemented\n", TYPE_PMB887X_GPRSCU,
+		(p->con & GPRSCU_CON_GEA2) ? 2 : 1);
+	return true;
+}
+
+static void gprscu_generate_keystream(pmb887x_gprscu_t *p, uint32_t size) {
+	uint8_t kc[8];
+
+	g_assert((p->con & GPRSCU_CON_GEA3) != 0);
+
+	// Kc is KEY1:KEY0, first byte is the most significant one
+	stq_be_p(kc, (uint64_t) p->key[1] << 32 | p->key[0]);
+	pmb887x_gea3_keystream(&p->kgcore, kc, p->input[0], (p->con & GPRSCU_CON_DIRECTION) != 0, p->keystream, size);
+}
+
+// KGCORE blocks are chained, a longer keystream is generated again from the start
+static void gprscu_prepare_keystream(pmb887x_gprscu_t *p, uint32_t size) {
+	if (size <= p->keystream_size)
+		return;
+
+	if (size > GPRSCU_KEYSTREAM_SIZE) {
+		EPRINTF("keystream is too long: %u\n", size);
+		exit(1);
+	}
+
+	p->keystream_size = MIN(MAX(MAX(size, p->keystream_size * 2), GPRSCU_KEYSTREAM_MIN), GPRSCU_KEYSTREAM_SIZE);
+	gprscu_generate_keystream(p, p->keystream_size);
+}
+
+static void gprscu_reset_keystream(pmb887x_gprscu_t *p) {
+	p->keystream_size = 0;
+	p->keystream_offset = 0;
+}
+
+static void gprscu_update_crc(pmb887x_gprscu_t *p, const uint8_t *data, uint32_t size) {
+	uint32_t polynomial = p->polynom ? p->polynom & 0xFFFFFF : PMB887X_CRC24_POLYNOMIAL;
+
+	if (p->crc.polynomial != polynomial)
+		pmb887x_crc24_init(&p->crc, polynomial);
+	p->fcs = pmb887x_crc24_update(&p->crc, p->fcs, data, size);
+}
+
+static void gprscu_convert(pmb887x_gprscu_t *p, uint32_t flags, uint8_t *data, uint32_t size) {
+	bool downlink = (p->con & GPRSCU_CON_DIRECTION) != 0;
+
+	// FCS always covers the plain text
+	if ((flags & GPRSCU_CON_CRC_CTRL) != 0 && !downlink)
+		gprscu_update_crc(p, data, size);
+
+	if ((flags & GPRSCU_CON_CIPH_CTRL) != 0) {
+		gprscu_prepare_keystream(p, p->keystream_offset + size);
+		for (uint32_t i = 0; i < size; i++)
+			data[i] ^= p->keystream[p->keystream_offset + i];
+		p->keystream_offset += size;
+	}
+
+	if ((flags & GPRSCU_CON_CRC_CTRL) != 0 && downlink)
+		gprscu_update_crc(p, data, size);
+}
+
+static void gprscu_start_segment(pmb887x_gprscu_t *p) {
+	uint32_t length = p->segment & GPRSCU_SEGMENT_LENGTH;
+
+	p->segment_active = true;
+	p->segment_remaining = length;
+
+	// The whole segment is ciphered with one keystream batch
+	if ((p->segment & GPRSCU_SEGMENT_CIPH_CTRL) != 0 && (p->con & GPRSCU_CON_GEA3) != 0)
+		gprscu_prepare_keystream(p, p->keystream_offset + length);
+}
+
 static void gprscu_process_fifo(pmb887x_gprscu_t *p) {
-	bool control_conversion = (p->con & (GPRSCU_CON_CRC_CTRL | GPRSCU_CON_CIPH_CTRL)) != 0;
-	bool segment_conversion = (p->segment & (GPRSCU_SEGMENT_CRC_CTRL | GPRSCU_SEGMENT_CIPH_CTRL)) != 0;
-	if (control_conversion || segment_conversion)
+	bool output_was_empty = pmb887x_fifo_is_empty(&p->output_fifo);
+	uint32_t flags = gprscu_flags(p);
+	uint8_t buffer[GPRSCU_FIFO_SIZE];
+
+	// Segment conversion waits for SEGMENT_START
+	if (!p->segment_active && (p->con & GPRSCU_CON_SEGMENT_MODE) != 0 &&
+		(p->segment & (GPRSCU_SEGMENT_CRC_CTRL | GPRSCU_SEGMENT_CIPH_CTRL)) != 0)
+		return;
+
+	if (gprscu_cipher_unsupported(p, flags))
 		return;
 
-	while (!pmb887x_fifo_is_empty(&p->input_fifo) && !pmb887x_fifo_is_full(&p->output_fifo))
-		pmb887x_fifo8_push(&p->output_fifo, pmb887x_fifo8_pop(&p->input_fifo));
+	while (!pmb887x_fifo_is_empty(&p->input_fifo) && !pmb887x_fifo_is_full(&p->output_fifo)) {
+		uint32_t size = MIN(pmb887x_fifo_count(&p->input_fifo), pmb887x_fifo_free_count(&p->output_fifo));
+		if (p->segment_active) {
+			size = MIN(size, p->segment_remaining);
+			if (!size)
+				break;
+		}
+
+		pmb887x_fifo8_read(&p->input_fifo, buffer, size);
+		if (flags)
+			gprscu_convert(p, flags, buffer, size);
+		pmb887x_fifo8_write(&p->output_fifo, buffer, size);
+
+		if (p->segment_active)
+			p->segment_remaining -= size;
+	}
+
+	if (p->segment_active && !p->segment_remaining) {
+		p->segment_active = false;
+		p->con &= ~GPRSCU_CON_SEGMENT_START;
+		pmb887x_src_update(&p->src[0], 0, MOD_SRC_SETR);
+	}
+
+	if (output_was_empty && !pmb887x_fifo_is_empty(&p->output_fifo))
+		pmb887x_src_update(&p->src[1], 0, MOD_SRC_SETR);
 }
 
 static uint32_t gprscu_status(pmb887x_gprscu_t *p) {
@@ -96,7 +230,9 @@ static void gprscu_initialize(pmb887x_gprscu_t *p) {
 	pmb887x_fifo_reset(&p->input_fifo);
 	pmb887x_fifo_reset(&p->output_fifo);
 	p->output_underrun = false;
-	p->con &= ~(GPRSCU_CON_INIT | GPRSCU_CON_BUSY);
+	p->segment_active = false;
+	gprscu_reset_keystream(p);
+	p->con &= ~(GPRSCU_CON_INIT | GPRSCU_CON_BUSY | GPRSCU_CON_SEGMENT_START);
 }
 
 static uint64_t gprscu_io_read(void *opaque, hwaddr haddr, unsigned int size) {
@@ -169,13 +305,21 @@ static void gprscu_io_write(void *opaque, hwaddr haddr, uint64_t value, unsigned
 			break;
 
 		case GPRSCU_CON:
+			// Direction and algorithm are KGCORE inputs as well
+			if ((p->con ^ value) & (GPRSCU_CON_DIRECTION | GPRSCU_CON_GEA2 | GPRSCU_CON_GEA3))
+				gprscu_reset_keystream(p);
 			p->con = value & (GPRSCU_CON_CONFIGURATION | GPRSCU_CON_COMMANDS);
+			if (p->segment_active)
+				p->con |= GPRSCU_CON_SEGMENT_START;
 			if ((p->con & GPRSCU_CON_INIT) != 0)
 				gprscu_initialize(p);
 			if ((p->con & GPRSCU_CON_SEGMENT_RESET) != 0) {
 				p->segment = 0;
-				p->con &= ~GPRSCU_CON_SEGMENT_RESET;
+				p->segment_active = false;
+				p->con &= ~(GPRSCU_CON_SEGMENT_RESET | GPRSCU_CON_SEGMENT_START);
 			}
+			if ((p->con & GPRSCU_CON_SEGMENT_START) != 0 && !p->segment_active)
+				gprscu_start_segment(p);
 			gprscu_process_fifo(p);
 			break;
 
@@ -195,10 +339,12 @@ static void gprscu_io_write(void *opaque, hwaddr haddr, uint64_t value, unsigned
 
 		case GPRSCU_INPUT0 ... GPRSCU_INPUT1:
 			p->input[(haddr - GPRSCU_INPUT0) / sizeof(uint32_t)] = value;
+			gprscu_reset_keystream(p);
 			break;
 
 		case GPRSCU_KEY0 ... GPRSCU_KEY3:
 			p->key[(haddr - GPRSCU_KEY0) / sizeof(uint32_t)] = value;
+			gprscu_reset_keystream(p);
 			break;
 
 		case GPRSCU_FCS:
@@ -252,6 +398,9 @@ static void gprscu_reset(DeviceState *dev) {
 	p->fcs = 0;
 	p->polynom = 0;
 	p->output_underrun = false;
+	p->segment_active = false;
+	p->segment_remaining = 0;
+	gprscu_reset_keystream(p);
 	pmb887x_fifo_reset(&p->input_fifo);
 	pmb887x_fifo_reset(&p->output_fifo);
 }
@@ -263,6 +412,7 @@ static void gprscu_realize(DeviceState *dev, Error **errp) {
 		pmb887x_src_init(&p->src[index], p->irq[index]);
 	pmb887x_fifo8_init(&p->input_fifo, GPRSCU_FIFO_SIZE);
 	pmb887x_fifo8_init(&p->output_fifo, GPRSCU_FIFO_SIZE);
+	pmb887x_crc24_init(&p->crc, PMB887X_CRC24_POLYNOMIAL);
 	gprscu_reset(dev);
 }
 
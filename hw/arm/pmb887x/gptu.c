@@ -16,6 +16,8 @@
 #include "hw/arm/pmb887x/pll.h"
 #include "hw/arm/pmb887x/gen/cpu_regs.h"
 #include "hw/arm/pmb887x/regs_dump.h"
+#include "hw/arm/pmb887x/idle.h"
+#include "hw/arm/pmb887x/scheduler.h"
 #include "hw/arm/pmb887x/mod.h"
 #include "hw/arm/pmb887x/trace.h"
 
@@ -88,11 +90,12 @@ struct pmb887x_gptu_t {
 	uint32_t revision;
 
 	qemu_irq irq[8];
-	QEMUTimer *timer;
-	QEMUTimer *timer_t2;
+	pmb887x_sched_event_t timer;
+	pmb887x_sched_event_t timer_t2;
 
 	bool enabled;
 	uint32_t freq;
+	pmb887x_sched_clock_t clock;
 
 	pmb887x_clc_reg_t clc;
 	pmb887x_src_reg_t src[8];
@@ -137,6 +140,7 @@ static void gptu_update_freq(pmb887x_gptu_t *p) {
 	uint8_t rmc = pmb887x_clc_get_rmc(&p->clc);
 
 	p->freq = rmc > 0 ? pmb887x_pll_get_fsys(p->pll) / rmc : 0;
+	pmb887x_sched_clock_set_freq(&p->clock, p->freq);
 	p->enabled = pmb887x_clc_is_enabled(&p->clc) && p->freq > 0;
 
 	DPRINTF("fgptu=%d %s\n", p->freq, p->enabled ? "[ON]" : "[OFF]");
@@ -145,13 +149,13 @@ static void gptu_update_freq(pmb887x_gptu_t *p) {
 static int64_t gptu_ticks_to_ns(pmb887x_gptu_t *p, uint64_t ticks) {
 	if (p->freq == 0)
 		return INT64_MAX;
-	return (int64_t) muldiv64(ticks, NANOSECONDS_PER_SECOND, p->freq);
+	return pmb887x_sched_clock_ticks_to_ns(&p->clock, ticks);
 }
 
 static int64_t gptu_ticks_to_deadline_ns(pmb887x_gptu_t *p, uint64_t ticks) {
 	if (p->freq == 0)
 		return INT64_MAX;
-	return (int64_t) muldiv64_round_up(ticks, NANOSECONDS_PER_SECOND, p->freq);
+	return pmb887x_sched_clock_ticks_to_ns_round_up(&p->clock, ticks);
 }
 
 static void gptu_trigger_ev_irq(pmb887x_gptu_t *p, int ev_id) {
@@ -325,7 +329,7 @@ static void gptu_t2_set_counter_value(pmb887x_gptu_t *p, int timer_id, uint32_t
 	pmb887x_gptu_timer_t2_t *timer = &p->timers_t2[timer_id];
 	int64_t limit = gptu_t2_limit(p);
 	timer->counter = value % limit;
-	timer->start = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+	timer->start = pmb887x_sched_now();
 }
 
 static void gptu_t2_fire_ouv(pmb887x_gptu_t *p, int event_id, uint64_t count) {
@@ -448,12 +452,12 @@ static void gptu_t2_sync_timer(pmb887x_gptu_t *p) {
 	p->syncing_t2 = true;
 
 	if (!p->enabled) {
-		timer_del(p->timer_t2);
+		pmb887x_sched_event_del(&p->timer_t2);
 		p->syncing_t2 = false;
 		return;
 	}
 
-	int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+	int64_t now = pmb887x_sched_now();
 	p->next_t2 = INT64_MAX;
 	bool has_enabled = false;
 
@@ -473,7 +477,7 @@ static void gptu_t2_sync_timer(pmb887x_gptu_t *p) {
 			timer->start = now;
 
 		if (gptu_t2_csrc(p, i) == 0) {
-			uint64_t elapsed = muldiv64(now - timer->start, p->freq, NANOSECONDS_PER_SECOND);
+			uint64_t elapsed = pmb887x_sched_clock_ns_to_ticks(&p->clock, now - timer->start);
 			if (elapsed > 0) {
 				int64_t start = timer->start;
 				gptu_t2_advance_ticks(p, i, elapsed);
@@ -489,9 +493,9 @@ static void gptu_t2_sync_timer(pmb887x_gptu_t *p) {
 	}
 
 	if (has_enabled) {
-		timer_mod(p->timer_t2, p->next_t2);
+		pmb887x_sched_event_mod(&p->timer_t2, p->next_t2);
 	} else {
-		timer_del(p->timer_t2);
+		pmb887x_sched_event_del(&p->timer_t2);
 	}
 
 	p->syncing_t2 = false;
@@ -779,12 +783,12 @@ static void gptu_sync_timer(pmb887x_gptu_t *p) {
 	p->syncing_t01 = true;
 
 	if (!p->enabled) {
-		timer_del(p->timer);
+		pmb887x_sched_event_del(&p->timer);
 		p->syncing_t01 = false;
 		return;
 	}
 
-	int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+	int64_t now = pmb887x_sched_now();
 	p->next = INT64_MAX;
 	bool has_enabled = false;
 
@@ -800,7 +804,7 @@ static void gptu_sync_timer(pmb887x_gptu_t *p) {
 		if (!timer->start)
 			timer->start = now;
 
-		uint64_t elapsed = muldiv64(now - timer->start, p->freq, NANOSECONDS_PER_SECOND);
+		uint64_t elapsed = pmb887x_sched_clock_ns_to_ticks(&p->clock, now - timer->start);
 		if (elapsed > 0) {
 			gptu_t01_add_ticks(p, i, elapsed, 0);
 			timer->start += gptu_ticks_to_ns(p, elapsed);
@@ -812,9 +816,9 @@ static void gptu_sync_timer(pmb887x_gptu_t *p) {
 	}
 
 	if (has_enabled) {
-		timer_mod(p->timer, p->next);
+		pmb887x_sched_event_mod(&p->timer, p->next);
 	} else {
-		timer_del(p->timer);
+		pmb887x_sched_event_del(&p->timer);
 	}
 
 	p->syncing_t01 = false;
@@ -873,6 +877,23 @@ static void gptu_ptimer_reset(void *opaque) {
 	gptu_sync_timer(p);
 }
 
+// Counters are brought up to date with the old clock before the new one takes over
+static void gptu_update_clock(pmb887x_gptu_t *p) {
+	gptu_sync_timer(p);
+	gptu_update_freq(p);
+	gptu_rebuild_timers(p);
+	gptu_t2_sync_timer(p);
+	gptu_t2_update_state(p);
+}
+
+static void gptu_update_clock_callback(void *opaque) {
+	pmb887x_gptu_t *p = opaque;
+	uint32_t rmc = pmb887x_clc_get_rmc(&p->clc);
+	uint32_t freq = rmc > 0 ? pmb887x_pll_get_fsys(p->pll) / rmc : 0;
+	if (p->freq != freq)
+		gptu_update_clock(p);
+}
+
 static uint64_t gptu_io_read(void *opaque, hwaddr haddr, unsigned size) {
 	pmb887x_gptu_t *p = opaque;
 
@@ -921,16 +942,19 @@ static uint64_t gptu_io_read(void *opaque, hwaddr haddr, unsigned size) {
 			break;
 
 		case GPTU_OUT:
+			pmb887x_idle_poll(haddr + p->mmio.addr);
 			gptu_sync_timer(p);
 			gptu_t2_sync_timer(p);
 			value = p->out & GPTU_OUT_MASK;
 			break;
 
 		case GPTU_T0DCBA:
+			pmb887x_idle_poll(haddr + p->mmio.addr);
 			value = gptu_get_counter(p, 0, 4);
 			break;
 
 		case GPTU_T0CBA:
+			pmb887x_idle_poll(haddr + p->mmio.addr);
 			value = gptu_get_counter(p, 0, 3);
 			break;
 
@@ -943,10 +967,12 @@ static uint64_t gptu_io_read(void *opaque, hwaddr haddr, unsigned size) {
 			break;
 
 		case GPTU_T1DCBA:
+			pmb887x_idle_poll(haddr + p->mmio.addr);
 			value = gptu_get_counter(p, 1, 4);
 			break;
 
 		case GPTU_T1CBA:
+			pmb887x_idle_poll(haddr + p->mmio.addr);
 			value = gptu_get_counter(p, 1, 3);
 			break;
 
@@ -959,6 +985,7 @@ static uint64_t gptu_io_read(void *opaque, hwaddr haddr, unsigned size) {
 			break;
 
 		case GPTU_T2:
+			pmb887x_idle_poll(haddr + p->mmio.addr);
 			value = gptu_t2_get_counter(p);
 			break;
 
@@ -971,6 +998,7 @@ static uint64_t gptu_io_read(void *opaque, hwaddr haddr, unsigned size) {
 			break;
 
 		case GPTU_T012RUN:
+			pmb887x_idle_poll(haddr + p->mmio.addr);
 			gptu_sync_timer(p);
 			gptu_t2_sync_timer(p);
 			value = p->t012run;
@@ -1020,11 +1048,7 @@ static void gptu_io_write(void *opaque, hwaddr haddr, uint64_t value, unsigned s
 	switch (haddr) {
 		case GPTU_CLC:
 			pmb887x_clc_set(&p->clc, value);
-			gptu_sync_timer(p);
-			gptu_update_freq(p);
-			gptu_rebuild_timers(p);
-			gptu_t2_sync_timer(p);
-			gptu_t2_update_state(p);
+			gptu_update_clock(p);
 			break;
 
 		case GPTU_T01IRS:
@@ -1219,8 +1243,8 @@ static void gptu_realize(DeviceState *dev, Error **errp) {
 		pmb887x_src_init(&p->src[i], p->irq[i]);
 	}
 
-	p->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, gptu_ptimer_reset, p);
-	p->timer_t2 = timer_new_ns(QEMU_CLOCK_VIRTUAL, gptu_t2_ptimer_reset, p);
+	pmb887x_sched_event_init(&p->timer, gptu_ptimer_reset, p);
+	pmb887x_sched_event_init(&p->timer_t2, gptu_t2_ptimer_reset, p);
 
 	gptu_update_freq(p);
 	gptu_update_events(p);
@@ -1228,13 +1252,15 @@ static void gptu_realize(DeviceState *dev, Error **errp) {
 	gptu_sync_timer(p);
 	gptu_t2_update_state(p);
 	gptu_t2_sync_timer(p);
+
+	pmb887x_pll_add_freq_update_callback(p->pll, gptu_update_clock_callback, p);
 }
 
 static void gptu_reset(DeviceState *dev) {
 	pmb887x_gptu_t *p = PMB887X_GPTU(dev);
 
-	timer_del(p->timer);
-	timer_del(p->timer_t2);
+	pmb887x_sched_event_del(&p->timer);
+	pmb887x_sched_event_del(&p->timer_t2);
 
 	pmb887x_clc_set(&p->clc, MOD_CLC_DISR);
 
@@ -1243,6 +1269,7 @@ static void gptu_reset(DeviceState *dev) {
 
 	p->enabled = false;
 	p->freq = 0;
+	pmb887x_sched_clock_set_freq(&p->clock, 0);
 
 	memset(p->timers, 0, sizeof(p->timers));
 	memset(p->timers_t2, 0, sizeof(p->timers_t2));
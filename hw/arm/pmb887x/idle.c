@@ -0,0 +1,131 @@
+/*
+ * Fast-forward of the timer polling loops
+ * */
+#define PMB887X_TRACE_ID		IDLE
+#define PMB887X_TRACE_PREFIX	"pmb887x-idle"
+
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+#include "qapi/error.h"
+#include "qom/object.h"
+#include "system/cpu-timers.h"
+#include "cpu.h"
+
+#include "hw/arm/pmb887x/idle.h"
+#include "hw/arm/pmb887x/board/board.h"
+#include "hw/arm/pmb887x/utils/toml.h"
+#include "hw/arm/pmb887x/trace.h"
+
+#define IDLE_DEFAULT_THRESHOLD		32
+#define IDLE_DEFAULT_MAX_WARP		10000		// us
+// Two polls of a tight loop are never further apart than this (ns of virtual time)
+#define IDLE_MAX_POLL_INTERVAL		2000
+
+typedef struct pmb887x_idle_t pmb887x_idle_t;
+
+struct pmb887x_idle_t {
+	ARMCPU *cpu;
+	uint32_t threshold;
+	int64_t max_warp;
+
+	uint32_t pc;
+	uint32_t addr;
+	uint32_t sequence;
+	uint32_t repeats;
+	int64_t first_poll;
+	int64_t last_poll;
+
+	pmb887x_idle_stats_t stats;
+};
+
+bool pmb887x_idle_enabled;
+uint32_t pmb887x_io_sequence;
+static pmb887x_idle_t idle;
+
+static void idle_reset_loop(uint32_t pc, uint32_t addr, uint32_t sequence, int64_t now) {
+	idle.pc = pc;
+	idle.addr = addr;
+	idle.repeats = 0;
+	idle.first_poll = now;
+	idle.last_poll = now;
+	idle.sequence = sequence;
+}
+
+void pmb887x_idle_poll_slow(uint32_t addr) {
+	int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+	uint32_t pc = idle.cpu->env.regs[15];
+	uint32_t sequence = qatomic_read(&pmb887x_io_sequence);
+
+	// Only the previous poll itself is allowed between two polls
+	bool same_loop = pc == idle.pc && addr == idle.addr &&
+		sequence == idle.sequence + 1 &&
+		now - idle.last_poll <= IDLE_MAX_POLL_INTERVAL;
+
+	if (!same_loop) {
+		idle_reset_loop(pc, addr, sequence, now);
+		return;
+	}
+
+	idle.sequence = sequence;
+	idle.last_poll = now;
+
+	if (++idle.repeats < idle.threshold)
+		return;
+
+	int64_t deadline = qemu_clock_deadline_ns_all(QEMU_CLOCK_VIRTUAL, QEMU_TIMER_ATTR_ALL);
+	if (deadline <= IDLE_MAX_POLL_INTERVAL) {
+		// No timers or the next one is too close to bother
+		idle_reset_loop(pc, addr, sequence, now);
+		return;
+	}
+
+	int64_t period = MAX((now - idle.first_poll) / idle.repeats, 1);
+	int64_t warp = MIN(deadline, idle.max_warp);
+
+	icount2_warp(warp);
+
+	idle.stats.warps++;
+	idle.stats.skipped_ns += warp;
+	idle.stats.skipped_polls += warp / period;
+
+	DPRINTF("pc=%08X addr=%08X period=%" PRId64 " ns, warp %" PRId64 " ns\n", pc, addr, period, warp);
+
+	idle_reset_loop(pc, addr, sequence, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL));
+}
+
+const pmb887x_idle_stats_t *pmb887x_idle_stats(void) {
+	return &idle.stats;
+}
+
+void pmb887x_idle_init(Object *machine) {
+	pmb887x_board_t *board = pmb887x_board();
+	bool enabled = toml_table_get_bool(board->config, "cpu.idle_skip", false, false);
+	idle.threshold = toml_table_get_uint32(board->config, "cpu.idle_skip_threshold", IDLE_DEFAULT_THRESHOLD, false);
+	idle.max_warp = (int64_t) toml_table_get_uint32(board->config, "cpu.idle_skip_max_warp",
+		IDLE_DEFAULT_MAX_WARP, false) * SCALE_US;
+
+	const char *idle_skip = getenv("PMB887X_IDLE_SKIP");
+	if (idle_skip && idle_skip[0])
+		enabled = strcmp(idle_skip, "0") != 0;
+
+	object_property_add_uint64_ptr(machine, "idle-skip-warps", &idle.stats.warps, OBJ_PROP_FLAG_READ);
+	object_property_add_uint64_ptr(machine, "idle-skip-polls", &idle.stats.skipped_polls, OBJ_PROP_FLAG_READ);
+	object_property_add_uint64_ptr(machine, "idle-skip-ns", &idle.stats.skipped_ns, OBJ_PROP_FLAG_READ);
+
+	if (!enabled)
+		return;
+
+	// Without precise clocks virtual time follows the host clock and can't be moved forward
+	if (!icount2_enabled()) {
+		WPRINTF("idle skip requires -icount precise-clocks=on, disabled\n");
+		return;
+	}
+
+	if (!idle.threshold || !idle.max_warp) {
+		EPRINTF("invalid idle skip config: threshold=%u, max_warp=%" PRId64 " ns\n", idle.threshold, idle.max_warp);
+		exit(1);
+	}
+
+	idle.cpu = ARM_CPU(qemu_get_cpu(0));
+	pmb887x_idle_enabled = true;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "qemu/osdep.h"
+#include "qom/object.h"
+
+typedef struct pmb887x_idle_stats_t pmb887x_idle_stats_t;
+
+struct pmb887x_idle_stats_t {
+	uint64_t warps;
+	uint64_t skipped_polls;
+	uint64_t skipped_ns;
+};
+
+extern bool pmb887x_idle_enabled;
+// Bumped on every CPU-side MMIO access, a poll loop must not touch anything else
+extern uint32_t pmb887x_io_sequence;
+
+void pmb887x_idle_init(Object *machine);
+void pmb887x_idle_poll_slow(uint32_t addr);
+const pmb887x_idle_stats_t *pmb887x_idle_stats(void);
+
+/*
+ * Called by timer registers reads before the value is computed.
+ * After enough identical polls from the same PC virtual time is warped to the next timer deadline.
+ * */
+static inline void pmb887x_idle_poll(uint32_t addr) {
+	if (pmb887x_idle_enabled)
+		pmb887x_idle_poll_slow(addr);
+}
@@ -1,5 +1,9 @@
 /*
  * MMC Interface
+ *
+ * The host side has no known registers besides CLC and ID, firmware clocks the card through the
+ * MMCI_CLK/CMD/DAT0 pins. The card side decodes that 1-bit SD bus protocol edge by edge and
+ * forwards it to a QEMU SD card (-drive if=sd).
  * */
 #define PMB887X_TRACE_ID		MMCI
 #define PMB887X_TRACE_PREFIX	"pmb887x-mmci"
@@ -11,6 +15,8 @@
 #include "system/memory.h"
 #include "hw/core/qdev-properties.h"
 #include "qapi/error.h"
+#include "qemu/crc-ccitt.h"
+#include "hw/sd/sd.h"
 #include "cpu.h"
 
 #include "hw/arm/pmb887x/gen/cpu_regs.h"
@@ -21,7 +27,33 @@
 #define TYPE_PMB887X_MMCI	"pmb887x-mmci"
 #define PMB887X_MMCI(obj)	OBJECT_CHECK(pmb887x_mmci_t, (obj), TYPE_PMB887X_MMCI)
 
+#define MMCI_SD_BLOCK_SIZE		512
+#define MMCI_SD_CMD_BITS		48
+// Clocks between the command end bit and the response start bit
+#define MMCI_SD_NCR				2
+// Clocks between the response end bit (or the previous block) and the read data start bit
+#define MMCI_SD_NAC				2
+// Clocks between the write data end bit and the CRC status token
+#define MMCI_SD_NCRC			2
+// Programming time after a written block, the backend write is synchronous
+#define MMCI_SD_BUSY			8
+// start + data + CRC16 + end
+#define MMCI_SD_FRAME_BITS		(1 + MMCI_SD_BLOCK_SIZE * 8 + 16 + 1)
+
+#define MMCI_SD_CRC_OK			0x05	// 0 010 1
+#define MMCI_SD_CRC_ERROR		0x0B	// 0 101 1
+
 typedef struct pmb887x_mmci_t pmb887x_mmci_t;
+typedef struct pmb887x_mmci_frame_t pmb887x_mmci_frame_t;
+
+// Card to host bit stream, MSB first
+struct pmb887x_mmci_frame_t {
+	uint8_t bits[DIV_ROUND_UP(MMCI_SD_FRAME_BITS + MMCI_SD_BUSY, 8)];
+	uint32_t count;
+	uint32_t pos;
+	uint32_t delay;		// idle (high) clocks before the first bit
+	bool active;
+};
 
 struct pmb887x_mmci_t {
 	SysBusDevice parent_obj;
@@ -32,6 +64,33 @@ struct pmb887x_mmci_t {
 	qemu_irq gpio_dat1;
 	qemu_irq gpio_cmd;
 	qemu_irq gpio_clk;
+
+	// Card side of the MMCI pins
+	SDBus sdbus;
+	qemu_irq sd_cmd_out;
+	qemu_irq sd_dat0_out;
+	bool sd_clk;
+	bool sd_cmd;
+	bool sd_dat0;
+	bool sd_dat0_driven;	// the host pin is an output, otherwise SD_DAT0_IN is only the latch
+	bool sd_cmd_level;
+	bool sd_dat0_level;
+
+	uint64_t cmd_shift;
+	uint32_t cmd_bits;
+	uint8_t last_cmd;
+	bool app_cmd;
+	uint32_t blocklen;
+
+	pmb887x_mmci_frame_t cmd_tx;
+	pmb887x_mmci_frame_t dat_tx;
+	bool dat_reading;
+
+	bool dat_rx;
+	uint32_t dat_rx_bits;
+	uint32_t dat_rx_len;
+	uint16_t dat_rx_crc;
+	uint8_t dat_buf[MMCI_SD_BLOCK_SIZE];
 };
 
 static uint64_t mmci_io_read(void *opaque, hwaddr haddr, unsigned size) {
@@ -88,6 +147,266 @@ static void mmci_handle_gpio_input(void *opaque, int id, int level) {
 	// nothing
 }
 
+static uint8_t mmci_sd_crc7(const uint8_t *buf, size_t len) {
+	uint8_t crc = 0;
+	for (size_t i = 0; i < len; i++) {
+		for (int bit = 7; bit >= 0; bit--) {
+			bool feedback = ((buf[i] >> bit) ^ (crc >> 6)) & 1;
+			crc = (crc << 1) & 0x7F;
+			if (feedback)
+				crc ^= 0x09;
+		}
+	}
+	return crc;
+}
+
+static void mmci_frame_start(pmb887x_mmci_frame_t *frame, uint32_t delay) {
+	frame->count = 0;
+	frame->pos = 0;
+	frame->delay = delay;
+	frame->active = true;
+}
+
+static void mmci_frame_put(pmb887x_mmci_frame_t *frame, uint32_t value, int bits) {
+	for (int i = bits - 1; i >= 0; i--) {
+		g_assert(frame->count < sizeof(frame->bits) * 8);
+		uint8_t mask = 0x80 >> (frame->count % 8);
+		if ((value >> i) & 1) {
+			frame->bits[frame->count / 8] |= mask;
+		} else {
+			frame->bits[frame->count / 8] &= ~mask;
+		}
+		frame->count++;
+	}
+}
+
+static void mmci_frame_put_bytes(pmb887x_mmci_frame_t *frame, const uint8_t *buf, size_t len) {
+	for (size_t i = 0; i < len; i++)
+		mmci_frame_put(frame, buf[i], 8);
+}
+
+// Next line level, -1 when the frame is over
+static int mmci_frame_next(pmb887x_mmci_frame_t *frame) {
+	if (frame->delay > 0) {
+		frame->delay--;
+		return 1;
+	}
+	if (frame->pos == frame->count) {
+		frame->active = false;
+		return -1;
+	}
+	int bit = (frame->bits[frame->pos / 8] >> (7 - frame->pos % 8)) & 1;
+	frame->pos++;
+	return bit;
+}
+
+static void mmci_sd_set_cmd(pmb887x_mmci_t *p, bool level) {
+	if (p->sd_cmd_level != level) {
+		p->sd_cmd_level = level;
+		qemu_set_irq(p->sd_cmd_out, level);
+	}
+}
+
+static void mmci_sd_set_dat0(pmb887x_mmci_t *p, bool level) {
+	if (p->sd_dat0_level != level) {
+		p->sd_dat0_level = level;
+		qemu_set_irq(p->sd_dat0_out, level);
+	}
+}
+
+static void mmci_sd_read_block(pmb887x_mmci_t *p, uint32_t delay) {
+	uint8_t *buf = p->dat_buf;
+	uint32_t len = 0;
+
+	// SCR, SD status, switch status and friends are shorter than a block, the card tells where they end
+	while (len < p->blocklen && sdbus_data_ready(&p->sdbus))
+		buf[len++] = sdbus_read_byte(&p->sdbus);
+
+	if (!len) {
+		p->dat_reading = false;
+		return;
+	}
+
+	mmci_frame_start(&p->dat_tx, delay);
+	mmci_frame_put(&p->dat_tx, 0, 1);
+	mmci_frame_put_bytes(&p->dat_tx, buf, len);
+	mmci_frame_put(&p->dat_tx, crc_ccitt_false(0, buf, len), 16);
+	mmci_frame_put(&p->dat_tx, 1, 1);
+	p->dat_reading = true;
+}
+
+static void mmci_sd_abort_data(pmb887x_mmci_t *p) {
+	p->dat_tx.active = false;
+	p->dat_reading = false;
+	p->dat_rx = false;
+	mmci_sd_set_dat0(p, true);
+}
+
+static void mmci_sd_command(pmb887x_mmci_t *p, uint64_t frame) {
+	uint8_t raw[5];
+	uint8_t resp[16];
+
+	for (size_t i = 0; i < ARRAY_SIZE(raw); i++)
+		raw[i] = frame >> (40 - i * 8);
+
+	if (!(raw[0] & 0x40) || !(frame & 1)) {
+		DPRINTF("invalid command frame %012"PRIX64"\n", frame);
+		return;
+	}
+
+	SDRequest req = {
+		.cmd = raw[0] & 0x3F,
+		.arg = ldl_be_p(&raw[1]),
+		.crc = (frame >> 1) & 0x7F,
+	};
+
+	// The card ignores commands with a bad CRC, the host sees a response timeout
+	if (mmci_sd_crc7(raw, sizeof(raw)) != req.crc) {
+		DPRINTF("CMD%d %08X: CRC error\n", req.cmd, req.arg);
+		return;
+	}
+
+	bool app_cmd = p->app_cmd;
+	size_t len = sdbus_do_command(&p->sdbus, &req, resp, sizeof(resp));
+	DPRINTF("%sCMD%d %08X: %zu response bytes\n", app_cmd ? "A" : "", req.cmd, req.arg, len);
+
+	p->last_cmd = req.cmd;
+	p->app_cmd = req.cmd == 55 && len > 0;
+
+	switch (req.cmd) {
+		case 0:
+			p->blocklen = MMCI_SD_BLOCK_SIZE;
+			mmci_sd_abort_data(p);
+			break;
+
+		case 12:
+			mmci_sd_abort_data(p);
+			break;
+
+		case 16:
+			if (len > 0 && req.arg > 0 && req.arg <= MMCI_SD_BLOCK_SIZE)
+				p->blocklen = req.arg;
+			break;
+	}
+
+	if (!len)
+		return;
+
+	mmci_frame_start(&p->cmd_tx, MMCI_SD_NCR);
+	if (len == 16) {
+		// R2: the CID/CSD already ends with its own CRC7 and end bit
+		mmci_frame_put(&p->cmd_tx, 0x3F, 8);
+		mmci_frame_put_bytes(&p->cmd_tx, resp, len);
+	} else if (app_cmd && req.cmd == 41) {
+		// R3: no index and no CRC
+		mmci_frame_put(&p->cmd_tx, 0x3F, 8);
+		mmci_frame_put_bytes(&p->cmd_tx, resp, 4);
+		mmci_frame_put(&p->cmd_tx, 0xFF, 8);
+	} else {
+		uint8_t header[5] = { req.cmd };
+		memcpy(&header[1], resp, 4);
+		mmci_frame_put_bytes(&p->cmd_tx, header, sizeof(header));
+		mmci_frame_put(&p->cmd_tx, (mmci_sd_crc7(header, sizeof(header)) << 1) | 1, 8);
+	}
+
+	// Read data follows the response
+	if (!p->dat_tx.active && sdbus_data_ready(&p->sdbus))
+		mmci_sd_read_block(p, MMCI_SD_NCR + p->cmd_tx.count + MMCI_SD_NAC);
+}
+
+static void mmci_sd_write_block(pmb887x_mmci_t *p) {
+	uint16_t crc = crc_ccitt_false(0, p->dat_buf, p->dat_rx_len);
+	bool crc_ok = crc == p->dat_rx_crc;
+
+	if (crc_ok) {
+		sdbus_write_data(&p->sdbus, p->dat_buf, p->dat_rx_len);
+	} else {
+		DPRINTF("CMD%d: data CRC error %04X != %04X\n", p->last_cmd, p->dat_rx_crc, crc);
+	}
+
+	mmci_frame_start(&p->dat_tx, MMCI_SD_NCRC);
+	mmci_frame_put(&p->dat_tx, crc_ok ? MMCI_SD_CRC_OK : MMCI_SD_CRC_ERROR, 5);
+	mmci_frame_put(&p->dat_tx, 0, MMCI_SD_BUSY);
+}
+
+// Rising edge: the card samples CMD and DAT0
+static void mmci_sd_sample(pmb887x_mmci_t *p) {
+	if (!p->cmd_tx.active && (p->cmd_bits > 0 || !p->sd_cmd)) {
+		p->cmd_shift = (p->cmd_shift << 1) | p->sd_cmd;
+		if (++p->cmd_bits == MMCI_SD_CMD_BITS) {
+			p->cmd_bits = 0;
+			mmci_sd_command(p, p->cmd_shift & MAKE_64BIT_MASK(0, MMCI_SD_CMD_BITS));
+		}
+	}
+
+	if (p->dat_rx) {
+		uint32_t bit = p->dat_rx_bits++;
+		if (bit < p->dat_rx_len * 8) {
+			uint8_t mask = 0x80 >> (bit % 8);
+			if (p->sd_dat0) {
+				p->dat_buf[bit / 8] |= mask;
+			} else {
+				p->dat_buf[bit / 8] &= ~mask;
+			}
+		} else if (bit < p->dat_rx_len * 8 + 16) {
+			p->dat_rx_crc = (p->dat_rx_crc << 1) | p->sd_dat0;
+		} else {
+			p->dat_rx = false;
+			mmci_sd_write_block(p);
+		}
+	} else if (!p->dat_tx.active && p->sd_dat0_driven && !p->sd_dat0 && sdbus_receive_ready(&p->sdbus)) {
+		// Start bit of a written block
+		p->dat_rx = true;
+		p->dat_rx_bits = 0;
+		p->dat_rx_crc = 0;
+		p->dat_rx_len = p->last_cmd == 27 ? 16 : p->blocklen;
+	}
+}
+
+// Falling edge: the card drives CMD and DAT0
+static void mmci_sd_drive(pmb887x_mmci_t *p) {
+	if (p->cmd_tx.active) {
+		int bit = mmci_frame_next(&p->cmd_tx);
+		mmci_sd_set_cmd(p, bit != 0);
+	}
+
+	if (p->dat_tx.active) {
+		int bit = mmci_frame_next(&p->dat_tx);
+		mmci_sd_set_dat0(p, bit != 0);
+
+		// READ_MULTIPLE_BLOCK goes on until STOP_TRANSMISSION
+		if (bit < 0 && p->dat_reading)
+			mmci_sd_read_block(p, MMCI_SD_NAC);
+	}
+}
+
+static void mmci_handle_sd_clk(void *opaque, int id, int level) {
+	pmb887x_mmci_t *p = opaque;
+	if (p->sd_clk == !!level)
+		return;
+	p->sd_clk = !!level;
+	if (p->sd_clk) {
+		mmci_sd_sample(p);
+	} else {
+		mmci_sd_drive(p);
+	}
+}
+
+static void mmci_handle_sd_cmd(void *opaque, int id, int level) {
+	pmb887x_mmci_t *p = opaque;
+	p->sd_cmd = !!level;
+}
+
+static void mmci_handle_sd_dat0(void *opaque, int id, int level) {
+	pmb887x_mmci_t *p = opaque;
+	p->sd_dat0 = !!level;
+}
+
+static void mmci_handle_sd_dat0_dir(void *opaque, int id, int level) {
+	pmb887x_mmci_t *p = opaque;
+	p->sd_dat0_driven = !!level;
+}
+
 static void mmci_init(Object *obj) {
 	DeviceState *dev = DEVICE(obj);
 	pmb887x_mmci_t *p = PMB887X_MMCI(obj);
@@ -102,11 +421,33 @@ static void mmci_init(Object *obj) {
 	qdev_init_gpio_out_named(dev, &p->gpio_dat1, "DAT1_OUT", 1);
 	qdev_init_gpio_out_named(dev, &p->gpio_cmd, "CMD_OUT", 1);
 	qdev_init_gpio_out_named(dev, &p->gpio_clk, "CLK_OUT", 1);
+
+	qbus_init(&p->sdbus, sizeof(p->sdbus), TYPE_SD_BUS, dev, "sd-bus");
+	qdev_init_gpio_in_named(dev, mmci_handle_sd_clk, "SD_CLK_IN", 1);
+	qdev_init_gpio_in_named(dev, mmci_handle_sd_cmd, "SD_CMD_IN", 1);
+	qdev_init_gpio_in_named(dev, mmci_handle_sd_dat0, "SD_DAT0_IN", 1);
+	qdev_init_gpio_in_named(dev, mmci_handle_sd_dat0_dir, "SD_DAT0_DIR_IN", 1);
+	qdev_init_gpio_out_named(dev, &p->sd_cmd_out, "SD_CMD_OUT", 1);
+	qdev_init_gpio_out_named(dev, &p->sd_dat0_out, "SD_DAT0_OUT", 1);
+}
+
+static void mmci_sd_reset(pmb887x_mmci_t *p) {
+	p->cmd_bits = 0;
+	p->app_cmd = false;
+	p->last_cmd = 0;
+	p->blocklen = MMCI_SD_BLOCK_SIZE;
+	p->cmd_tx.active = false;
+	p->sd_cmd_level = false;
+	p->sd_dat0_level = false;
+	// Lines are pulled up while the card doesn't drive them
+	mmci_sd_set_cmd(p, true);
+	mmci_sd_abort_data(p);
 }
 
 static void mmci_reset(DeviceState *dev) {
 	pmb887x_mmci_t *p = PMB887X_MMCI(dev);
 	pmb887x_clc_init(&p->clc);
+	mmci_sd_reset(p);
 }
 
 static void mmci_realize(DeviceState *dev, Error **errp) {
@@ -4,25 +4,69 @@
 #include "target/arm/cpu.h"
 #include "qemu/log.h"
 #include "qemu/error-report.h"
+#include "qemu/memalign.h"
+#include "qemu/timer.h"
 #include "system/system.h"
 #include "hw/arm/pmb887x/gen/cpu_regs.h"
 
-typedef struct pmb887x_io_operation_t pmb887x_io_operation_t;
+typedef struct pmb887x_io_trace_header_t pmb887x_io_trace_header_t;
+typedef struct pmb887x_io_trace_record_t pmb887x_io_trace_record_t;
+typedef struct pmb887x_io_dump_ring_t pmb887x_io_dump_ring_t;
+typedef struct pmb887x_io_dump_coalesce_t pmb887x_io_dump_coalesce_t;
 typedef struct pmb887x_io_dump_buffer_t pmb887x_io_dump_buffer_t;
 
-#define IO_DUMP_QUEUE_CAPACITY 0x100000
+#define IO_DUMP_RING_CAPACITY 0x40000
+#define IO_DUMP_MAX_RINGS 32
 #define IO_DUMP_BATCH_SIZE 256
 #define IO_DUMP_DEDUPLICATION_INTERVAL_MS 100
+#define IO_DUMP_IDLE_WAIT_MS 20
 #define IO_DUMP_BUFFER_SIZE 4096
 
-struct pmb887x_io_operation_t {
-	pmb887x_trace_io_t trace_io;
+#define IO_TRACE_MAGIC "PMBIOTRC"
+#define IO_TRACE_VERSION 1
+#define IO_TRACE_FLAG_WRITE		(1 << 0)
+#define IO_TRACE_FLAG_DROPPED	(1 << 1) // value = number of records lost before this point
+
+/*
+ * Binary trace file: header followed by fixed-size little-endian records.
+ * Records are raw, duplicates are folded only when decoding.
+ * */
+struct pmb887x_io_trace_header_t {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t cpu;
+	uint32_t reserved;
+} QEMU_PACKED;
+
+struct pmb887x_io_trace_record_t {
+	uint64_t timestamp;
+	uint32_t pc;
+	uint32_t lr;
 	uint32_t addr;
 	uint32_t value;
+	uint16_t trace_io;
 	uint8_t size;
-	uint32_t pc;
-	uint32_t lr;
-	bool is_write;
+	uint8_t flags;
+	uint32_t reserved;
+} QEMU_PACKED;
+
+/*
+ * Single producer (owning thread) / single consumer (io_dump thread) ring.
+ * head and tail are free-running counters.
+ * The producer sets closed on thread exit, the consumer frees the ring once it is drained.
+ * */
+struct pmb887x_io_dump_ring_t {
+	uint32_t head;
+	uint32_t reported_dropped;
+	uint32_t tail QEMU_ALIGNED(64);
+	uint32_t dropped;
+	bool closed;
+	pmb887x_io_trace_record_t records[IO_DUMP_RING_CAPACITY] QEMU_ALIGNED(64);
+};
+
+struct pmb887x_io_dump_coalesce_t {
+	pmb887x_io_trace_record_t record;
 	uint64_t count;
 	int64_t deadline_ms;
 };
@@ -33,12 +77,19 @@ struct pmb887x_io_dump_buffer_t {
 };
 
 static bool io_dump_stopping;
+static bool io_dump_enabled;
+static bool io_dump_sleeping;
 static QemuMutex io_dump_lock;
 static QemuThread io_dump_thread_id;
-static QemuCond io_dump_ready;
-static pmb887x_io_operation_t io_dump_queue[IO_DUMP_QUEUE_CAPACITY];
-static size_t io_dump_queue_head;
-static size_t io_dump_queue_count;
+static QemuSemaphore io_dump_wakeup;
+static pmb887x_io_dump_ring_t *io_dump_rings[IO_DUMP_MAX_RINGS];
+static uint32_t io_dump_rings_count;
+static uint32_t io_dump_lost;
+static uint32_t io_dump_producers;
+static __thread pmb887x_io_dump_ring_t *io_dump_ring;
+static __thread bool io_dump_ring_failed;
+static __thread Notifier io_dump_ring_exit_notifier;
+static FILE *io_dump_trace_file;
 static ARMCPU *io_dump_cpu;
 static bool io_dump_log_enabled;
 static Notifier io_dump_exit_notifier;
@@ -136,80 +187,270 @@ static const char *regs_dump_find_cpu_irq_name(const pmb887x_cpu_meta_t *cpu, ui
 	return NULL;
 }
 
-static bool regs_dump_pop_io(pmb887x_io_operation_t *entry, bool wait) {
+static pmb887x_io_dump_ring_t *regs_dump_register_ring(void) {
+	pmb887x_io_dump_ring_t *ring = NULL;
+
 	qemu_mutex_lock(&io_dump_lock);
-	if (wait) {
-		while (!io_dump_stopping) {
-			if (io_dump_queue_count == 0) {
-				qemu_cond_wait(&io_dump_ready, &io_dump_lock);
-			} else if (io_dump_queue_count > 1) {
-				break;
-			} else {
-				int64_t timeout_ms = io_dump_queue[io_dump_queue_head].deadline_ms - qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
-				if (timeout_ms <= 0)
-					break;
-				qemu_cond_timedwait(&io_dump_ready, &io_dump_lock, timeout_ms);
-			}
+	uint32_t index = io_dump_rings_count;
+	if (index < IO_DUMP_MAX_RINGS && !qatomic_read(&io_dump_stopping)) {
+		ring = qemu_memalign(64, sizeof(*ring));
+		memset(ring, 0, offsetof(pmb887x_io_dump_ring_t, records));
+		io_dump_rings[index] = ring;
+		qatomic_store_release(&io_dump_rings_count, index + 1);
+	}
+	qemu_mutex_unlock(&io_dump_lock);
+
+	if (!ring)
+		warn_report("IO trace: too many producer threads, records from this thread are dropped");
+	return ring;
+}
+
+static void regs_dump_ring_thread_exit(Notifier *notifier, void *data) {
+	qemu_mutex_lock(&io_dump_lock);
+	// After stop the rings are already freed
+	if (!qatomic_read(&io_dump_stopping))
+		qatomic_store_release(&io_dump_ring->closed, true);
+	qemu_mutex_unlock(&io_dump_lock);
+	io_dump_ring = NULL;
+}
+
+static void regs_dump_free_closed_rings(void) {
+	qemu_mutex_lock(&io_dump_lock);
+	for (uint32_t i = 0; i < io_dump_rings_count; ) {
+		pmb887x_io_dump_ring_t *ring = io_dump_rings[i];
+		if (!qatomic_load_acquire(&ring->closed) || ring->head != qatomic_load_acquire(&ring->tail)) {
+			i++;
+			continue;
 		}
+
+		qatomic_add(&io_dump_lost, qatomic_read(&ring->dropped) - ring->reported_dropped);
+		io_dump_rings[i] = io_dump_rings[io_dump_rings_count - 1];
+		qatomic_store_release(&io_dump_rings_count, io_dump_rings_count - 1);
+		qemu_vfree(ring);
 	}
+	qemu_mutex_unlock(&io_dump_lock);
+}
 
-	bool can_pop = io_dump_queue_count > 1 || io_dump_stopping;
-	if (io_dump_queue_count == 1 && !can_pop)
-		can_pop = io_dump_queue[io_dump_queue_head].deadline_ms <= qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
-	if (!can_pop || io_dump_queue_count == 0) {
-		qemu_mutex_unlock(&io_dump_lock);
-		return false;
+static pmb887x_io_dump_ring_t *regs_dump_next_ring(void) {
+	uint32_t rings_count = qatomic_load_acquire(&io_dump_rings_count);
+	pmb887x_io_dump_ring_t *next = NULL;
+	uint64_t next_timestamp = 0;
+
+	// Merge producers by timestamp, so the log keeps global order
+	for (uint32_t i = 0; i < rings_count; i++) {
+		pmb887x_io_dump_ring_t *ring = io_dump_rings[i];
+		if (ring->head == qatomic_load_acquire(&ring->tail))
+			continue;
+
+		uint64_t timestamp = ring->records[ring->head % IO_DUMP_RING_CAPACITY].timestamp;
+		if (!next || timestamp < next_timestamp) {
+			next = ring;
+			next_timestamp = timestamp;
+		}
+	}
+	return next;
+}
+
+static uint32_t regs_dump_collect_dropped(void) {
+	uint32_t rings_count = qatomic_load_acquire(&io_dump_rings_count);
+	uint32_t dropped = qatomic_xchg(&io_dump_lost, 0);
+
+	for (uint32_t i = 0; i < rings_count; i++) {
+		pmb887x_io_dump_ring_t *ring = io_dump_rings[i];
+		uint32_t total = qatomic_read(&ring->dropped);
+		dropped += total - ring->reported_dropped;
+		ring->reported_dropped = total;
 	}
+	return dropped;
+}
 
-	*entry = io_dump_queue[io_dump_queue_head];
-	io_dump_queue_head = (io_dump_queue_head + 1) % IO_DUMP_QUEUE_CAPACITY;
-	io_dump_queue_count--;
-	qemu_mutex_unlock(&io_dump_lock);
-	return true;
+static bool regs_dump_is_same_io(const pmb887x_io_trace_record_t *a, const pmb887x_io_trace_record_t *b) {
+	return a->trace_io == b->trace_io && a->addr == b->addr && a->value == b->value && a->size == b->size &&
+		a->pc == b->pc && a->lr == b->lr && a->flags == b->flags;
+}
+
+static void regs_dump_coalesce_flush(pmb887x_io_dump_coalesce_t *pending, FILE *log_file, bool with_timestamp) {
+	if (!pending->count)
+		return;
+
+	if (log_file) {
+		const pmb887x_io_trace_record_t *record = &pending->record;
+		if (with_timestamp) {
+			uint64_t seconds = record->timestamp / NANOSECONDS_PER_SECOND;
+			uint64_t us = (record->timestamp % NANOSECONDS_PER_SECOND) / 1000;
+			fprintf(log_file, "[%6" PRIu64 ".%06" PRIu64 "] ", seconds, us);
+		}
+		regs_dump_print_io(log_file, record->trace_io, record->addr, record->size, record->value,
+			(record->flags & IO_TRACE_FLAG_WRITE) != 0, record->pc, record->lr, pending->count);
+	}
+	pending->count = 0;
+}
+
+static void regs_dump_coalesce_push(pmb887x_io_dump_coalesce_t *pending, const pmb887x_io_trace_record_t *record,
+	FILE *log_file, bool with_timestamp, int64_t deadline_ms
+) {
+	if (pending->count && regs_dump_is_same_io(&pending->record, record)) {
+		pending->count++;
+		return;
+	}
+	regs_dump_coalesce_flush(pending, log_file, with_timestamp);
+	pending->record = *record;
+	pending->count = 1;
+	pending->deadline_ms = deadline_ms;
+}
+
+static void regs_dump_write_record(const pmb887x_io_trace_record_t *record) {
+	pmb887x_io_trace_record_t le_record = {
+		.timestamp = cpu_to_le64(record->timestamp),
+		.pc = cpu_to_le32(record->pc),
+		.lr = cpu_to_le32(record->lr),
+		.addr = cpu_to_le32(record->addr),
+		.value = cpu_to_le32(record->value),
+		.trace_io = cpu_to_le16(record->trace_io),
+		.size = record->size,
+		.flags = record->flags,
+	};
+
+	if (fwrite(&le_record, sizeof(le_record), 1, io_dump_trace_file) != 1) {
+		error_report("IO trace: write failed: %s", strerror(errno));
+		fclose(io_dump_trace_file);
+		io_dump_trace_file = NULL;
+	}
 }
 
 static void *regs_dump_dump_io_thread(void *arg) {
+	pmb887x_io_dump_coalesce_t pending = { .count = 0 };
+	uint64_t total_dropped = 0;
+
 	while (true) {
-		pmb887x_io_operation_t entry;
-		if (!regs_dump_pop_io(&entry, true))
-			break;
+		bool stopping = qatomic_load_acquire(&io_dump_stopping);
+		pmb887x_io_dump_ring_t *ring = regs_dump_next_ring();
+		uint32_t dropped = regs_dump_collect_dropped();
+		int64_t now_ms = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+
+		if (!ring && !dropped) {
+			if (pending.count && (stopping || pending.deadline_ms <= now_ms)) {
+				FILE *log_file = qemu_log_trylock_with_context();
+				regs_dump_coalesce_flush(&pending, log_file, false);
+				if (log_file)
+					qemu_log_unlock(log_file);
+			}
+
+			if (stopping)
+				break;
+
+			regs_dump_free_closed_rings();
+
+			int timeout_ms = pending.count ? MAX(pending.deadline_ms - now_ms, 1) : IO_DUMP_IDLE_WAIT_MS;
+			qatomic_set(&io_dump_sleeping, true);
+			smp_mb();
+			if (!regs_dump_next_ring())
+				qemu_sem_timedwait(&io_dump_wakeup, timeout_ms);
+			qatomic_set(&io_dump_sleeping, false);
+			continue;
+		}
 
 		FILE *log_file = io_dump_log_enabled ? qemu_log_trylock_with_context() : NULL;
-		for (size_t i = 0; i < IO_DUMP_BATCH_SIZE; i++) {
+		if (dropped) {
+			total_dropped += dropped;
+			regs_dump_coalesce_flush(&pending, log_file, false);
 			if (log_file)
-				regs_dump_print_io(log_file, entry.trace_io, entry.addr, entry.size, entry.value, entry.is_write, entry.pc,
-					entry.lr, entry.count);
-			if (i + 1 == IO_DUMP_BATCH_SIZE || !regs_dump_pop_io(&entry, false))
-				break;
+				fprintf(log_file, "IO trace: %u records dropped\n", dropped);
+			if (io_dump_trace_file) {
+				pmb887x_io_trace_record_t record = {
+					.timestamp = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL),
+					.value = dropped,
+					.flags = IO_TRACE_FLAG_DROPPED,
+				};
+				regs_dump_write_record(&record);
+			}
+		}
+
+		for (size_t i = 0; ring && i < IO_DUMP_BATCH_SIZE; i++) {
+			pmb887x_io_trace_record_t record = ring->records[ring->head % IO_DUMP_RING_CAPACITY];
+			qatomic_store_release(&ring->head, ring->head + 1);
+
+			if (io_dump_trace_file)
+				regs_dump_write_record(&record);
+			if (io_dump_log_enabled)
+				regs_dump_coalesce_push(&pending, &record, log_file, false, now_ms + IO_DUMP_DEDUPLICATION_INTERVAL_MS);
+			ring = regs_dump_next_ring();
 		}
+
 		if (log_file)
 			qemu_log_unlock(log_file);
 	}
+
+	if (io_dump_trace_file) {
+		fclose(io_dump_trace_file);
+		io_dump_trace_file = NULL;
+	}
+	if (total_dropped)
+		warn_report("IO trace: %" PRIu64 " records dropped, producers were faster than the dump thread", total_dropped);
 	return NULL;
 }
 
 static void regs_dump_exit_notify(Notifier *notifier, void *data) {
+	qatomic_set(&io_dump_enabled, false);
 	qemu_mutex_lock(&io_dump_lock);
-	io_dump_stopping = true;
-	qemu_cond_broadcast(&io_dump_ready);
+	qatomic_store_release(&io_dump_stopping, true);
 	qemu_mutex_unlock(&io_dump_lock);
+	qemu_sem_post(&io_dump_wakeup);
 	qemu_thread_join(&io_dump_thread_id);
+
+	// vCPUs may still be running here, wait for producers which passed the io_dump_enabled check
+	smp_mb();
+	while (qatomic_read(&io_dump_producers))
+		g_usleep(100);
+
+	for (uint32_t i = 0; i < io_dump_rings_count; i++)
+		qemu_vfree(io_dump_rings[i]);
+	io_dump_rings_count = 0;
 }
 
-void pmb887x_io_dump_init(void) {
+static void regs_dump_open_trace_file(const char *trace_file) {
+	pmb887x_io_trace_header_t header = {
+		.magic = IO_TRACE_MAGIC,
+		.version = cpu_to_le32(IO_TRACE_VERSION),
+		.record_size = cpu_to_le32(sizeof(pmb887x_io_trace_record_t)),
+		.cpu = cpu_to_le32(pmb887x_board()->cpu),
+	};
+
+	io_dump_trace_file = fopen(trace_file, "wb");
+	if (!io_dump_trace_file) {
+		error_report("Can't open IO trace file %s: %s", trace_file, strerror(errno));
+		exit(1);
+	}
+
+	if (fwrite(&header, sizeof(header), 1, io_dump_trace_file) != 1) {
+		error_report("Can't write IO trace file %s: %s", trace_file, strerror(errno));
+		exit(1);
+	}
+}
+
+void pmb887x_io_dump_init(const char *trace_file) {
 	const pmb887x_cpu_meta_t *cpu_info = pmb887x_get_cpu_meta(pmb887x_board()->cpu);
 
 	io_dump_stopping = false;
-	io_dump_queue_head = 0;
-	io_dump_queue_count = 0;
+	io_dump_sleeping = false;
+	io_dump_rings_count = 0;
+	io_dump_lost = 0;
+	io_dump_producers = 0;
 	io_dump_cpu = NULL;
+	io_dump_trace_file = NULL;
 	io_dump_log_enabled = qemu_loglevel_mask(LOG_TRACE);
-	qemu_mutex_init(&io_dump_lock);
-	qemu_cond_init(&io_dump_ready);
-	io_dump_exit_notifier.notify = regs_dump_exit_notify;
-	qemu_add_exit_notifier(&io_dump_exit_notifier);
 
-	qemu_thread_create(&io_dump_thread_id, "io_dump", regs_dump_dump_io_thread, NULL, QEMU_THREAD_JOINABLE);
+	if (trace_file && *trace_file)
+		regs_dump_open_trace_file(trace_file);
+
+	io_dump_enabled = io_dump_log_enabled || io_dump_trace_file;
+	if (io_dump_enabled) {
+		qemu_mutex_init(&io_dump_lock);
+		qemu_sem_init(&io_dump_wakeup, 0);
+		io_dump_exit_notifier.notify = regs_dump_exit_notify;
+		qemu_add_exit_notifier(&io_dump_exit_notifier);
+		qemu_thread_create(&io_dump_thread_id, "io_dump", regs_dump_dump_io_thread, NULL, QEMU_THREAD_JOINABLE);
+	}
 
 	// Module search index
 	for (int i = 0; i < cpu_info->modules_count; i++) {
@@ -227,43 +468,99 @@ void pmb887x_io_dump_init(void) {
 	assert(gpio_base != 0);
 }
 
+bool pmb887x_io_trace_decode(const char *trace_file, FILE *out) {
+	pmb887x_io_dump_coalesce_t pending = { .count = 0 };
+	pmb887x_io_trace_header_t header;
+	pmb887x_io_trace_record_t record;
+
+	FILE *fp = fopen(trace_file, "rb");
+	if (!fp) {
+		error_report("Can't open IO trace file %s: %s", trace_file, strerror(errno));
+		return false;
+	}
+
+	if (fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, IO_TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+		le32_to_cpu(header.version) != IO_TRACE_VERSION || le32_to_cpu(header.record_size) != sizeof(record)) {
+		error_report("%s: not a pmb887x IO trace (or unsupported version)", trace_file);
+		fclose(fp);
+		return false;
+	}
+
+	if (le32_to_cpu(header.cpu) != pmb887x_board()->cpu)
+		warn_report("%s: trace was recorded on another CPU, register names may be wrong", trace_file);
+
+	while (fread(&record, sizeof(record), 1, fp) == 1) {
+		record.timestamp = le64_to_cpu(record.timestamp);
+		record.pc = le32_to_cpu(record.pc);
+		record.lr = le32_to_cpu(record.lr);
+		record.addr = le32_to_cpu(record.addr);
+		record.value = le32_to_cpu(record.value);
+		record.trace_io = le16_to_cpu(record.trace_io);
+
+		if ((record.flags & IO_TRACE_FLAG_DROPPED)) {
+			regs_dump_coalesce_flush(&pending, out, true);
+			fprintf(out, "IO trace: %u records dropped\n", record.value);
+			continue;
+		}
+		regs_dump_coalesce_push(&pending, &record, out, true, 0);
+	}
+	regs_dump_coalesce_flush(&pending, out, true);
+
+	fclose(fp);
+	return true;
+}
+
 static void regs_dump_io(pmb887x_trace_io_t trace_io, uint32_t addr, uint32_t size, uint32_t value, bool is_write,
 	uint32_t pc, uint32_t lr
 ) {
-	qemu_mutex_lock(&io_dump_lock);
-	if (io_dump_queue_count > 0) {
-		size_t last_index = (io_dump_queue_head + io_dump_queue_count - 1) % IO_DUMP_QUEUE_CAPACITY;
-		pmb887x_io_operation_t *last_entry = &io_dump_queue[last_index];
-		bool is_duplicate = last_entry->trace_io == trace_io && last_entry->addr == addr && last_entry->value == value &&
-			last_entry->size == size && last_entry->pc == pc && last_entry->lr == lr && last_entry->is_write == is_write;
-		if (is_duplicate) {
-			last_entry->count++;
-			qemu_mutex_unlock(&io_dump_lock);
+	if (!qatomic_read(&io_dump_enabled))
+		return;
+
+	// Full barrier, pairs with regs_dump_exit_notify(): rings are not freed while a producer is inside
+	qatomic_inc(&io_dump_producers);
+	if (unlikely(!qatomic_read(&io_dump_enabled))) {
+		qatomic_dec(&io_dump_producers);
+		return;
+	}
+
+	pmb887x_io_dump_ring_t *ring = io_dump_ring;
+	if (unlikely(!ring)) {
+		if (!io_dump_ring_failed)
+			ring = io_dump_ring = regs_dump_register_ring();
+		if (!ring) {
+			io_dump_ring_failed = true;
+			qatomic_inc(&io_dump_lost);
+			qatomic_dec(&io_dump_producers);
 			return;
 		}
+		io_dump_ring_exit_notifier.notify = regs_dump_ring_thread_exit;
+		qemu_thread_atexit_add(&io_dump_ring_exit_notifier);
 	}
-	if (io_dump_queue_count == IO_DUMP_QUEUE_CAPACITY) {
-		qemu_mutex_unlock(&io_dump_lock);
-		error_report("IO dump queue overflow (%d)! Something wrong!", IO_DUMP_QUEUE_CAPACITY);
-		exit(1);
+
+	uint32_t tail = ring->tail;
+	if (tail - qatomic_load_acquire(&ring->head) == IO_DUMP_RING_CAPACITY) {
+		qatomic_set(&ring->dropped, ring->dropped + 1);
+		qatomic_dec(&io_dump_producers);
+		return;
 	}
 
-	size_t tail = (io_dump_queue_head + io_dump_queue_count) % IO_DUMP_QUEUE_CAPACITY;
-	io_dump_queue[tail] = (pmb887x_io_operation_t) {
-		.trace_io = trace_io,
-		.addr = addr,
-		.size = size,
-		.value = value,
-		.is_write = is_write,
+	ring->records[tail % IO_DUMP_RING_CAPACITY] = (pmb887x_io_trace_record_t) {
+		.timestamp = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL),
 		.pc = pc,
 		.lr = lr,
-		.count = 1,
-		.deadline_ms = qemu_clock_get_ms(QEMU_CLOCK_REALTIME) + IO_DUMP_DEDUPLICATION_INTERVAL_MS,
+		.addr = addr,
+		.value = value,
+		.trace_io = trace_io,
+		.size = size,
+		.flags = is_write ? IO_TRACE_FLAG_WRITE : 0,
 	};
-	io_dump_queue_count++;
-	if (io_dump_queue_count <= 2)
-		qemu_cond_signal(&io_dump_ready);
-	qemu_mutex_unlock(&io_dump_lock);
+	qatomic_store_release(&ring->tail, tail + 1);
+
+	// Pairs with smp_mb() in the dump thread: either it sees the new tail or we see it sleeping
+	smp_mb();
+	if (qatomic_read(&io_dump_sleeping))
+		qemu_sem_post(&io_dump_wakeup);
+	qatomic_dec(&io_dump_producers);
 }
 
 void pmb887x_dump_io_read(pmb887x_trace_io_t trace_io, uint32_t addr, uint32_t size, uint32_t value) {
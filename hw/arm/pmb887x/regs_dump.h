@@ -9,4 +9,5 @@ void pmb887x_dump_io_read_ex(pmb887x_trace_io_t trace_io, uint32_t addr, uint32_
 	uint32_t pc, uint32_t lr);
 void pmb887x_dump_io_write_ex(pmb887x_trace_io_t trace_io, uint32_t addr, uint32_t size, uint32_t value,
 	uint32_t pc, uint32_t lr);
-void pmb887x_io_dump_init(void);
+void pmb887x_io_dump_init(const char *trace_file);
+bool pmb887x_io_trace_decode(const char *trace_file, FILE *out);
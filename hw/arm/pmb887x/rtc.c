@@ -18,6 +18,7 @@
 #include "hw/arm/pmb887x/regs_dump.h"
 #include "hw/arm/pmb887x/mod.h"
 #include "hw/arm/pmb887x/pll.h"
+#include "hw/arm/pmb887x/scheduler.h"
 #include "hw/arm/pmb887x/trace.h"
 
 #define TYPE_PMB887X_RTC	"pmb887x-rtc"
@@ -37,7 +38,8 @@ struct pmb887x_rtc_t {
 	pmb887x_src_reg_t src;
 	pmb887x_pll_t *pll;
 	qemu_irq irq;
-	QEMUTimer *timer;
+	pmb887x_sched_event_t timer;
+	pmb887x_sched_clock_t clock;
 	
 	uint32_t ctrl;
 	uint32_t con;
@@ -55,7 +57,7 @@ static uint32_t rtc_get_freq(pmb887x_rtc_t *p) {
 }
 
 static int64_t rtc_ticks_to_ns(pmb887x_rtc_t *p, uint64_t ticks) {
-	return muldiv64_round_up(ticks, NANOSECONDS_PER_SECOND, rtc_get_freq(p));
+	return pmb887x_sched_clock_ticks_to_ns_round_up(&p->clock, ticks);
 }
 
 static uint32_t rtc_get_enabled_requests(pmb887x_rtc_t *p) {
@@ -140,15 +142,18 @@ static void rtc_advance(pmb887x_rtc_t *p, uint64_t ticks) {
 static void rtc_sync(pmb887x_rtc_t *p) {
 	if (!(p->con & RTC_CON_RUN)) {
 		p->start = 0;
-		timer_del(p->timer);
+		pmb887x_sched_event_del(&p->timer);
 		return;
 	}
 
-	int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+	// PRE can change while the RTC is running
+	pmb887x_sched_clock_set_freq(&p->clock, rtc_get_freq(p));
+
+	int64_t now = pmb887x_sched_now();
 	if (!p->start)
 		p->start = now;
 
-	uint64_t elapsed = muldiv64(now - p->start, rtc_get_freq(p), NANOSECONDS_PER_SECOND);
+	uint64_t elapsed = pmb887x_sched_clock_ns_to_ticks(&p->clock, now - p->start);
 	if (elapsed) {
 		rtc_advance(p, elapsed);
 		p->start += rtc_ticks_to_ns(p, elapsed);
@@ -156,7 +161,7 @@ static void rtc_sync(pmb887x_rtc_t *p) {
 
 	uint32_t count = (p->t14 & RTC_T14_CNT) >> RTC_T14_CNT_SHIFT;
 	uint64_t next = (p->con & (RTC_CON_T14DEC | RTC_CON_T14INC)) ? 1 : 0x10000 - count;
-	timer_mod(p->timer, p->start + rtc_ticks_to_ns(p, next));
+	pmb887x_sched_event_mod(&p->timer, p->start + rtc_ticks_to_ns(p, next));
 }
 
 static void rtc_ptimer_reset(void *opaque) {
@@ -305,7 +310,7 @@ static void rtc_init(Object *obj) {
 static void rtc_reset(DeviceState *dev) {
 	pmb887x_rtc_t *p = PMB887X_RTC(dev);
 
-	timer_del(p->timer);
+	pmb887x_sched_event_del(&p->timer);
 
 	pmb887x_clc_init(&p->clc);
 	pmb887x_src_reset(&p->src);
@@ -334,7 +339,7 @@ static void rtc_realize(DeviceState *dev, Error **errp) {
 	
 	pmb887x_clc_init(&p->clc);
 	pmb887x_src_init(&p->src, p->irq);
-	p->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, rtc_ptimer_reset, p);
+	pmb887x_sched_event_init(&p->timer, rtc_ptimer_reset, p);
 	p->con = RTC_CON_RUN | RTC_CON_PRE;
 	uint32_t t14_start = (UINT16_MAX + 1) - rtc_get_freq(p);
 	p->t14 = ((t14_start << RTC_T14_CNT_SHIFT) | (t14_start << RTC_T14_REL_SHIFT));
@@ -18,6 +18,8 @@
 #include "hw/arm/pmb887x/pll.h"
 #include "hw/arm/pmb887x/gen/cpu_regs.h"
 #include "hw/arm/pmb887x/mod.h"
+#include "hw/arm/pmb887x/idle.h"
+#include "hw/arm/pmb887x/scheduler.h"
 #include "hw/arm/pmb887x/trace.h"
 
 #define TYPE_PMB887X_SCCU	"pmb887x-sccu"
@@ -42,6 +44,7 @@ struct pmb887x_sccu_t {
 
 	bool irq_fired;
 	uint32_t timer_freq;
+	pmb887x_sched_clock_t clock;
 	int64_t start;
 	bool enabled;
 
@@ -58,9 +61,9 @@ struct pmb887x_sccu_t {
 	uint32_t timer_cnt;
 	uint32_t tdmini;
 
-	QEMUTimer *timer;
-	QEMUTimer *cal_timer;
-	QEMUTimer *sc_timer;
+	pmb887x_sched_event_t timer;
+	pmb887x_sched_event_t cal_timer;
+	pmb887x_sched_event_t sc_timer;
 	pmb887x_pll_t *pll;
 };
 
@@ -69,19 +72,22 @@ static uint32_t sccu_get_nqtz(pmb887x_sccu_t *p) {
 	return nqtz ? nqtz : 1;
 }
 
+static void sccu_update_freq(pmb887x_sccu_t *p) {
+	p->timer_freq = pmb887x_pll_get_frtc(p->pll) / sccu_get_nqtz(p);
+	pmb887x_sched_clock_set_freq(&p->clock, p->timer_freq);
+}
+
 static uint64_t sccu_get_counter(pmb887x_sccu_t *p, bool real) {
 	uint64_t next = p->timer_cnt;
 
-	if (p->enabled) {
-		uint64_t delta_ns = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) - p->start;
-		next += muldiv64(delta_ns, p->timer_freq, NANOSECONDS_PER_SECOND);
-	}
+	if (p->enabled)
+		next += pmb887x_sched_clock_elapsed(&p->clock, p->start);
 
 	return real ? next : MIN(next, p->tdmini);
 }
 
 static int64_t sccu_ticks_to_ns(pmb887x_sccu_t *p, uint64_t ticks) {
-	return (int64_t) muldiv64(ticks, NANOSECONDS_PER_SECOND, p->timer_freq) + (ticks ? 1 : 0);
+	return pmb887x_sched_clock_ticks_to_ns(&p->clock, ticks) + (ticks ? 1 : 0);
 }
 
 static void sccu_cal_timer_reset(void *opaque) {
@@ -142,21 +148,21 @@ static void sccu_ptimer_reset(void *opaque) {
 		DPRINTF("now %u\n", (uint32_t) (qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) / 1000000));
 		DPRINTF("sleep timer done\n");
 	} else {
-		timer_mod(p->timer, p->start + sccu_ticks_to_ns(p, overflow));
+		pmb887x_sched_event_mod(&p->timer, p->start + sccu_ticks_to_ns(p, overflow));
 	}
 }
 
 static void sccu_start_sleep(pmb887x_sccu_t *p) {
-	p->timer_freq = pmb887x_pll_get_frtc(p->pll) / sccu_get_nqtz(p);
+	sccu_update_freq(p);
 	p->timer_cnt = 0;
-	p->start = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+	p->start = pmb887x_sched_now();
 	p->enabled = true;
 	p->irq_fired = false;
 	p->slpctrl |= SCCU_SLPCTRL_SLPEN;
 	p->sccuclksta &= ~SCCU_SCCUCLKSTA_GSMCLK;
 
 	uint32_t first_event = p->tdmini ? p->tdmini : p->tdmini + 1;
-	timer_mod(p->timer, p->start + sccu_ticks_to_ns(p, first_event));
+	pmb887x_sched_event_mod(&p->timer, p->start + sccu_ticks_to_ns(p, first_event));
 	DPRINTF("sleep timer start %d ms\n", (uint32_t) (sccu_ticks_to_ns(p, p->tdmini + 1) / 1000000));
 }
 
@@ -166,7 +172,7 @@ uint32_t pmb887x_sccu_clc_get(pmb887x_sccu_t *p) {
 
 void pmb887x_sccu_clc_set(pmb887x_sccu_t *p, uint32_t value) {
 	pmb887x_clc_set(&p->clc, value);
-	p->timer_freq = pmb887x_pll_get_frtc(p->pll) / sccu_get_nqtz(p);
+	sccu_update_freq(p);
 }
 
 static int sccu_get_reg_index(hwaddr haddr) {
@@ -192,6 +198,7 @@ static uint64_t sccu_io_read(void *opaque, hwaddr haddr, unsigned size) {
 			break;
 
 		case SCCU_TDMOUT:
+			pmb887x_idle_poll(haddr + p->mmio.addr);
 			value = sccu_get_counter(p, false);
 			break;
 
@@ -266,7 +273,7 @@ static void sccu_io_write(void *opaque, hwaddr haddr, uint64_t value, unsigned s
 			p->slpctrl = status | (value & (SCCU_SLPCTRL_SLPRST | SCCU_SLPCTRL_HWACTDI));
 
 			if ((value & SCCU_SLPCTRL_SLPRST)) {
-				timer_del(p->timer);
+				pmb887x_sched_event_del(&p->timer);
 				p->enabled = false;
 				p->start = 0;
 				p->timer_cnt = 0;
@@ -281,7 +288,7 @@ static void sccu_io_write(void *opaque, hwaddr haddr, uint64_t value, unsigned s
 				int64_t duration = (int64_t) muldiv64(16 * 60000, NANOSECONDS_PER_SECOND, sccu_freq);
 
 				p->slpctrl = (p->slpctrl | SCCU_SLPCTRL_REFEN) & ~SCCU_SLPCTRL_REFERR;
-				timer_mod(p->cal_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + duration);
+				pmb887x_sched_event_mod(&p->cal_timer, pmb887x_sched_now() + duration);
 			}
 
 			if ((value & SCCU_SLPCTRL_SLPEN) && !p->enabled)
@@ -292,7 +299,7 @@ static void sccu_io_write(void *opaque, hwaddr haddr, uint64_t value, unsigned s
 				p->start = 0;
 				p->enabled = false;
 				p->slpctrl &= ~(SCCU_SLPCTRL_SLPEN | SCCU_SLPCTRL_SLPSTP);
-				timer_del(p->timer);
+				pmb887x_sched_event_del(&p->timer);
 				sccu_set_active_state(p);
 			}
 			break;
@@ -304,7 +311,7 @@ static void sccu_io_write(void *opaque, hwaddr haddr, uint64_t value, unsigned s
 
 		case SCCU_NQTZ:
 			p->nqtz = value & SCCU_NQTZ_NQTZ;
-			p->timer_freq = pmb887x_pll_get_frtc(p->pll) / sccu_get_nqtz(p);
+			sccu_update_freq(p);
 			break;
 
 		case SCCU_SCCTRL:
@@ -312,7 +319,7 @@ static void sccu_io_write(void *opaque, hwaddr haddr, uint64_t value, unsigned s
 			if (p->scctrl) {
 				uint32_t frtc = pmb887x_pll_get_frtc(p->pll);
 				int64_t duration = (int64_t) muldiv64(3, NANOSECONDS_PER_SECOND, frtc) + 1;
-				timer_mod(p->sc_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + duration);
+				pmb887x_sched_event_mod(&p->sc_timer, pmb887x_sched_now() + duration);
 			}
 			break;
 
@@ -367,22 +374,22 @@ static void sccu_realize(DeviceState *dev, Error **errp) {
 		pmb887x_src_init(&p->src[i], p->irq[i]);
 	}
 
-	p->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, sccu_ptimer_reset, p);
-	p->cal_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, sccu_cal_timer_reset, p);
-	p->sc_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, sccu_sc_timer_reset, p);
+	pmb887x_sched_event_init(&p->timer, sccu_ptimer_reset, p);
+	pmb887x_sched_event_init(&p->cal_timer, sccu_cal_timer_reset, p);
+	pmb887x_sched_event_init(&p->sc_timer, sccu_sc_timer_reset, p);
 
 	p->nqtz = 0x97;
 	p->wait = 3 << SCCU_WAIT_PREWUP_SHIFT;
-	p->timer_freq = pmb887x_pll_get_frtc(p->pll) / sccu_get_nqtz(p);
+	sccu_update_freq(p);
 	sccu_set_active_state(p);
 }
 
 static void sccu_reset(DeviceState *dev) {
 	pmb887x_sccu_t *p = PMB887X_SCCU(dev);
 
-	timer_del(p->timer);
-	timer_del(p->cal_timer);
-	timer_del(p->sc_timer);
+	pmb887x_sched_event_del(&p->timer);
+	pmb887x_sched_event_del(&p->cal_timer);
+	pmb887x_sched_event_del(&p->sc_timer);
 
 	pmb887x_clc_init(&p->clc);
 
@@ -405,7 +412,7 @@ static void sccu_reset(DeviceState *dev) {
 	p->sccumsta = 0;
 	p->timer_cnt = 0;
 	p->tdmini = 0;
-	p->timer_freq = pmb887x_pll_get_frtc(p->pll) / sccu_get_nqtz(p);
+	sccu_update_freq(p);
 
 	sccu_set_active_state(p);
 }
@@ -0,0 +1,136 @@
+/*
+ * Virtual time event scheduler for the timer peripherals
+ * */
+#define PMB887X_TRACE_ID		SCHED
+#define PMB887X_TRACE_PREFIX	"pmb887x-sched"
+
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+
+#include "hw/arm/pmb887x/scheduler.h"
+#include "hw/arm/pmb887x/trace.h"
+
+typedef struct pmb887x_sched_t pmb887x_sched_t;
+
+struct pmb887x_sched_t {
+	QEMUTimer *timer;
+	QTAILQ_HEAD(, pmb887x_sched_event_t) events;
+	int64_t armed;
+	bool dispatching;
+	pmb887x_sched_stats_t stats;
+};
+
+static pmb887x_sched_t sched = {
+	.events = QTAILQ_HEAD_INITIALIZER(sched.events),
+	.armed = -1,
+};
+
+static void sched_rearm(void) {
+	if (sched.dispatching)
+		return;
+
+	pmb887x_sched_event_t *first = QTAILQ_FIRST(&sched.events);
+	int64_t deadline = first ? first->deadline : -1;
+
+	// Most of the updates don't touch the head of the queue
+	if (deadline == sched.armed) {
+		sched.stats.skipped_rearms++;
+		return;
+	}
+
+	sched.armed = deadline;
+	sched.stats.rearms++;
+	if (deadline < 0) {
+		timer_del(sched.timer);
+	} else {
+		timer_mod(sched.timer, deadline);
+	}
+}
+
+static void sched_dispatch(void *opaque) {
+	int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+	pmb887x_sched_event_t *event;
+
+	sched.armed = -1;
+	sched.dispatching = true;
+	while ((event = QTAILQ_FIRST(&sched.events)) && event->deadline <= now) {
+		QTAILQ_REMOVE(&sched.events, event, entry);
+		event->pending = false;
+		sched.stats.dispatched++;
+		event->callback(event->opaque);
+	}
+	sched.dispatching = false;
+
+	sched_rearm();
+}
+
+void pmb887x_sched_event_init(pmb887x_sched_event_t *event, pmb887x_sched_callback_t callback, void *opaque) {
+	if (!sched.timer)
+		sched.timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, sched_dispatch, NULL);
+
+	event->deadline = -1;
+	event->pending = false;
+	event->callback = callback;
+	event->opaque = opaque;
+}
+
+static void sched_event_remove(pmb887x_sched_event_t *event) {
+	if (event->pending) {
+		QTAILQ_REMOVE(&sched.events, event, entry);
+		event->pending = false;
+	}
+}
+
+void pmb887x_sched_event_mod(pmb887x_sched_event_t *event, int64_t deadline) {
+	if (event->pending && event->deadline == deadline)
+		return;
+
+	sched_event_remove(event);
+	event->deadline = MAX(deadline, 0);
+	event->pending = true;
+
+	// A handful of events, a sorted list is cheaper than a heap here
+	pmb887x_sched_event_t *next;
+	QTAILQ_FOREACH(next, &sched.events, entry) {
+		if (next->deadline > event->deadline)
+			break;
+	}
+	if (next) {
+		QTAILQ_INSERT_BEFORE(next, event, entry);
+	} else {
+		QTAILQ_INSERT_TAIL(&sched.events, event, entry);
+	}
+
+	sched_rearm();
+}
+
+void pmb887x_sched_event_del(pmb887x_sched_event_t *event) {
+	if (!event->pending)
+		return;
+	sched_event_remove(event);
+	sched_rearm();
+}
+
+const pmb887x_sched_stats_t *pmb887x_sched_stats(void) {
+	return &sched.stats;
+}
+
+void pmb887x_sched_init(Object *machine) {
+	object_property_add_uint64_ptr(machine, "sched-dispatched", &sched.stats.dispatched, OBJ_PROP_FLAG_READ);
+	object_property_add_uint64_ptr(machine, "sched-rearms", &sched.stats.rearms, OBJ_PROP_FLAG_READ);
+	object_property_add_uint64_ptr(machine, "sched-skipped-rearms", &sched.stats.skipped_rearms, OBJ_PROP_FLAG_READ);
+}
+
+void pmb887x_sched_clock_set_freq(pmb887x_sched_clock_t *clock, uint32_t freq) {
+	if (clock->freq == freq && clock->mult)
+		return;
+
+	// floor(2^64 * freq / 10^9), fits while freq < 1 GHz
+	uint64_t low = 0, high = freq;
+	divu128(&low, &high, NANOSECONDS_PER_SECOND);
+
+	clock->freq = freq;
+	clock->mult = low;
+	clock->cached_now = INT64_MIN;
+	DPRINTF("clock %p: %u Hz\n", clock, freq);
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "qemu/osdep.h"
+#include "qemu/host-utils.h"
+#include "qemu/queue.h"
+#include "qemu/timer.h"
+#include "qom/object.h"
+
+typedef struct pmb887x_sched_event_t pmb887x_sched_event_t;
+typedef struct pmb887x_sched_clock_t pmb887x_sched_clock_t;
+typedef void (*pmb887x_sched_callback_t)(void *opaque);
+
+/*
+ * Compare event of a timer peripheral. All events live in one queue ordered by deadline,
+ * and only the nearest one is armed as a QEMUTimer.
+ * */
+struct pmb887x_sched_event_t {
+	int64_t deadline;
+	bool pending;
+	pmb887x_sched_callback_t callback;
+	void *opaque;
+	QTAILQ_ENTRY(pmb887x_sched_event_t) entry;
+};
+
+/*
+ * Tick domain of a timer peripheral, the frequency comes from the PLL outputs.
+ * ns -> ticks is done with a multiply instead of a 128-bit division, and the last result is cached,
+ * so back-to-back counter reads at the same virtual time are free.
+ * */
+struct pmb887x_sched_clock_t {
+	uint32_t freq;
+	uint64_t mult;
+
+	int64_t cached_now;
+	int64_t cached_since;
+	uint64_t cached_ticks;
+};
+
+typedef struct pmb887x_sched_stats_t pmb887x_sched_stats_t;
+
+struct pmb887x_sched_stats_t {
+	uint64_t dispatched;
+	uint64_t rearms;
+	uint64_t skipped_rearms;
+};
+
+void pmb887x_sched_event_init(pmb887x_sched_event_t *event, pmb887x_sched_callback_t callback, void *opaque);
+void pmb887x_sched_event_mod(pmb887x_sched_event_t *event, int64_t deadline);
+void pmb887x_sched_event_del(pmb887x_sched_event_t *event);
+const pmb887x_sched_stats_t *pmb887x_sched_stats(void);
+void pmb887x_sched_init(Object *machine);
+
+static inline bool pmb887x_sched_event_pending(pmb887x_sched_event_t *event) {
+	return event->pending;
+}
+
+static inline int64_t pmb887x_sched_now(void) {
+	return qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+}
+
+void pmb887x_sched_clock_set_freq(pmb887x_sched_clock_t *clock, uint32_t freq);
+
+static inline uint32_t pmb887x_sched_clock_get_freq(pmb887x_sched_clock_t *clock) {
+	return clock->freq;
+}
+
+// Same as muldiv64(ns, freq, NANOSECONDS_PER_SECOND)
+static inline uint64_t pmb887x_sched_clock_ns_to_ticks(pmb887x_sched_clock_t *clock, uint64_t ns) {
+	uint64_t ticks, low, high, exact_low, exact_high;
+
+	// mult is rounded down, so the estimate is exact or one tick short
+	mulu64(&low, &ticks, ns, clock->mult);
+	mulu64(&low, &high, ticks + 1, NANOSECONDS_PER_SECOND);
+	mulu64(&exact_low, &exact_high, ns, clock->freq);
+	if (high < exact_high || (high == exact_high && low <= exact_low))
+		ticks++;
+	return ticks;
+}
+
+static inline int64_t pmb887x_sched_clock_ticks_to_ns(pmb887x_sched_clock_t *clock, uint64_t ticks) {
+	return (int64_t) muldiv64(ticks, NANOSECONDS_PER_SECOND, clock->freq);
+}
+
+static inline int64_t pmb887x_sched_clock_ticks_to_ns_round_up(pmb887x_sched_clock_t *clock, uint64_t ticks) {
+	return (int64_t) muldiv64_round_up(ticks, NANOSECONDS_PER_SECOND, clock->freq);
+}
+
+// Ticks elapsed from `since` to the current virtual time
+static inline uint64_t pmb887x_sched_clock_elapsed(pmb887x_sched_clock_t *clock, int64_t since) {
+	int64_t now = pmb887x_sched_now();
+	if (now != clock->cached_now || since != clock->cached_since) {
+		clock->cached_ticks = pmb887x_sched_clock_ns_to_ticks(clock, now - since);
+		clock->cached_now = now;
+		clock->cached_since = since;
+	}
+	return clock->cached_ticks;
+}
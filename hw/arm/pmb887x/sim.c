@@ -14,6 +14,7 @@
 #include "hw/core/qdev-properties-system.h"
 #include "hw/core/sysbus.h"
 #include "qapi/error.h"
+#include "system/cpu-timers.h"
 
 #include "hw/arm/pmb887x/gen/cpu_regs.h"
 #include "hw/arm/pmb887x/mod.h"
@@ -43,6 +44,8 @@
 
 #define SIM_CARD_CLOCK_HZ 3250000
 #define SIM_BRF_CLOCKS_PER_ETU 4
+// Start bit, 8 data bits, parity and the 2 ETU guard time
+#define SIM_CHARACTER_ETU 12
 
 enum {
 	SIM_IRQ_ERR,
@@ -66,6 +69,7 @@ struct pmb887x_sim_t {
 	MemoryRegion mmio;
 	uint32_t revision;
 	qemu_irq irq[SIM_IRQ_COUNT];
+	bool turbo;
 
 	pmb887x_clc_reg_t clc;
 	pmb887x_srb_reg_t srb;
@@ -106,6 +110,9 @@ struct pmb887x_sim_t {
 
 	bool rx_last;
 
+	// Turbo: virtual time at which the wire would have finished the last character
+	int64_t turbo_time;
+
 	qemu_irq cc_rst;
 	qemu_irq cc_io;
 	qemu_irq cc_clk;
@@ -196,6 +203,31 @@ static void sim_update_character_timer(pmb887x_sim_t *p) {
 	timer_mod(p->character_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + timeout_ns);
 }
 
+static int64_t sim_byte_time(pmb887x_sim_t *p) {
+	return p->turbo ? 0 : SIM_BYTE_TIME_NS;
+}
+
+static void sim_turbo_charge(pmb887x_sim_t *p, uint32_t characters) {
+	int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+	uint64_t character_ns = muldiv64(
+		(uint64_t) SIM_CHARACTER_ETU * p->brf * SIM_BRF_CLOCKS_PER_ETU,
+		NANOSECONDS_PER_SECOND,
+		SIM_CARD_CLOCK_HZ
+	);
+	p->turbo_time = MAX(p->turbo_time, now) + characters * character_ns;
+}
+
+/*
+ * Bytes are exchanged as fast as the guest drains them, then virtual time is moved forward
+ * by the ETUs the guest didn't spend itself. Without precise clocks it follows the host clock anyway.
+ * */
+static void sim_turbo_sync(pmb887x_sim_t *p) {
+	int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+	if (p->turbo_time > now && icount2_enabled())
+		icount2_warp(p->turbo_time - now);
+	p->turbo_time = 0;
+}
+
 static void sim_character_timeout(void *opaque) {
 	pmb887x_sim_t *p = opaque;
 	sim_raise_status(p, SIM_STAT_CHTIMEOUT);
@@ -213,6 +245,7 @@ static void sim_t0_reset(pmb887x_sim_t *p, bool start) {
 	p->t0_data_transferred = 0;
 	p->t0_chunk_remaining = 0;
 	p->t0_tx_slot = start;
+	p->turbo_time = 0;
 	sim_update_dma_request(p);
 }
 
@@ -224,6 +257,8 @@ static void sim_t0_finish(pmb887x_sim_t *p) {
 	p->t0_data_size = 0;
 	p->t0_data_transferred = 0;
 	p->t0_chunk_remaining = 0;
+	if (p->turbo)
+		sim_turbo_sync(p);
 	sim_raise_status(p, SIM_STAT_T0END);
 	sim_update_dma_request(p);
 }
@@ -297,6 +332,8 @@ static void sim_receive(void *opaque, const uint8_t *buffer, int size) {
 
 	if (!sim_is_uart_running(p) || size == 0)
 		return;
+	if (p->turbo)
+		sim_turbo_charge(p, 1);
 	if (sim_is_t0_running(p)) {
 		sim_t0_receive(p, buffer[0]);
 		return;
@@ -307,6 +344,10 @@ static void sim_receive(void *opaque, const uint8_t *buffer, int size) {
 		return;
 	}
 
+	// No APDU boundaries outside of T=0 (ATR, PPS), so catch up on every character
+	if (p->turbo)
+		sim_turbo_sync(p);
+
 	p->rxb = buffer[0];
 	p->rx_pending = true;
 	sim_raise_status(p, SIM_STAT_UARTOK);
@@ -344,11 +385,23 @@ static void sim_tx_complete(void *opaque) {
 	pmb887x_sim_t *p = opaque;
 
 	if (!fifo8_is_empty(&p->t0_tx_fifo)) {
-		uint8_t value = fifo8_pop(&p->t0_tx_fifo);
-		qemu_chr_fe_write_all(&p->chr, &value, 1);
-		sim_t0_tx_advance(p);
+		if (p->turbo) {
+			// Whole FIFO in one write, the wire time is accounted for at the end of the APDU
+			uint8_t buffer[SIM_T0_TX_FIFO_SIZE];
+			uint32_t count = 0;
+			while (!fifo8_is_empty(&p->t0_tx_fifo))
+				buffer[count++] = fifo8_pop(&p->t0_tx_fifo);
+			sim_turbo_charge(p, count);
+			qemu_chr_fe_write_all(&p->chr, buffer, count);
+			for (uint32_t i = 0; i < count; i++)
+				sim_t0_tx_advance(p);
+		} else {
+			uint8_t value = fifo8_pop(&p->t0_tx_fifo);
+			qemu_chr_fe_write_all(&p->chr, &value, 1);
+			sim_t0_tx_advance(p);
+		}
 		if (!fifo8_is_empty(&p->t0_tx_fifo)) {
-			timer_mod(p->tx_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + SIM_BYTE_TIME_NS);
+			timer_mod(p->tx_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + sim_byte_time(p));
 		} else {
 			p->tx_pending = false;
 			p->t0_tx_slot = true;
@@ -360,6 +413,10 @@ static void sim_tx_complete(void *opaque) {
 
 	p->tx_pending = false;
 	uint8_t value = p->txb;
+	if (p->turbo) {
+		sim_turbo_charge(p, 1);
+		sim_turbo_sync(p);
+	}
 	qemu_chr_fe_write_all(&p->chr, &value, 1);
 	sim_raise_status(p, SIM_STAT_UARTOK);
 }
@@ -379,7 +436,7 @@ static void sim_t0_write_txb(pmb887x_sim_t *p, uint8_t value) {
 
 	if (!p->tx_pending) {
 		p->tx_pending = true;
-		timer_mod(p->tx_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + SIM_BYTE_TIME_NS);
+		timer_mod(p->tx_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + sim_byte_time(p));
 	}
 }
 
@@ -398,7 +455,7 @@ static void sim_write_txb(pmb887x_sim_t *p, uint8_t value) {
 
 	p->txb = value;
 	p->tx_pending = true;
-	timer_mod(p->tx_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + SIM_BYTE_TIME_NS);
+	timer_mod(p->tx_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + sim_byte_time(p));
 }
 
 static uint64_t sim_io_read(void *opaque, hwaddr haddr, unsigned size) {
@@ -672,6 +729,9 @@ static void sim_realize(DeviceState *dev, Error **errp) {
 	p->tx_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, sim_tx_complete, p);
 	p->character_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, sim_character_timeout, p);
 	fifo8_create(&p->t0_tx_fifo, SIM_T0_TX_FIFO_SIZE);
+
+	if (p->turbo && !icount2_enabled())
+		WPRINTF("turbo without -icount precise-clocks=on, ETUs are not accounted in virtual time\n");
 }
 
 static void sim_reset(DeviceState *dev) {
@@ -706,6 +766,7 @@ static void sim_reset(DeviceState *dev) {
 	p->dma_event_pending = false;
 	p->t0_tx_slot = false;
 	p->rx_last = false;
+	p->turbo_time = 0;
 	p->t0_state = SIM_T0_STATE_IDLE;
 	p->t0_header_size = 0;
 	p->t0_data_size = 0;
@@ -736,6 +797,7 @@ static void sim_finalize(Object *obj) {
 static const Property sim_properties[] = {
 	DEFINE_PROP_UINT32("revision", pmb887x_sim_t, revision, 0),
 	DEFINE_PROP_CHR("chardev", pmb887x_sim_t, chr),
+	DEFINE_PROP_BOOL("turbo", pmb887x_sim_t, turbo, false),
 };
 
 static void sim_class_init(ObjectClass *klass, const void *data) {
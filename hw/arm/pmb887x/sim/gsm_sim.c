@@ -43,6 +43,7 @@ struct pmb887x_gsm_sim_t {
 	pmb887x_sim_fs_t fs;
 	char *imsi;
 	char *operator_code;
+	char *image;
 	pmb887x_sim_fs_file_definition_t *file_definitions;
 	uint8_t imsi_data[GSM_SIM_IMSI_DATA_SIZE];
 	uint8_t ad_data[GSM_SIM_AD_SIZE];
@@ -296,7 +297,12 @@ static void gsm_sim_realize(DeviceState *dev, Error **errp) {
 	if (!gsm_sim_prepare_identity(sim, errp))
 		return;
 	gsm_sim_prepare_file_definitions(sim);
-	pmb887x_sim_fs_init(&sim->fs, sim->file_definitions, ARRAY_SIZE(GSM_SIM_FILES));
+	// The image keeps the identity it was created with, imsi/operator_code only seed a new one
+	if (sim->image) {
+		pmb887x_sim_fs_init_image(&sim->fs, sim->image, sim->file_definitions, ARRAY_SIZE(GSM_SIM_FILES), errp);
+	} else {
+		pmb887x_sim_fs_init(&sim->fs, sim->file_definitions, ARRAY_SIZE(GSM_SIM_FILES));
+	}
 }
 
 static void gsm_sim_reset(DeviceState *dev) {
@@ -312,6 +318,7 @@ static void gsm_sim_finalize(Object *obj) {
 static const Property gsm_sim_properties[] = {
 	DEFINE_PROP_STRING("imsi", pmb887x_gsm_sim_t, imsi),
 	DEFINE_PROP_STRING("operator_code", pmb887x_gsm_sim_t, operator_code),
+	DEFINE_PROP_STRING("image", pmb887x_gsm_sim_t, image),
 };
 
 static void gsm_sim_class_init(ObjectClass *klass, const void *data) {
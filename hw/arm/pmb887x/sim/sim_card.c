@@ -37,7 +37,9 @@ struct pmb887x_sim_card_t {
 	char *apdu_backend;
 	char *imsi;
 	char *operator_code;
+	char *image;
 	char *reader_name;
+	bool turbo;
 	QEMUTimer *tx_timer;
 	Fifo8 output;
 
@@ -71,8 +73,11 @@ static void sim_card_trace_bytes(const char *name, const uint8_t *data, size_t s
 }
 
 static void sim_card_schedule_output(pmb887x_sim_card_t *card) {
-	if (!timer_pending(card->tx_timer) && !fifo8_is_empty(&card->output))
-		timer_mod(card->tx_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + SIM_CARD_BYTE_TIME_NS);
+	if (!timer_pending(card->tx_timer) && !fifo8_is_empty(&card->output)) {
+		// Turbo: the interface accounts the ETUs itself, bytes go out as soon as it accepts them
+		int64_t delay = card->turbo ? 0 : SIM_CARD_BYTE_TIME_NS;
+		timer_mod(card->tx_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + delay);
+	}
 }
 
 static void sim_card_queue_bytes(pmb887x_sim_card_t *card, const uint8_t *data, size_t size) {
@@ -100,7 +105,21 @@ static void sim_card_tx(void *opaque) {
 	if (!card->reset || fifo8_is_empty(&card->output))
 		return;
 	if (qemu_chr_be_can_write(card->chardev) == 0) {
-		sim_card_schedule_output(card);
+		// Turbo: resumed by sim_card_chr_accept_input()
+		if (!card->turbo)
+			sim_card_schedule_output(card);
+		return;
+	}
+
+	if (card->turbo) {
+		int count;
+		while (!fifo8_is_empty(&card->output) && (count = qemu_chr_be_can_write(card->chardev)) > 0) {
+			uint8_t buffer[SIM_CARD_OUTPUT_SIZE];
+			uint32_t size = 0;
+			while (size < count && !fifo8_is_empty(&card->output))
+				buffer[size++] = fifo8_pop(&card->output);
+			qemu_chr_be_write(card->chardev, buffer, size);
+		}
 		return;
 	}
 
@@ -255,6 +274,8 @@ static void sim_card_realize(DeviceState *dev, Error **errp) {
 				qdev_prop_set_string(backend, "imsi", card->imsi);
 			if (card->operator_code)
 				qdev_prop_set_string(backend, "operator_code", card->operator_code);
+			if (card->image)
+				qdev_prop_set_string(backend, "image", card->image);
 		}
 		if (!qdev_realize(backend, NULL, errp)) {
 			object_unref(OBJECT(backend));
@@ -322,12 +343,20 @@ static int sim_card_chr_write(Chardev *chardev, const uint8_t *buffer, int size)
 	return size;
 }
 
+static void sim_card_chr_accept_input(Chardev *chardev) {
+	pmb887x_sim_card_t *card = PMB887X_SIM_CARD_CHARDEV(chardev)->card;
+	if (card && card->turbo)
+		sim_card_schedule_output(card);
+}
+
 static const Property sim_card_properties[] = {
 	DEFINE_PROP_LINK("apdu", pmb887x_sim_card_t, apdu, TYPE_PMB887X_APDU_BACKEND, pmb887x_apdu_backend_t *),
 	DEFINE_PROP_STRING("apdu_backend", pmb887x_sim_card_t, apdu_backend),
 	DEFINE_PROP_STRING("imsi", pmb887x_sim_card_t, imsi),
 	DEFINE_PROP_STRING("operator_code", pmb887x_sim_card_t, operator_code),
+	DEFINE_PROP_STRING("image", pmb887x_sim_card_t, image),
 	DEFINE_PROP_STRING("reader", pmb887x_sim_card_t, reader_name),
+	DEFINE_PROP_BOOL("turbo", pmb887x_sim_card_t, turbo, false),
 };
 
 static void sim_card_class_init(ObjectClass *klass, const void *data) {
@@ -340,7 +369,9 @@ static void sim_card_class_init(ObjectClass *klass, const void *data) {
 }
 
 static void sim_card_chardev_class_init(ObjectClass *klass, const void *data) {
-	CHARDEV_CLASS(klass)->chr_write = sim_card_chr_write;
+	ChardevClass *chardev_class = CHARDEV_CLASS(klass);
+	chardev_class->chr_write = sim_card_chr_write;
+	chardev_class->chr_accept_input = sim_card_chr_accept_input;
 }
 
 static const TypeInfo sim_card_info = {
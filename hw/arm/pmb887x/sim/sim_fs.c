@@ -1,4 +1,5 @@
 #include "qemu/osdep.h"
+#include "qemu/bswap.h"
 
 #include "hw/arm/pmb887x/sim/sim_fs.h"
 
@@ -15,6 +16,15 @@
 #define SIM_FS_UNBLOCK_ATTEMPTS_REMAINING 10
 #define SIM_FS_NO_CURRENT_RECORD UINT16_MAX
 
+#define SIM_FS_IMAGE_MAGIC "PMBSIMFS"
+#define SIM_FS_IMAGE_VERSION 1
+#define SIM_FS_IMAGE_HEADER_SIZE 16
+#define SIM_FS_IMAGE_ENTRY_HEADER_SIZE 8
+#define SIM_FS_IMAGE_FILE_HEADER_SIZE 8
+#define SIM_FS_IMAGE_TAG_FILE 0x0001
+
+#define SIM_FS_INDEX_KEY(id, parent_id) GUINT_TO_POINTER(((uint32_t) (parent_id) << 16) | (id))
+
 enum sim_fs_metadata_offset_t {
 	SIM_FS_METADATA_SIZE_MSB = 2,
 	SIM_FS_METADATA_SIZE_LSB,
@@ -60,16 +70,24 @@ static void sim_fs_set_status(pmb887x_apdu_response_t *response, uint16_t status
 	pmb887x_apdu_response_set_status(response, status);
 }
 
+// Start the writeback of an updated range right away instead of leaving it in the page cache until exit
+static void sim_fs_sync(pmb887x_sim_fs_t *fs, const uint8_t *data, size_t size) {
+	if (!fs->image)
+		return;
+	uintptr_t start = QEMU_ALIGN_DOWN((uintptr_t) data, qemu_real_host_page_size());
+	msync((void *) start, (uintptr_t) data + size - start, MS_ASYNC);
+}
+
 static bool sim_fs_is_directory(const pmb887x_sim_fs_file_t *file) {
 	return file->definition->type == PMB887X_SIM_FS_MF || file->definition->type == PMB887X_SIM_FS_DF;
 }
 
+static bool sim_fs_is_record_type(enum pmb887x_sim_fs_file_type_t type) {
+	return type == PMB887X_SIM_FS_EF_LINEAR_FIXED || type == PMB887X_SIM_FS_EF_CYCLIC;
+}
+
 static pmb887x_sim_fs_file_t *sim_fs_find_file(pmb887x_sim_fs_t *fs, uint16_t id, uint16_t parent_id) {
-	for (size_t i = 0; i < fs->files_count; i++) {
-		if (fs->files[i].definition->id == id && fs->files[i].definition->parent_id == parent_id)
-			return &fs->files[i];
-	}
-	return NULL;
+	return g_hash_table_lookup(fs->index, SIM_FS_INDEX_KEY(id, parent_id));
 }
 
 static uint8_t sim_fs_directory_child_count(pmb887x_sim_fs_t *fs, uint16_t parent_id, bool directories) {
@@ -82,6 +100,33 @@ static uint8_t sim_fs_directory_child_count(pmb887x_sim_fs_t *fs, uint16_t paren
 	return count;
 }
 
+static bool sim_fs_build_index(pmb887x_sim_fs_t *fs, Error **errp) {
+	fs->index = g_hash_table_new(g_direct_hash, g_direct_equal);
+	for (size_t i = 0; i < fs->files_count; i++) {
+		pmb887x_sim_fs_file_t *file = &fs->files[i];
+		if (!g_hash_table_insert(fs->index, SIM_FS_INDEX_KEY(file->definition->id, file->definition->parent_id), file)) {
+			error_setg(errp, "sim-fs: duplicate file %04X in %04X", file->definition->id, file->definition->parent_id);
+			return false;
+		}
+	}
+
+	// Static for the lifetime of the filesystem, no need to count on every SELECT
+	for (size_t i = 0; i < fs->files_count; i++) {
+		pmb887x_sim_fs_file_t *file = &fs->files[i];
+		if (sim_fs_is_directory(file)) {
+			file->child_df_count = sim_fs_directory_child_count(fs, file->definition->id, true);
+			file->child_ef_count = sim_fs_directory_child_count(fs, file->definition->id, false);
+		}
+	}
+
+	pmb887x_sim_fs_file_t *mf = sim_fs_find_file(fs, PMB887X_SIM_FS_MF_ID, 0);
+	if (!mf || mf->definition->type != PMB887X_SIM_FS_MF) {
+		error_setg(errp, "sim-fs: no MF");
+		return false;
+	}
+	return true;
+}
+
 static uint8_t sim_fs_file_type(const pmb887x_sim_fs_file_t *file) {
 	switch (file->definition->type) {
 		case PMB887X_SIM_FS_MF:
@@ -115,8 +160,8 @@ static size_t sim_fs_build_metadata(pmb887x_sim_fs_t *fs, pmb887x_sim_fs_file_t
 		metadata[SIM_FS_METADATA_FILE_TYPE] = sim_fs_file_type(file);
 		metadata[SIM_FS_METADATA_DATA_SIZE] = SIM_FS_DIRECTORY_DATA_SIZE;
 		metadata[SIM_FS_DIRECTORY_CHARACTERISTICS] = SIM_FS_CHARACTERISTICS_DEFAULT;
-		metadata[SIM_FS_DIRECTORY_CHILD_DF_COUNT] = sim_fs_directory_child_count(fs, definition->id, true);
-		metadata[SIM_FS_DIRECTORY_CHILD_EF_COUNT] = sim_fs_directory_child_count(fs, definition->id, false);
+		metadata[SIM_FS_DIRECTORY_CHILD_DF_COUNT] = file->child_df_count;
+		metadata[SIM_FS_DIRECTORY_CHILD_EF_COUNT] = file->child_ef_count;
 		metadata[SIM_FS_DIRECTORY_SECRET_CODE_COUNT] = SIM_FS_SECRET_CODE_COUNT;
 		metadata[SIM_FS_DIRECTORY_CHV1_STATUS] = SIM_FS_SECRET_STATUS(SIM_FS_PIN_ATTEMPTS_REMAINING);
 		metadata[SIM_FS_DIRECTORY_UNBLOCK_CHV1_STATUS] = SIM_FS_SECRET_STATUS(SIM_FS_UNBLOCK_ATTEMPTS_REMAINING);
@@ -166,8 +211,7 @@ void pmb887x_sim_fs_init(
 	for (size_t i = 0; i < definitions_count; i++) {
 		pmb887x_sim_fs_file_t *file = &fs->files[i];
 		file->definition = &definitions[i];
-		bool record_file = definitions[i].type == PMB887X_SIM_FS_EF_LINEAR_FIXED ||
-			definitions[i].type == PMB887X_SIM_FS_EF_CYCLIC;
+		bool record_file = sim_fs_is_record_type(definitions[i].type);
 		g_assert(!record_file || (definitions[i].record_size != 0 && definitions[i].size % definitions[i].record_size == 0));
 		if (definitions[i].size != 0) {
 			file->data = g_malloc(definitions[i].size);
@@ -176,13 +220,171 @@ void pmb887x_sim_fs_init(
 				memcpy(file->data, definitions[i].initial_data, definitions[i].size);
 		}
 	}
+	sim_fs_build_index(fs, &error_abort);
 	pmb887x_sim_fs_card_reset(fs);
 }
 
+static bool sim_fs_image_create(
+	const char *filename,
+	const pmb887x_sim_fs_file_definition_t *definitions,
+	size_t definitions_count,
+	Error **errp
+) {
+	GByteArray *image = g_byte_array_new();
+	uint8_t header[SIM_FS_IMAGE_HEADER_SIZE];
+	memcpy(header, SIM_FS_IMAGE_MAGIC, 8);
+	stl_le_p(header + 8, SIM_FS_IMAGE_VERSION);
+	stl_le_p(header + 12, definitions_count);
+	g_byte_array_append(image, header, sizeof(header));
+
+	for (size_t i = 0; i < definitions_count; i++) {
+		const pmb887x_sim_fs_file_definition_t *definition = &definitions[i];
+		uint8_t entry[SIM_FS_IMAGE_ENTRY_HEADER_SIZE + SIM_FS_IMAGE_FILE_HEADER_SIZE];
+		uint8_t *file = entry + SIM_FS_IMAGE_ENTRY_HEADER_SIZE;
+		stw_le_p(entry, SIM_FS_IMAGE_TAG_FILE);
+		stw_le_p(entry + 2, 0);
+		stl_le_p(entry + 4, SIM_FS_IMAGE_FILE_HEADER_SIZE + definition->size);
+		stw_le_p(file, definition->id);
+		stw_le_p(file + 2, definition->parent_id);
+		file[4] = definition->type;
+		file[5] = definition->record_size;
+		stw_le_p(file + 6, definition->size);
+		g_byte_array_append(image, entry, sizeof(entry));
+
+		size_t offset = image->len;
+		g_byte_array_set_size(image, offset + definition->size);
+		memset(image->data + offset, definition->fill, definition->size);
+		if (definition->initial_data)
+			memcpy(image->data + offset, definition->initial_data, definition->size);
+	}
+
+	GError *error = NULL;
+	bool ok = g_file_set_contents(filename, (const char *) image->data, image->len, &error);
+	if (!ok) {
+		error_setg(errp, "sim-fs: can't create %s: %s", filename, error->message);
+		g_error_free(error);
+	}
+	g_byte_array_free(image, true);
+	return ok;
+}
+
+static bool sim_fs_image_parse(pmb887x_sim_fs_t *fs, const char *filename, Error **errp) {
+	if (fs->image_size < SIM_FS_IMAGE_HEADER_SIZE || memcmp(fs->image, SIM_FS_IMAGE_MAGIC, 8) != 0) {
+		error_setg(errp, "sim-fs: %s is not a SIM filesystem image", filename);
+		return false;
+	}
+	if (ldl_le_p(fs->image + 8) != SIM_FS_IMAGE_VERSION) {
+		error_setg(errp, "sim-fs: %s has unsupported version %u", filename, ldl_le_p(fs->image + 8));
+		return false;
+	}
+
+	uint32_t entries_count = ldl_le_p(fs->image + 12);
+	size_t offset = SIM_FS_IMAGE_HEADER_SIZE;
+	if (entries_count > (fs->image_size - offset) / SIM_FS_IMAGE_ENTRY_HEADER_SIZE)
+		goto truncated;
+	fs->image_definitions = g_new0(pmb887x_sim_fs_file_definition_t, entries_count);
+	fs->files = g_new0(pmb887x_sim_fs_file_t, entries_count);
+
+	for (uint32_t i = 0; i < entries_count; i++) {
+		if (fs->image_size - offset < SIM_FS_IMAGE_ENTRY_HEADER_SIZE)
+			goto truncated;
+		uint16_t tag = lduw_le_p(fs->image + offset);
+		uint32_t length = ldl_le_p(fs->image + offset + 4);
+		offset += SIM_FS_IMAGE_ENTRY_HEADER_SIZE;
+		if (fs->image_size - offset < length)
+			goto truncated;
+		if (tag != SIM_FS_IMAGE_TAG_FILE) {
+			offset += length;
+			continue;
+		}
+
+		uint8_t *value = fs->image + offset;
+		pmb887x_sim_fs_file_definition_t *definition = &fs->image_definitions[fs->files_count];
+		bool valid = length >= SIM_FS_IMAGE_FILE_HEADER_SIZE;
+		if (valid) {
+			definition->id = lduw_le_p(value);
+			definition->parent_id = lduw_le_p(value + 2);
+			definition->type = value[4];
+			definition->record_size = value[5];
+			definition->size = lduw_le_p(value + 6);
+			valid = definition->type <= PMB887X_SIM_FS_EF_CYCLIC &&
+				length == SIM_FS_IMAGE_FILE_HEADER_SIZE + definition->size;
+		}
+		if (valid && sim_fs_is_record_type(definition->type))
+			valid = definition->record_size != 0 && definition->size % definition->record_size == 0;
+		if (!valid) {
+			error_setg(errp, "sim-fs: %s: invalid entry #%u at offset %zu", filename, i, offset);
+			return false;
+		}
+
+		pmb887x_sim_fs_file_t *file = &fs->files[fs->files_count++];
+		file->definition = definition;
+		file->data = definition->size ? value + SIM_FS_IMAGE_FILE_HEADER_SIZE : NULL;
+		offset += length;
+	}
+	return true;
+
+truncated:
+	error_setg(errp, "sim-fs: %s is truncated", filename);
+	return false;
+}
+
+bool pmb887x_sim_fs_init_image(
+	pmb887x_sim_fs_t *fs,
+	const char *filename,
+	const pmb887x_sim_fs_file_definition_t *definitions,
+	size_t definitions_count,
+	Error **errp
+) {
+	if (!g_file_test(filename, G_FILE_TEST_EXISTS) &&
+			!sim_fs_image_create(filename, definitions, definitions_count, errp))
+		return false;
+
+	int fd = qemu_open(filename, O_RDWR, errp);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		error_setg(errp, "sim-fs: %s is empty", filename);
+		qemu_close(fd);
+		return false;
+	}
+
+	// Shared mapping: every UPDATE lands in the page cache of the image and survives the exit
+	void *image = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	qemu_close(fd);
+	if (image == MAP_FAILED) {
+		error_setg_errno(errp, errno, "sim-fs: can't map %s", filename);
+		return false;
+	}
+	fs->image = image;
+	fs->image_size = st.st_size;
+
+	if (!sim_fs_image_parse(fs, filename, errp) || !sim_fs_build_index(fs, errp)) {
+		pmb887x_sim_fs_destroy(fs);
+		return false;
+	}
+	pmb887x_sim_fs_card_reset(fs);
+	return true;
+}
+
 void pmb887x_sim_fs_destroy(pmb887x_sim_fs_t *fs) {
-	for (size_t i = 0; i < fs->files_count; i++)
-		g_free(fs->files[i].data);
+	if (fs->image) {
+		msync(fs->image, fs->image_size, MS_SYNC);
+		munmap(fs->image, fs->image_size);
+		fs->image = NULL;
+		fs->image_size = 0;
+	} else {
+		for (size_t i = 0; i < fs->files_count; i++)
+			g_free(fs->files[i].data);
+	}
+	if (fs->index)
+		g_hash_table_destroy(fs->index);
+	g_free(fs->image_definitions);
 	g_free(fs->files);
+	fs->index = NULL;
+	fs->image_definitions = NULL;
 	fs->files = NULL;
 	fs->files_count = 0;
 }
@@ -254,6 +456,7 @@ void pmb887x_sim_fs_update_binary(
 		return;
 	}
 	memcpy(file->data + offset, data, size);
+	sim_fs_sync(fs, file->data + offset, size);
 	pmb887x_apdu_response_set_status(response, PMB887X_APDU_STATUS_SUCCESS);
 }
 
@@ -293,8 +496,7 @@ void pmb887x_sim_fs_read_record(
 	pmb887x_apdu_response_t *response
 ) {
 	pmb887x_sim_fs_file_t *file = fs->selected_file;
-	bool record_file = file->definition->type == PMB887X_SIM_FS_EF_LINEAR_FIXED ||
-		file->definition->type == PMB887X_SIM_FS_EF_CYCLIC;
+	bool record_file = sim_fs_is_record_type(file->definition->type);
 	if (!record_file || !sim_fs_select_record(fs, record, mode)) {
 		sim_fs_set_status(response, PMB887X_APDU_STATUS_NO_CURRENT_EF);
 		return;
@@ -317,8 +519,7 @@ void pmb887x_sim_fs_update_record(
 	pmb887x_apdu_response_t *response
 ) {
 	pmb887x_sim_fs_file_t *file = fs->selected_file;
-	bool record_file = file->definition->type == PMB887X_SIM_FS_EF_LINEAR_FIXED ||
-		file->definition->type == PMB887X_SIM_FS_EF_CYCLIC;
+	bool record_file = sim_fs_is_record_type(file->definition->type);
 	if (!record_file || !sim_fs_select_record(fs, record, mode)) {
 		sim_fs_set_status(response, PMB887X_APDU_STATUS_NO_CURRENT_EF);
 		return;
@@ -327,6 +528,8 @@ void pmb887x_sim_fs_update_record(
 		sim_fs_set_status(response, PMB887X_APDU_STATUS_WRONG_LENGTH);
 		return;
 	}
-	memcpy(file->data + fs->current_record * file->definition->record_size, data, size);
+	uint8_t *record_data = file->data + fs->current_record * file->definition->record_size;
+	memcpy(record_data, data, size);
+	sim_fs_sync(fs, record_data, size);
 	pmb887x_apdu_response_set_status(response, PMB887X_APDU_STATUS_SUCCESS);
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "qapi/error.h"
 #include "hw/arm/pmb887x/sim/apdu.h"
 
 enum pmb887x_sim_fs_file_type_t {
@@ -31,11 +32,19 @@ typedef struct pmb887x_sim_fs_file_definition_t {
 typedef struct pmb887x_sim_fs_file_t {
 	const pmb887x_sim_fs_file_definition_t *definition;
 	uint8_t *data;
+	uint8_t child_df_count;
+	uint8_t child_ef_count;
 } pmb887x_sim_fs_file_t;
 
 typedef struct pmb887x_sim_fs_t {
 	pmb887x_sim_fs_file_t *files;
 	size_t files_count;
+	// (parent_id << 16 | id) -> file
+	GHashTable *index;
+	// Image mode: file data points into a shared mapping, so updates go straight to the file
+	pmb887x_sim_fs_file_definition_t *image_definitions;
+	uint8_t *image;
+	size_t image_size;
 	pmb887x_sim_fs_file_t *current_directory;
 	pmb887x_sim_fs_file_t *selected_file;
 	uint16_t current_record;
@@ -46,6 +55,22 @@ void pmb887x_sim_fs_init(
 	const pmb887x_sim_fs_file_definition_t *definitions,
 	size_t definitions_count
 );
+/*
+ * Open a filesystem image, it's created from the definitions if it doesn't exist yet.
+ *
+ * Image layout, all values are little-endian:
+ *   header: "PMBSIMFS", u32 version, u32 entries count
+ *   entry:  u16 tag, u16 reserved, u32 value length, value
+ *   file:   u16 id, u16 parent id, u8 type, u8 record size, u16 size, data
+ * Entries with unknown tags are skipped.
+ * */
+bool pmb887x_sim_fs_init_image(
+	pmb887x_sim_fs_t *fs,
+	const char *filename,
+	const pmb887x_sim_fs_file_definition_t *definitions,
+	size_t definitions_count,
+	Error **errp
+);
 void pmb887x_sim_fs_destroy(pmb887x_sim_fs_t *fs);
 void pmb887x_sim_fs_card_reset(pmb887x_sim_fs_t *fs);
 bool pmb887x_sim_fs_select(pmb887x_sim_fs_t *fs, uint16_t id, uint8_t *response_size);
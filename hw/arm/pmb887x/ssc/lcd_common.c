@@ -7,6 +7,8 @@
 #include <math.h>
 #include "qemu/osdep.h"
 #include "qapi/error.h"
+#include "qapi/visitor.h"
+#include "qemu/atomic.h"
 #include "qemu/module.h"
 #include "qemu/error-report.h"
 #include "hw/core/hw-error.h"
@@ -16,8 +18,13 @@
 #include "hw/arm/pmb887x/ssc/lcd_common.h"
 
 #define LCD_CMD_MAX_PARAMS 256
+// Pixels start on a cache line boundary past the header
+#define LCD_STREAM_HEADER_SIZE	ROUND_UP(sizeof(pmb887x_lcd_stream_t), 64)
+// FNV-1a, applied per pixel
+#define LCD_HASH_SEED			0xCBF29CE484222325ULL
+#define LCD_HASH_PRIME			0x00000100000001B3ULL
 
-static void lcd_incr_px(pmb887x_lcd_t *lcd);
+QEMU_BUILD_BUG_ON(sizeof(pmb887x_lcd_stream_t) > LCD_STREAM_HEADER_SIZE);
 
 static void lcd_write_control_byte(pmb887x_lcd_t *lcd, uint8_t value);
 
@@ -97,6 +104,7 @@ void pmb887x_lcd_set_pixel_format(pmb887x_lcd_t *lcd, enum pmb887x_lcd_pixel_for
 	lcd->byte_pp = info->bytes_per_pixel;
 	lcd->decode_pixel = info->decode;
 	lcd->encode_pixel = info->encode;
+	lcd->decode_row = info->decode_row;
 	lcd->tmp_pixel = 0;
 	lcd->tmp_index = 0;
 	DPRINTF("pixel format: %d, bpp: %d [%dB]\n", format, lcd->bpp, lcd->byte_pp);
@@ -168,57 +176,6 @@ void pmb887x_lcd_set_transform(pmb887x_lcd_t *lcd, bool flip_h_pins, bool flip_v
 		lcd->flip_vertical);
 }
 
-static void lcd_mark_dirty(pmb887x_lcd_t *lcd, uint32_t x, uint32_t y) {
-	lcd->dirty.x1 = MIN(lcd->dirty.x1, x);
-	lcd->dirty.y1 = MIN(lcd->dirty.y1, y);
-	lcd->dirty.x2 = MAX(lcd->dirty.x2, x);
-	lcd->dirty.y2 = MAX(lcd->dirty.y2, y);
-}
-
-static inline bool lcd_incr_ac_x(pmb887x_lcd_t *lcd) {
-	if (lcd->ac_x == LCD_AC_INC) {
-		lcd->buffer_x++;
-		if (lcd->buffer_x > lcd->window.x2) {
-			lcd->buffer_x = lcd->window.x1;
-			return true;
-		}
-	} else {
-		lcd->buffer_x--;
-		if (lcd->buffer_x < lcd->window.x1) {
-			lcd->buffer_x = lcd->window.x2;
-			return true;
-		}
-	}
-	return false;
-}
-
-static inline bool lcd_incr_ac_y(pmb887x_lcd_t *lcd) {
-	if (lcd->ac_y == LCD_AC_INC) {
-		lcd->buffer_y++;
-		if (lcd->buffer_y > lcd->window.y2) {
-			lcd->buffer_y = lcd->window.y1;
-			return true;
-		}
-	} else {
-		lcd->buffer_y--;
-		if (lcd->buffer_y < lcd->window.y1) {
-			lcd->buffer_y = lcd->window.y2;
-			return true;
-		}
-	}
-	return false;
-}
-
-static inline void lcd_incr_px(pmb887x_lcd_t *lcd) {
-	if (lcd->am == LCD_AM_VERTICAL) {
-		if (lcd_incr_ac_y(lcd))
-			lcd_incr_ac_x(lcd);
-	} else {
-		if (lcd_incr_ac_x(lcd))
-			lcd_incr_ac_y(lcd);
-	}
-}
-
 static void lcd_handle_command(pmb887x_lcd_t *lcd, uint8_t value) {
 	if (lcd->wr_state != LCD_WR_STATE_CMD) {
 		if (lcd->wr_state == LCD_WR_STATE_PARAM)
@@ -372,35 +329,166 @@ static inline pmb887x_lcd_rect_t lcd_get_dirty_region(pmb887x_lcd_t *lcd) {
 	return dirty;
 }
 
-static bool lcd_update_display(void *opaque) {
-	pmb887x_lcd_t *lcd = opaque;
-	
+static inline bool lcd_rect_is_empty(const pmb887x_lcd_rect_t *r) {
+	return r->x1 > r->x2 || r->y1 > r->y2;
+}
+
+static inline void lcd_rect_clear(pmb887x_lcd_rect_t *r) {
+	r->x1 = INT_MAX;
+	r->y1 = INT_MAX;
+	r->x2 = -1;
+	r->y2 = -1;
+}
+
+static inline void lcd_rect_union(pmb887x_lcd_rect_t *r, const pmb887x_lcd_rect_t *other) {
+	r->x1 = MIN(r->x1, other->x1);
+	r->y1 = MIN(r->y1, other->y1);
+	r->x2 = MAX(r->x2, other->x2);
+	r->y2 = MAX(r->y2, other->y2);
+}
+
+static uint64_t lcd_hash_row(const uint32_t *row, size_t count) {
+	uint64_t hash = LCD_HASH_SEED;
+	for (size_t i = 0; i < count; i++)
+		hash = (hash ^ row[i]) * LCD_HASH_PRIME;
+	return hash;
+}
+
+static void lcd_update_frame_hash(pmb887x_lcd_t *lcd, const pmb887x_lcd_rect_t *dirty) {
+	uint32_t width = surface_width(lcd->shadow_surface);
+	uint32_t height = surface_height(lcd->shadow_surface);
+	const uint32_t *pixels = (const uint32_t *) lcd->shadow_buffer;
+
+	// Only the dirty rows are rehashed, the frame hash is folded from the cached row hashes
+	for (int y = dirty->y1; y <= dirty->y2; y++)
+		lcd->row_hash[y] = lcd_hash_row(&pixels[y * width], width);
+
+	uint64_t hash = LCD_HASH_SEED;
+	for (uint32_t y = 0; y < height; y++)
+		hash = (hash ^ lcd->row_hash[y]) * LCD_HASH_PRIME;
+	lcd->frame_hash = hash;
+}
+
+static void lcd_stream_publish(pmb887x_lcd_t *lcd, const pmb887x_lcd_rect_t *dirty) {
+	pmb887x_lcd_stream_t *stream = lcd->stream;
+	uint8_t *pixels = (uint8_t *) stream + stream->header_size;
+	uint32_t width = surface_width(lcd->shadow_surface);
+	uint32_t stride = width * 4;
+	size_t row_size = (dirty->x2 - dirty->x1 + 1) * 4;
+
+	qatomic_set(&stream->sequence, stream->sequence + 1);
+	smp_wmb();
+
+	for (int y = dirty->y1; y <= dirty->y2; y++) {
+		size_t offset = y * stride + dirty->x1 * 4;
+		memcpy(pixels + offset, lcd->shadow_buffer + offset, row_size);
+	}
+
+	stream->width = width;
+	stream->height = surface_height(lcd->shadow_surface);
+	stream->stride = stride;
+	stream->frame = lcd->frame;
+	stream->hash = lcd->frame_hash;
+	stream->time = pmb887x_sched_now();
+	stream->dirty_x = dirty->x1;
+	stream->dirty_y = dirty->y1;
+	stream->dirty_width = dirty->x2 - dirty->x1 + 1;
+	stream->dirty_height = dirty->y2 - dirty->y1 + 1;
+
+	smp_wmb();
+	qatomic_set(&stream->sequence, stream->sequence + 1);
+}
+
+/*
+ * Moves the dirty part of GRAM to the output surface as a new frame.
+ * Returns false if nothing was changed since the previous frame.
+ */
+static bool lcd_commit_frame(pmb887x_lcd_t *lcd) {
 	if (!lcd->surface)
-		return true;
-	
+		return false;
+
 	pmb887x_lcd_rect_t dirty = lcd_get_dirty_region(lcd);
-	if (dirty.x1 > dirty.x2 || dirty.y1 > dirty.y2)
-		return true;
+	if (lcd_rect_is_empty(&dirty))
+		return false;
+
+	lcd_transform_rect(lcd, &dirty);
+	pixman_image_composite32(
+		PIXMAN_OP_SRC,
+		lcd->surface->image, /* src */
+		NULL /* mask */,
+		lcd->shadow_surface->image, /* dest */
+		dirty.x1, dirty.y1, /* src_x, src_y */
+		0, 0, /* mask_x, mask_y */
+		dirty.x1, dirty.y1, /* dest_x, dest_y */
+		dirty.x2 - dirty.x1 + 1, /* width */
+		dirty.y2 - dirty.y1 + 1 /* height */
+	);
 
-	if (lcd->shadow_surface) {
-		lcd_transform_rect(lcd, &dirty);
-		pixman_image_composite32(
-			PIXMAN_OP_SRC,
-			lcd->surface->image, /* src */
-			NULL /* mask */,
-			lcd->shadow_surface->image, /* dest */
-			dirty.x1, dirty.y1, /* src_x, src_y */
-			0, 0, /* mask_x, mask_y */
-			dirty.x1, dirty.y1, /* dest_x, dest_y */
-			dirty.x2 - dirty.x1 + 1, /* width */
-			dirty.y2 - dirty.y1 + 1 /* height */
-		);
-	}
+	lcd_update_frame_hash(lcd, &dirty);
+	lcd_rect_union(&lcd->console_dirty, &dirty);
+	lcd->frame_dirty = dirty;
+	lcd->frame++;
+
+	if (lcd->stream)
+		lcd_stream_publish(lcd, &dirty);
+	return true;
+}
+
+static bool lcd_update_display(void *opaque) {
+	pmb887x_lcd_t *lcd = opaque;
+
+	lcd_commit_frame(lcd);
+
+	// Frames committed outside of the refresh are also shown
+	pmb887x_lcd_rect_t dirty = lcd->console_dirty;
+	if (lcd_rect_is_empty(&dirty))
+		return true;
+	lcd_rect_clear(&lcd->console_dirty);
 
 	qemu_console_update(lcd->console, dirty.x1, dirty.y1, dirty.x2 - dirty.x1 + 1, dirty.y2 - dirty.y1 + 1);
 	return true;
 }
 
+static void lcd_stream_tick(void *opaque) {
+	pmb887x_lcd_t *lcd = opaque;
+	lcd_commit_frame(lcd);
+	pmb887x_sched_event_mod(&lcd->stream_timer, pmb887x_sched_now() + (int64_t) lcd->stream_interval * SCALE_MS);
+}
+
+static void lcd_stream_init(pmb887x_lcd_t *lcd, Error **errp) {
+	lcd->stream_size = LCD_STREAM_HEADER_SIZE + (size_t) lcd->width * lcd->height * 4;
+
+	int fd = qemu_create(lcd->stream_file, O_RDWR | O_TRUNC, 0644, errp);
+	if (fd < 0)
+		return;
+
+	if (ftruncate(fd, lcd->stream_size) != 0) {
+		error_setg_errno(errp, errno, "Can't resize LCD stream %s", lcd->stream_file);
+		qemu_close(fd);
+		return;
+	}
+
+	void *mem = mmap(NULL, lcd->stream_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	qemu_close(fd);
+	if (mem == MAP_FAILED) {
+		error_setg_errno(errp, errno, "Can't map LCD stream %s", lcd->stream_file);
+		return;
+	}
+
+	lcd->stream = mem;
+	lcd->stream->version = PMB887X_LCD_STREAM_VERSION;
+	lcd->stream->header_size = LCD_STREAM_HEADER_SIZE;
+	lcd->stream->format = PIXMAN_x8r8g8b8;
+	memcpy(lcd->stream->magic, PMB887X_LCD_STREAM_MAGIC, sizeof(lcd->stream->magic));
+
+	if (lcd->stream_interval) {
+		pmb887x_sched_event_init(&lcd->stream_timer, lcd_stream_tick, lcd);
+		pmb887x_sched_event_mod(&lcd->stream_timer, pmb887x_sched_now() + (int64_t) lcd->stream_interval * SCALE_MS);
+	}
+
+	DPRINTF("stream: %s, every %u ms\n", lcd->stream_file, lcd->stream_interval);
+}
+
 static void lcd_invalidate_display(void *opaque) {
 	lcd_invalidate_full(opaque);
 }
@@ -452,7 +540,7 @@ static uint32_t lcd_transfer(SSIPeripheral *dev, uint32_t data) {
 			if (lcd->tmp_index == lcd->byte_pp) {
 				lcd->tmp_pixel = 0;
 				lcd->tmp_index = 0;
-				lcd_incr_px(lcd);
+				pmb887x_lcd_incr_px(lcd);
 			}
 			return value;
 		}
@@ -462,17 +550,7 @@ static uint32_t lcd_transfer(SSIPeripheral *dev, uint32_t data) {
 	}
 
 	if (lcd->wr_state == LCD_WR_STATE_RAM && !lcd->cd) {
-		lcd->tmp_pixel = lcd->tmp_pixel << 8 | (data & 0xFF);
-		lcd->tmp_index++;
-
-		if (lcd->tmp_index == lcd->byte_pp) {
-			uint32_t index = lcd->buffer_y * lcd->width + lcd->buffer_x;
-			lcd->gram[index] = lcd->decode_pixel(lcd->tmp_pixel);
-			lcd_mark_dirty(lcd, lcd->buffer_x, lcd->buffer_y);
-			lcd->tmp_pixel = 0;
-			lcd->tmp_index = 0;
-			lcd_incr_px(lcd);
-		}
+		pmb887x_lcd_write_ram_byte(lcd, data);
 	} else {
 		lcd_write_control_byte(lcd, data);
 	}
@@ -480,6 +558,74 @@ static uint32_t lcd_transfer(SSIPeripheral *dev, uint32_t data) {
 	return 0;
 }
 
+static void lcd_write_burst(pmb887x_lcd_t *lcd, const uint8_t *data, size_t size) {
+	// Only a control byte can leave RAM write (CD and RESET changes flush the burst), the rest is pixel data
+	while (size > 0 && !lcd->reset_active && !(lcd->wr_state == LCD_WR_STATE_RAM && !lcd->cd)) {
+		lcd_transfer(SSI_PERIPHERAL(lcd), *data++);
+		size--;
+	}
+	if (size > 0 && !lcd->reset_active)
+		pmb887x_lcd_write_ram(lcd, data, size);
+}
+
+static bool lcd_is_selected(SSIPeripheral *dev) {
+	switch (dev->spc->cs_polarity) {
+		case SSI_CS_HIGH:
+			return dev->cs;
+		case SSI_CS_LOW:
+			return !dev->cs;
+		default:
+			return true;
+	}
+}
+
+static bool lcd_bus_can_burst(SSIBus *bus) {
+	BusChild *kid;
+	bool found = false;
+
+	QTAILQ_FOREACH(kid, &BUS(bus)->children, sibling) {
+		SSIPeripheral *dev = SSI_PERIPHERAL(kid->child);
+		pmb887x_lcd_t *lcd;
+
+		if (!lcd_is_selected(dev))
+			continue;
+		lcd = (pmb887x_lcd_t *) object_dynamic_cast(OBJECT(dev), TYPE_PMB887X_LCD);
+		if (!lcd || lcd->read_active || !lcd->gram)
+			return false;
+		found = true;
+	}
+	return found;
+}
+
+void pmb887x_lcd_burst_flush(pmb887x_lcd_burst_t *burst) {
+	BusChild *kid;
+
+	if (burst->size == 0)
+		return;
+
+	QTAILQ_FOREACH(kid, &BUS(burst->bus)->children, sibling) {
+		SSIPeripheral *dev = SSI_PERIPHERAL(kid->child);
+		if (lcd_is_selected(dev)) {
+			pmb887x_lcd_t *lcd = PMB887X_LCD(dev);
+			lcd->k->write_burst(lcd, burst->data, burst->size);
+		}
+	}
+	burst->size = 0;
+}
+
+uint32_t pmb887x_lcd_burst_transfer(pmb887x_lcd_burst_t *burst, uint32_t value) {
+	if (value > 0xFF || (burst->size == 0 && !lcd_bus_can_burst(burst->bus))) {
+		pmb887x_lcd_burst_flush(burst);
+		return ssi_transfer(burst->bus, value);
+	}
+
+	// LCD writes always read back as 0
+	burst->data[burst->size++] = value;
+	if (burst->size == PMB887X_LCD_BURST_SIZE)
+		pmb887x_lcd_burst_flush(burst);
+	return 0;
+}
+
 static const GraphicHwOps pmb887x_lcd_gfx_ops = {
 	.invalidate = lcd_invalidate_display,
 	.gfx_update = lcd_update_display
@@ -492,8 +638,45 @@ static const Property lcd_props[] = {
 	DEFINE_PROP_BOOL("flip_horizontal", pmb887x_lcd_t, default_flip_horizontal, false),
 	DEFINE_PROP_BOOL("flip_vertical", pmb887x_lcd_t, default_flip_vertical, false),
 	DEFINE_PROP_BOOL("bgr_filter", pmb887x_lcd_t, bgr_filter, false),
+	DEFINE_PROP_STRING("stream", pmb887x_lcd_t, stream_file),
+	DEFINE_PROP_UINT32("stream_interval", pmb887x_lcd_t, stream_interval, 20),
 };
 
+static void lcd_get_frame(Object *obj, Visitor *v, const char *name, void *opaque, Error **errp) {
+	pmb887x_lcd_t *lcd = PMB887X_LCD(obj);
+	lcd_commit_frame(lcd);
+	visit_type_uint64(v, name, &lcd->frame, errp);
+}
+
+static void lcd_get_frame_hash(Object *obj, Visitor *v, const char *name, void *opaque, Error **errp) {
+	pmb887x_lcd_t *lcd = PMB887X_LCD(obj);
+	lcd_commit_frame(lcd);
+	visit_type_uint64(v, name, &lcd->frame_hash, errp);
+}
+
+static void lcd_get_frame_dirty(Object *obj, Visitor *v, const char *name, void *opaque, Error **errp) {
+	pmb887x_lcd_t *lcd = PMB887X_LCD(obj);
+	lcd_commit_frame(lcd);
+
+	pmb887x_lcd_rect_t *dirty = &lcd->frame_dirty;
+	int32_t x = dirty->x1;
+	int32_t y = dirty->y1;
+	int32_t width = dirty->x2 - dirty->x1 + 1;
+	int32_t height = dirty->y2 - dirty->y1 + 1;
+
+	if (!visit_start_struct(v, name, NULL, 0, errp))
+		return;
+	bool ok = (
+		visit_type_int32(v, "x", &x, errp) &&
+		visit_type_int32(v, "y", &y, errp) &&
+		visit_type_int32(v, "width", &width, errp) &&
+		visit_type_int32(v, "height", &height, errp)
+	);
+	if (ok)
+		visit_check_struct(v, errp);
+	visit_end_struct(v, NULL);
+}
+
 static void lcd_handle_rd(void *opaque, int n, int level) {
 	pmb887x_lcd_t *lcd = PMB887X_LCD(opaque);
 	bool read_active = level == 0;
@@ -571,6 +754,19 @@ static void lcd_realize(SSIPeripheral *d, Error **errp) {
 	pmb887x_lcd_set_window_x2(lcd, lcd->width - 1);
 	pmb887x_lcd_set_window_y2(lcd, lcd->height - 1);
 
+	lcd_rect_clear(&lcd->console_dirty);
+	lcd->frame_dirty.x1 = 0;
+	lcd->frame_dirty.y1 = 0;
+	lcd->frame_dirty.x2 = -1;
+	lcd->frame_dirty.y2 = -1;
+	lcd->row_hash = g_new0(uint64_t, MAX(lcd->width, lcd->height));
+
+	if (lcd->stream_file && lcd->stream_file[0]) {
+		lcd_stream_init(lcd, errp);
+		if (!lcd->stream)
+			return;
+	}
+
 	if (lcd->k->realize)
 		lcd->k->realize(lcd, errp);
 }
@@ -581,12 +777,19 @@ static void lcd_reset(DeviceState *dev) {
 
 static void lcd_class_init(ObjectClass *klass, const void *data) {
 	SSIPeripheralClass *k = SSI_PERIPHERAL_CLASS(klass);
+	pmb887x_lcd_class_t *lk = PMB887X_LCD_CLASS(klass);
 	DeviceClass *dc = DEVICE_CLASS(klass);
 	device_class_set_props(dc, lcd_props);
 	device_class_set_legacy_reset(dc, lcd_reset);
 	k->realize = lcd_realize;
 	k->transfer = lcd_transfer;
 	k->cs_polarity = SSI_CS_LOW;
+	lk->write_burst = lcd_write_burst;
+
+	// qom-get <path> frame/frame-hash/frame-dirty: commit pending GRAM writes and describe the last frame
+	object_class_property_add(klass, "frame", "uint64", lcd_get_frame, NULL, NULL, NULL);
+	object_class_property_add(klass, "frame-hash", "uint64", lcd_get_frame_hash, NULL, NULL, NULL);
+	object_class_property_add(klass, "frame-dirty", "pmb887x-lcd-rect", lcd_get_frame_dirty, NULL, NULL, NULL);
 }
 
 static const TypeInfo lcd_type_info = {
@@ -6,14 +6,20 @@
 #include "hw/ssi/ssi.h"
 #include "ui/console.h"
 #include "hw/arm/pmb887x/fifo.h"
+#include "hw/arm/pmb887x/scheduler.h"
 #include "hw/arm/pmb887x/ssc/lcd_common_format.h"
 
 #define TYPE_PMB887X_LCD	"pmb887x-lcd"
 OBJECT_DECLARE_TYPE(pmb887x_lcd_t, pmb887x_lcd_class_t, PMB887X_LCD);
 
 #define LCD_DATA_IS_CMD (1 << 8)
+#define PMB887X_LCD_BURST_SIZE	1024
+#define PMB887X_LCD_STREAM_MAGIC	"PMBLCDFB"
+#define PMB887X_LCD_STREAM_VERSION	1
 
 typedef struct pmb887x_lcd_rect_t pmb887x_lcd_rect_t;
+typedef struct pmb887x_lcd_burst_t pmb887x_lcd_burst_t;
+typedef struct pmb887x_lcd_stream_t pmb887x_lcd_stream_t;
 
 enum pmb887x_lcd_wr_state_t {
 	LCD_WR_STATE_NONE,
@@ -40,6 +46,31 @@ struct pmb887x_lcd_rect_t {
 	int y2;
 };
 
+/*
+ * Header of the shared memory frame stream ("stream" property), followed by the output pixels
+ * at header_size in PIXMAN_x8r8g8b8 with the rotation and flips already applied.
+ * The writer makes sequence odd while a frame is copied: readers take a snapshot only when
+ * sequence is even and unchanged after the copy. Only the dirty rectangle is rewritten per frame.
+ */
+struct pmb887x_lcd_stream_t {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t format;
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride;
+	uint32_t sequence;
+	uint32_t reserved;
+	uint64_t frame;
+	uint64_t hash;
+	int64_t time;			// virtual ns
+	int32_t dirty_x;
+	int32_t dirty_y;
+	int32_t dirty_width;
+	int32_t dirty_height;
+};
+
 struct pmb887x_lcd_t {
 	SSIPeripheral parent;
 	pmb887x_lcd_class_t *k;
@@ -66,6 +97,7 @@ struct pmb887x_lcd_t {
 	enum pmb887x_lcd_pixel_format_t pixel_format;
 	uint32_t (*decode_pixel)(uint32_t);
 	uint32_t (*encode_pixel)(uint32_t);
+	void (*decode_row)(uint32_t *, const uint8_t *, size_t);
 	bool output_bgr;
 
 	bool mirror_xy;
@@ -95,8 +127,21 @@ struct pmb887x_lcd_t {
 
 	DisplaySurface *surface;
 	QemuConsole *console;
+	pmb887x_lcd_rect_t console_dirty;
 
 	bool invalidate;
+
+	/* Frames are committed on display refresh, stream ticks and frame-* property reads */
+	uint64_t frame;
+	uint64_t frame_hash;
+	uint64_t *row_hash;
+	pmb887x_lcd_rect_t frame_dirty;
+
+	char *stream_file;
+	uint32_t stream_interval;
+	pmb887x_lcd_stream_t *stream;
+	size_t stream_size;
+	pmb887x_sched_event_t stream_timer;
 };
 
 struct pmb887x_lcd_class_t {
@@ -111,6 +156,19 @@ struct pmb887x_lcd_class_t {
 	uint32_t (*on_read)(pmb887x_lcd_t *, uint32_t);
 	void (*reset)(pmb887x_lcd_t *);
 	void (*realize)(pmb887x_lcd_t *, Error **errp);
+	/* Same as a transfer() per byte, while RD is inactive */
+	void (*write_burst)(pmb887x_lcd_t *, const uint8_t *, size_t);
+};
+
+/*
+ * Write-side batching for display controllers. Bytes sent while every selected device
+ * on the bus is a write-only LCD are collected and handed over as one span.
+ * Flush before changing any line the LCD sees (CS, CD, RD, RESET).
+ */
+struct pmb887x_lcd_burst_t {
+	SSIBus *bus;
+	uint32_t size;
+	uint8_t data[PMB887X_LCD_BURST_SIZE];
 };
 
 void pmb887x_lcd_set_pixel_format(pmb887x_lcd_t *lcd, enum pmb887x_lcd_pixel_format_t format);
@@ -119,6 +177,14 @@ void pmb887x_lcd_set_transform(pmb887x_lcd_t *lcd, bool flip_h_pins, bool flip_v
 void pmb887x_lcd_set_ram_mode(pmb887x_lcd_t *lcd, bool flag);
 void pmb887x_lcd_set_addr_mode(pmb887x_lcd_t *lcd, enum pmb887x_lcd_am_t am, enum pmb887x_lcd_ac_t ac_x, enum pmb887x_lcd_ac_t ac_y);
 
+// GRAM writes in RAM write mode: one byte of the serial path, and a whole burst using row spans where possible
+void pmb887x_lcd_write_ram_byte(pmb887x_lcd_t *lcd, uint8_t value);
+void pmb887x_lcd_write_ram(pmb887x_lcd_t *lcd, const uint8_t *data, size_t size);
+void pmb887x_lcd_incr_px(pmb887x_lcd_t *lcd);
+
+uint32_t pmb887x_lcd_burst_transfer(pmb887x_lcd_burst_t *burst, uint32_t value);
+void pmb887x_lcd_burst_flush(pmb887x_lcd_burst_t *burst);
+
 static inline bool pmb887x_lcd_get_cd(pmb887x_lcd_t *lcd) {
 	return lcd->cd;
 }
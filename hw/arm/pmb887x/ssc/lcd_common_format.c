@@ -58,12 +58,29 @@ static uint32_t lcd_format_rgb888_encode(uint32_t value) {
 	return value & 0xFFFFFF;
 }
 
+// Plain loops over the byte stream, simple enough for the compiler to vectorize
+static void lcd_format_rgb565_decode_row(uint32_t *dst, const uint8_t *src, size_t count) {
+	for (size_t i = 0; i < count; i++)
+		dst[i] = lcd_format_rgb565_decode(src[i * 2] << 8 | src[i * 2 + 1]);
+}
+
+#define LCD_FORMAT_DECODE_ROW_24(name) \
+	static void lcd_format_##name##_decode_row(uint32_t *dst, const uint8_t *src, size_t count) { \
+		for (size_t i = 0; i < count; i++) \
+			dst[i] = lcd_format_##name##_decode(src[i * 3] << 16 | src[i * 3 + 1] << 8 | src[i * 3 + 2]); \
+	}
+
+LCD_FORMAT_DECODE_ROW_24(rgb666_8_8_2)
+LCD_FORMAT_DECODE_ROW_24(rgb666_2_8_8)
+LCD_FORMAT_DECODE_ROW_24(rgb666_6_6_6)
+LCD_FORMAT_DECODE_ROW_24(rgb888)
+
 static const pmb887x_lcd_format_t LCD_PIXEL_FORMATS[LCD_PIXEL_FORMAT_COUNT] = {
-	[LCD_PIXEL_FORMAT_RGB565] = { 2, 16, lcd_format_rgb565_decode, lcd_format_rgb565_encode },
-	[LCD_PIXEL_FORMAT_RGB666_8_8_2] = { 3, 18, lcd_format_rgb666_8_8_2_decode, lcd_format_rgb666_8_8_2_encode },
-	[LCD_PIXEL_FORMAT_RGB666_2_8_8] = { 3, 18, lcd_format_rgb666_2_8_8_decode, lcd_format_rgb666_2_8_8_encode },
-	[LCD_PIXEL_FORMAT_RGB666_6_6_6] = { 3, 18, lcd_format_rgb666_6_6_6_decode, lcd_format_rgb666_6_6_6_encode },
-	[LCD_PIXEL_FORMAT_RGB888] = { 3, 24, lcd_format_rgb888_decode, lcd_format_rgb888_encode },
+	[LCD_PIXEL_FORMAT_RGB565] = { 2, 16, lcd_format_rgb565_decode, lcd_format_rgb565_encode, lcd_format_rgb565_decode_row },
+	[LCD_PIXEL_FORMAT_RGB666_8_8_2] = { 3, 18, lcd_format_rgb666_8_8_2_decode, lcd_format_rgb666_8_8_2_encode, lcd_format_rgb666_8_8_2_decode_row },
+	[LCD_PIXEL_FORMAT_RGB666_2_8_8] = { 3, 18, lcd_format_rgb666_2_8_8_decode, lcd_format_rgb666_2_8_8_encode, lcd_format_rgb666_2_8_8_decode_row },
+	[LCD_PIXEL_FORMAT_RGB666_6_6_6] = { 3, 18, lcd_format_rgb666_6_6_6_decode, lcd_format_rgb666_6_6_6_encode, lcd_format_rgb666_6_6_6_decode_row },
+	[LCD_PIXEL_FORMAT_RGB888] = { 3, 24, lcd_format_rgb888_decode, lcd_format_rgb888_encode, lcd_format_rgb888_decode_row },
 };
 
 const pmb887x_lcd_format_t *pmb887x_lcd_format_get(enum pmb887x_lcd_pixel_format_t format) {
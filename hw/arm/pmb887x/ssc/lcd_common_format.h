@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 enum pmb887x_lcd_pixel_format_t {
@@ -19,6 +20,8 @@ struct pmb887x_lcd_format_t {
 	uint8_t bits_per_pixel;
 	uint32_t (*decode)(uint32_t);
 	uint32_t (*encode)(uint32_t);
+	/* Converts count big-endian pixels from src to 0x00RRGGBB */
+	void (*decode_row)(uint32_t *dst, const uint8_t *src, size_t count);
 };
 
 const pmb887x_lcd_format_t *pmb887x_lcd_format_get(enum pmb887x_lcd_pixel_format_t format);
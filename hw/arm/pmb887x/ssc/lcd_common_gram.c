@@ -0,0 +1,112 @@
+/*
+ * GRAM writes of the generic serial display, without device glue so the host tests can use them
+ */
+#include "qemu/osdep.h"
+#include "hw/arm/pmb887x/ssc/lcd_common.h"
+
+static inline void lcd_mark_dirty(pmb887x_lcd_t *lcd, uint32_t x, uint32_t y) {
+	lcd->dirty.x1 = MIN(lcd->dirty.x1, x);
+	lcd->dirty.y1 = MIN(lcd->dirty.y1, y);
+	lcd->dirty.x2 = MAX(lcd->dirty.x2, x);
+	lcd->dirty.y2 = MAX(lcd->dirty.y2, y);
+}
+
+static inline bool lcd_incr_ac_x(pmb887x_lcd_t *lcd) {
+	if (lcd->ac_x == LCD_AC_INC) {
+		lcd->buffer_x++;
+		if (lcd->buffer_x > lcd->window.x2) {
+			lcd->buffer_x = lcd->window.x1;
+			return true;
+		}
+	} else {
+		lcd->buffer_x--;
+		if (lcd->buffer_x < lcd->window.x1) {
+			lcd->buffer_x = lcd->window.x2;
+			return true;
+		}
+	}
+	return false;
+}
+
+static inline bool lcd_incr_ac_y(pmb887x_lcd_t *lcd) {
+	if (lcd->ac_y == LCD_AC_INC) {
+		lcd->buffer_y++;
+		if (lcd->buffer_y > lcd->window.y2) {
+			lcd->buffer_y = lcd->window.y1;
+			return true;
+		}
+	} else {
+		lcd->buffer_y--;
+		if (lcd->buffer_y < lcd->window.y1) {
+			lcd->buffer_y = lcd->window.y2;
+			return true;
+		}
+	}
+	return false;
+}
+
+void pmb887x_lcd_incr_px(pmb887x_lcd_t *lcd) {
+	if (lcd->am == LCD_AM_VERTICAL) {
+		if (lcd_incr_ac_y(lcd))
+			lcd_incr_ac_x(lcd);
+	} else {
+		if (lcd_incr_ac_x(lcd))
+			lcd_incr_ac_y(lcd);
+	}
+}
+
+void pmb887x_lcd_write_ram_byte(pmb887x_lcd_t *lcd, uint8_t value) {
+	lcd->tmp_pixel = lcd->tmp_pixel << 8 | value;
+	lcd->tmp_index++;
+
+	if (lcd->tmp_index == lcd->byte_pp) {
+		uint32_t index = lcd->buffer_y * lcd->width + lcd->buffer_x;
+		lcd->gram[index] = lcd->decode_pixel(lcd->tmp_pixel);
+		lcd_mark_dirty(lcd, lcd->buffer_x, lcd->buffer_y);
+		lcd->tmp_pixel = 0;
+		lcd->tmp_index = 0;
+		pmb887x_lcd_incr_px(lcd);
+	}
+}
+
+static size_t lcd_write_ram_row(pmb887x_lcd_t *lcd, const uint8_t *data, size_t pixels, pmb887x_lcd_rect_t *dirty) {
+	size_t count = MIN(pixels, (size_t) (lcd->window.x2 - lcd->buffer_x + 1));
+
+	lcd->decode_row(&lcd->gram[lcd->buffer_y * lcd->width + lcd->buffer_x], data, count);
+	dirty->x1 = MIN(dirty->x1, lcd->buffer_x);
+	dirty->y1 = MIN(dirty->y1, lcd->buffer_y);
+	dirty->x2 = MAX(dirty->x2, lcd->buffer_x + (int) count - 1);
+	dirty->y2 = MAX(dirty->y2, lcd->buffer_y);
+
+	lcd->buffer_x += count;
+	if (lcd->buffer_x > lcd->window.x2) {
+		lcd->buffer_x = lcd->window.x1;
+		lcd_incr_ac_y(lcd);
+	}
+	return count;
+}
+
+void pmb887x_lcd_write_ram(pmb887x_lcd_t *lcd, const uint8_t *data, size_t size) {
+	pmb887x_lcd_rect_t dirty = lcd->dirty;
+
+	while (size > 0) {
+		bool is_row_write = (
+			lcd->tmp_index == 0 && size >= lcd->byte_pp &&
+			lcd->am == LCD_AM_HORIZONTAL && lcd->ac_x == LCD_AC_INC &&
+			lcd->buffer_x <= lcd->window.x2
+		);
+
+		if (is_row_write) {
+			// Whole pixels along the current window row
+			size_t count = lcd_write_ram_row(lcd, data, size / lcd->byte_pp, &dirty);
+			data += count * lcd->byte_pp;
+			size -= count * lcd->byte_pp;
+		} else {
+			lcd->dirty = dirty;
+			pmb887x_lcd_write_ram_byte(lcd, *data++);
+			dirty = lcd->dirty;
+			size--;
+		}
+	}
+	lcd->dirty = dirty;
+}
@@ -16,6 +16,8 @@
 #include "hw/arm/pmb887x/pll.h"
 #include "hw/arm/pmb887x/gen/cpu_regs.h"
 #include "hw/arm/pmb887x/regs_dump.h"
+#include "hw/arm/pmb887x/idle.h"
+#include "hw/arm/pmb887x/scheduler.h"
 #include "hw/arm/pmb887x/mod.h"
 #include "hw/arm/pmb887x/trace.h"
 
@@ -33,6 +35,7 @@ struct pmb887x_stm_t {
 	
 	bool enabled;
 	uint32_t freq;
+	pmb887x_sched_clock_t clock;
 	int64_t start;
 	int64_t capture;
 	int64_t counter;
@@ -41,13 +44,16 @@ struct pmb887x_stm_t {
 };
 
 static int64_t stm_get_time(pmb887x_stm_t *p) {
-	if (p->enabled) {
-		uint64_t delta_ns = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) - p->start;
-		return p->counter + muldiv64(delta_ns, p->freq, NANOSECONDS_PER_SECOND);
-	}
+	if (p->enabled)
+		return p->counter + pmb887x_sched_clock_elapsed(&p->clock, p->start);
 	return p->counter;
 }
 
+static int64_t stm_poll_time(pmb887x_stm_t *p, hwaddr haddr) {
+	pmb887x_idle_poll(haddr + p->mmio.addr);
+	return stm_get_time(p);
+}
+
 static void stm_update_state(pmb887x_stm_t *p) {
 	uint32_t div = pmb887x_clc_get_rmc(&p->clc);
 	uint32_t new_freq = div > 0 ? pmb887x_pll_get_fstm(p->pll) / div : 0;
@@ -57,9 +63,10 @@ static void stm_update_state(pmb887x_stm_t *p) {
 		p->counter = stm_get_time(p);
 		p->freq = new_freq;
 		p->enabled = new_enabled;
+		pmb887x_sched_clock_set_freq(&p->clock, new_freq);
 		
 		if (p->enabled) {
-			p->start = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+			p->start = pmb887x_sched_now();
 		} else {
 			p->start = 0;
 		}
@@ -86,37 +93,37 @@ static uint64_t stm_io_read(void *opaque, hwaddr haddr, unsigned size) {
 			break;
 		
 		case STM_TIM0:
-			p->capture = stm_get_time(p);
+			p->capture = stm_poll_time(p, haddr);
 			value = (p->capture >> 0) & 0xFFFFFFFF;
 			break;
 		
 		case STM_TIM1:
-			p->capture = stm_get_time(p);
+			p->capture = stm_poll_time(p, haddr);
 			value = (p->capture >> 4) & 0xFFFFFFFF;
 			break;
 		
 		case STM_TIM2:
-			p->capture = stm_get_time(p);
+			p->capture = stm_poll_time(p, haddr);
 			value = (p->capture >> 8) & 0xFFFFFFFF;
 			break;
 		
 		case STM_TIM3:
-			p->capture = stm_get_time(p);
+			p->capture = stm_poll_time(p, haddr);
 			value = (p->capture >> 12) & 0xFFFFFFFF;
 			break;
 		
 		case STM_TIM4:
-			p->capture = stm_get_time(p);
+			p->capture = stm_poll_time(p, haddr);
 			value = (p->capture >> 16) & 0xFFFFFFFF;
 			break;
 		
 		case STM_TIM5:
-			p->capture = stm_get_time(p);
+			p->capture = stm_poll_time(p, haddr);
 			value = (p->capture >> 20) & 0xFFFFFFFF;
 			break;
 		
 		case STM_TIM6:
-			p->capture = stm_get_time(p);
+			p->capture = stm_poll_time(p, haddr);
 			value = (p->capture >> 32) & 0x00FFFFFF;
 			break;
 		
@@ -0,0 +1,136 @@
+#include "qemu/osdep.h"
+#include "qemu-main.h"
+#include "qemu/main-loop.h"
+#include "qemu/module.h"
+#include "qapi/error.h"
+#include "qobject/qdict.h"
+#include "block/block.h"
+#include "system/block-backend.h"
+#include "system/runstate.h"
+#include "hw/core/sysbus.h"
+#include "hw/core/qdev-properties.h"
+#include "hw/core/qdev-properties-system.h"
+
+#include "hw/arm/pmb887x/flash-blk.h"
+
+#define TEST_IMAGE_SIZE		(64 * 1024)
+#define TEST_WRITE_OFFSET	0x3000
+#define TEST_WRITE_SIZE		0x2000
+#define TEST_BASE_FILL		0xAA
+#define TEST_GUEST_FILL		0x55
+
+typedef struct test_flash_t test_flash_t;
+
+struct test_flash_t {
+	char *image_file;
+	char *overlay_file;
+	DeviceState *dev;
+	pmb887x_flash_blk_t *flash;
+	uint8_t *storage;
+};
+
+int (*qemu_main)(void);
+
+static char *test_create_file(const uint8_t *data, size_t size) {
+	g_autoptr(GError) error = NULL;
+	char *path = NULL;
+	int fd = g_file_open_tmp("pmb887x-flash-blk-XXXXXX", &path, &error);
+
+	g_assert_no_error(error);
+	close(fd);
+	if (data != NULL)
+		g_assert_true(g_file_set_contents(path, (const char *) data, size, NULL));
+	return path;
+}
+
+static void test_flash_create(test_flash_t *t, const char *id, const char *overlay_file, bool writeback) {
+	g_autofree uint8_t *image = g_malloc(TEST_IMAGE_SIZE);
+	QDict *options = qdict_new();
+
+	memset(image, TEST_BASE_FILL, TEST_IMAGE_SIZE);
+	t->image_file = test_create_file(image, TEST_IMAGE_SIZE);
+	// Without a path start from an empty file, the device creates a new overlay in it
+	t->overlay_file = overlay_file ? g_strdup(overlay_file) : test_create_file(NULL, 0);
+
+	qdict_put_str(options, "driver", "raw");
+	BlockBackend *blk = blk_new_open(t->image_file, NULL, options, BDRV_O_RDWR, &error_abort);
+
+	t->dev = qdev_new("pmb887x-flash-blk");
+	qdev_prop_set_drive(t->dev, "drive", blk);
+	qdev_prop_set_string(t->dev, "overlay", t->overlay_file);
+	qdev_prop_set_bit(t->dev, "lazy", false);
+	qdev_prop_set_bit(t->dev, "writeback", writeback);
+	blk_unref(blk);
+
+	object_property_add_child(object_get_root(), id, OBJECT(t->dev));
+	sysbus_realize_and_unref(SYS_BUS_DEVICE(t->dev), &error_abort);
+
+	t->flash = pmb887x_flash_blk_self(t->dev);
+	t->storage = g_malloc(TEST_IMAGE_SIZE);
+	g_assert_cmpint(pmb887x_flash_blk_pread(t->flash, 0, TEST_IMAGE_SIZE, t->storage), >=, 0);
+	pmb887x_flash_blk_attach_storage(t->flash, 0, TEST_IMAGE_SIZE, t->storage);
+}
+
+static void test_flash_program(test_flash_t *t) {
+	memset(t->storage + TEST_WRITE_OFFSET, TEST_GUEST_FILL, TEST_WRITE_SIZE);
+	g_assert_cmpint(pmb887x_flash_blk_write_storage(t->flash, TEST_WRITE_OFFSET, TEST_WRITE_SIZE), >=, 0);
+	pmb887x_flash_blk_flush(t->flash);
+}
+
+static void test_assert_filled(const uint8_t *data, size_t size, uint8_t value) {
+	for (size_t i = 0; i < size; i++)
+		g_assert_cmphex(data[i], ==, value);
+}
+
+static void test_overlay_discard(const void *opaque) {
+	bool writeback = GPOINTER_TO_INT(opaque);
+	g_autofree uint8_t *image = NULL;
+	size_t image_size = 0;
+	test_flash_t t = {};
+
+	test_flash_create(&t, writeback ? "flash-writeback" : "flash", NULL, writeback);
+	test_flash_program(&t);
+
+	// Programmed data lives only in the overlay
+	g_assert_true(g_file_get_contents(t.image_file, (char **) &image, &image_size, NULL));
+	g_assert_cmpuint(image_size, ==, TEST_IMAGE_SIZE);
+	test_assert_filled(image, TEST_IMAGE_SIZE, TEST_BASE_FILL);
+	test_assert_filled(t.storage + TEST_WRITE_OFFSET, TEST_WRITE_SIZE, TEST_GUEST_FILL);
+
+	object_property_set_bool(OBJECT(t.dev), "overlay-discard", true, &error_abort);
+
+	// The storage is back to the base image and the overlay has no chunks left for a new instance
+	test_assert_filled(t.storage, TEST_IMAGE_SIZE, TEST_BASE_FILL);
+	test_flash_t reopened = {};
+	test_flash_create(&reopened, writeback ? "flash-writeback-reopened" : "flash-reopened", t.overlay_file, false);
+	test_assert_filled(reopened.storage, TEST_IMAGE_SIZE, TEST_BASE_FILL);
+}
+
+static void test_overlay_discard_running(void) {
+	Error *err = NULL;
+	test_flash_t t = {};
+
+	test_flash_create(&t, "flash-running", NULL, false);
+	test_flash_program(&t);
+
+	runstate_set(RUN_STATE_RUNNING);
+	object_property_set_bool(OBJECT(t.dev), "overlay-discard", true, &err);
+	runstate_set(RUN_STATE_PAUSED);
+
+	g_assert_nonnull(err);
+	error_free(err);
+	test_assert_filled(t.storage + TEST_WRITE_OFFSET, TEST_WRITE_SIZE, TEST_GUEST_FILL);
+}
+
+int main(int argc, char **argv) {
+	g_test_init(&argc, &argv, NULL);
+	module_call_init(MODULE_INIT_QOM);
+	bdrv_init();
+	qemu_init_main_loop(&error_abort);
+	bql_lock();
+
+	g_test_add_data_func("/pmb887x/flash-blk/overlay-discard", GINT_TO_POINTER(false), test_overlay_discard);
+	g_test_add_data_func("/pmb887x/flash-blk/overlay-discard-writeback", GINT_TO_POINTER(true), test_overlay_discard);
+	g_test_add_func("/pmb887x/flash-blk/overlay-discard-running", test_overlay_discard_running);
+	return g_test_run();
+}
@@ -0,0 +1,80 @@
+#include "qemu/osdep.h"
+
+#define BENCH_IMAGE_SIZE	(128 * 1024 * 1024)
+// Roughly what a firmware touches until its main loop: boot code, a few tables and FFS headers
+#define BENCH_TOUCHED_SIZE	(8 * 1024 * 1024)
+
+static char *bench_create_image(void) {
+	g_autoptr(GError) error = NULL;
+	g_autofree uint8_t *buffer = g_malloc(1024 * 1024);
+	char *path = NULL;
+	int fd = g_file_open_tmp("pmb887x-flash-bench-XXXXXX", &path, &error);
+
+	g_assert_no_error(error);
+	for (size_t i = 0; i < 1024 * 1024; i++)
+		buffer[i] = g_test_rand_int();
+	for (size_t offset = 0; offset < BENCH_IMAGE_SIZE; offset += 1024 * 1024)
+		g_assert_cmpint(pwrite(fd, buffer, 1024 * 1024, offset), ==, 1024 * 1024);
+	close(fd);
+	return path;
+}
+
+static int64_t bench_resident_bytes(void) {
+	g_autofree char *statm = NULL;
+	unsigned long size, resident;
+
+	if (!g_file_get_contents("/proc/self/statm", &statm, NULL, NULL) || sscanf(statm, "%lu %lu", &size, &resident) != 2)
+		return -1;
+	return (int64_t) resident * qemu_real_host_page_size();
+}
+
+static void bench_load(const char *image, bool mapped) {
+	size_t page_size = qemu_real_host_page_size();
+	// Same as the ROMD RAM block of a flash partition
+	uint8_t *storage = mmap(NULL, BENCH_IMAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	int fd = open(image, O_RDONLY);
+	uint32_t checksum = 0;
+
+	g_assert_true(storage != MAP_FAILED);
+	g_assert_cmpint(fd, >=, 0);
+
+	int64_t resident = bench_resident_bytes();
+	g_test_timer_start();
+	if (mapped) {
+		g_assert_true(mmap(storage, BENCH_IMAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) != MAP_FAILED);
+	} else {
+		for (size_t offset = 0; offset < BENCH_IMAGE_SIZE; ) {
+			ssize_t ret = pread(fd, storage + offset, BENCH_IMAGE_SIZE - offset, offset);
+			g_assert_cmpint(ret, >, 0);
+			offset += ret;
+		}
+	}
+	double load = g_test_timer_elapsed();
+
+	for (size_t offset = 0; offset < BENCH_TOUCHED_SIZE; offset += page_size)
+		checksum += storage[offset];
+	double touch = g_test_timer_elapsed() - load;
+	resident = bench_resident_bytes() - resident;
+
+	g_test_message("%3d MiB image, %-6s: realize %8.2f ms, first %d MiB touched in %7.2f ms, RSS +%4"PRId64" MiB (%08X)",
+		BENCH_IMAGE_SIZE >> 20, mapped ? "mapped" : "pread", load * 1000, BENCH_TOUCHED_SIZE >> 20,
+		touch * 1000, resident >> 20, checksum);
+
+	munmap(storage, BENCH_IMAGE_SIZE);
+	close(fd);
+}
+
+static void bench_flash_load(void) {
+	g_autofree char *image = bench_create_image();
+
+	// The image was just written, both variants read it from the page cache
+	bench_load(image, false);
+	bench_load(image, true);
+	unlink(image);
+}
+
+int main(int argc, char **argv) {
+	g_test_init(&argc, &argv, NULL);
+	g_test_add_func("/pmb887x/flash/bench/load", bench_flash_load);
+	return g_test_run();
+}
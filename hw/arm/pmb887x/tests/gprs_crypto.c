@@ -0,0 +1,160 @@
+#include "qemu/osdep.h"
+#include "qemu/bitops.h"
+
+#include "hw/arm/pmb887x/gprs_crypto.h"
+
+static uint32_t test_crc24_bitwise(uint32_t polynomial, uint32_t value, const uint8_t *data, size_t size) {
+	uint32_t reflected = 0;
+
+	for (size_t bit = 0; bit < 24; bit++) {
+		if (polynomial & BIT(bit))
+			reflected |= BIT(23 - bit);
+	}
+
+	for (size_t i = 0; i < size; i++) {
+		value ^= data[i];
+		for (size_t bit = 0; bit < 8; bit++)
+			value = (value & 1) ? (value >> 1) ^ reflected : value >> 1;
+	}
+	return value;
+}
+
+static void test_crc24_fcs(void) {
+	static const uint8_t check[] = "123456789";
+	pmb887x_crc24_t crc;
+	uint8_t frame[64 + 3];
+
+	pmb887x_crc24_init(&crc, PMB887X_CRC24_POLYNOMIAL);
+	g_assert_cmphex(pmb887x_crc24_update(&crc, PMB887X_CRC24_INIT, check, sizeof(check) - 1), ==, 0xB17934);
+
+	// A frame followed by its complemented FCS (LSB first) always leaves the same remainder
+	for (size_t size = 0; size <= 64; size++) {
+		for (size_t i = 0; i < size; i++)
+			frame[i] = g_test_rand_int();
+
+		uint32_t fcs = pmb887x_crc24_update(&crc, PMB887X_CRC24_INIT, frame, size) ^ 0xFFFFFF;
+		frame[size] = fcs;
+		frame[size + 1] = fcs >> 8;
+		frame[size + 2] = fcs >> 16;
+		g_assert_cmphex(pmb887x_crc24_update(&crc, PMB887X_CRC24_INIT, frame, size + 3), ==, 0x0C91B6);
+	}
+}
+
+static void test_crc24_slices(void) {
+	uint8_t data[1600 + 7];
+
+	for (size_t i = 0; i < sizeof(data); i++)
+		data[i] = g_test_rand_int();
+
+	for (size_t iteration = 0; iteration < 256; iteration++) {
+		uint32_t polynomial = iteration ? (g_test_rand_int() & 0xFFFFFF) | 1 : PMB887X_CRC24_POLYNOMIAL;
+		uint32_t value = g_test_rand_int() & 0xFFFFFF;
+		size_t offset = iteration % 8;
+		size_t size = iteration < 128 ? iteration : g_test_rand_int_range(0, sizeof(data) - offset);
+		pmb887x_crc24_t crc;
+
+		pmb887x_crc24_init(&crc, polynomial);
+		g_assert_cmphex(pmb887x_crc24_update(&crc, value, data + offset, size), ==,
+			test_crc24_bitwise(polynomial, value, data + offset, size));
+	}
+}
+
+// GEA3 written out from TS 55.216 on top of the raw KASUMI block cipher
+static void test_gea3_reference(const uint8_t kc[8], uint32_t input, bool direction, uint8_t *output, size_t size) {
+	cipher_kasumi_keys_t keys;
+	uint8_t key[16];
+	uint64_t a;
+	uint64_t block = 0;
+
+	for (size_t i = 0; i < 16; i++)
+		key[i] = kc[i % 8] ^ 0x55;
+	cipher_kasumi_setup(&keys, key);
+	a = cipher_kasumi_encrypt(&keys, (uint64_t) input << 32 | (uint64_t) direction << 26 | 0xFF0000);
+
+	for (size_t i = 0; i < 16; i++)
+		key[i] = kc[i % 8];
+	cipher_kasumi_setup(&keys, key);
+
+	for (size_t i = 0; i < size; i++) {
+		if (i % 8 == 0)
+			block = cipher_kasumi_encrypt(&keys, a ^ (i / 8) ^ block);
+		output[i] = block >> (56 - (i % 8) * 8);
+	}
+}
+
+static void test_gea3(void) {
+	cipher_kgcore_t kgcore = { .valid = false };
+	uint8_t expected[1600];
+	uint8_t actual[1600];
+
+	for (size_t iteration = 0; iteration < 64; iteration++) {
+		size_t size = g_test_rand_int_range(1, sizeof(actual));
+		uint32_t input = g_test_rand_int();
+		bool direction = iteration & 1;
+		uint8_t kc[8];
+
+		// Every fourth frame changes Kc, the others reuse the cached schedules
+		for (size_t i = 0; i < sizeof(kc); i++)
+			kc[i] = iteration / 4 * 8 + i;
+
+		test_gea3_reference(kc, input, direction, expected, size);
+		pmb887x_gea3_keystream(&kgcore, kc, input, direction, actual, size);
+		g_assert_cmpmem(actual, size, expected, size);
+	}
+}
+
+static void test_gea3_vectors(void) {
+	/*
+	 * TS 55.218 (implementors' test data) GEA3 test sets 1 and 2, direction 0.
+	 * Only the leading keystream bytes are listed, they are enough to pin down KGCORE.
+	 * */
+	static const struct {
+		uint8_t kc[8];
+		uint32_t input;
+		bool direction;
+		size_t size;
+		uint8_t output[45];
+	} vectors[] = {
+		{
+			.kc = { 0x2B, 0xD6, 0x45, 0x9F, 0x82, 0xC5, 0xBC, 0x00 },
+			.input = 0x8E9421A3,
+			.direction = false,
+			.size = 20,
+			.output = {
+				0x5F, 0x35, 0x97, 0x09, 0xDE, 0x95, 0x0D, 0x01, 0x05, 0xB1, 0x7B, 0x6C, 0x90, 0x19, 0x42, 0x80,
+				0xF8, 0x80, 0xB4, 0x8D,
+			},
+		},
+		{
+			.kc = { 0x95, 0x2C, 0x49, 0x10, 0x48, 0x81, 0xFF, 0x48 },
+			.input = 0x5064DB71,
+			.direction = false,
+			.size = 45,
+			.output = {
+				0xFD, 0xC0, 0x3D, 0x73, 0x8C, 0x8E, 0x14, 0xFF, 0x03, 0x20, 0xE5, 0x9A, 0xAF, 0x75, 0x76, 0x07,
+				0x99, 0xE9, 0xDA, 0x78, 0xDD, 0x8F, 0x88, 0x84, 0x71, 0xC4, 0xAE, 0xAA, 0xC1, 0x84, 0x96, 0x33,
+				0xA2, 0x6C, 0xD8, 0x4F, 0x45, 0x9D, 0x26, 0x5B, 0x83, 0xD7, 0xD9, 0xB9, 0xA0,
+			},
+		},
+	};
+
+	for (size_t i = 0; i < ARRAY_SIZE(vectors); i++) {
+		cipher_kgcore_t kgcore = { .valid = false };
+		uint8_t actual[45];
+
+		pmb887x_gea3_keystream(&kgcore, vectors[i].kc, vectors[i].input, vectors[i].direction, actual, vectors[i].size);
+		g_assert_cmpmem(actual, vectors[i].size, vectors[i].output, vectors[i].size);
+
+		test_gea3_reference(vectors[i].kc, vectors[i].input, vectors[i].direction, actual, vectors[i].size);
+		g_assert_cmpmem(actual, vectors[i].size, vectors[i].output, vectors[i].size);
+	}
+}
+
+int main(int argc, char **argv) {
+	g_test_init(&argc, &argv, NULL);
+	g_test_add_func("/pmb887x/gprs/crc24-fcs", test_crc24_fcs);
+	g_test_add_func("/pmb887x/gprs/crc24-slices", test_crc24_slices);
+	g_test_add_func("/pmb887x/gprs/gea3", test_gea3);
+	g_test_add_func("/pmb887x/gprs/gea3-vectors", test_gea3_vectors);
+	return g_test_run();
+}
@@ -0,0 +1,49 @@
+#include "qemu/osdep.h"
+
+#include "hw/arm/pmb887x/gprs_crypto.h"
+
+#define BENCH_SECONDS	1.0
+#define BENCH_FRAME		1523
+
+static void bench_crc24(void) {
+	pmb887x_crc24_t crc;
+	uint8_t frame[BENCH_FRAME];
+	uint32_t value = 0;
+	size_t frames = 0;
+
+	for (size_t i = 0; i < sizeof(frame); i++)
+		frame[i] = g_test_rand_int();
+	pmb887x_crc24_init(&crc, PMB887X_CRC24_POLYNOMIAL);
+
+	g_test_timer_start();
+	do {
+		for (size_t i = 0; i < 256; i++, frames++)
+			value ^= pmb887x_crc24_update(&crc, PMB887X_CRC24_INIT, frame, sizeof(frame));
+	} while (g_test_timer_elapsed() < BENCH_SECONDS);
+
+	double elapsed = g_test_timer_last();
+	g_test_message("crc24 slice-by-8: %8.2f MB/s (%06x)", frames * sizeof(frame) / elapsed / 1e6, value);
+}
+
+static void bench_gea3(void) {
+	static const uint8_t kc[8] = { 0x2B, 0xD6, 0x45, 0x9F, 0x82, 0xC5, 0xB3, 0x00 };
+	cipher_kgcore_t kgcore = { .valid = false };
+	uint8_t keystream[BENCH_FRAME];
+	size_t frames = 0;
+
+	g_test_timer_start();
+	do {
+		for (size_t i = 0; i < 64; i++, frames++)
+			pmb887x_gea3_keystream(&kgcore, kc, frames, false, keystream, sizeof(keystream));
+	} while (g_test_timer_elapsed() < BENCH_SECONDS);
+
+	double elapsed = g_test_timer_last();
+	g_test_message("gea3 keystream:   %8.2f MB/s", frames * sizeof(keystream) / elapsed / 1e6);
+}
+
+int main(int argc, char **argv) {
+	g_test_init(&argc, &argv, NULL);
+	g_test_add_func("/pmb887x/gprs/bench/crc24", bench_crc24);
+	g_test_add_func("/pmb887x/gprs/bench/gea3", bench_gea3);
+	return g_test_run();
+}
@@ -0,0 +1,111 @@
+#include "qemu/osdep.h"
+
+#include "hw/arm/pmb887x/ssc/lcd_common.h"
+
+#define TEST_WIDTH		48
+#define TEST_HEIGHT		40
+#define TEST_ROUNDS		64
+
+static void test_lcd_init(pmb887x_lcd_t *lcd, enum pmb887x_lcd_pixel_format_t format) {
+	const pmb887x_lcd_format_t *info = pmb887x_lcd_format_get(format);
+
+	memset(lcd, 0, sizeof(*lcd));
+	lcd->width = TEST_WIDTH;
+	lcd->height = TEST_HEIGHT;
+	lcd->gram = g_new0(uint32_t, TEST_WIDTH * TEST_HEIGHT);
+	lcd->pixel_format = format;
+	lcd->bpp = info->bits_per_pixel;
+	lcd->byte_pp = info->bytes_per_pixel;
+	lcd->decode_pixel = info->decode;
+	lcd->decode_row = info->decode_row;
+	lcd->wr_state = LCD_WR_STATE_RAM;
+	lcd->dirty = (pmb887x_lcd_rect_t) { .x1 = TEST_WIDTH - 1, .y1 = TEST_HEIGHT - 1, .x2 = 0, .y2 = 0 };
+}
+
+static void test_lcd_randomize(pmb887x_lcd_t *lcd) {
+	int x1 = g_test_rand_int_range(0, TEST_WIDTH);
+	int y1 = g_test_rand_int_range(0, TEST_HEIGHT);
+
+	lcd->window = (pmb887x_lcd_rect_t) {
+		.x1 = x1,
+		.y1 = y1,
+		.x2 = g_test_rand_int_range(x1, TEST_WIDTH),
+		.y2 = g_test_rand_int_range(y1, TEST_HEIGHT),
+	};
+	lcd->buffer_x = g_test_rand_int_range(lcd->window.x1, lcd->window.x2 + 1);
+	lcd->buffer_y = g_test_rand_int_range(lcd->window.y1, lcd->window.y2 + 1);
+	// Mostly the burst friendly mode, the other ones must fall back to the byte path
+	lcd->am = g_test_rand_int_range(0, 4) ? LCD_AM_HORIZONTAL : LCD_AM_VERTICAL;
+	lcd->ac_x = g_test_rand_int_range(0, 4) ? LCD_AC_INC : LCD_AC_DEC;
+	lcd->ac_y = g_test_rand_bit() ? LCD_AC_INC : LCD_AC_DEC;
+}
+
+static void test_lcd_assert_equal(const pmb887x_lcd_t *serial, const pmb887x_lcd_t *burst) {
+	g_assert_cmpmem(serial->gram, TEST_WIDTH * TEST_HEIGHT * sizeof(uint32_t),
+		burst->gram, TEST_WIDTH * TEST_HEIGHT * sizeof(uint32_t));
+	g_assert_cmpint(serial->buffer_x, ==, burst->buffer_x);
+	g_assert_cmpint(serial->buffer_y, ==, burst->buffer_y);
+	g_assert_cmpuint(serial->tmp_index, ==, burst->tmp_index);
+	g_assert_cmphex(serial->tmp_pixel, ==, burst->tmp_pixel);
+	g_assert_cmpmem(&serial->dirty, sizeof(serial->dirty), &burst->dirty, sizeof(burst->dirty));
+}
+
+static void test_burst_matches_serial(gconstpointer opaque) {
+	enum pmb887x_lcd_pixel_format_t format = GPOINTER_TO_INT(opaque);
+	pmb887x_lcd_t *serial = g_new(pmb887x_lcd_t, 1);
+	pmb887x_lcd_t *burst = g_new(pmb887x_lcd_t, 1);
+	uint8_t data[TEST_WIDTH * TEST_HEIGHT * 3 + 7];
+
+	test_lcd_init(serial, format);
+	test_lcd_init(burst, format);
+
+	for (size_t round = 0; round < TEST_ROUNDS; round++) {
+		test_lcd_randomize(serial);
+		burst->window = serial->window;
+		burst->buffer_x = serial->buffer_x;
+		burst->buffer_y = serial->buffer_y;
+		burst->am = serial->am;
+		burst->ac_x = serial->ac_x;
+		burst->ac_y = serial->ac_y;
+
+		// Odd sizes and split bursts leave partial pixels between calls
+		size_t size = g_test_rand_int_range(1, sizeof(data) + 1);
+		for (size_t i = 0; i < size; i++)
+			data[i] = g_test_rand_int();
+
+		for (size_t i = 0; i < size; i++)
+			pmb887x_lcd_write_ram_byte(serial, data[i]);
+		for (size_t offset = 0; offset < size; ) {
+			size_t chunk = MIN(size - offset, (size_t) g_test_rand_int_range(1, PMB887X_LCD_BURST_SIZE + 1));
+			pmb887x_lcd_write_ram(burst, &data[offset], chunk);
+			offset += chunk;
+		}
+
+		test_lcd_assert_equal(serial, burst);
+	}
+
+	g_free(serial->gram);
+	g_free(burst->gram);
+	g_free(serial);
+	g_free(burst);
+}
+
+int main(int argc, char **argv) {
+	static const struct {
+		const char *name;
+		enum pmb887x_lcd_pixel_format_t format;
+	} formats[] = {
+		{ "rgb565", LCD_PIXEL_FORMAT_RGB565 },
+		{ "rgb666-8-8-2", LCD_PIXEL_FORMAT_RGB666_8_8_2 },
+		{ "rgb666-2-8-8", LCD_PIXEL_FORMAT_RGB666_2_8_8 },
+		{ "rgb666-6-6-6", LCD_PIXEL_FORMAT_RGB666_6_6_6 },
+		{ "rgb888", LCD_PIXEL_FORMAT_RGB888 },
+	};
+
+	g_test_init(&argc, &argv, NULL);
+	for (size_t i = 0; i < ARRAY_SIZE(formats); i++) {
+		g_autofree char *path = g_strdup_printf("/pmb887x/lcd/burst-matches-serial/%s", formats[i].name);
+		g_test_add_data_func(path, GINT_TO_POINTER(formats[i].format), test_burst_matches_serial);
+	}
+	return g_test_run();
+}
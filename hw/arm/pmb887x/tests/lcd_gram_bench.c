@@ -0,0 +1,65 @@
+#include "qemu/osdep.h"
+
+#include "hw/arm/pmb887x/ssc/lcd_common.h"
+
+#define BENCH_SECONDS	1.0
+#define BENCH_WIDTH		240
+#define BENCH_HEIGHT	320
+
+static void bench_lcd_init(pmb887x_lcd_t *lcd) {
+	const pmb887x_lcd_format_t *info = pmb887x_lcd_format_get(LCD_PIXEL_FORMAT_RGB565);
+
+	memset(lcd, 0, sizeof(*lcd));
+	lcd->width = BENCH_WIDTH;
+	lcd->height = BENCH_HEIGHT;
+	lcd->gram = g_new0(uint32_t, BENCH_WIDTH * BENCH_HEIGHT);
+	lcd->byte_pp = info->bytes_per_pixel;
+	lcd->decode_pixel = info->decode;
+	lcd->decode_row = info->decode_row;
+	lcd->wr_state = LCD_WR_STATE_RAM;
+	lcd->window = (pmb887x_lcd_rect_t) { .x1 = 0, .y1 = 0, .x2 = BENCH_WIDTH - 1, .y2 = BENCH_HEIGHT - 1 };
+	lcd->am = LCD_AM_HORIZONTAL;
+	lcd->ac_x = LCD_AC_INC;
+	lcd->ac_y = LCD_AC_INC;
+}
+
+static void bench_frame(bool burst) {
+	pmb887x_lcd_t *lcd = g_new(pmb887x_lcd_t, 1);
+	size_t size = BENCH_WIDTH * BENCH_HEIGHT * 2;
+	g_autofree uint8_t *frame = g_malloc(size);
+	size_t frames = 0;
+
+	bench_lcd_init(lcd);
+	for (size_t i = 0; i < size; i++)
+		frame[i] = g_test_rand_int();
+
+	g_test_timer_start();
+	do {
+		if (burst) {
+			// Same chunking as the DIF burst buffer
+			for (size_t offset = 0; offset < size; offset += PMB887X_LCD_BURST_SIZE)
+				pmb887x_lcd_write_ram(lcd, &frame[offset], MIN(size - offset, PMB887X_LCD_BURST_SIZE));
+		} else {
+			for (size_t i = 0; i < size; i++)
+				pmb887x_lcd_write_ram_byte(lcd, frame[i]);
+		}
+		frames++;
+	} while (g_test_timer_elapsed() < BENCH_SECONDS);
+
+	double elapsed = g_test_timer_last();
+	g_test_message("%ux%u rgb565, %-6s path: %8.1f frames/s", BENCH_WIDTH, BENCH_HEIGHT,
+		burst ? "burst" : "byte", frames / elapsed);
+	g_free(lcd->gram);
+	g_free(lcd);
+}
+
+static void bench_lcd_gram(void) {
+	bench_frame(false);
+	bench_frame(true);
+}
+
+int main(int argc, char **argv) {
+	g_test_init(&argc, &argv, NULL);
+	g_test_add_func("/pmb887x/lcd/bench/gram", bench_lcd_gram);
+	return g_test_run();
+}
@@ -0,0 +1,271 @@
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qapi/error.h"
+
+#include "hw/arm/pmb887x/sim/sim_fs.h"
+
+#define TEST_IMAGE_HEADER_SIZE		16
+#define TEST_ENTRY_HEADER_SIZE		8
+#define TEST_FILE_HEADER_SIZE		8
+#define TEST_TAG_FILE				0x0001
+
+#define TEST_DF_GSM		0x7F20
+#define TEST_DF_TELECOM	0x7F10
+#define TEST_EF_IMSI	0x6F07
+#define TEST_EF_ADN		0x6F3A
+
+static const uint8_t test_imsi[] = { 0x08, 0x29, 0x05, 0x01, 0x10, 0x32, 0x54, 0x76, 0x98 };
+
+static const pmb887x_sim_fs_file_definition_t test_files[] = {
+	{ .id = PMB887X_SIM_FS_MF_ID, .type = PMB887X_SIM_FS_MF },
+	{ .id = TEST_DF_GSM, .parent_id = PMB887X_SIM_FS_MF_ID, .type = PMB887X_SIM_FS_DF },
+	{ .id = TEST_DF_TELECOM, .parent_id = PMB887X_SIM_FS_MF_ID, .type = PMB887X_SIM_FS_DF },
+	{
+		.id = TEST_EF_IMSI, .parent_id = TEST_DF_GSM, .type = PMB887X_SIM_FS_EF_TRANSPARENT,
+		.initial_data = test_imsi, .size = sizeof(test_imsi),
+	},
+	{
+		.id = TEST_EF_ADN, .parent_id = TEST_DF_TELECOM, .type = PMB887X_SIM_FS_EF_LINEAR_FIXED,
+		.size = 4 * 16, .fill = 0xFF, .record_size = 16,
+	},
+};
+
+typedef struct test_image_t {
+	char *dir;
+	char *filename;
+} test_image_t;
+
+static void test_image_init(test_image_t *image) {
+	image->dir = g_dir_make_tmp("pmb887x-sim-fs-XXXXXX", NULL);
+	g_assert_nonnull(image->dir);
+	image->filename = g_build_filename(image->dir, "sim.img", NULL);
+}
+
+static void test_image_cleanup(test_image_t *image) {
+	unlink(image->filename);
+	rmdir(image->dir);
+	g_free(image->filename);
+	g_free(image->dir);
+}
+
+static GByteArray *test_image_new(uint32_t version, uint32_t entries_count) {
+	GByteArray *data = g_byte_array_new();
+	uint8_t header[TEST_IMAGE_HEADER_SIZE];
+	memcpy(header, "PMBSIMFS", 8);
+	stl_le_p(header + 8, version);
+	stl_le_p(header + 12, entries_count);
+	g_byte_array_append(data, header, sizeof(header));
+	return data;
+}
+
+static void test_image_add_entry(GByteArray *data, uint16_t tag, const uint8_t *value, uint32_t length) {
+	uint8_t header[TEST_ENTRY_HEADER_SIZE];
+	stw_le_p(header, tag);
+	stw_le_p(header + 2, 0);
+	stl_le_p(header + 4, length);
+	g_byte_array_append(data, header, sizeof(header));
+	g_byte_array_append(data, value, length);
+}
+
+static void test_image_add_file(GByteArray *data, uint16_t id, uint16_t parent_id, uint8_t type, uint8_t record_size,
+	uint16_t size) {
+	g_autofree uint8_t *value = g_malloc0(TEST_FILE_HEADER_SIZE + size);
+	stw_le_p(value, id);
+	stw_le_p(value + 2, parent_id);
+	value[4] = type;
+	value[5] = record_size;
+	stw_le_p(value + 6, size);
+	test_image_add_entry(data, TEST_TAG_FILE, value, TEST_FILE_HEADER_SIZE + size);
+}
+
+static void test_image_write(test_image_t *image, GByteArray *data) {
+	g_assert_true(g_file_set_contents(image->filename, (const char *) data->data, data->len, NULL));
+	g_byte_array_free(data, true);
+}
+
+static void test_select(pmb887x_sim_fs_t *fs, uint16_t id) {
+	uint8_t response_size;
+	g_assert_true(pmb887x_sim_fs_select(fs, id, &response_size));
+}
+
+static void test_open_image(void) {
+	pmb887x_sim_fs_t fs = {};
+	pmb887x_apdu_response_t response;
+	uint8_t response_size;
+	test_image_t image;
+
+	test_image_init(&image);
+	g_assert_true(pmb887x_sim_fs_init_image(&fs, image.filename, test_files, ARRAY_SIZE(test_files), &error_abort));
+	g_assert_cmpuint(fs.files_count, ==, ARRAY_SIZE(test_files));
+	g_assert_cmpuint(g_hash_table_size(fs.index), ==, ARRAY_SIZE(test_files));
+
+	// Child counts are precomputed when the index is built
+	g_assert_cmpuint(fs.current_directory->definition->id, ==, PMB887X_SIM_FS_MF_ID);
+	g_assert_cmpuint(fs.current_directory->child_df_count, ==, 2);
+	g_assert_cmpuint(fs.current_directory->child_ef_count, ==, 0);
+
+	// EF is only visible from its own DF, a DF is always reachable through the MF
+	g_assert_false(pmb887x_sim_fs_select(&fs, TEST_EF_IMSI, &response_size));
+	test_select(&fs, TEST_DF_TELECOM);
+	g_assert_false(pmb887x_sim_fs_select(&fs, TEST_EF_IMSI, &response_size));
+	test_select(&fs, TEST_DF_GSM);
+	g_assert_cmpuint(fs.current_directory->child_ef_count, ==, 1);
+	test_select(&fs, TEST_EF_IMSI);
+
+	pmb887x_sim_fs_read_binary(&fs, 0, sizeof(test_imsi), &response);
+	g_assert_cmphex(response.sw1, ==, 0x90);
+	g_assert_cmpmem(response.data, response.size, test_imsi, sizeof(test_imsi));
+
+	static const uint8_t update[] = { 0x12, 0x34 };
+	pmb887x_sim_fs_update_binary(&fs, 3, update, sizeof(update), &response);
+	g_assert_cmphex(response.sw1, ==, 0x90);
+
+	test_select(&fs, TEST_DF_TELECOM);
+	test_select(&fs, TEST_EF_ADN);
+	uint8_t record[16];
+	memset(record, 0x5A, sizeof(record));
+	pmb887x_sim_fs_update_record(&fs, 4, PMB887X_SIM_FS_RECORD_ABSOLUTE, record, sizeof(record), &response);
+	g_assert_cmphex(response.sw1, ==, 0x90);
+	pmb887x_sim_fs_destroy(&fs);
+
+	// Updates went to the image, the definitions only seed a new one
+	g_assert_true(pmb887x_sim_fs_init_image(&fs, image.filename, test_files, ARRAY_SIZE(test_files), &error_abort));
+	test_select(&fs, TEST_DF_GSM);
+	test_select(&fs, TEST_EF_IMSI);
+	pmb887x_sim_fs_read_binary(&fs, 3, sizeof(update), &response);
+	g_assert_cmpmem(response.data, response.size, update, sizeof(update));
+
+	test_select(&fs, TEST_DF_TELECOM);
+	test_select(&fs, TEST_EF_ADN);
+	pmb887x_sim_fs_read_record(&fs, 3, PMB887X_SIM_FS_RECORD_ABSOLUTE, sizeof(record), &response);
+	g_assert_cmphex(response.data[0], ==, 0xFF);
+	pmb887x_sim_fs_read_record(&fs, 0, PMB887X_SIM_FS_RECORD_NEXT, sizeof(record), &response);
+	g_assert_cmpmem(response.data, response.size, record, sizeof(record));
+	pmb887x_sim_fs_destroy(&fs);
+
+	test_image_cleanup(&image);
+}
+
+static void test_unknown_tag(void) {
+	pmb887x_sim_fs_t fs = {};
+	test_image_t image;
+	static const uint8_t padding[5] = { 1, 2, 3, 4, 5 };
+
+	test_image_init(&image);
+	GByteArray *data = test_image_new(1, 3);
+	test_image_add_entry(data, 0x7777, padding, sizeof(padding));
+	test_image_add_file(data, PMB887X_SIM_FS_MF_ID, 0, PMB887X_SIM_FS_MF, 0, 0);
+	test_image_add_file(data, TEST_EF_IMSI, PMB887X_SIM_FS_MF_ID, PMB887X_SIM_FS_EF_TRANSPARENT, 0, 9);
+	test_image_write(&image, data);
+
+	g_assert_true(pmb887x_sim_fs_init_image(&fs, image.filename, test_files, ARRAY_SIZE(test_files), &error_abort));
+	g_assert_cmpuint(fs.files_count, ==, 2);
+	test_select(&fs, TEST_EF_IMSI);
+	pmb887x_sim_fs_destroy(&fs);
+
+	test_image_cleanup(&image);
+}
+
+typedef struct test_invalid_image_t {
+	const char *name;
+	const char *error;
+	GByteArray *(*build)(void);
+} test_invalid_image_t;
+
+static GByteArray *test_build_bad_magic(void) {
+	GByteArray *data = test_image_new(1, 0);
+	data->data[0] = 'X';
+	return data;
+}
+
+static GByteArray *test_build_bad_version(void) {
+	return test_image_new(2, 0);
+}
+
+static GByteArray *test_build_too_many_entries(void) {
+	return test_image_new(1, 1000);
+}
+
+static GByteArray *test_build_truncated_value(void) {
+	GByteArray *data = test_image_new(1, 1);
+	test_image_add_file(data, PMB887X_SIM_FS_MF_ID, 0, PMB887X_SIM_FS_MF, 0, 0);
+	g_byte_array_set_size(data, data->len - 1);
+	return data;
+}
+
+static GByteArray *test_build_size_mismatch(void) {
+	GByteArray *data = test_image_new(1, 1);
+	test_image_add_file(data, PMB887X_SIM_FS_MF_ID, 0, PMB887X_SIM_FS_MF, 0, 4);
+	stw_le_p(data->data + TEST_IMAGE_HEADER_SIZE + TEST_ENTRY_HEADER_SIZE + 6, 3);
+	return data;
+}
+
+static GByteArray *test_build_bad_type(void) {
+	GByteArray *data = test_image_new(1, 1);
+	test_image_add_file(data, PMB887X_SIM_FS_MF_ID, 0, PMB887X_SIM_FS_EF_CYCLIC + 1, 0, 0);
+	return data;
+}
+
+static GByteArray *test_build_bad_record_size(void) {
+	GByteArray *data = test_image_new(1, 2);
+	test_image_add_file(data, PMB887X_SIM_FS_MF_ID, 0, PMB887X_SIM_FS_MF, 0, 0);
+	test_image_add_file(data, TEST_EF_ADN, PMB887X_SIM_FS_MF_ID, PMB887X_SIM_FS_EF_LINEAR_FIXED, 16, 40);
+	return data;
+}
+
+static GByteArray *test_build_duplicate(void) {
+	GByteArray *data = test_image_new(1, 3);
+	test_image_add_file(data, PMB887X_SIM_FS_MF_ID, 0, PMB887X_SIM_FS_MF, 0, 0);
+	test_image_add_file(data, TEST_EF_IMSI, PMB887X_SIM_FS_MF_ID, PMB887X_SIM_FS_EF_TRANSPARENT, 0, 9);
+	test_image_add_file(data, TEST_EF_IMSI, PMB887X_SIM_FS_MF_ID, PMB887X_SIM_FS_EF_TRANSPARENT, 0, 9);
+	return data;
+}
+
+static GByteArray *test_build_no_mf(void) {
+	GByteArray *data = test_image_new(1, 1);
+	test_image_add_file(data, TEST_DF_GSM, PMB887X_SIM_FS_MF_ID, PMB887X_SIM_FS_DF, 0, 0);
+	return data;
+}
+
+static const test_invalid_image_t test_invalid_images[] = {
+	{ "bad-magic", "is not a SIM filesystem image", test_build_bad_magic },
+	{ "bad-version", "unsupported version 2", test_build_bad_version },
+	{ "too-many-entries", "is truncated", test_build_too_many_entries },
+	{ "truncated-value", "is truncated", test_build_truncated_value },
+	{ "size-mismatch", "invalid entry #0", test_build_size_mismatch },
+	{ "bad-type", "invalid entry #0", test_build_bad_type },
+	{ "bad-record-size", "invalid entry #1", test_build_bad_record_size },
+	{ "duplicate", "duplicate file 6F07 in 3F00", test_build_duplicate },
+	{ "no-mf", "no MF", test_build_no_mf },
+};
+
+static void test_invalid_image(gconstpointer opaque) {
+	const test_invalid_image_t *test = opaque;
+	pmb887x_sim_fs_t fs = {};
+	Error *error = NULL;
+	test_image_t image;
+
+	test_image_init(&image);
+	test_image_write(&image, test->build());
+	g_assert_false(pmb887x_sim_fs_init_image(&fs, image.filename, test_files, ARRAY_SIZE(test_files), &error));
+	g_assert_nonnull(error);
+	g_assert_nonnull(strstr(error_get_pretty(error), test->error));
+	error_free(error);
+
+	// Nothing is left behind for the caller to clean up
+	g_assert_null(fs.image);
+	g_assert_null(fs.files);
+	g_assert_null(fs.index);
+	test_image_cleanup(&image);
+}
+
+int main(int argc, char **argv) {
+	g_test_init(&argc, &argv, NULL);
+	g_test_add_func("/pmb887x/sim-fs/open-image", test_open_image);
+	g_test_add_func("/pmb887x/sim-fs/unknown-tag", test_unknown_tag);
+	for (size_t i = 0; i < ARRAY_SIZE(test_invalid_images); i++) {
+		g_autofree char *path = g_strdup_printf("/pmb887x/sim-fs/invalid-image/%s", test_invalid_images[i].name);
+		g_test_add_data_func(path, &test_invalid_images[i], test_invalid_image);
+	}
+	return g_test_run();
+}
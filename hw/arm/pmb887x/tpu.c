@@ -21,6 +21,8 @@
 #include "hw/arm/pmb887x/dsp/signals.h"
 #include "hw/arm/pmb887x/gen/cpu_regs.h"
 #include "hw/arm/pmb887x/regs_dump.h"
+#include "hw/arm/pmb887x/idle.h"
+#include "hw/arm/pmb887x/scheduler.h"
 #include "hw/arm/pmb887x/mod.h"
 #include "hw/arm/pmb887x/trace.h"
 
@@ -112,10 +114,11 @@ struct pmb887x_tpu_t {
 	uint32_t fade;
 
 	uint32_t irq_fired;
-	QEMUTimer *timer;
+	pmb887x_sched_event_t timer;
 	
 	bool enabled;
 	uint32_t freq;
+	pmb887x_sched_clock_t clock;
 	uint32_t counter;
 	int64_t start;
 	int64_t next;
@@ -139,16 +142,14 @@ struct pmb887x_tpu_t {
 static uint64_t tpu_get_counter(pmb887x_tpu_t *p) {
 	uint64_t counter = p->counter;
 
-	if (p->enabled) {
-		int64_t delta_ns = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) - p->start;
-		counter += muldiv64(delta_ns, p->freq, NANOSECONDS_PER_SECOND);
-	}
+	if (p->enabled)
+		counter += pmb887x_sched_clock_elapsed(&p->clock, p->start);
 
 	return counter;
 }
 
 static int64_t tpu_ticks_to_ns(pmb887x_tpu_t *p, uint64_t ticks) {
-	return (int64_t) muldiv64_round_up(ticks, NANOSECONDS_PER_SECOND, p->freq);
+	return pmb887x_sched_clock_ticks_to_ns_round_up(&p->clock, ticks);
 }
 
 static int64_t tpu_run_irq(pmb887x_tpu_t *p, int64_t counter, uint64_t now, int64_t next) {
@@ -366,7 +367,7 @@ static void tpu_finish_frame(pmb887x_tpu_t *p) {
 
 static void tpu_update_timer(pmb887x_tpu_t *p) {
 	if (!p->enabled) {
-		timer_del(p->timer);
+		pmb887x_sched_event_del(&p->timer);
 		return;
 	}
 
@@ -381,7 +382,7 @@ static void tpu_update_timer(pmb887x_tpu_t *p) {
 	p->next = p->start + tpu_ticks_to_ns(p, p->frame_ticks - p->counter);
 	p->next = tpu_run_irq(p, p->counter, p->start, p->next);
 	p->next = tpu_run_events(p, p->counter, p->start, p->next);
-	timer_mod(p->timer, p->next);
+	pmb887x_sched_event_mod(&p->timer, p->next);
 }
 
 static void tpu_timer_callback(void *opaque) {
@@ -445,6 +446,7 @@ static void tpu_update_state(pmb887x_tpu_t *p) {
 	if (p->freq != new_freq || p->enabled != enabled) {
 		p->freq = new_freq;
 		p->enabled = enabled;
+		pmb887x_sched_clock_set_freq(&p->clock, new_freq);
 		clock_update_hz(p->gsm_clock, p->freq);
 		DPRINTF("fsys=%d, ftpu=%d, fcounter=%d [%s]\n", pmb887x_pll_get_fsys(p->pll), ftpu, p->freq, p->enabled ? "ON" : "OFF");
 	}
@@ -459,7 +461,7 @@ static void tpu_update_state(pmb887x_tpu_t *p) {
 		tpu_begin_event_frame(p);
 		p->timing_advance = 0;
 		p->triggers = 0;
-		p->start = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+		p->start = pmb887x_sched_now();
 		if (p->offset_pending)
 			tpu_apply_offset(p);
 		p->offset_pending = false;
@@ -600,6 +602,7 @@ static uint64_t tpu_io_read(void *opaque, hwaddr haddr, unsigned size) {
 			break;
 		
 		case TPU_COUNTER:
+			pmb887x_idle_poll(haddr + p->mmio.addr);
 			value = tpu_get_counter(p);
 			break;
 
@@ -832,7 +835,7 @@ static void tpu_realize(DeviceState *dev, Error **errp) {
 		pmb887x_src_init(&p->gp_src[i], p->gp_irq[i]);
 	}
 	
-	p->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, tpu_timer_callback, p);
+	pmb887x_sched_event_init(&p->timer, tpu_timer_callback, p);
 	p->enabled = false;
 	
 	tpu_update_state(p);
@@ -842,7 +845,7 @@ static void tpu_realize(DeviceState *dev, Error **errp) {
 static void tpu_reset(DeviceState *dev) {
 	pmb887x_tpu_t *p = PMB887X_TPU(dev);
 
-	timer_del(p->timer);
+	pmb887x_sched_event_del(&p->timer);
 
 	pmb887x_clc_set(&p->clc, MOD_CLC_DISR);
 
@@ -879,6 +882,7 @@ static void tpu_reset(DeviceState *dev) {
 
 	p->enabled = false;
 	p->freq = 0;
+	pmb887x_sched_clock_set_freq(&p->clock, 0);
 	clock_update_hz(p->gsm_clock, 0);
 	p->counter = 0;
 	p->start = 0;
@@ -6,6 +6,7 @@
 #include "qemu/error-report.h"
 #include "hw/arm/pmb887x/regs_dump.h"
 #include "hw/arm/pmb887x/trace_common.h"
+#include "hw/arm/pmb887x/idle.h"
 
 #ifndef PMB887X_TRACE_ID
 #error "PMB887X_TRACE_ID not defined!"
@@ -37,11 +38,13 @@
 	} while (0)
 
 #define IO_DUMP_READ(...) do { \
+		qatomic_inc(&pmb887x_io_sequence); \
 		if (pmb887x_trace_io_enabled(PMB887X_MOD_CONST_NAME(PMB887X_TRACE_ID))) \
 			pmb887x_dump_io_read(PMB887X_TRACE_IO, __VA_ARGS__); \
 	} while (0)
 
 #define IO_DUMP_WRITE(...) do { \
+		qatomic_inc(&pmb887x_io_sequence); \
 		if (pmb887x_trace_io_enabled(PMB887X_MOD_CONST_NAME(PMB887X_TRACE_ID))) \
 			pmb887x_dump_io_write(PMB887X_TRACE_IO, __VA_ARGS__); \
 	} while (0)
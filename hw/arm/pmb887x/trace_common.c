@@ -61,6 +61,8 @@ static const pmb887x_debug_channel_t debug_channels[] = {
 	{ "gprscu",	PMB887X_TRACE_GPRSCU },
 	{ "usb",		PMB887X_TRACE_USB },
 	{ "mmicif",	PMB887X_TRACE_MMICIF },
+	{ "idle",		PMB887X_TRACE_IDLE },
+	{ "sched",		PMB887X_TRACE_SCHED },
 
 	// peripherals
 	{ "sim-card",	PMB887X_TRACE_SIM_CARD },
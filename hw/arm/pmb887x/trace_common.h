@@ -57,6 +57,10 @@ enum pmb887x_modules_t {
 		PMB887X_TRACE_DSP_MODULATOR | PMB887X_TRACE_DSP_SSC | PMB887X_TRACE_DSP_I2S |
 		PMB887X_TRACE_DSP_I2S_TX | PMB887X_TRACE_DSP_UNKNOWN,
 
+	// Emulator
+	PMB887X_TRACE_IDLE		= 1ULL << 44,
+	PMB887X_TRACE_SCHED		= 1ULL << 45,
+
 	// External
 	PMB887X_TRACE_SIM_CARD	= 1ULL << 56,
 	PMB887X_TRACE_ACODEC	= 1ULL << 57,
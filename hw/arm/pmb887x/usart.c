@@ -28,6 +28,9 @@
 #define USART_SEND_FULL_FIFO	1
 #define USART_IMMEDIATE_TRANSFER	1
 #define USART_FIFO_SIZE			8
+#define USART_TURBO_BUFFER_SIZE	4096
+#define USART_TURBO_BATCH		32
+#define USART_TURBO_MIN_DELAY_NS	10000
 
 enum {
 	USART_IRQ_TX,
@@ -79,6 +82,14 @@ struct pmb887x_usart_t {
 	int ris_read_count;
 #endif
 
+	// Turbo mode: the char backend gets whole batches, the guest timing is kept with a virtual time budget
+	bool turbo;
+	QEMUTimer *turbo_timer;
+	uint8_t turbo_tx[USART_TURBO_BUFFER_SIZE];
+	uint32_t turbo_tx_size;
+	int64_t turbo_tx_time;
+	pmb887x_fifo8_t turbo_rx;
+
 	uint32_t pisel;
 	uint32_t con;
 	uint32_t bg;
@@ -110,6 +121,9 @@ struct pmb887x_usart_t {
 
 static void usart_update_state(pmb887x_usart_t *p);
 static void usart_transmit_fifo(pmb887x_usart_t *p);
+static void usart_turbo_flush(pmb887x_usart_t *p);
+static void usart_turbo_transmit(pmb887x_usart_t *p);
+static void usart_turbo_reset(pmb887x_usart_t *p);
 
 static uint32_t usart_get_baud_rate(pmb887x_usart_t *p) {
 	uint32_t rmc = pmb887x_clc_get_rmc(&p->clc);
@@ -277,6 +291,7 @@ static void usart_update_state(pmb887x_usart_t *p) {
 		pmb887x_fifo_reset(p->tx_fifo);
 		pmb887x_fifo_reset(p->rx_fifo);
 		timer_del(p->tmo_timer);
+		usart_turbo_reset(p);
 
 		if (p->transfer_pending) {
 			timer_del(p->timer);
@@ -322,6 +337,8 @@ static int usart_can_receive(void *opaque) {
 	pmb887x_usart_t *p = opaque;
 	if (!pmb887x_clc_is_enabled(&p->clc))
 		return 0;
+	if (p->turbo)
+		return pmb887x_fifo_free_count(&p->turbo_rx);
 	return pmb887x_fifo_free_count(p->rx_fifo);
 }
 
@@ -350,9 +367,103 @@ static void usart_receive_complete(pmb887x_usart_t *p) {
 	usart_handle_dma(p);
 }
 
+/*
+ * Turbo mode
+ * */
+static void usart_turbo_receive(pmb887x_usart_t *p) {
+	uint32_t count = MIN(pmb887x_fifo_count(&p->turbo_rx), pmb887x_fifo_free_count(p->rx_fifo));
+	for (uint32_t i = 0; i < count; i++)
+		usart_receive_word(p, pmb887x_fifo8_pop(&p->turbo_rx));
+
+	if (count > 0)
+		usart_receive_complete(p);
+}
+
+static gboolean usart_turbo_transmit_delayed(void *do_not_use, GIOCondition cond, void *opaque) {
+	pmb887x_usart_t *p = opaque;
+	p->watch_tag = 0;
+	usart_turbo_flush(p);
+	usart_turbo_transmit(p);
+	return false;
+}
+
+static void usart_turbo_flush(pmb887x_usart_t *p) {
+	if (p->watch_tag || !p->turbo_tx_size)
+		return;
+
+	int ret = qemu_chr_fe_write(&p->chr, p->turbo_tx, p->turbo_tx_size);
+	uint32_t transmitted = MAX(0, ret);
+
+	// Transmission incomplete, continue when char backend available again
+	if (transmitted < p->turbo_tx_size) {
+		p->watch_tag = qemu_chr_fe_add_watch(&p->chr, G_IO_OUT | G_IO_HUP, usart_turbo_transmit_delayed, p);
+		if (!p->watch_tag) {
+			// QEMU char backend is not connected, data is lost
+			transmitted = p->turbo_tx_size;
+		}
+	}
+
+	p->turbo_tx_size -= transmitted;
+	memmove(p->turbo_tx, p->turbo_tx + transmitted, p->turbo_tx_size);
+}
+
+static void usart_turbo_transmit(pmb887x_usart_t *p) {
+	int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+	int64_t frame_time_ns = usart_baud_ticks_to_ns(p, usart_frame_bits(p));
+	int64_t window_ns = frame_time_ns * USART_TURBO_BATCH * 2;
+	uint32_t accepted = 0;
+
+	// Take frames from the FIFO while the line is not too far ahead of the virtual time
+	p->turbo_tx_time = MAX(p->turbo_tx_time, now);
+	while (!pmb887x_fifo_is_empty(p->tx_fifo) && p->turbo_tx_size < USART_TURBO_BUFFER_SIZE) {
+		if (p->turbo_tx_time - now > window_ns)
+			break;
+		p->turbo_tx[p->turbo_tx_size++] = pmb887x_fifo16_pop(p->tx_fifo);
+		p->turbo_tx_time += frame_time_ns;
+		accepted++;
+	}
+
+	/*
+	 * Next batch when the budget is half spent, or after the first frame for a short burst.
+	 * A blocked backend resumes from its watch, polling it from the timer would only spin.
+	 * */
+	bool has_pending = p->turbo_tx_size > 0 || !pmb887x_fifo_is_empty(p->tx_fifo);
+	if (has_pending && !p->watch_tag && !timer_pending(p->turbo_timer)) {
+		int64_t delay = MAX(frame_time_ns, p->turbo_tx_time - now - window_ns / 2);
+		timer_mod(p->turbo_timer, now + MAX(delay, USART_TURBO_MIN_DELAY_NS));
+	}
+
+	if (accepted > 0) {
+		if (usart_tb_irq(p))
+			pmb887x_srb_set_isr(&p->srb, USART_ISR_TB);
+		if (usart_tx_irq(p))
+			pmb887x_srb_set_isr(&p->srb, USART_ISR_TX);
+		usart_handle_dma(p);
+	}
+}
+
+static void usart_turbo_timer_reset(void *opaque) {
+	pmb887x_usart_t *p = opaque;
+	usart_turbo_flush(p);
+	usart_turbo_transmit(p);
+}
+
+static void usart_turbo_reset(pmb887x_usart_t *p) {
+	timer_del(p->turbo_timer);
+	pmb887x_fifo_reset(&p->turbo_rx);
+	p->turbo_tx_size = 0;
+	p->turbo_tx_time = 0;
+}
+
 static void usart_receive(void *opaque, const uint8_t *buf, int size) {
 	pmb887x_usart_t *p = opaque;
 
+	if (p->turbo) {
+		pmb887x_fifo8_write(&p->turbo_rx, buf, size);
+		usart_turbo_receive(p);
+		return;
+	}
+
 	for (int i = 0; i < size; i++)
 		usart_receive_word(p, buf[i]);
 
@@ -500,6 +611,12 @@ static void usart_write_txb(pmb887x_usart_t *p, uint16_t value) {
 
 	pmb887x_fifo16_push(p->tx_fifo, p->txb);
 
+	// Loopback is handled by the regular path
+	if (p->turbo && (p->con & USART_CON_LB) == 0) {
+		usart_turbo_transmit(p);
+		return;
+	}
+
 	if (p->transfer_pending) {
 		if (usart_tb_irq(p))
 			pmb887x_srb_set_isr(&p->srb, USART_ISR_TB);
@@ -553,8 +670,10 @@ static uint64_t usart_io_read(void *opaque, hwaddr haddr, unsigned size) {
 
 		case USART_RXB:
 			if (!pmb887x_fifo_is_empty(p->rx_fifo)) {
-				bool is_full = pmb887x_fifo_is_full(p->rx_fifo);
+				bool is_full = p->turbo ? pmb887x_fifo_is_full(&p->turbo_rx) : pmb887x_fifo_is_full(p->rx_fifo);
 				value = pmb887x_fifo16_pop(p->rx_fifo);
+				if (p->turbo)
+					usart_turbo_receive(p);
 				if (is_full)
 					qemu_chr_fe_accept_input(&p->chr);
 				if ((p->rxfcon & USART_RXFCON_RXTMEN) && !pmb887x_fifo_is_empty(p->rx_fifo))
@@ -841,12 +960,14 @@ static void usart_realize(DeviceState *dev, Error **errp) {
 	pmb887x_fifo16_init(&p->rx_fifo_single, 1);
 
 	pmb887x_fifo16_init(&p->tx_buffer, 1);
+	pmb887x_fifo8_init(&p->turbo_rx, USART_TURBO_BUFFER_SIZE);
 
 	pmb887x_srb_init(&p->srb, p->irq, ARRAY_SIZE(p->irq));
 	pmb887x_srb_set_event_handler(&p->srb, dev, usart_event_handler);
 
 	p->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, usart_timer_reset, p);
 	p->tmo_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, usart_tmo_timer_reset, p);
+	p->turbo_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, usart_turbo_timer_reset, p);
 	p->tx_fifo = &p->tx_fifo_single;
 	p->rx_fifo = &p->rx_fifo_single;
 	usart_tx_fifo_config(p, 0);
@@ -861,6 +982,7 @@ static void usart_reset(DeviceState *dev) {
 
 	timer_del(p->timer);
 	timer_del(p->tmo_timer);
+	usart_turbo_reset(p);
 	if (p->watch_tag) {
 		g_source_remove(p->watch_tag);
 		p->watch_tag = 0;
@@ -910,6 +1032,7 @@ static void usart_reset(DeviceState *dev) {
 
 static const Property usart_properties[] = {
 	DEFINE_PROP_UINT32("revision", pmb887x_usart_t, revision, 0),
+	DEFINE_PROP_BOOL("turbo", pmb887x_usart_t, turbo, false),
 	DEFINE_PROP_LINK("pll", pmb887x_usart_t, pll, "pmb887x-pll", pmb887x_pll_t *),
     DEFINE_PROP_CHR("chardev", struct pmb887x_usart_t, chr),
 };
@@ -6,11 +6,15 @@
 
 #include "qemu/osdep.h"
 #include "hw/core/qdev-properties.h"
+#include "hw/core/qdev-properties-system.h"
 #include "hw/core/sysbus.h"
 #include "system/memory.h"
+#include "qemu/main-loop.h"
+#include "chardev/char-fe.h"
 
 #include "hw/arm/pmb887x/gen/cpu_regs.h"
 #include "hw/arm/pmb887x/mod.h"
+#include "hw/arm/pmb887x/fifo.h"
 #include "hw/arm/pmb887x/regs_dump.h"
 #include "hw/arm/pmb887x/trace.h"
 
@@ -22,8 +26,23 @@
 #define USB_ENDPOINT_COUNT 11
 #define USB_ENDPOINT_CONFIG_STRIDE (USB_EP_CONFIG1 - USB_EP_CONFIG0)
 #define USB_ENDPOINT_STRIDE (USB_EP_DATA1 - USB_EP_DATA0)
+#define USB_ENDPOINT_BUFFER_SIZE 4096
 
 typedef struct pmb887x_usb_t pmb887x_usb_t;
+typedef struct pmb887x_usb_endpoint_t pmb887x_usb_endpoint_t;
+
+/*
+ * Data port of an endpoint bridged to a host chardev as a byte stream.
+ * Host data is returned by EP_DATA reads, EP_DATA writes are collected and passed to the host in one call.
+ * Status, count and interrupt registers stay a plain register file, their semantics are not documented.
+ * */
+struct pmb887x_usb_endpoint_t {
+	CharFrontend chr;
+	guint watch_tag;
+	pmb887x_fifo8_t rx;
+	uint8_t tx[USB_ENDPOINT_BUFFER_SIZE];
+	uint32_t tx_size;
+};
 
 struct pmb887x_usb_t {
 	SysBusDevice parent_obj;
@@ -33,8 +52,13 @@ struct pmb887x_usb_t {
 	qemu_irq irq;
 	pmb887x_clc_reg_t clc;
 	uint8_t registers[USB_IO_SIZE];
+
+	QEMUBH *flush_bh;
+	pmb887x_usb_endpoint_t endpoints[USB_ENDPOINT_COUNT];
 };
 
+static void usb_endpoint_flush(pmb887x_usb_endpoint_t *ep);
+
 static uint64_t usb_register_read(pmb887x_usb_t *p, hwaddr haddr, unsigned int size) {
 	uint64_t value = 0;
 
@@ -48,6 +72,99 @@ static void usb_register_write(pmb887x_usb_t *p, hwaddr haddr, uint64_t value, u
 		p->registers[haddr + index] = (uint8_t) (value >> (index * CHAR_BIT));
 }
 
+static pmb887x_usb_endpoint_t *usb_get_bridged_endpoint(pmb887x_usb_t *p, hwaddr haddr) {
+	if (haddr < USB_EP_DATA0 || haddr > USB_EP_DATA10 || ((haddr - USB_EP_DATA0) % USB_ENDPOINT_STRIDE) != 0)
+		return NULL;
+
+	pmb887x_usb_endpoint_t *ep = &p->endpoints[(haddr - USB_EP_DATA0) / USB_ENDPOINT_STRIDE];
+	return qemu_chr_fe_backend_connected(&ep->chr) ? ep : NULL;
+}
+
+static int usb_endpoint_can_receive(void *opaque) {
+	pmb887x_usb_endpoint_t *ep = opaque;
+	return pmb887x_fifo_free_count(&ep->rx);
+}
+
+static void usb_endpoint_receive(void *opaque, const uint8_t *buf, int size) {
+	pmb887x_usb_endpoint_t *ep = opaque;
+	pmb887x_fifo8_write(&ep->rx, buf, size);
+}
+
+static uint64_t usb_endpoint_read(pmb887x_usb_endpoint_t *ep, unsigned int size) {
+	bool is_full = pmb887x_fifo_is_full(&ep->rx);
+	uint32_t count = MIN(size, pmb887x_fifo_count(&ep->rx));
+	uint64_t value = 0;
+
+	for (uint32_t index = 0; index < count; index++)
+		value |= (uint64_t) pmb887x_fifo8_pop(&ep->rx) << (index * CHAR_BIT);
+
+	if (is_full && count > 0)
+		qemu_chr_fe_accept_input(&ep->chr);
+	return value;
+}
+
+static void usb_endpoint_write(pmb887x_usb_t *p, pmb887x_usb_endpoint_t *ep, uint64_t value, unsigned int size) {
+	for (uint32_t index = 0; index < size; index++) {
+		if (ep->tx_size == USB_ENDPOINT_BUFFER_SIZE) {
+			usb_endpoint_flush(ep);
+			if (ep->tx_size == USB_ENDPOINT_BUFFER_SIZE) {
+				EPRINTF("endpoint %d: host is not reading, data is lost\n", (int) (ep - p->endpoints));
+				return;
+			}
+		}
+		ep->tx[ep->tx_size++] = (uint8_t) (value >> (index * CHAR_BIT));
+	}
+
+	// Pass everything written by the current burst in one call
+	qemu_bh_schedule(p->flush_bh);
+}
+
+static gboolean usb_endpoint_flush_delayed(void *do_not_use, GIOCondition cond, void *opaque) {
+	pmb887x_usb_endpoint_t *ep = opaque;
+	ep->watch_tag = 0;
+	usb_endpoint_flush(ep);
+	return false;
+}
+
+static void usb_endpoint_flush(pmb887x_usb_endpoint_t *ep) {
+	if (ep->watch_tag || !ep->tx_size)
+		return;
+
+	int ret = qemu_chr_fe_write(&ep->chr, ep->tx, ep->tx_size);
+	uint32_t transmitted = MAX(0, ret);
+
+	// Transmission incomplete, continue when char backend available again
+	if (transmitted < ep->tx_size) {
+		ep->watch_tag = qemu_chr_fe_add_watch(&ep->chr, G_IO_OUT | G_IO_HUP, usb_endpoint_flush_delayed, ep);
+		if (!ep->watch_tag) {
+			// QEMU char backend is not connected, data is lost
+			transmitted = ep->tx_size;
+		}
+	}
+
+	ep->tx_size -= transmitted;
+	memmove(ep->tx, ep->tx + transmitted, ep->tx_size);
+}
+
+static void usb_flush_bh(void *opaque) {
+	pmb887x_usb_t *p = opaque;
+	for (uint32_t endpoint = 0; endpoint < USB_ENDPOINT_COUNT; endpoint++)
+		usb_endpoint_flush(&p->endpoints[endpoint]);
+}
+
+static void usb_reset_endpoints(pmb887x_usb_t *p) {
+	qemu_bh_cancel(p->flush_bh);
+	for (uint32_t endpoint = 0; endpoint < USB_ENDPOINT_COUNT; endpoint++) {
+		pmb887x_usb_endpoint_t *ep = &p->endpoints[endpoint];
+		if (ep->watch_tag) {
+			g_source_remove(ep->watch_tag);
+			ep->watch_tag = 0;
+		}
+		pmb887x_fifo_reset(&ep->rx);
+		ep->tx_size = 0;
+	}
+}
+
 static void usb_reset_internal_state(pmb887x_usb_t *p) {
 	static const uint8_t endpoint_config_reset[USB_ENDPOINT_COUNT] = {
 		0x2C, 0x28, 0x20, 0x28, 0x20, 0x28, 0x20, 0x28, 0x20, 0x28, 0x20,
@@ -60,6 +177,7 @@ static void usb_reset_internal_state(pmb887x_usb_t *p) {
 	};
 
 	memset(p->registers, 0, sizeof(p->registers));
+	usb_reset_endpoints(p);
 	if (p->revision != USB_PMB8876_REVISION)
 		return;
 
@@ -80,6 +198,7 @@ static void usb_reset_input(void *opaque, int id, int level) {
 
 static uint64_t usb_io_read(void *opaque, hwaddr haddr, unsigned int size) {
 	pmb887x_usb_t *p = opaque;
+	pmb887x_usb_endpoint_t *ep;
 	uint64_t value;
 
 	switch (haddr) {
@@ -92,7 +211,8 @@ static uint64_t usb_io_read(void *opaque, hwaddr haddr, unsigned int size) {
 			break;
 
 		default:
-			value = usb_register_read(p, haddr, size);
+			ep = usb_get_bridged_endpoint(p, haddr);
+			value = ep ? usb_endpoint_read(ep, size) : usb_register_read(p, haddr, size);
 			break;
 	}
 
@@ -108,8 +228,15 @@ static void usb_io_write(void *opaque, hwaddr haddr, uint64_t value, unsigned in
 		pmb887x_clc_set(&p->clc, value);
 		return;
 	}
-	if (haddr != USB_ID)
-		usb_register_write(p, haddr, value, size);
+	if (haddr == USB_ID)
+		return;
+
+	pmb887x_usb_endpoint_t *ep = usb_get_bridged_endpoint(p, haddr);
+	if (ep) {
+		usb_endpoint_write(p, ep, value, size);
+		return;
+	}
+	usb_register_write(p, haddr, value, size);
 }
 
 static const MemoryRegionOps usb_io_ops = {
@@ -147,11 +274,30 @@ static void usb_reset(DeviceState *dev) {
 }
 
 static void usb_realize(DeviceState *dev, Error **errp) {
+	pmb887x_usb_t *p = PMB887X_USB(dev);
+
+	p->flush_bh = qemu_bh_new(usb_flush_bh, p);
+	for (uint32_t endpoint = 0; endpoint < USB_ENDPOINT_COUNT; endpoint++) {
+		pmb887x_usb_endpoint_t *ep = &p->endpoints[endpoint];
+		pmb887x_fifo8_init(&ep->rx, USB_ENDPOINT_BUFFER_SIZE);
+		qemu_chr_fe_set_handlers(&ep->chr, usb_endpoint_can_receive, usb_endpoint_receive, NULL, NULL, ep, NULL, true);
+	}
+
 	usb_reset(dev);
 }
 
 static const Property usb_properties[] = {
 	DEFINE_PROP_UINT32("revision", pmb887x_usb_t, revision, 0),
+	DEFINE_PROP_CHR("ep1", pmb887x_usb_t, endpoints[1].chr),
+	DEFINE_PROP_CHR("ep2", pmb887x_usb_t, endpoints[2].chr),
+	DEFINE_PROP_CHR("ep3", pmb887x_usb_t, endpoints[3].chr),
+	DEFINE_PROP_CHR("ep4", pmb887x_usb_t, endpoints[4].chr),
+	DEFINE_PROP_CHR("ep5", pmb887x_usb_t, endpoints[5].chr),
+	DEFINE_PROP_CHR("ep6", pmb887x_usb_t, endpoints[6].chr),
+	DEFINE_PROP_CHR("ep7", pmb887x_usb_t, endpoints[7].chr),
+	DEFINE_PROP_CHR("ep8", pmb887x_usb_t, endpoints[8].chr),
+	DEFINE_PROP_CHR("ep9", pmb887x_usb_t, endpoints[9].chr),
+	DEFINE_PROP_CHR("ep10", pmb887x_usb_t, endpoints[10].chr),
 };
 
 static void usb_class_init(ObjectClass *klass, const void *data) {
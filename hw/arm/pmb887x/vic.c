@@ -11,6 +11,7 @@
 #include "qapi/error.h"
 #include "hw/core/qdev-properties.h"
 #include "hw/core/irq.h"
+#include "qemu/bitops.h"
 
 #include "hw/arm/pmb887x/gen/cpu_regs.h"
 #include "hw/arm/pmb887x/io_bridge.h"
@@ -21,9 +22,11 @@
 #define PMB887X_VIC(obj)	OBJECT_CHECK(pmb887x_vic_t, (obj), TYPE_PMB887X_VIC)
 #define IRQS_COUNT			((VIC_CON169 - VIC_CON0) / 4 + 1)
 #define VIC_FRAME_DEPTH		15
+#define VIC_PRIORITIES		16
 
 typedef struct pmb887x_vic_irq_t pmb887x_vic_irq_t;
 typedef struct pmb887x_vic_frame_t pmb887x_vic_frame_t;
+typedef struct pmb887x_vic_pending_t pmb887x_vic_pending_t;
 typedef struct pmb887x_vic_t pmb887x_vic_t;
 
 struct pmb887x_vic_irq_t {
@@ -39,6 +42,13 @@ struct pmb887x_vic_frame_t {
 	uint8_t priority;
 };
 
+/* Asserted lines with a non-zero priority, bucketed by priority */
+struct pmb887x_vic_pending_t {
+	unsigned long lines[VIC_PRIORITIES][BITS_TO_LONGS(IRQS_COUNT)];
+	uint16_t count[VIC_PRIORITIES];
+	uint32_t priorities;
+};
+
 struct pmb887x_vic_t {
 	SysBusDevice parent_obj;
 	MemoryRegion mmio;
@@ -55,16 +65,43 @@ struct pmb887x_vic_t {
 	int pending_irq;
 	int pending_fiq;
 
+	pmb887x_vic_pending_t irq_pending;
+	pmb887x_vic_pending_t fiq_pending;
+
 	pmb887x_vic_frame_t irq_frames[VIC_FRAME_DEPTH];
 	pmb887x_vic_frame_t fiq_frames[VIC_FRAME_DEPTH];
 	uint8_t irq_depth;
 	uint8_t fiq_depth;
 };
 
-static uint32_t vic_get_nested_priority(pmb887x_vic_irq_t *line) {
-	if (!line->level)
-		return 0;
-	return (line->priority << 16) | (IRQS_COUNT - line->id);
+static pmb887x_vic_pending_t *vic_line_pending(pmb887x_vic_t *p, pmb887x_vic_irq_t *line) {
+	return line->fiq ? &p->fiq_pending : &p->irq_pending;
+}
+
+static void vic_line_link(pmb887x_vic_t *p, pmb887x_vic_irq_t *line) {
+	pmb887x_vic_pending_t *pending = vic_line_pending(p, line);
+	if (!line->level || !line->priority)
+		return;
+	set_bit(line->id, pending->lines[line->priority]);
+	pending->count[line->priority]++;
+	pending->priorities |= BIT(line->priority);
+}
+
+static void vic_line_unlink(pmb887x_vic_t *p, pmb887x_vic_irq_t *line) {
+	pmb887x_vic_pending_t *pending = vic_line_pending(p, line);
+	if (!line->level || !line->priority)
+		return;
+	clear_bit(line->id, pending->lines[line->priority]);
+	if (!--pending->count[line->priority])
+		pending->priorities &= ~BIT(line->priority);
+}
+
+static int vic_find_pending(pmb887x_vic_pending_t *pending, uint32_t mask_priority) {
+	// Highest priority above the mask wins, the lowest line number breaks ties
+	uint32_t priorities = pending->priorities & ~MAKE_64BIT_MASK(0, mask_priority + 1);
+	if (!priorities)
+		return -1;
+	return find_first_bit(pending->lines[31 - clz32(priorities)], IRQS_COUNT);
 }
 
 static uint32_t vic_get_irq_mask_priority(pmb887x_vic_t *p) {
@@ -80,45 +117,11 @@ static uint32_t vic_get_fiq_mask_priority(pmb887x_vic_t *p) {
 }
 
 static int vic_pending_irq(pmb887x_vic_t *p) {
-	int irq_n = -1;
-	uint32_t max_priority = 0;
-	uint32_t mask_priority = vic_get_irq_mask_priority(p);
-
-	for (int i = 0; i < IRQS_COUNT; ++i) {
-		pmb887x_vic_irq_t *line = &p->irq_state[i];
-		
-		if (line->fiq || !line->level || line->priority <= mask_priority)
-			continue;
-		
-		uint32_t priority = vic_get_nested_priority(line);
-		if (max_priority < priority) {
-			irq_n = i;
-			max_priority = priority;
-		}
-	}
-	
-	return irq_n;
+	return vic_find_pending(&p->irq_pending, vic_get_irq_mask_priority(p));
 }
 
 static int vic_pending_fiq(pmb887x_vic_t *p) {
-	int irq_n = -1;
-	uint32_t max_priority = 0;
-	uint32_t mask_priority = vic_get_fiq_mask_priority(p);
-
-	for (int i = 0; i < IRQS_COUNT; ++i) {
-		pmb887x_vic_irq_t *line = &p->irq_state[i];
-
-		if (!line->fiq || !line->level || line->priority <= mask_priority)
-			continue;
-
-		uint32_t priority = vic_get_nested_priority(line);
-		if (max_priority < priority) {
-			irq_n = i;
-			max_priority = priority;
-		}
-	}
-	
-	return irq_n;
+	return vic_find_pending(&p->fiq_pending, vic_get_fiq_mask_priority(p));
 }
 
 static void vic_update_state(pmb887x_vic_t *p) {
@@ -138,7 +141,13 @@ static void vic_irq_handler(void *opaque, int irq, int level) {
 	}
 	#endif
 	
-	p->irq_state[irq].level = level;
+	pmb887x_vic_irq_t *line = &p->irq_state[irq];
+	if (line->level == level)
+		return;
+
+	vic_line_unlink(p, line);
+	line->level = level;
+	vic_line_link(p, line);
 	vic_update_state(p);
 }
 
@@ -251,7 +260,9 @@ static void vic_io_write(void *opaque, hwaddr haddr, uint64_t value, unsigned si
 		case VIC_IRQ_ACK:
 			#if PMB887X_IO_BRIDGE
 			if (p->irq_depth && p->irq_state[p->irq_frames[p->irq_depth - 1].irq].bridge) {
-				p->irq_state[p->irq_frames[p->irq_depth - 1].irq].level = 0;
+				pmb887x_vic_irq_t *line = &p->irq_state[p->irq_frames[p->irq_depth - 1].irq];
+				vic_line_unlink(p, line);
+				line->level = 0;
 				pmb8876_io_bridge_write(haddr + p->mmio.addr, size, value);
 			}
 			#endif
@@ -266,8 +277,10 @@ static void vic_io_write(void *opaque, hwaddr haddr, uint64_t value, unsigned si
 		case VIC_CON0 ... VIC_CON169:
 		{
 			uint32_t irq_n = (haddr - VIC_CON0) / 4;
+			vic_line_unlink(p, &p->irq_state[irq_n]);
 			p->irq_state[irq_n].fiq = (value & VIC_CON_FIQ) != 0;
 			p->irq_state[irq_n].priority = (value & VIC_CON_PRIORITY) >> VIC_CON_PRIORITY_SHIFT;
+			vic_line_link(p, &p->irq_state[irq_n]);
 			
 			#if PMB887X_IO_BRIDGE
 			if (irq_n != 22 && irq_n != 23 && irq_n != 24) {
@@ -337,6 +350,8 @@ static void vic_reset(DeviceState *dev) {
 
 	p->pending_irq = -1;
 	p->pending_fiq = -1;
+	memset(&p->irq_pending, 0, sizeof(p->irq_pending));
+	memset(&p->fiq_pending, 0, sizeof(p->fiq_pending));
 	p->irq_depth = 0;
 	p->fiq_depth = 0;
 	memset(p->irq_frames, 0, sizeof(p->irq_frames));
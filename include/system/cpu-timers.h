@@ -57,6 +57,7 @@ extern bool use_icount2;
 void icount2_configure(QemuOpts *opts, Error **errp);
 void icount2_advance(uint32_t cycles);
 void icount2_sync(void);
+void icount2_warp(int64_t ns);
 int64_t icount2_get(void);
 void icount2_enter_sleep(void);
 void icount2_exit_sleep(void);
@@ -46,6 +46,11 @@ void icount2_sync(void)
 	abort();
 }
 
+void icount2_warp(int64_t ns)
+{
+	abort();
+}
+
 int64_t icount2_get(void)
 {
 	abort();
@@ -100,6 +100,18 @@ void icount2_advance(uint32_t cycles) {
 	}
 }
 
+void icount2_warp(int64_t ns) {
+	if (ns <= 0 || timers_state.icount2_idle)
+		return;
+
+	seqlock_write_lock(&timers_state.vm_clock_seqlock, &timers_state.vm_clock_lock);
+	int64_t bias = qatomic_read(&timers_state.icount2_bias);
+	qatomic_set(&timers_state.icount2_bias, bias + ns);
+	seqlock_write_unlock(&timers_state.vm_clock_seqlock, &timers_state.vm_clock_lock);
+
+	icount2_sync();
+}
+
 static int64_t icount2_get_locked(void) {
 	int64_t ticks = qatomic_read(&timers_state.icount2_ticks);
 	int64_t offset = qatomic_read(&timers_state.icount2_offset);